@@ -10,66 +10,27 @@
 // main roboticscape API header
 #include <roboticscape.h>
 #include <rc_usefulincludes.h>
+#include <stdatomic.h>
 #include "balance_config.h"
-
-// function declarations
-void on_pause_pressed();
-void on_pause_released();
-
-/*******************************************************************************
-* control_state_t
-* ENGAGED or DISENGAGED to show if controller is running
-*
-*******************************************************************************/
-typedef enum control_state_t{
-	ENGAGED,
-	DISENGAGED
-}control_state_t;
-
-/*******************************************************************************
-* setpoint_t
-* 
-* stores setpoints
-*******************************************************************************/
-typedef struct setpoint_t{
-	control_state_t control_state;
-	float theta;		//body theta radians
-	float phi;		// wheel position radians
-	float gamma;		//body turn angle radians
-}setpoint_t;
-/*******************************************************************************
-* core_state_t 
-* System information
-* 
-*******************************************************************************/
-typedef struct core_state_t{
-	float wheelAngleL; //wheel angle
-	float wheelAngleR;
-	float theta;	   //Mip angle radians
-	float phi;	   //average wheels angle
-	float gamma;	   //turn angle radians 
-	float vBatt;	   // battery status
-	float d1_out;	   //output to motors
-	float d2_out;	   //theta_ref
-	float d3_out;	   //steering output
-} core_state_t;
-
-/*******************************************************************************
-* Local Functions  
-*
-*
-*******************************************************************************/
-//IMU interrupt service
-void balancer();
-//threads
-void* printer(void* ptr);
-void* battery_checker(void* ptr);
-void* outer_loop(void* ptr);
-//functions
-int zero_out_controller();
-int wait_for_start_condition();
-int disengage_controller();
-int engage_controller();
+#include "balance.h"
+#include "sample_bus.h"
+#include "task_runner.h"
+#include "fixed_ctrl.h"
+#include "shm_export.h"
+#include "trajectory.h"
+#include "gain_schedule.h"
+#include "comp_adapt.h"
+#include "flight_recorder.h"
+#include "startup_prof.h"
+#include "imu_online.h"
+#include "lqr.h"
+#include "mpc.h"
+#include "ctrl_stage.h"
+#include "perf_prof.h"
+#include "../common/comp_filter.h"
+#include "../common/motor_output.h"
+#include "../common/imu_cal.h"
+#include "../common/input_event.h"
 
 /*******************************************************************************
 * Global Variables 
@@ -79,89 +40,159 @@ int engage_controller();
 core_state_t state;
 setpoint_t setpoint;
 rc_imu_data_t imu_data;
-rc_ringbuf_t d1_in_buf;
-rc_ringbuf_t d1_out_buf;
-rc_ringbuf_t d2_in_buf;
-rc_ringbuf_t d2_out_buf;
-rc_ringbuf_t d3_in_buf;
-rc_ringbuf_t d3_out_buf;
-
 static float soft_start=0;
+// V_NOMINAL/vBatt, written by battery_checker() and read once per D1 tick
+static _Atomic float batt_scale=1.0f;
+// vBatt/V_NOMINAL, the D1 output that gives full duty, from battery_checker()
+static _Atomic float d1_limit=1.0f;
 float theta_a=0.0;
 float theta_g=0.0; //ale
+// both wheels are written through this in one call per D1 tick
+static motor_output_t motors;
+// shared memory snapshot for monitors, NULL if it couldn't be created
+static shm_export_t* shm_state=NULL;
+// gyro bias subtracted from every IMU sample, from IMU_CAL_FILE when it's valid
+static imu_cal_t imu_cal;
+static imu_cal_window_t cal_window;
+static _Atomic int cal_checked=0;	// a still window has checked the gyro bias
+static _Atomic int cal_dirty=0;		// imu_cal changed, main() saves it
+// moves imu_cal's gyro bias and mount angle while balancing
+static imu_online_t imu_online;
+static _Atomic uint32_t imu_ticks=0;
+static void balance_tick();
+static void check_gyro_bias();
+static int imu_cal_moved(const imu_cal_t* saved);
+static void save_imu_cal(imu_cal_t* saved);
+
+#ifdef USE_FIXED_POINT
+// fixed point controller state, the float stages go unused
+static fix_comp_t comp_q;
+static fix_filter_t d1_q, d2_q, d3_q;
+static q31_t soft_start_q=0;
+static _Atomic q31_t batt_scale_q=FIX_Q(1.0,FIX_SCALE_FRAC);
+static _Atomic q31_t d1_limit_q=FIX_Q(1.0,FIX_ANGLE_FRAC);
+#else
+// body angle estimator shared with hw2, see common/comp_filter.h
+static comp_filter_t comp;
+// the cascade with its limits, LQR=1 and MPC=1 run D3 only
+static ctrl_stage_t d1, d2, d3;
+#endif
+
+#ifdef USE_GAIN_SCHEDULE
+#ifdef USE_FIXED_POINT
+#error "SCHEDULE=1 is only implemented for the float controller"
+#endif
+// D1 gain over tilt
+static gain_schedule_t d1_sched;
+#endif
+
+#ifdef USE_ADAPTIVE_FILTER
+#ifdef USE_FIXED_POINT
+#error "ADAPTIVE=1 is only implemented for the float estimator"
+#endif
+// complementary filter crossover that backs off while the robot accelerates
+static comp_adapt_t comp_adapt;
+#endif
+
+#ifdef USE_LQR
+#if defined(USE_FIXED_POINT) || defined(USE_GAIN_SCHEDULE)
+#error "LQR=1 replaces the float D1/D2 controllers, build it without FIXED or SCHEDULE"
+#endif
+// full state feedback in place of D1 and D2, outer_loop() is not scheduled
+static lqr_t lqr;
+#endif
+
+#ifdef USE_MPC
+#if defined(USE_FIXED_POINT) || defined(USE_GAIN_SCHEDULE) || defined(USE_LQR)
+#error "MPC=1 replaces the float D1/D2 controllers, build it without FIXED, SCHEDULE or LQR"
+#endif
+// explicit MPC from mpc_table.h, outer_loop() is not scheduled either
+static mpc_t mpc;
+#endif
+
+#ifdef USE_PERF_PROF
+// balancer() as a perf_prof.h region, the tasks are profiled by task_runner.c
+static int prof_tick=-1;
+#endif
+
+// D2 and D3 output scale, stepped by input_task() and read once per tick
+static const float gain_sets[]=GAIN_SETS;
+#define NUM_GAIN_SETS	(int)(sizeof(gain_sets)/sizeof(gain_sets[0]))
+static _Atomic int gain_set=0;
+#ifdef USE_FIXED_POINT
+static q31_t gain_sets_q[NUM_GAIN_SETS];
+#endif
 
 
 
 /*******************************************************************************
-* int main() 
+* int main(int argc, char* argv[])
 *
+* An optional argument names a trajectory file, see trajectory.h. Nothing
+* waits on a sensor to settle, the time from exec to the first balancer()
+* tick is reported once, see startup_prof.h.
 * This template main function contains these critical components
 * - call to rc_initialize() at the beginning
 * - main while loop that checks for EXITING condition
 * - rc_cleanup() at the end
 *******************************************************************************/
-int main(){
+int main(int argc, char* argv[]){
+	imu_cal_t cal_saved;	// what IMU_CAL_FILE holds
+	int reported=0;
 
+	startup_mark("main");
 	// always initialize cape library first
 	if(rc_initialize()){
 		fprintf(stderr,"ERROR: failed to initialize rc_initialize(), are you root?\n");
 		return -1;
 	}
+	startup_mark("rc_initialize");
 	// do your own initialization here
 	printf("\nHello BeagleBone\n");
-	rc_set_pause_pressed_func(&on_pause_pressed);
-	rc_set_pause_released_func(&on_pause_released);
+	// pause toggles, held stops, the mode button steps the gain set or,
+	// held, turns the flight log on and off
+	if(input_init(INPUT_DEBOUNCE_MS,INPUT_LONG_MS) ||
+	   input_bind(INPUT_PAUSE,INPUT_SHORT,INPUT_CMD_PAUSE) ||
+	   input_bind(INPUT_PAUSE,INPUT_LONG,INPUT_CMD_EXIT) ||
+	   input_bind(INPUT_MODE,INPUT_SHORT,INPUT_CMD_GAIN_SET) ||
+	   input_bind(INPUT_MODE,INPUT_LONG,INPUT_CMD_LOG) || input_attach())
+		fprintf(stderr,"WARNING: buttons won't work, stop with ctrl-c\n");
 
 	rc_set_led(RED,1);
 	rc_set_led(GREEN,0);
 	rc_set_state(UNINITIALIZED);
+	if(fr_init(FLIGHT_RECORDER_DIR))
+		fprintf(stderr,"WARNING: flight recorder can't write dumps\n");
+	else if(FLIGHT_LOG_AT_START && fr_log_start())
+		fprintf(stderr,"WARNING: flight recorder can't write a log\n");
 
 	// start with Disengaged state to detect when Mip is picked up
-	setpoint.control_state = DISENGAGED;
-	//empty  ring bufs 
-	d1_in_buf    =rc_empty_ringbuf();
-	d1_out_buf   =rc_empty_ringbuf();
-	d2_in_buf    =rc_empty_ringbuf();
-	d2_out_buf   =rc_empty_ringbuf();
-	d3_in_buf    =rc_empty_ringbuf();
-	d3_out_buf   =rc_empty_ringbuf();
-	
-  
-	if(rc_alloc_ringbuf(&d1_in_buf,4)<0){
-          printf("d1 in ringbuf allocation failed\n");
-	}
-	if(rc_alloc_ringbuf(&d1_out_buf,4)<0){
-          printf("d1 out ringbuf allocation failed\n");
-	}
-	if(rc_alloc_ringbuf(&d2_in_buf,4)<0){
-          printf("d2 in ringbuf allocation failed\n");
-	}
-	if(rc_alloc_ringbuf(&d2_out_buf,4)<0){
-          printf("d2 out ringbuf allocation failed\n");
-	}	
-	if(rc_alloc_ringbuf(&d3_in_buf,4)<0){
-          printf("d3 in ringbuf allocation failed\n");
-	}
-	if(rc_alloc_ringbuf(&d3_out_buf,4)<0){
-          printf("d3 out ringbuf allocation failed\n");
+	init_controller();
+	if(load_imu_cal(IMU_CAL_FILE)==0) startup_mark("controller, cached IMU calibration");
+	else startup_mark("controller, no IMU calibration cached");
+	cal_saved=imu_cal;
+	// first battery read here, D1 is compensated from its first tick
+	battery_checker();
+
+	//battery check, printing and input share one timer driven thread, the
+	//outer loop gets its own above them so stdout and file I/O can't hold it up
+#if !defined(USE_LQR) && !defined(USE_MPC)
+	task_runner_add_own("outer_loop",outer_loop,SAMPLE_RATE_D2_HZ,OUTER_LOOP_PRIORITY);
+#endif
+	task_runner_add("battery",battery_checker,BATTERY_CHECK_HZ);
+	task_runner_add("printer",printer,PRINTF_HZ);
+	task_runner_add("input",input_task,INPUT_HZ);
+	if(traj_init(TRAJ_SOCKET,argc>1 ? argv[1] : NULL))
+		fprintf(stderr,"WARNING: trajectory input incomplete, holding position until commanded\n");
+	task_runner_add("trajectory",traj_task,SETPOINT_MANAGER_HZ);
+	shm_state=shm_export_open(SHM_EXPORT_NAME,1);
+	if(shm_state!=NULL) task_runner_add("shm_export",state_exporter,SHM_EXPORT_HZ);
+	else fprintf(stderr,"WARNING: running without shared memory state export\n");
+	if(task_runner_start(TASK_RUNNER_PRIORITY)){
+		fprintf(stderr,"ERROR: failed to start housekeeping tasks\n");
+		return -1;
 	}
-
-		//outer loop thread
-	pthread_t d2_thread;
-	pthread_create(&d2_thread,NULL,outer_loop, (void*) NULL);
-	pthread_setschedprio(d2_thread,60);
-	//sample battery thread
-	pthread_t battery_thread;
-	pthread_create(&battery_thread, NULL, battery_checker, (void*) NULL);
-	pthread_setschedprio(battery_thread, 22);
-	//wait for battery thread to make first read
-	while(state.vBatt==0 && rc_get_state()!=EXITING) rc_usleep(1000);
-
-	//printer thread to print to screen 	
-	pthread_t print_thread;
-	pthread_create(&print_thread,NULL,printer,(void*) NULL);
-	pthread_setschedprio(print_thread,25);
-	
+	startup_mark("housekeeping tasks");
 
 	//set up IMU configuration
 	rc_imu_config_t imu_config= rc_default_imu_config();
@@ -174,6 +205,7 @@ int main(){
 		rc_blink_led(RED,5,5);
 		return -1;
 	}
+	startup_mark("rc_initialize_imu_dmp");
 
 	//Interrupt set last
 	rc_set_imu_interrupt_func(&balancer);
@@ -185,6 +217,16 @@ int main(){
 
 	// Keep looping until state changes to EXITING
 	while(rc_get_state()!=EXITING){
+		if(!reported && atomic_load_explicit(&imu_ticks,memory_order_acquire)>0){
+			startup_report(stdout,STARTUP_BUDGET_MS);
+			reported=1;
+		}
+		// a new gyro bias from the startup check, or estimates that moved
+		// while balancing. File I/O stays out of the interrupt.
+		if(atomic_exchange_explicit(&cal_dirty,0,memory_order_acquire) ||\
+		   (setpoint.control_state==DISENGAGED && imu_cal_moved(&cal_saved))){
+			save_imu_cal(&cal_saved);
+		}
 		//detect starting condition(when Mip is picked up
 		if(setpoint.control_state ==DISENGAGED){
 				if(wait_for_start_condition()==0){
@@ -197,19 +239,20 @@ int main(){
 		rc_usleep(10000);
 	}
 	
-	// exit cleanly
+	// exit cleanly, stop housekeeping before the cape is released
+	if(imu_cal_moved(&cal_saved)) save_imu_cal(&cal_saved);
+	task_runner_stop();
+	fr_cleanup();
+	traj_cleanup(TRAJ_SOCKET);
+	shm_export_close(shm_state,SHM_EXPORT_NAME,1);
 	rc_power_off_imu();
+#ifdef USE_PERF_PROF
+	perf_prof_report(stdout);
+	perf_prof_cleanup();
+#endif
 	rc_cleanup(); 
 	rc_disable_motors();
-	if(pthread_join(print_thread,NULL)==0){
-		printf("\nprint thread joined\n");
-	}
-	if(pthread_join(battery_thread,NULL)==0){
-		printf("\nbattery thread joined\n");
-	}
-	if(pthread_join(d2_thread,NULL)==0){
-		printf("\nd2_thread joined\n");
-	}
+	input_cleanup();
 
 	return 0;
 }
@@ -220,45 +263,100 @@ int main(){
 * void balancer()          
 *	
 * discrete-time balance controller using IMU interrupt function
-* called at SAMPLE_RATE_HZ (See configuration file)
+* called at SAMPLE_RATE_HZ (See configuration file). Every tick, however it
+* ended, goes into the flight recorder. With PERF=1 all of it is profiled.
 *******************************************************************************/
 void balancer(){
+	fr_record_t r;
+
+#ifdef USE_PERF_PROF
+	perf_prof_begin(prof_tick);
+#endif
+	balance_tick();
+
+	r.t_ns=bus_now_ns();
+	r.tick=atomic_load_explicit(&imu_ticks,memory_order_relaxed);
+	if(r.tick==0) startup_mark("first balancer() tick");
+	atomic_store_explicit(&imu_ticks,r.tick+1,memory_order_release);
+	r.rc_state=rc_get_state();
+	r.control_state=setpoint.control_state;
+	memcpy(r.accel,imu_data.accel,sizeof(r.accel));
+	memcpy(r.gyro,imu_data.gyro,sizeof(r.gyro));
+	r.theta=state.theta;
+	r.theta_a=theta_a;
+	r.theta_g=theta_g;
+	r.wheel_angle_l=state.wheelAngleL;
+	r.wheel_angle_r=state.wheelAngleR;
+	r.phi=state.phi;
+	r.gamma=state.gamma;
+	r.theta_ref=setpoint.theta;
+	r.phi_ref=setpoint.phi;
+	r.gamma_ref=setpoint.gamma;
+	r.d1_out=state.d1_out;
+	r.d2_out=state.d2_out;
+	r.d3_out=state.d3_out;
+	r.v_batt=state.vBatt;
+	r.saturated=state.saturated;
+	fr_record(&r);
+#ifdef USE_PERF_PROF
+	perf_prof_end(prof_tick);
+#endif
+}
+
+/*******************************************************************************
+* static void balance_tick()
+*
+* estimator, exit checks and the D1/D3 controllers for one IMU sample
+*******************************************************************************/
+static void balance_tick(){
 	//initializing variables
 	static int inner_saturation_counter =0;
 	float dutyL,dutyR;
-	float	d1_num[]=D1_NUM;
-	float	d1_den[]=D1_DEN;
-	float d3_num[]=D3_NUM;
-	float d3_den[]=D3_DEN;
+	float sample[BUS_SAMPLE_WIDTH];
+#ifdef USE_FIXED_POINT
+	q31_t theta_q,wheelL_q,wheelR_q,gamma_q,d1_q_out,d3_q_out,d1_q_lim;
+#else
+	float d1_u;
+#endif
 
 	
 	/*****************************************************************
 	*Complementary filter LPF for Accelerometer and HPF for Gyroscope
 	* Used for state estimation
 	*****************************************************************/
-	//initialize values to zero	
-	float theta_a_raw=0;
-	static float theta_g_raw = 0;
-	static float last_theta_a_raw = 0;
-	static float last_theta_g_raw = 0;
-	static float last_theta_a = 0;
-	static float last_theta_g = 0;
-	//calculate angle from acceleration data
-	theta_a_raw = atan2(-imu_data.accel[2],imu_data.accel[1]);
-	//calculate rotation from start with gyro data
-	theta_g_raw = theta_g_raw + DT_D1*(imu_data.gyro[0]*DEG_TO_RAD) ;
-	// Low Pass Filter for accelerometer
-	theta_a = (FILTER_W*DT_D1*last_theta_a_raw)+((1-(FILTER_W*DT_D1))*last_theta_a);
-	// High pass filter for gyroscope
-	theta_g = (1-(FILTER_W*DT_D1))*last_theta_g + theta_g_raw - last_theta_g_raw;
-	//get theta 
-	state.theta = theta_a + theta_g + MOUNT_ANGLE;
-
-	//set last stuff
-	last_theta_a = theta_a;
-	last_theta_g = theta_g;
-	last_theta_g_raw = theta_g_raw;
-	last_theta_a_raw = theta_a_raw;
+	imu_cal_apply(&imu_cal,imu_data.gyro);
+	check_gyro_bias();
+#ifdef USE_FIXED_POINT
+	// sensor floats from the cape library are converted once here
+	theta_q=fix_comp_step(&comp_q,fix_from_float(imu_data.accel[1],FIX_SENSOR_FRAC),\
+				fix_from_float(imu_data.accel[2],FIX_SENSOR_FRAC),\
+				fix_from_float(imu_data.gyro[0],FIX_SENSOR_FRAC));
+	wheelR_q=fix_mul(rc_get_encoder_pos(ENCODER_CHANNEL_R),\
+		FIX_Q(TWO_PI/(ENCODER_POLARITY_R*GEARBOX*ENCODER_RES),31),31-FIX_WHEEL_FRAC);
+	wheelL_q=fix_mul(rc_get_encoder_pos(ENCODER_CHANNEL_L),\
+		FIX_Q(TWO_PI/(ENCODER_POLARITY_L*GEARBOX*ENCODER_RES),31),31-FIX_WHEEL_FRAC);
+	gamma_q=fix_mul(fix_sub(wheelR_q,wheelL_q),\
+		FIX_Q(WHEEL_RADIUS_M/TRACK_WIDTH_M,FIX_SCALE_FRAC),FIX_SCALE_FRAC);
+
+	// floats kept for telemetry and the sample bus
+	theta_a=FIX_FLOAT(comp_q.theta_a,FIX_ANGLE_FRAC);
+	theta_g=FIX_FLOAT(comp_q.theta_g,FIX_ANGLE_FRAC);
+	state.theta=FIX_FLOAT(theta_q,FIX_ANGLE_FRAC);
+	state.wheelAngleR=FIX_FLOAT(wheelR_q,FIX_WHEEL_FRAC);
+	state.wheelAngleL=FIX_FLOAT(wheelL_q,FIX_WHEEL_FRAC);
+	state.gamma=FIX_FLOAT(gamma_q,FIX_WHEEL_FRAC);
+#else
+	//complementary filter on accel Z over Y and gyro X
+#ifdef USE_ADAPTIVE_FILTER
+	state.theta = comp_filter_step_alpha(&comp,imu_data.accel[1],imu_data.accel[2],\
+			imu_data.gyro[0],comp_adapt_alpha(&comp_adapt,imu_data.accel));
+#else
+	state.theta = comp_filter_step(&comp,imu_data.accel[1],imu_data.accel[2],\
+			imu_data.gyro[0]);
+#endif
+	state.theta += imu_cal.mount_angle;
+	theta_a = comp.theta_a;
+	theta_g = comp.theta_g;
 
 		//steering angle  calculation
 	state.wheelAngleR= (rc_get_encoder_pos(ENCODER_CHANNEL_R) *TWO_PI)\
@@ -268,7 +366,26 @@ void balancer(){
 
 	state.gamma =(state.wheelAngleR-state.wheelAngleL) \
 										*(WHEEL_RADIUS_M/TRACK_WIDTH_M);
+#endif
+
+	// gyro bias and mount angle follow the robot while it balances
+	if(imu_online_step(&imu_online,setpoint.control_state==ENGAGED,imu_data.gyro[0],\
+			state.theta,&imu_cal.gyro_bias[0],&imu_cal.mount_angle)){
+#ifdef USE_FIXED_POINT
+		comp_q.mount=fix_from_float(imu_cal.mount_angle,FIX_ANGLE_FRAC);
+#endif
+	}
 
+	//publish estimates, IMU first so the pair can be matched by timestamp
+	sample[0]=state.theta;
+	sample[1]=theta_a;
+	sample[2]=theta_g;
+	sample[3]=imu_data.gyro[0]*DEG_TO_RAD;
+	bus_publish(BUS_IMU,sample,4);
+	sample[0]=state.wheelAngleL;
+	sample[1]=state.wheelAngleR;
+	sample[2]=state.gamma;
+	bus_publish(BUS_ENCODERS,sample,3);
 	
 
 	
@@ -293,52 +410,106 @@ void balancer(){
 	if(fabs(state.theta)>TIP_ANGLE){
 		disengage_controller();
 		printf("\ntip detected state.theta %f\n",state.theta);
+		fr_trigger(FR_TIP);
 		return;
 	}
 
 /*******************************************************************************
  * INNER LOOP ANGLE Theta controller D1
  * Input to D1 is theta error(setpoint-state). Then scale output u to compensate
- * for changing battery voltage.
+ * for changing battery voltage. D1 is limited to the output that gives full
+ * duty at this voltage so it doesn't wind up past it. With SCHEDULE=1 the
+ * numerator is also scaled by the gain schedule. With LQR=1 the whole state is fed back here and phi follows the
+ * trajectory directly, with the same limit on the duty.
 *******************************************************************************/
-	rc_insert_new_ringbuf_value(&d1_in_buf,setpoint.theta-state.theta);
-	
-	state.d1_out=soft_start*D1_GAIN*(d1_num[0]*rc_get_ringbuf_value(&d1_in_buf,0) \
-													  +(d1_num[1]*rc_get_ringbuf_value(&d1_in_buf,1)) \
-														+(d1_num[2]*rc_get_ringbuf_value(&d1_in_buf,2))\
-							 							-(d1_den[1]*rc_get_ringbuf_value(&d1_out_buf,0))
-														-(d1_den[2]*rc_get_ringbuf_value(&d1_out_buf,1)));
-	rc_insert_new_ringbuf_value(&d1_out_buf,state.d1_out);
+#ifdef USE_FIXED_POINT
+	d1_q_lim=atomic_load_explicit(&d1_limit_q,memory_order_relaxed);
+	fix_filter_set_limits(&d1_q,-d1_q_lim,d1_q_lim);
+	d1_q_out=fix_filter_step(&d1_q,fix_sub(fix_from_float(setpoint.theta,FIX_ANGLE_FRAC),theta_q),\
+				soft_start_q);
+	d1_q_out=fix_mul(d1_q_out,atomic_load_explicit(&batt_scale_q,memory_order_relaxed),\
+				FIX_SCALE_FRAC);
+	state.d1_out=FIX_FLOAT(d1_q_out,FIX_ANGLE_FRAC);
+#elif defined(USE_LQR)
+	if(traj_next_phi(&setpoint.phi)==0) lqr_set_ref(&lqr,setpoint.phi);
+	lqr_set_limit(&lqr,atomic_load_explicit(&d1_limit,memory_order_relaxed));
+	state.phi=((state.wheelAngleL+state.wheelAngleR)/2)+state.theta;
+	d1_u=lqr_step(&lqr,state.theta,imu_data.gyro[0]*DEG_TO_RAD,state.phi,soft_start);
+	state.d1_out=d1_u*atomic_load_explicit(&batt_scale,memory_order_relaxed);
+#elif defined(USE_MPC)
+	if(traj_next_phi(&setpoint.phi)==0) mpc_set_ref(&mpc,setpoint.phi);
+	mpc_set_limit(&mpc,atomic_load_explicit(&d1_limit,memory_order_relaxed));
+	state.phi=((state.wheelAngleL+state.wheelAngleR)/2)+state.theta;
+	d1_u=mpc_step(&mpc,state.theta,imu_data.gyro[0]*DEG_TO_RAD,state.phi,soft_start);
+	state.d1_out=d1_u*atomic_load_explicit(&batt_scale,memory_order_relaxed);
+#else
+#ifdef USE_GAIN_SCHEDULE
+	{
+		static const float num[]=D1_NUM;
+		float k, b[3];
+		int n;
+		k=gain_schedule_lookup(&d1_sched,fabs(state.theta));
+		for(n=0;n<3;n++) b[n]=k*num[n];
+		ctrl_stage_set_num(&d1,b);
+	}
+#endif
+	{
+		float lim=atomic_load_explicit(&d1_limit,memory_order_relaxed);
+		ctrl_stage_set_limits(&d1,-lim,lim);
+	}
+	d1_u=ctrl_stage_step(&d1,setpoint.theta-state.theta,soft_start);
+	state.d1_out=d1_u*atomic_load_explicit(&batt_scale,memory_order_relaxed);
+#endif
 	
 /*******************************************************************************
 *Inner loop saturation check if saturated over a second disable controller
 *
 *******************************************************************************/
+#ifdef USE_FIXED_POINT
+	if(d1_q_out>FIX_Q(0.95,FIX_ANGLE_FRAC) || d1_q_out<-FIX_Q(0.95,FIX_ANGLE_FRAC)) inner_saturation_counter++;
+#else
 	if(fabs(state.d1_out)>0.95) inner_saturation_counter++;
+#endif
 	else inner_saturation_counter = 0;
 	//if saturate for a second disable
 	if(inner_saturation_counter > (SAMPLE_RATE_D1_HZ*D1_SATURATION_TIMEOUT)){
 		printf("inner loop controller saturated \n");
 		disengage_controller();
+		fr_trigger(FR_SATURATION);
 		inner_saturation_counter = 0;
 		return;
 	}
+#ifdef USE_FIXED_POINT
+	soft_start_q+=FIX_Q(0.1,FIX_SCALE_FRAC);
+	if(soft_start_q>FIX_Q(1.0,FIX_SCALE_FRAC)) soft_start_q=FIX_Q(1.0,FIX_SCALE_FRAC);
+#else
 	if(soft_start<1)soft_start+=.1;
 	if(soft_start>=1)soft_start=1;
+#endif
 
 /*******************************************************************************
  * D3 controller for gamma changes
- * 
+ * limited to +-STEERING_INPUT_MAX inside the stage
 *******************************************************************************/
-
-	rc_insert_new_ringbuf_value(&d3_in_buf,setpoint.gamma-state.gamma);
-	state.d3_out=D3_GAIN*((d3_num[0]*rc_get_ringbuf_value(&d3_in_buf,0)) \
-											+(d3_num[1]*rc_get_ringbuf_value(&d3_in_buf,1)) \
-											-(d3_den[1]*rc_get_ringbuf_value(&d3_out_buf,0)));
-	rc_insert_new_ringbuf_value(&d3_out_buf,state.d3_out);
-	//if the output of D3 is over  a value set it equal to that value
-	if(fabs(state.d3_out) >STEERING_INPUT_MAX) state.d3_out=STEERING_INPUT_MAX;
-	if(fabs(state.d3_out)<-STEERING_INPUT_MAX) state.d3_out=-STEERING_INPUT_MAX;
+	traj_next_gamma(&setpoint.gamma);
+
+#ifdef USE_FIXED_POINT
+	d3_q_out=fix_filter_step(&d3_q,fix_sub(fix_from_float(setpoint.gamma,FIX_WHEEL_FRAC),gamma_q),\
+				gain_sets_q[atomic_load_explicit(&gain_set,memory_order_relaxed)]);
+	d3_q_out=fix_convert(d3_q_out,FIX_WHEEL_FRAC,FIX_ANGLE_FRAC);
+	state.d3_out=FIX_FLOAT(d3_q_out,FIX_ANGLE_FRAC);
+	state.saturated=(d1_q.sat ? SAT_D1 : 0)|(d2_q.sat ? SAT_D2 : 0)|(d3_q.sat ? SAT_D3 : 0);
+#else
+	state.d3_out=ctrl_stage_step(&d3,setpoint.gamma-state.gamma,\
+			gain_sets[atomic_load_explicit(&gain_set,memory_order_relaxed)]);
+#if defined(USE_LQR)
+	state.saturated=(lqr.sat ? SAT_D1 : 0)|(d3.sat ? SAT_D3 : 0);
+#elif defined(USE_MPC)
+	state.saturated=(mpc.meas.sat ? SAT_D1 : 0)|(d3.sat ? SAT_D3 : 0);
+#else
+	state.saturated=(d1.sat ? SAT_D1 : 0)|(d2.sat ? SAT_D2 : 0)|(d3.sat ? SAT_D3 : 0);
+#endif
+#endif
 
 /*******************************************************************************
  * Send signal to motors
@@ -346,42 +517,217 @@ void balancer(){
  *multiplied by polarity to enure direction
 *******************************************************************************/
 
+#ifdef USE_FIXED_POINT
+	dutyL =FIX_FLOAT(fix_sub(d1_q_out,d3_q_out),FIX_ANGLE_FRAC);
+	dutyR =FIX_FLOAT(fix_add(d1_q_out,d3_q_out),FIX_ANGLE_FRAC);
+#else
 	dutyL =state.d1_out-state.d3_out;
 	dutyR =state.d1_out+state.d3_out;
-	rc_set_motor(MOTOR_CHANNEL_L,MOTOR_POLARITY_L * dutyL);
-	rc_set_motor(MOTOR_CHANNEL_R,MOTOR_POLARITY_R * dutyR);
-
+#endif
+	motor_output_set(&motors,dutyL,dutyR);
+
+	sample[0]=state.d1_out;
+	sample[1]=state.d2_out;
+	sample[2]=state.d3_out;
+	sample[3]=state.saturated;
+	bus_publish(BUS_CONTROL,sample,4);
 	return;
 }
 	
+/*******************************************************************************
+* init_controller()
+*
+* Set up the controller stages and start DISENGAGED. Kept out of main() so
+* the simulated build can set up the same controller without the hardware.
+*******************************************************************************/
+int init_controller(){
+	setpoint.control_state = DISENGAGED;
+#ifdef USE_FIXED_POINT
+	{
+		float d1_num[]=D1_NUM, d1_den[]=D1_DEN;
+		float d2_num[]=D2_NUM, d2_den[]=D2_DEN;
+		float d3_num[]=D3_NUM, d3_den[]=D3_DEN;
+		int i;
+		fix_comp_init(&comp_q);
+		if(fix_filter_init(&d1_q,d1_num,d1_den,2,D1_GAIN) ||
+		   fix_filter_init(&d2_q,d2_num,d2_den,1,D2_GAIN) ||
+		   fix_filter_init(&d3_q,d3_num,d3_den,1,D3_GAIN)){
+			fprintf(stderr,"ERROR: fixed point controller order too high\n");
+			return -1;
+		}
+		if(fix_filter_set_aw(&d1_q,d1_den,D1_AW_GAIN)){
+			fprintf(stderr,"ERROR: anti-windup gain must be 0 to 1\n");
+			return -1;
+		}
+		// D1's limit follows the battery, set every tick
+		fix_filter_set_limits(&d2_q,-FIX_Q(THETA_REF_MAX,FIX_WHEEL_FRAC),\
+					FIX_Q(THETA_REF_MAX,FIX_WHEEL_FRAC));
+		fix_filter_set_limits(&d3_q,-FIX_Q(STEERING_INPUT_MAX,FIX_WHEEL_FRAC),\
+					FIX_Q(STEERING_INPUT_MAX,FIX_WHEEL_FRAC));
+		for(i=0;i<NUM_GAIN_SETS;i++){
+			if(gain_sets[i]<=0 || gain_sets[i]>=2){
+				fprintf(stderr,"ERROR: fixed point gain sets must be between 0 and 2\n");
+				return -1;
+			}
+			gain_sets_q[i]=fix_from_float(gain_sets[i],FIX_SCALE_FRAC);
+		}
+	}
+#else
+	if(comp_filter_init(&comp,FILTER_W,DT_D1)) return -1;
+	{
+		float d1_num[]=D1_NUM, d1_den[]=D1_DEN;
+		float d2_num[]=D2_NUM, d2_den[]=D2_DEN;
+		float d3_num[]=D3_NUM, d3_den[]=D3_DEN;
+		// D1's limit follows the battery, set every tick
+		if(ctrl_stage_init(&d1,d1_num,d1_den,2,D1_GAIN,1.0,D1_AW_GAIN) ||
+		   ctrl_stage_init(&d2,d2_num,d2_den,1,D2_GAIN,THETA_REF_MAX,0) ||
+		   ctrl_stage_init(&d3,d3_num,d3_den,1,D3_GAIN,STEERING_INPUT_MAX,0))
+			return -1;
+	}
+#endif
+	imu_cal_default(&imu_cal,MOUNT_ANGLE);
+	if(imu_cal_window_init(&cal_window,IMU_CAL_CHECK_S*SAMPLE_RATE_D1_HZ,IMU_CAL_STILL_SD))
+		return -1;
+	atomic_store_explicit(&cal_checked,0,memory_order_relaxed);
+	if(imu_online_init(&imu_online)) return -1;
+	if(motor_output_init(&motors,MOTOR_SLEW_RATE,SAMPLE_RATE_D1_HZ) ||
+	   motor_output_add(&motors,MOTOR_OUTPUT_L,MOTOR_CHANNEL_L,MOTOR_POLARITY_L,MOTOR_DEADBAND_L) ||
+	   motor_output_add(&motors,MOTOR_OUTPUT_R,MOTOR_CHANNEL_R,MOTOR_POLARITY_R,MOTOR_DEADBAND_R)){
+		return -1;
+	}
+#ifdef USE_GAIN_SCHEDULE
+	if(gain_schedule_init(&d1_sched)) return -1;
+#endif
+#ifdef USE_LQR
+	if(lqr_init(&lqr)) return -1;
+#endif
+#ifdef USE_MPC
+	if(mpc_init(&mpc)) return -1;
+#endif
+#ifdef USE_ADAPTIVE_FILTER
+	if(comp_adapt_init(&comp_adapt)) return -1;
+#endif
+#ifdef USE_PERF_PROF
+	if(prof_tick<0) prof_tick=perf_prof_region("balancer");
+#endif
+	return 0;
+}
+
+/*******************************************************************************
+* load_imu_cal()
+*
+* Use the offsets and mount angle saved in path. Called after
+* init_controller() and before the IMU starts, returns -1 and keeps the
+* defaults when there is no valid file. The gyro bias is checked again on
+* the first still window either way.
+*******************************************************************************/
+int load_imu_cal(const char* path){
+	if(imu_cal_load(path,&imu_cal)) return -1;
+#ifdef USE_FIXED_POINT
+	comp_q.mount=fix_from_float(imu_cal.mount_angle,FIX_ANGLE_FRAC);
+#endif
+	return 0;
+}
+
+/*******************************************************************************
+* static void check_gyro_bias()
+*
+* The cached bias is used from the first tick. The first still window while
+* DISENGAGED confirms it, or replaces it when it is off by more than
+* IMU_CAL_GYRO_TOL or was never measured. The window sees corrected samples,
+* so its mean is how far off the bias is. main() does the saving.
+*******************************************************************************/
+static void check_gyro_bias(){
+	float err[3];
+	int i, off=0;
+
+	if(atomic_load_explicit(&cal_checked,memory_order_relaxed)) return;
+	if(setpoint.control_state!=DISENGAGED){
+		imu_cal_window_reset(&cal_window);
+		return;
+	}
+	if(imu_cal_window_add(&cal_window,imu_data.gyro,err)!=1) return;
+	for(i=0;i<3;i++) if(fabsf(err[i])>IMU_CAL_GYRO_TOL) off=1;
+	if(off || !(imu_cal.flags&IMU_CAL_GYRO)){
+		for(i=0;i<3;i++) imu_cal.gyro_bias[i]+=err[i];
+		imu_cal.flags|=IMU_CAL_GYRO;
+		atomic_store_explicit(&cal_dirty,1,memory_order_release);
+	}
+	atomic_store_explicit(&cal_checked,1,memory_order_relaxed);
+}
+
+/*******************************************************************************
+* static int imu_cal_moved(const imu_cal_t* saved)
+*
+* 1 when the gyro bias or mount angle in use are far enough from the saved
+* ones to be worth a write
+*******************************************************************************/
+static int imu_cal_moved(const imu_cal_t* saved){
+	return fabsf(imu_cal.gyro_bias[0]-saved->gyro_bias[0])>IMU_CAL_GYRO_TOL ||\
+	       fabsf(imu_cal.mount_angle-saved->mount_angle)>IMU_CAL_MOUNT_TOL;
+}
+
+/*******************************************************************************
+* static void save_imu_cal(imu_cal_t* saved)
+*
+* Writes a snapshot of imu_cal and keeps it in saved. The mount angle counts
+* as measured once the online estimate has run a full time constant.
+*******************************************************************************/
+static void save_imu_cal(imu_cal_t* saved){
+	imu_cal_t c=imu_cal;
+
+	if(imu_online.updates*DT_D1>=IMU_ONLINE_MOUNT_TAU) c.flags|=IMU_CAL_MOUNT;
+	printf("\ngyro bias %.3f deg/s, mount angle %.4f rad",c.gyro_bias[0],c.mount_angle);
+	if(imu_cal_save(IMU_CAL_FILE,&c)){
+		printf(", not saved\n");
+		return;
+	}
+	printf(", saved to %s\n",IMU_CAL_FILE);
+	*saved=c;
+}
+
 /*******************************************************************************
 * zero_out_controller() 
 *	
 * Clear the controller's memory and zero out setpoints. 
 *******************************************************************************/
 int zero_out_controller(){
-	rc_reset_ringbuf(&d1_in_buf);
-	rc_reset_ringbuf(&d1_out_buf);
-	rc_reset_ringbuf(&d2_in_buf);
-	rc_reset_ringbuf(&d2_out_buf);
-	rc_reset_ringbuf(&d3_out_buf);
-	rc_reset_ringbuf(&d3_out_buf);
+#ifdef USE_FIXED_POINT
+	fix_filter_reset(&d1_q);
+	fix_filter_reset(&d2_q);
+	fix_filter_reset(&d3_q);
+#else
+	ctrl_stage_reset(&d1);
+	ctrl_stage_reset(&d2);
+	ctrl_stage_reset(&d3);
+#endif
+	state.saturated=0;
+#ifdef USE_LQR
+	lqr_reset(&lqr);
+#endif
+#ifdef USE_MPC
+	mpc_reset(&mpc);
+#endif
 	
 	setpoint.theta =0.0f;
 	setpoint.phi   =0.0f;
 	setpoint.gamma =0.0f;
+	traj_reset();
 	rc_set_motor_all(0.0f);
+	motor_output_reset(&motors);
 	return 0;
 }
 
 /*******************************************************************************
 * disengage_controller()
 *
-* disable motors & set the control_state to DISENGAGED
+* disable motors & set the control_state to DISENGAGED, trajectory commands
+* from now on wait for the next engage
 *******************************************************************************/
 int disengage_controller(){
 	rc_disable_motors();
 	setpoint.control_state = DISENGAGED;
+	traj_stop();
 	rc_set_led(RED,1);
 	return 0;
 }
@@ -393,6 +739,9 @@ int disengage_controller(){
 *******************************************************************************/
 int engage_controller(){
 	soft_start=0;
+#ifdef USE_FIXED_POINT
+	soft_start_q=0;
+#endif
 	zero_out_controller();
 	rc_set_encoder_pos(ENCODER_CHANNEL_L,0);
 	rc_set_encoder_pos(ENCODER_CHANNEL_R,0);
@@ -443,134 +792,194 @@ int wait_for_start_condition(){
 /*******************************************************************************
 * printer
 *
-* prints status to the screen
+* prints status to the screen, run by the task runner at PRINTF_HZ
 *******************************************************************************/
-void* printer(void* ptr){
-	rc_state_t last_rc_state, new_rc_state; //keeping track of previous state
-	last_rc_state=rc_get_state();
-	while(rc_get_state()!=EXITING){
-		new_rc_state=rc_get_state();
-
-		// check if first time being paused
-		if(new_rc_state==RUNNING && last_rc_state!=RUNNING){
-			printf("\nRUNNING: Hold upright to balance.\n");
-			printf("    θ    |");
-			printf("  θ_ref  |");
-			printf("    φ    |");
-			printf("  φ_ref  |");
-			printf("    γ    |");
-			printf("  D1_u   |");
-			printf("  D3_u   |");
-			printf("  vBatt  |");
-			printf("control_state|");
-			printf("\n");
-		}
-		else if(new_rc_state==PAUSED && last_rc_state!=PAUSED){
-			printf("\nPAUSED: press pause again to start.\n");
-		}
-		last_rc_state = new_rc_state;
-		// decide what to print or exit
-		if(new_rc_state == RUNNING){	
-			printf("\r");
-			printf("%7.3f  |", state.theta);
-			printf("%7.3f  |", setpoint.theta);
-			printf("%7.3f  |", state.phi);
-			printf("%7.3f  |", setpoint.phi);
-			printf("%7.3f  |", state.gamma);
-			printf("%7.3f  |", state.d1_out);
-			printf("%7.3f  |", state.d3_out);
-			printf("%7.3f  |", state.vBatt);
-			
+void printer(){
+	static rc_state_t last_rc_state=UNINITIALIZED; //keeping track of previous state
+	rc_state_t new_rc_state;
+	new_rc_state=rc_get_state();
+
+	// check if first time being paused
+	if(new_rc_state==RUNNING && last_rc_state!=RUNNING){
+		printf("\nRUNNING: Hold upright to balance.\n");
+		printf("    θ    |");
+		printf("  θ_ref  |");
+		printf("    φ    |");
+		printf("  φ_ref  |");
+		printf("    γ    |");
+		printf("  D1_u   |");
+		printf("  D3_u   |");
+		printf("  vBatt  |");
+		printf("control_state|");
+		printf("\n");
+	}
+	else if(new_rc_state==PAUSED && last_rc_state!=PAUSED){
+		printf("\nPAUSED: press pause again to start.\n");
+	}
+	last_rc_state = new_rc_state;
+	// decide what to print or exit
+	if(new_rc_state == RUNNING){	
+		printf("\r");
+		printf("%7.3f  |", state.theta);
+		printf("%7.3f  |", setpoint.theta);
+		printf("%7.3f  |", state.phi);
+		printf("%7.3f  |", setpoint.phi);
+		printf("%7.3f  |", state.gamma);
+		printf("%7.3f  |", state.d1_out);
+		printf("%7.3f  |", state.d3_out);
+		printf("%7.3f  |", state.vBatt);
+		
 		if(setpoint.control_state == ENGAGED) {
-				printf("  ENGAGED  |");
+			printf("  ENGAGED  |");
 		}
 		else printf("DISENGAGED |");
-			
-		}
-			fflush(stdout);
-		
-		rc_usleep(1000000 / PRINTF_HZ);
 	}
-	return NULL;
+	fflush(stdout);
+	return;
 }		
 
 /*******************************************************************************
- * Outer loop thread()
- * change theta setpoint based on phi
- * input to the controller is phi error(setpoint-state)
+ * state_exporter()
  *
+ * Copies state, setpoint and the task statistics into the shared memory
+ * segment for out of process monitors. Runs on the task runner thread and
+ * reads state the same way printer() does, balancer() does no extra work.
 *******************************************************************************/
-void* outer_loop(void* ptr){
-	float d2_num[]=D2_NUM;
-	float d2_den[]=D2_DEN;
-
-	while(rc_get_state()!=EXITING){
-		if(rc_get_state()==RUNNING && setpoint.control_state==ENGAGED){
-			
-			//average wheel rotation with body rotation 
-			state.phi=((state.wheelAngleL+state.wheelAngleR)/2)+state.theta;
-
-			rc_insert_new_ringbuf_value(&d2_in_buf,setpoint.phi-state.phi);
-			state.d2_out=D2_GAIN*(d2_num[0]*rc_get_ringbuf_value(&d2_in_buf,0)   \
-													 +(d2_num[1]*rc_get_ringbuf_value(&d2_in_buf,1))  \
-													 -(d2_den[1]*rc_get_ringbuf_value(&d2_out_buf,0)));
-			rc_insert_new_ringbuf_value(&d2_out_buf,state.d2_out);	
-			setpoint.theta=state.d2_out;
-		if(state.d2_out >THETA_REF_MAX) state.d2_out=THETA_REF_MAX;
-		if(state.d2_out <-THETA_REF_MAX) state.d2_out=-THETA_REF_MAX;
-		}
-		rc_usleep(1000000 / SAMPLE_RATE_D2_HZ);
+void state_exporter(){
+	static shm_payload_t p;
+	task_stats_t stats[SHM_MAX_TASKS];
+	int i;
+
+	p.count++;
+	p.t_ns=bus_now_ns();
+	p.rc_state=rc_get_state();
+	p.wheel_angle_l=state.wheelAngleL;
+	p.wheel_angle_r=state.wheelAngleR;
+	p.theta=state.theta;
+	p.phi=state.phi;
+	p.gamma=state.gamma;
+	p.v_batt=state.vBatt;
+	p.d1_out=state.d1_out;
+	p.d2_out=state.d2_out;
+	p.d3_out=state.d3_out;
+	p.saturated=state.saturated;
+	p.control_state=setpoint.control_state;
+	p.theta_ref=setpoint.theta;
+	p.phi_ref=setpoint.phi;
+	p.gamma_ref=setpoint.gamma;
+	p.num_tasks=task_runner_stats(stats,SHM_MAX_TASKS);
+	for(i=0;i<p.num_tasks;i++){
+		strncpy(p.tasks[i].name,stats[i].name,sizeof(p.tasks[i].name)-1);
+		p.tasks[i].hz=stats[i].hz;
+		p.tasks[i].max_us=stats[i].max_ns/1000;
+		p.tasks[i].runs=stats[i].runs;
+		p.tasks[i].missed=stats[i].missed;
 	}
-	return NULL;
+	p.count_end=p.count;
+	shm_export_write(shm_state,&p);
+	return;
 }
 
-
 /*******************************************************************************
- * battery_checker()
+ * outer_loop()
+ * change theta setpoint based on phi, run by the task runner at SAMPLE_RATE_D2_HZ
+ * input to the controller is phi error(setpoint-state), output limited to
+ * +-THETA_REF_MAX
  *
- * Slow loop checking battery voltage and change D1 saturation limit 
 *******************************************************************************/
-void* battery_checker(void* ptr){
-	float new_v;
-	while(rc_get_state()!=EXITING){
-			new_v= rc_battery_voltage();
-			// if over range of battery set to Vnominal
-			if(new_v>9.0 || new_v<5.0) new_v = V_NOMINAL;
-			state.vBatt = new_v;
-			rc_usleep(1000000 / BATTERY_CHECK_HZ);
-	}
-	return NULL;
+void outer_loop(){
+	float sample[BUS_SAMPLE_WIDTH];
+	bus_sample_t enc, imu;
+
+#if defined(USE_LQR) || defined(USE_MPC)
+	// balancer() tracks phi itself
+	return;
+#endif
+	if(rc_get_state()!=RUNNING || setpoint.control_state!=ENGAGED) return;
+	if(bus_latest(BUS_ENCODERS,&enc) || bus_latest_before(BUS_IMU,enc.t_ns,&imu)) return;
+	if(bus_now_ns()-enc.t_ns >= BUS_MAX_AGE_NS) return;
+	traj_next_phi(&setpoint.phi);
+
+	//average wheel rotation with body rotation from the same D1 tick
+	state.phi=((enc.v[0]+enc.v[1])/2)+imu.v[0];
+
+#ifdef USE_FIXED_POINT
+	state.d2_out=FIX_FLOAT(fix_filter_step(&d2_q,fix_sub(fix_from_float(setpoint.phi,FIX_WHEEL_FRAC),\
+				fix_from_float(state.phi,FIX_WHEEL_FRAC)),\
+				gain_sets_q[atomic_load_explicit(&gain_set,memory_order_relaxed)]),FIX_WHEEL_FRAC);
+#else
+	state.d2_out=ctrl_stage_step(&d2,setpoint.phi-state.phi,\
+			gain_sets[atomic_load_explicit(&gain_set,memory_order_relaxed)]);
+#endif
+	//already within +-THETA_REF_MAX, the stage limits it
+	setpoint.theta=state.d2_out;
+	sample[0]=setpoint.theta;
+	sample[1]=setpoint.phi;
+	sample[2]=setpoint.gamma;
+	bus_publish(BUS_SETPOINT,sample,3);
+	return;
 }
 
+
 /*******************************************************************************
-* void on_pause_released() 
-*	
-* Make the Pause button toggle between paused and running states.
+ * battery_checker()
+ *
+ * Slow task checking battery voltage. Low pass filters the reading and
+ * publishes V_NOMINAL/vBatt so balancer() compensates D1 with one multiply,
+ * and its inverse as the D1 output limit.
 *******************************************************************************/
-void on_pause_released(){
-	// toggle betewen paused and running modes
-	if(rc_get_state()==RUNNING)		rc_set_state(PAUSED);
-	else if(rc_get_state()==PAUSED)	rc_set_state(RUNNING);
+void battery_checker(){
+	static float v_filt=0;
+	const float alpha=(1.0/BATTERY_CHECK_HZ)/(BATTERY_LPF_TAU+(1.0/BATTERY_CHECK_HZ));
+	float new_v;
+
+	new_v= rc_battery_voltage();
+	// if over range of battery set to Vnominal
+	if(new_v>9.0 || new_v<5.0) new_v = V_NOMINAL;
+	// first read seeds the filter so main() is not held up
+	if(v_filt==0) v_filt = new_v;
+	else v_filt += alpha*(new_v-v_filt);
+	atomic_store_explicit(&batt_scale,V_NOMINAL/v_filt,memory_order_relaxed);
+	atomic_store_explicit(&d1_limit,v_filt/V_NOMINAL,memory_order_relaxed);
+#ifdef USE_FIXED_POINT
+	atomic_store_explicit(&batt_scale_q,fix_from_float(V_NOMINAL/v_filt,FIX_SCALE_FRAC),\
+				memory_order_relaxed);
+	atomic_store_explicit(&d1_limit_q,fix_from_float(v_filt/V_NOMINAL,FIX_ANGLE_FRAC),\
+				memory_order_relaxed);
+#endif
+	state.vBatt = v_filt;
+	bus_publish(BUS_BATTERY,&v_filt,1);
 	return;
 }
 
 /*******************************************************************************
-* void on_pause_pressed() 
+* input_task()
 *
-* If the user holds the pause button for 2 seconds, set state to exiting which 
-* triggers the rest of the program to exit cleanly.
+* Button commands from common/input_event.h, run by the task runner so they
+* land between ticks. Pause and exit set the cape state, a new gain set is
+* picked up by outer_loop() and balancer()'s D3 at their next tick and the
+* flight log is opened and closed here, away from the IMU interrupt.
 *******************************************************************************/
-void on_pause_pressed(){
-	int i=0;
-	const int samples = 100;	// check for release 100 times in this period
-	const int us_wait = 2000000; // 2 seconds
-	
-	// now keep checking to see if the button is still held down
-	for(i=0;i<samples;i++){
-		rc_usleep(us_wait/samples);
-		if(rc_get_pause_button() == RELEASED) return;
+void input_task(){
+	input_cmd_t c;
+	int g;
+
+	while(input_poll(&c)){
+		if(input_apply_state(&c)==0) continue;
+		switch(c.type){
+		case INPUT_CMD_GAIN_SET:
+			g=(atomic_load_explicit(&gain_set,memory_order_relaxed)+1)%NUM_GAIN_SETS;
+			atomic_store_explicit(&gain_set,g,memory_order_relaxed);
+			printf("\ngain set %d, D2 and D3 x%.2f\n",g,gain_sets[g]);
+			break;
+		case INPUT_CMD_LOG:
+			if(fr_log_running()) fr_log_stop();
+			else if(fr_log_start())
+				fprintf(stderr,"WARNING: flight recorder can't write a log\n");
+			break;
+		default:
+			break;
+		}
 	}
-	printf("long press detected, shutting down\n");
-	rc_set_state(EXITING);
 	return;
 }
@@ -0,0 +1,86 @@
+/*******************************************************************************
+* balance.h
+*
+* Types, globals and functions of balance.c shared with the other modules and
+* with the simulated build in sim/
+*******************************************************************************/
+
+#ifndef BALANCE_H
+#define BALANCE_H
+
+#include <roboticscape.h>
+
+/*******************************************************************************
+* control_state_t
+* ENGAGED or DISENGAGED to show if controller is running
+*
+*******************************************************************************/
+typedef enum control_state_t{
+	ENGAGED,
+	DISENGAGED
+}control_state_t;
+
+/*******************************************************************************
+* setpoint_t
+* 
+* stores setpoints
+*******************************************************************************/
+typedef struct setpoint_t{
+	control_state_t control_state;
+	float theta;		//body theta radians
+	float phi;		// wheel position radians
+	float gamma;		//body turn angle radians
+}setpoint_t;
+/*******************************************************************************
+* core_state_t 
+* System information
+* 
+*******************************************************************************/
+typedef struct core_state_t{
+	float wheelAngleL; //wheel angle
+	float wheelAngleR;
+	float theta;	   //Mip angle radians
+	float phi;	   //average wheels angle
+	float gamma;	   //turn angle radians 
+	float vBatt;	   // battery status
+	float d1_out;	   //output to motors
+	float d2_out;	   //theta_ref
+	float d3_out;	   //steering output
+	unsigned int saturated; // SAT_* of the controllers on a limit this tick
+} core_state_t;
+
+// controller saturation bits, also in the telemetry
+#define SAT_D1		0x1	// balance, at full duty
+#define SAT_D2		0x2	// position, theta setpoint at THETA_REF_MAX
+#define SAT_D3		0x4	// steering, at STEERING_INPUT_MAX
+
+/*******************************************************************************
+* Functions
+*
+*
+*******************************************************************************/
+//IMU interrupt service
+void balancer();
+//housekeeping tasks, all run on the task runner thread
+void printer();
+void battery_checker();
+void outer_loop();
+void state_exporter();
+void input_task();
+//functions
+int init_controller();
+int load_imu_cal(const char* path);
+int zero_out_controller();
+int wait_for_start_condition();
+int disengage_controller();
+int engage_controller();
+
+/*******************************************************************************
+* Global Variables, defined in balance.c
+*
+*******************************************************************************/
+extern core_state_t state;
+extern setpoint_t setpoint;
+extern rc_imu_data_t imu_data;
+
+#endif	//BALANCE_H
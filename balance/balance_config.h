@@ -19,14 +19,37 @@
 #define WHEEL_RADIUS_M	  	 0.034
 #define TRACK_WIDTH_M	  	 0.035
 #define V_NOMINAL	  	 7.4
+#define BATTERY_LPF_TAU	  	 2.0		// battery voltage filter time constant (s)
 
 // inner loop controller 100hz
 #define D1_GAIN		   	 0.990
 #define D1_NUM 					{-3.093, 4.860,-1.840}
 #define D1_DEN					{1 , -1.379, .3793}
 #define D1_SATURATION_TIMEOUT	 0.4
+// back calculation anti-windup, 0 off to 1 full (ctrl_stage.h). Left off
+// on purpose: in ../sim every gain from 0.1 to 1.0 recovers from the shove
+// more slowly, D1's wound up integrator is what carries it through. Turned
+// on only after 5 to 30 ticks on the limit it changes nothing on the shove
+// and tips or slows the hardest pushes D1 still catches. Only D1 has a pole
+// that can wind up, D2 and D3 just get their limits.
+#define D1_AW_GAIN		 0.0
 #define FILTER_W		 0.550     	 //complementary filter frequency
 
+// adaptive complementary filter, only used when built with make ADAPTIVE=1
+#define FILTER_W_MIN		 0.15		// crossover while the accelerometer is disturbed
+#define FILTER_ADAPT_DEADBAND	 0.01		// |a|^2/g^2-1 accelerometer noise ignores
+#define FILTER_ADAPT_DIST_REF	 0.005		// past the deadband where it is halfway down,
+						// 1 m/s^2 of push is only 0.01
+#define FILTER_ADAPT_DIST_MAX	 0.1		// end of the weight table
+#define FILTER_ADAPT_N		 32
+#define FILTER_ADAPT_ATTACK	 0.05		// s, rise of the disturbance estimate
+#define FILTER_ADAPT_RELEASE	 0.3		// s, decay of the disturbance estimate
+
+// D1 gain schedule over |theta|, only used when built with make SCHEDULE=1
+#define D1_SCHED_THETA_MAX	 0.4		// |theta| at the last point
+#define D1_SCHED_THETA_N	 5
+#define D1_SCHED_TILT_GAIN	 0.3		// extra gain at D1_SCHED_THETA_MAX
+
 //outer loop controller 20hz
 #define D2_GAIN 				0.83
 #define THETA_REF_MAX			.33
@@ -39,6 +62,15 @@
 #define D3_DEN					 {1.00, -.5596}
 #define STEERING_INPUT_MAX 0.5
 
+// D2 and D3 output scale for each gain set, how hard the robot holds its
+// position and heading. A short press of the mode button steps to the next
+// at the following tick. D1 stays, in ../sim 5% either way makes it tip.
+#define GAIN_SETS		 {1.0, 0.8, 1.2}
+
+// full state feedback for make LQR=1 (lqr.h), from ../design:
+// design LQR lqr 10 0.1 1 0.1 1
+#define LQR_K			{-3.3583, -0.361687, -11.8583, 11.6499, -0.963925}
+
 // electrical hookups
 #define MOTOR_CHANNEL_L		 3
 #define MOTOR_CHANNEL_R		 2
@@ -48,11 +80,47 @@
 #define ENCODER_CHANNEL_R	 2
 #define ENCODER_POLARITY_L	 1
 #define ENCODER_POLARITY_R	 -1
+// motor output stage, see common/motor_output.h
+#define MOTOR_DEADBAND_L	 0.0	// duty the wheel starts turning at, on the stand
+#define MOTOR_DEADBAND_R	 0.0
+#define MOTOR_SLEW_RATE		 50.0	// duty per second, 0 for no limit
 
 // Thread Loops
 #define BATTERY_CHECK_HZ	 		5
 #define SETPOINT_MANAGER_HZ   100
 #define PRINTF_HZ		 					50
+#define SHM_EXPORT_HZ		 100	// state snapshots for external monitors
+#define INPUT_HZ		 20	// button commands taken, see common/input_event.h
+#define TASK_RUNNER_PRIORITY	 25	// one thread runs the loops above
+#define OUTER_LOOP_PRIORITY	 60	// D2 runs on a thread of its own
+#define BUS_MAX_AGE_NS		 30000000	// samples older than 3 D1 ticks are stale
+
+// flight recorder, see flight_recorder.h
+#define FLIGHT_RECORDER_S	 5.0	// seconds kept before a tip or saturation
+#define FLIGHT_RECORDER_POST_S	 0.5	// and after it
+#define FLIGHT_RECORDER_DIR	 "/var/log/balance"
+#define FLIGHT_LOG_AT_START	 0	// 1 logs every tick from start, compressed
+
+// IMU calibration cache and startup, see common/imu_cal.h and startup_prof.h
+#define IMU_CAL_CHECK_S		 0.25	// still window that checks the cached gyro bias
+#define IMU_CAL_STILL_SD	 0.5	// deg/s, gyro spread that still counts as still
+#define IMU_CAL_GYRO_TOL	 0.1	// deg/s, bias error the cache is rewritten for
+#define IMU_CAL_MOUNT_TOL	 0.002	// rad, mount angle change the cache is rewritten for
+#define STARTUP_BUDGET_MS	 1000	// exec to first balancer() tick
+
+// gyro bias and mount angle tracked while balancing, see imu_online.h
+#define IMU_ONLINE_BIAS_TAU	 30.0	// s of quasi static ticks the bias averages over
+#define IMU_ONLINE_MOUNT_TAU	 10.0	// s, same for the mount angle
+#define IMU_ONLINE_SETTLE_S	 2.0	// engaged this long before updates start
+#define IMU_ONLINE_GATE_RATE	 10.0	// deg/s, faster ticks are skipped
+#define IMU_ONLINE_GATE_THETA	 0.1	// rad, ticks leaning further are skipped
+
+// commanded motion, see trajectory.h
+#define TRAJ_SOCKET		 "/tmp/mip_traj.sock"
+#define TRAJ_PHI_RATE_MAX	 10.0	// rad/s of wheel rotation, ~0.34 m/s
+#define TRAJ_PHI_ACCEL_MAX	 10.0	// rad/s^2
+#define TRAJ_GAMMA_RATE_MAX	 1.5	// rad/s
+#define TRAJ_GAMMA_ACCEL_MAX	 3.0	// rad/s^2
 
 // other
 #define TIP_ANGLE		 0.85
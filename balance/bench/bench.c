@@ -0,0 +1,772 @@
+/*******************************************************************************
+* bench.c
+*
+* Benchmark runner for the balance code. Times the hot path (estimator,
+* full balancer tick, outer loop, sample bus) built from the same sources as
+* ../sim, collects the closed loop scenario metrics from ../sim/sim, writes
+* everything as JSON and compares it with a stored baseline.
+*
+*	bench				print results as JSON
+*	bench -b baseline.json		also compare, exit 1 on a regression
+*	bench -b baseline.json -u	store this run as the new baseline
+*	bench -H history.jsonl		append this run to a history file
+*******************************************************************************/
+
+#include <rc_usefulincludes.h>
+#include <sched.h>
+#include <float.h>
+#include "../balance_config.h"
+#include "../balance.h"
+#include "../sample_bus.h"
+#include "../fixed_ctrl.h"
+#include "../gain_schedule.h"
+#include "../comp_adapt.h"
+#include "../imu_online.h"
+#include "../lqr.h"
+#include "../mpc.h"
+#include "../flight_recorder.h"
+#include "../fr_codec.h"
+#include "../../common/comp_filter.h"
+#include "rc_sim.h"
+#include "mip_plant.h"
+
+#define REPLAY_TICKS	1000	// D1 ticks recorded from a balanced run
+#define BENCH_SAMPLES	31	// timed batches per benchmark
+#define BENCH_WARMUP	3	// untimed batches first
+#define MAX_JSON	16384
+#define MAD_TO_SIGMA	1.4826	// MAD of a normal distribution times this is sigma
+#define COMP_BATCH	100	// samples per comp_filter_batch() call, divides REPLAY_TICKS
+#define MPC_GRID	17	// points per state searched for the slowest MPC lookup
+#define CODEC_BLOCKS	(REPLAY_TICKS/FR_CODEC_BLOCK)	// full blocks in the replay
+
+/*******************************************************************************
+* replay_t
+*
+* Sensor readings recorded from the simulator while balancing. The timed
+* loops play them back so balancer() sees a realistic input sequence and
+* stays engaged without the plant model inside the timing.
+*******************************************************************************/
+typedef struct replay_t{
+	float accel[3];
+	float gyro[3];
+	int enc_l, enc_r;
+	float theta;		// plant tilt, what the estimators should read
+}replay_t;
+
+typedef struct bench_t{
+	const char* name;
+	void (*setup)(void);	// untimed, before every batch
+	void (*fn)(int i);	// one call, i counts up through the batch
+	int batch;		// calls per timed batch
+}bench_t;
+
+typedef struct stats_t{
+	double median, mad, min;
+	int n;
+}stats_t;
+
+/*******************************************************************************
+* float_comp_t
+*
+* float copy of the complementary filter as balancer() had it inline before
+* it moved to common/comp_filter.c. The reference the library and the fixed
+* point filter are timed against.
+*******************************************************************************/
+typedef struct float_comp_t{
+	float theta_a, theta_g;
+	float last_a_raw, last_g_raw;
+	float g_raw;
+}float_comp_t;
+
+static replay_t replay[REPLAY_TICKS];
+static float_comp_t comp_f;
+static float_comp_t comp_fa;
+static comp_adapt_t comp_a;
+static fix_comp_t comp_x;
+static comp_filter_t comp_l;
+// the replay split into arrays, the way a log is fed to comp_filter_batch()
+static float replay_ay[REPLAY_TICKS], replay_az[REPLAY_TICKS], replay_gx[REPLAY_TICKS];
+static float batch_theta[REPLAY_TICKS];
+static imu_online_t online;
+static float online_bias, online_mount;
+static lqr_t lqr;
+static mpc_t mpc;
+static float mpc_worst_x[MPC_STATES];	// state the MPC lookup took longest on
+static float d1_in_f[3], d1_out_f[2];
+static fix_filter_t d1_x;
+static gain_schedule_t d1_sched;
+static float d1_theta[REPLAY_TICKS];	// |theta| the schedule is looked up with
+static float d1_err[REPLAY_TICKS];	// D1 input from the float estimator
+static q31_t d1_err_q[REPLAY_TICKS];
+static fr_record_t codec_in[REPLAY_TICKS];	// flight recorder ring after the replay
+static fr_record_t codec_out[FR_CODEC_BLOCK];
+static uint8_t codec_buf[CODEC_BLOCKS+1][FR_CODEC_MAX_BYTES];	// and the partial last one
+static int codec_len[CODEC_BLOCKS+1];
+static fr_log_header_t codec_hdr;
+static volatile float sink_f;		// keeps the timed calls from being optimized out
+static volatile q31_t sink_q;
+static double time_threshold=0.05;	// relative slowdown that counts
+static double sigma_threshold=3.0;	// and it has to be this far outside the noise
+static double ctl_threshold=0.10;	// relative control quality loss that counts
+static const char* sim_path="../sim/sim";
+
+static void print_usage(){
+	printf("\nUsage: bench [options]\n");
+	printf("-b file    baseline to compare against\n");
+	printf("-u         write this run to the baseline file instead of comparing\n");
+	printf("-o file    write the JSON result there instead of stdout\n");
+	printf("-H file    append this run as one line to a history file\n");
+	printf("-s path    simulator binary (default %s)\n", sim_path);
+	printf("-a cpu     pin to one cpu\n");
+	printf("-tt frac   relative slowdown threshold (default %.2f)\n", time_threshold);
+	printf("-ts sigma  noise threshold for slowdowns (default %.1f)\n", sigma_threshold);
+	printf("-tc frac   control quality threshold (default %.2f)\n\n", ctl_threshold);
+}
+
+static double now_s(){
+	struct timespec t;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return t.tv_sec + t.tv_nsec*1e-9;
+}
+
+/*******************************************************************************
+* static void record_replay()
+*
+* Run the simulator the way ../sim does, release at 0.05 rad, give the
+* controller two seconds to settle and record the next REPLAY_TICKS inputs.
+*******************************************************************************/
+static void record_replay(){
+	mip_plant_t plant;
+	double dutyL=0, dutyR=0;
+	int k, warm=8*SAMPLE_RATE_D1_HZ, settle=2*SAMPLE_RATE_D1_HZ;
+	const int d2_div = SAMPLE_RATE_D1_HZ/SAMPLE_RATE_D2_HZ;
+
+	mip_plant_init(&plant, 0.05);
+	plant.noise = 0.02;
+	plant.held = 1;
+	rc_initialize();
+	init_controller();
+	rc_set_state(RUNNING);
+	for(k=-warm; k<settle+REPLAY_TICKS; k++){
+		if(k==0){
+			plant.held = 0;
+			engage_controller();
+		}
+		mip_plant_step(&plant, dutyL, dutyR, DT_D1);
+		mip_plant_imu(&plant, imu_data.accel, imu_data.gyro);
+		mip_plant_encoders(&plant, &rc_sim.encoder_raw[ENCODER_CHANNEL_L],\
+					&rc_sim.encoder_raw[ENCODER_CHANNEL_R]);
+		balancer();
+		if(k%d2_div==0) outer_loop();
+		dutyL = MOTOR_POLARITY_L*rc_sim_motor(MOTOR_CHANNEL_L);
+		dutyR = MOTOR_POLARITY_R*rc_sim_motor(MOTOR_CHANNEL_R);
+		if(k>=settle){
+			memcpy(replay[k-settle].accel, imu_data.accel, sizeof(imu_data.accel));
+			memcpy(replay[k-settle].gyro, imu_data.gyro, sizeof(imu_data.gyro));
+			replay[k-settle].enc_l = rc_sim.encoder_raw[ENCODER_CHANNEL_L];
+			replay[k-settle].enc_r = rc_sim.encoder_raw[ENCODER_CHANNEL_R];
+			replay[k-settle].theta = plant.theta;
+			replay_ay[k-settle] = imu_data.accel[1];
+			replay_az[k-settle] = imu_data.accel[2];
+			replay_gx[k-settle] = imu_data.gyro[0];
+		}
+	}
+	if(setpoint.control_state!=ENGAGED){
+		fprintf(stderr,"ERROR: recording run fell over\n");
+	}
+	if(fr_latest(codec_in, REPLAY_TICKS)!=REPLAY_TICKS){
+		fprintf(stderr,"ERROR: flight recorder kept less than the replay\n");
+	}
+}
+
+static inline void feed(int i){
+	const replay_t* r = &replay[i%REPLAY_TICKS];
+	memcpy(imu_data.accel, r->accel, sizeof(r->accel));
+	memcpy(imu_data.gyro, r->gyro, sizeof(r->gyro));
+	rc_sim.encoder_raw[ENCODER_CHANNEL_L] = r->enc_l;
+	rc_sim.encoder_raw[ENCODER_CHANNEL_R] = r->enc_r;
+}
+
+/*******************************************************************************
+* benchmarks
+*******************************************************************************/
+static void setup_disengaged(){
+	disengage_controller();
+}
+
+// engaged with the encoders zeroed at the start of the recording
+static void setup_engaged(){
+	engage_controller();
+	rc_sim.encoder_offset[ENCODER_CHANNEL_L] = replay[0].enc_l;
+	rc_sim.encoder_offset[ENCODER_CHANNEL_R] = replay[0].enc_r;
+}
+
+// disengaged this is only the estimator: complementary filter, encoder
+// conversion and bus publish. engaged it is the whole D1 tick.
+static void fn_balancer(int i){
+	feed(i);
+	balancer();
+}
+
+static void fn_outer_loop(int i){
+	feed(i);
+	balancer();
+	outer_loop();
+}
+
+static void fn_bus_publish(int i){
+	float v[4] = {i, 1, 2, 3};
+	bus_publish(BUS_CONTROL, v, 4);
+}
+
+static void fn_bus_lookup(int i){
+	bus_sample_t s;
+	bus_latest_before(BUS_IMU, bus_now_ns(), &s);
+}
+
+static float comp_step_alpha(float_comp_t* c, const replay_t* r, float alpha){
+	float a_raw = atan2(-r->accel[2], r->accel[1]);
+	c->g_raw = c->g_raw + DT_D1*(r->gyro[0]*DEG_TO_RAD);
+	c->theta_a = (alpha*c->last_a_raw)+((1-alpha)*c->theta_a);
+	c->theta_g = (1-alpha)*c->theta_g + c->g_raw - c->last_g_raw;
+	c->last_a_raw = a_raw;
+	c->last_g_raw = c->g_raw;
+	return c->theta_a + c->theta_g + MOUNT_ANGLE;
+}
+
+static float float_comp_step(float_comp_t* c, const replay_t* r){
+	return comp_step_alpha(c, r, FILTER_W*DT_D1);
+}
+
+// the ADAPTIVE=1 estimator, crossover from the accelerometer disturbance
+static float adaptive_comp_step(float_comp_t* c, const replay_t* r){
+	return comp_step_alpha(c, r, comp_adapt_alpha(&comp_a, r->accel));
+}
+
+static q31_t fixed_comp_step(fix_comp_t* c, const replay_t* r){
+	return fix_comp_step(c, fix_from_float(r->accel[1], FIX_SENSOR_FRAC),\
+			fix_from_float(r->accel[2], FIX_SENSOR_FRAC),\
+			fix_from_float(r->gyro[0], FIX_SENSOR_FRAC));
+}
+
+static float float_d1_step(float e){
+	float num[]=D1_NUM, den[]=D1_DEN, u;
+	d1_in_f[2] = d1_in_f[1];
+	d1_in_f[1] = d1_in_f[0];
+	d1_in_f[0] = e;
+	u = D1_GAIN*(num[0]*d1_in_f[0] + num[1]*d1_in_f[1] + num[2]*d1_in_f[2]\
+			- den[1]*d1_out_f[0] - den[2]*d1_out_f[1]);
+	d1_out_f[1] = d1_out_f[0];
+	d1_out_f[0] = u;
+	return u;
+}
+
+// same as float_d1_step with the numerator scaled by the gain schedule
+static float sched_d1_step(float e, float abs_theta){
+	float num[]=D1_NUM, den[]=D1_DEN, k, u;
+	k = gain_schedule_lookup(&d1_sched, abs_theta);
+	d1_in_f[2] = d1_in_f[1];
+	d1_in_f[1] = d1_in_f[0];
+	d1_in_f[0] = e;
+	u = D1_GAIN*(k*(num[0]*d1_in_f[0] + num[1]*d1_in_f[1] + num[2]*d1_in_f[2])\
+			- den[1]*d1_out_f[0] - den[2]*d1_out_f[1]);
+	d1_out_f[1] = d1_out_f[0];
+	d1_out_f[0] = u;
+	return u;
+}
+
+static void setup_filters(){
+	float num[]=D1_NUM, den[]=D1_DEN;
+	gain_schedule_init(&d1_sched);
+	memset(&comp_f, 0, sizeof(comp_f));
+	memset(&comp_fa, 0, sizeof(comp_fa));
+	comp_adapt_init(&comp_a);
+	fix_comp_init(&comp_x);
+	comp_filter_init(&comp_l, FILTER_W, DT_D1);
+	memset(d1_in_f, 0, sizeof(d1_in_f));
+	memset(d1_out_f, 0, sizeof(d1_out_f));
+	fix_filter_init(&d1_x, num, den, 2, D1_GAIN);
+	imu_online_init(&online);
+	online.engaged_ticks = online.settle;
+	online_bias = 0;
+	online_mount = MOUNT_ANGLE;
+	lqr_init(&lqr);
+	mpc_init(&mpc);
+}
+
+static void fn_comp_float(int i){
+	sink_f = float_comp_step(&comp_f, &replay[i%REPLAY_TICKS]);
+}
+
+static void fn_comp_adaptive(int i){
+	sink_f = adaptive_comp_step(&comp_fa, &replay[i%REPLAY_TICKS]);
+}
+
+static void fn_comp_library(int i){
+	const replay_t* r = &replay[i%REPLAY_TICKS];
+	sink_f = comp_filter_step(&comp_l, r->accel[1], r->accel[2], r->gyro[0]) + MOUNT_ANGLE;
+}
+
+// one batch call every COMP_BATCH calls, so the time per call is per sample
+static void fn_comp_batch(int i){
+	i %= REPLAY_TICKS;
+	if(i%COMP_BATCH) return;
+	comp_filter_batch(&comp_l, replay_ay+i, replay_az+i, replay_gx+i, batch_theta+i, COMP_BATCH);
+	sink_f = batch_theta[i];
+}
+
+// the replay's plant tilt stands in for the estimate, every tick passes the gates
+static void fn_imu_online(int i){
+	const replay_t* r = &replay[i%REPLAY_TICKS];
+	sink_f = imu_online_step(&online, 1, r->gyro[0]-online_bias, r->theta,\
+				&online_bias, &online_mount);
+}
+
+static void fn_comp_fixed(int i){
+	sink_q = fixed_comp_step(&comp_x, &replay[i%REPLAY_TICKS]);
+}
+
+static void fn_d1_float(int i){
+	sink_f = float_d1_step(d1_err[i%REPLAY_TICKS]);
+}
+
+// state from the replay's plant tilt, gyro and mean encoder angle, as balancer() builds it
+static void fn_lqr(int i){
+	const replay_t* r = &replay[i%REPLAY_TICKS];
+	sink_f = lqr_step(&lqr, r->theta, r->gyro[0]*DEG_TO_RAD,\
+			(r->enc_l+r->enc_r)*(float)(TWO_PI/(2*GEARBOX*ENCODER_RES))+r->theta, 1);
+}
+
+static void fn_mpc(int i){
+	const replay_t* r = &replay[i%REPLAY_TICKS];
+	sink_f = mpc_step(&mpc, r->theta, r->gyro[0]*DEG_TO_RAD,\
+			(r->enc_l+r->enc_r)*(float)(TWO_PI/(2*GEARBOX*ENCODER_RES))+r->theta, 1);
+}
+
+// the same state every call, found by check_mpc()
+static void fn_mpc_worst(int i){
+	sink_f = mpc_lookup(mpc_worst_x, NULL, NULL);
+}
+
+static void fn_d1_sched(int i){
+	sink_f = sched_d1_step(d1_err[i%REPLAY_TICKS], d1_theta[i%REPLAY_TICKS]);
+}
+
+static void fn_d1_fixed(int i){
+	sink_q = fix_filter_step(&d1_x, d1_err_q[i%REPLAY_TICKS], FIX_Q(1.0,FIX_SCALE_FRAC));
+}
+
+// one full block of the replay per call
+static void fn_fr_encode(int i){
+	int k = i%CODEC_BLOCKS;
+	codec_len[k] = fr_codec_encode(&codec_in[k*FR_CODEC_BLOCK], FR_CODEC_BLOCK, 0, codec_buf[k]);
+}
+
+static void fn_fr_decode(int i){
+	int k = i%CODEC_BLOCKS;
+	fr_codec_decode(&codec_hdr, codec_buf[k], codec_len[k], codec_out);
+}
+
+/*******************************************************************************
+* static void record_d1_inputs()
+*
+* What D1 would see over the replay with the float estimator and setpoint
+* 0, in float and fixed point, and the |theta| the schedule is looked up
+* with. test/test_fixed checks the fixed point path against the float one.
+*******************************************************************************/
+static void record_d1_inputs(){
+	float tf;
+	int i;
+
+	setup_filters();
+	// the second pass, with the filter settled, is the one kept
+	for(i=0;i<2*REPLAY_TICKS;i++){
+		tf = float_comp_step(&comp_f, &replay[i%REPLAY_TICKS]);
+		d1_err[i%REPLAY_TICKS] = -tf;
+		d1_err_q[i%REPLAY_TICKS] = fix_from_float(-tf, FIX_ANGLE_FRAC);
+		d1_theta[i%REPLAY_TICKS] = fabs(tf);
+	}
+}
+
+/*******************************************************************************
+* static int check_codec(char* out, int len, int* failed)
+*
+* Encodes the flight recorder records of the replay block by block, decodes
+* them and compares. Floats have to come back within half a quantum, the
+* timestamp within half a microsecond, everything else exact. Leaves the
+* encoded blocks for the fr_decode_block benchmark.
+*******************************************************************************/
+static int check_codec(char* out, int len, int* failed){
+	const int floats = (offsetof(fr_record_t, saturated)-offsetof(fr_record_t, accel))/sizeof(float);
+	const fr_record_t *a, *b;
+	double max_q=0, e;
+	long bytes=0;
+	int i, j, k, n, bad=0;
+
+	fr_codec_header(&codec_hdr, codec_in[0].t_ns);
+	for(i=0;i<REPLAY_TICKS;i+=FR_CODEC_BLOCK){
+		k = i/FR_CODEC_BLOCK;
+		n = REPLAY_TICKS-i<FR_CODEC_BLOCK ? REPLAY_TICKS-i : FR_CODEC_BLOCK;
+		codec_len[k] = fr_codec_encode(&codec_in[i], n, 0, codec_buf[k]);
+		bytes += codec_len[k];
+		n = fr_codec_decode(&codec_hdr, codec_buf[k], codec_len[k], codec_out);
+		if(n<0){
+			bad++;
+			continue;
+		}
+		for(k=0;k<n;k++){
+			a = &codec_in[i+k];
+			b = &codec_out[k];
+			// fields after the four integers are the floats in fr_record_t order
+			for(j=0;j<floats;j++){
+				// less the float rounding of the restored value
+				e = (fabs((&b->accel[0])[j]-(&a->accel[0])[j])\
+					-fabs((&a->accel[0])[j])*FLT_EPSILON)/codec_hdr.quantum[4+j];
+				if(e>max_q) max_q = e;
+			}
+			bad += llabs((long long)(b->t_ns-a->t_ns))>500 || b->tick!=a->tick ||\
+				b->rc_state!=a->rc_state || b->control_state!=a->control_state ||\
+				b->saturated!=a->saturated;
+		}
+	}
+	*failed = bad || max_q>0.5;
+	if(*failed) fprintf(stderr,"ERROR: flight log codec off by %.3g quanta, %d records wrong\n",\
+				max_q, bad);
+	return snprintf(out, len, "\"codec\":{\"ratio\":%.3g,\"bytes_per_record\":%.3g,"\
+		"\"max_err_quanta\":%.3g},\n", (double)REPLAY_TICKS*sizeof(fr_record_t)/bytes,\
+		(double)bytes/REPLAY_TICKS, max_q);
+}
+
+/*******************************************************************************
+* static int check_mpc(char* out, int len)
+*
+* Looks up every state on a MPC_GRID^4 grid over the table's box and keeps
+* the one that took the most dot products for the mpc_lookup_worst
+* benchmark. Also reports how much of the box has no feasible region.
+*******************************************************************************/
+static int check_mpc(char* out, int len){
+	float box[MPC_STATES], x[MPC_STATES];
+	int idx[MPC_STATES]={0}, i, region, dots, worst=-1, total=0, outside=0;
+	double sum=0;
+
+	mpc_get_box(box);
+	for(;;){
+		for(i=0;i<MPC_STATES;i++) x[i] = box[i]*(2.0f*idx[i]/(MPC_GRID-1)-1);
+		mpc_lookup(x, &region, &dots);
+		if(dots>worst){
+			worst = dots;
+			memcpy(mpc_worst_x, x, sizeof(x));
+		}
+		sum += dots;
+		outside += region<0;
+		total++;
+		for(i=0;i<MPC_STATES && ++idx[i]==MPC_GRID;i++) idx[i] = 0;
+		if(i==MPC_STATES) break;
+	}
+	return snprintf(out, len, "\"mpc\":{\"worst_dots\":%d,\"mean_dots\":%.3g,"\
+		"\"no_region\":%.3g},\n", worst, sum/total, (double)outside/total);
+}
+
+static bench_t benches[] = {
+	{"estimator",		setup_disengaged,	fn_balancer,	REPLAY_TICKS},
+	{"balancer",		setup_engaged,		fn_balancer,	REPLAY_TICKS},
+	{"balancer_outer_loop",	setup_engaged,		fn_outer_loop,	REPLAY_TICKS},
+	{"bus_publish",		NULL,			fn_bus_publish,	10000},
+	{"bus_latest_before",	NULL,			fn_bus_lookup,	10000},
+	{"comp_filter_float",	setup_filters,		fn_comp_float,	REPLAY_TICKS},
+	{"comp_filter_fixed",	setup_filters,		fn_comp_fixed,	REPLAY_TICKS},
+	{"comp_filter_library",	setup_filters,		fn_comp_library,	REPLAY_TICKS},
+	{"comp_filter_batch",	setup_filters,		fn_comp_batch,	REPLAY_TICKS},
+	{"comp_filter_adaptive",	setup_filters,		fn_comp_adaptive,	REPLAY_TICKS},
+	{"imu_online_step",	setup_filters,		fn_imu_online,	REPLAY_TICKS},
+	{"d1_step_float",	setup_filters,		fn_d1_float,	REPLAY_TICKS},
+	{"d1_step_fixed",	setup_filters,		fn_d1_fixed,	REPLAY_TICKS},
+	{"d1_step_scheduled",	setup_filters,		fn_d1_sched,	REPLAY_TICKS},
+	{"lqr_step",		setup_filters,		fn_lqr,		REPLAY_TICKS},
+	{"mpc_step",		setup_filters,		fn_mpc,		REPLAY_TICKS},
+	{"mpc_lookup_worst",	NULL,			fn_mpc_worst,	REPLAY_TICKS},
+	{"fr_encode_block",	NULL,			fn_fr_encode,	CODEC_BLOCKS},
+	{"fr_decode_block",	NULL,			fn_fr_decode,	CODEC_BLOCKS},
+};
+#define NUM_BENCHES (int)(sizeof(benches)/sizeof(benches[0]))
+
+static int cmp_double(const void* a, const void* b){
+	double x = *(const double*)a, y = *(const double*)b;
+	return x<y ? -1 : x>y;
+}
+
+static double median(double* v, int n){
+	qsort(v, n, sizeof(double), cmp_double);
+	return n%2 ? v[n/2] : 0.5*(v[n/2-1]+v[n/2]);
+}
+
+/*******************************************************************************
+* static stats_t run_bench(const bench_t* b)
+*
+* Median and median absolute deviation of the per call time over the timed
+* batches. Both shrug off the odd batch hit by an interrupt or a migration.
+*******************************************************************************/
+static stats_t run_bench(const bench_t* b){
+	double t[BENCH_SAMPLES], dev[BENCH_SAMPLES], t0;
+	stats_t s;
+	int k, i;
+
+	for(k=-BENCH_WARMUP; k<BENCH_SAMPLES; k++){
+		if(b->setup) b->setup();
+		t0 = now_s();
+		for(i=0;i<b->batch;i++) b->fn(i);
+		if(k>=0) t[k] = (now_s()-t0)*1e9/b->batch;
+	}
+	if(b->setup==setup_engaged && setpoint.control_state!=ENGAGED){
+		fprintf(stderr,"WARNING: %s disengaged during replay\n", b->name);
+	}
+	s.n = BENCH_SAMPLES;
+	s.min = t[0];
+	for(k=1;k<BENCH_SAMPLES;k++) if(t[k]<s.min) s.min = t[k];
+	s.median = median(t, BENCH_SAMPLES);
+	for(k=0;k<BENCH_SAMPLES;k++) dev[k] = fabs(t[k]-s.median);
+	s.mad = median(dev, BENCH_SAMPLES);
+	return s;
+}
+
+/*******************************************************************************
+* static int run_sim(char* out, int len)
+*
+* closed loop metrics, the JSON object ../sim/sim -j prints. -1 and {} in
+* out when sim is missing or printed no scenarios.
+*******************************************************************************/
+static int run_sim(char* out, int len){
+	char cmd[512];
+	FILE* p;
+	int n;
+
+	snprintf(cmd, sizeof(cmd), "%s -j all", sim_path);
+	p = popen(cmd, "r");
+	if(p==NULL){
+		perror(cmd);
+		return -1;
+	}
+	n = fread(out, 1, len-1, p);
+	out[n] = '\0';
+	pclose(p);
+	while(n>0 && (out[n-1]=='\n' || out[n-1]==' ')) out[--n] = '\0';
+	if(n==0 || out[0]!='{' || strcmp(out, "{}")==0){
+		fprintf(stderr,"ERROR: no results from %s\n", sim_path);
+		snprintf(out, len, "{}");
+		return -1;
+	}
+	return 0;
+}
+
+static void first_line(const char* cmd, char* out, int len){
+	FILE* p = popen(cmd, "r");
+	out[0] = '\0';
+	if(p==NULL) return;
+	if(fgets(out, len, p)==NULL) out[0] = '\0';
+	out[strcspn(out, "\r\n\"")] = '\0';
+	pclose(p);
+}
+
+/*******************************************************************************
+* static double json_get(const char* json, const char* entry, const char* key)
+*
+* Value of "key" inside the "entry":{...} object, NAN if it isn't there.
+* Only reads the flat layout this program and sim -j write.
+*******************************************************************************/
+static double json_get(const char* json, const char* entry, const char* key){
+	char pat[128];
+	const char *e, *end, *k;
+
+	snprintf(pat, sizeof(pat), "\"%s\":{", entry);
+	e = strstr(json, pat);
+	if(e==NULL) return NAN;
+	end = strchr(e, '}');
+	snprintf(pat, sizeof(pat), "\"%s\":", key);
+	k = strstr(e, pat);
+	if(k==NULL || k>end) return NAN;
+	return atof(k+strlen(pat));
+}
+
+static char* read_file(const char* path){
+	FILE* f = fopen(path, "r");
+	char* buf;
+	long n;
+
+	if(f==NULL) return NULL;
+	fseek(f, 0, SEEK_END);
+	n = ftell(f);
+	rewind(f);
+	buf = malloc(n+1);
+	if(buf==NULL || fread(buf, 1, n, f)!=(size_t)n){
+		free(buf);
+		fclose(f);
+		return NULL;
+	}
+	buf[n] = '\0';
+	fclose(f);
+	return buf;
+}
+
+/*******************************************************************************
+* static int compare(const char* base, const char* cur)
+*
+* A benchmark is slower when its median grew by more than the relative
+* threshold and by more than sigma_threshold times the combined spread of
+* both runs. A scenario regressed when it stopped passing or its ISE,
+* settling time or peak tilt got worse by more than the control threshold.
+* Returns the number of regressions.
+*******************************************************************************/
+static int compare(const char* base, const char* cur){
+	static const char* ctl_keys[] = {"ise", "settle", "max_theta"};
+	const char *p, *q;
+	char name[64];
+	double m0, m1, d0, d1, z, v0, v1;
+	int i, j, bad, regressions=0;
+
+	fprintf(stderr, "%-20s %10s %10s %8s %6s\n", "benchmark", "base ns", "now ns", "change", "z");
+	for(i=0;i<NUM_BENCHES;i++){
+		m0 = json_get(base, benches[i].name, "median_ns");
+		d0 = json_get(base, benches[i].name, "mad_ns");
+		m1 = json_get(cur, benches[i].name, "median_ns");
+		d1 = json_get(cur, benches[i].name, "mad_ns");
+		if(isnan(m0)){
+			fprintf(stderr, "%-20s %10s %10.1f  not in baseline\n", benches[i].name, "-", m1);
+			continue;
+		}
+		z = (m1-m0)/(MAD_TO_SIGMA*sqrt(d0*d0+d1*d1)+1e-9);
+		bad = m1>m0*(1+time_threshold) && z>sigma_threshold;
+		regressions += bad;
+		fprintf(stderr, "%-20s %10.1f %10.1f %+7.1f%% %6.1f  %s\n", benches[i].name,\
+			m0, m1, 100*(m1-m0)/m0, z, bad ? "SLOWER" : "ok");
+	}
+
+	fprintf(stderr, "\n%-20s %10s %10s %10s %10s\n", "scenario", "ok", "ise", "settle", "max|θ|");
+	// every scenario in the baseline, one "name":{...} object each
+	p = strstr(base, "\"closed_loop\":{");
+	if(p) p += strlen("\"closed_loop\":{");
+	while(p && (p=strchr(p, '"'))!=NULL && (q=strchr(p+1, '"'))!=NULL){
+		snprintf(name, sizeof(name), "%.*s", (int)(q-p-1), p+1);
+		p = strchr(q, '}');
+		bad = json_get(base, name, "ok")==1 && json_get(cur, name, "ok")!=1;
+		for(j=0;j<3;j++){
+			v0 = json_get(base, name, ctl_keys[j]);
+			v1 = json_get(cur, name, ctl_keys[j]);
+			// settling time gets an absolute allowance of one outer loop tick
+			if(v1 > v0*(1+ctl_threshold) + (j==1 ? 1.0/SAMPLE_RATE_D2_HZ : 1e-6)) bad = 1;
+		}
+		regressions += bad;
+		fprintf(stderr, "%-20s %4.0f->%-4.0f %10.5f %9.2fs %10.3f  %s\n", name,\
+			json_get(base, name, "ok"), json_get(cur, name, "ok"),\
+			json_get(cur, name, "ise"), json_get(cur, name, "settle"),\
+			json_get(cur, name, "max_theta"), bad ? "REGRESSED" : "ok");
+	}
+	return regressions;
+}
+
+int main(int argc, char* argv[]){
+	static char json[MAX_JSON], sim[MAX_JSON/2];
+	const char *base_path=NULL, *out_path=NULL, *hist_path=NULL;
+	char git[64], host[64], date[32], *base, *p;
+	int i, n=0, update=0, cpu=-1, regressions, saved, codec_failed, sim_failed;
+	stats_t s;
+	time_t now;
+	FILE* f;
+
+	for(i=1;i<argc;i++){
+		if(i+1<argc && strcmp(argv[i],"-b")==0) base_path=argv[++i];
+		else if(strcmp(argv[i],"-u")==0) update=1;
+		else if(i+1<argc && strcmp(argv[i],"-o")==0) out_path=argv[++i];
+		else if(i+1<argc && strcmp(argv[i],"-H")==0) hist_path=argv[++i];
+		else if(i+1<argc && strcmp(argv[i],"-s")==0) sim_path=argv[++i];
+		else if(i+1<argc && strcmp(argv[i],"-a")==0) cpu=atoi(argv[++i]);
+		else if(i+1<argc && strcmp(argv[i],"-tt")==0) time_threshold=atof(argv[++i]);
+		else if(i+1<argc && strcmp(argv[i],"-ts")==0) sigma_threshold=atof(argv[++i]);
+		else if(i+1<argc && strcmp(argv[i],"-tc")==0) ctl_threshold=atof(argv[++i]);
+		else{
+			print_usage();
+			return -1;
+		}
+	}
+	if(update && base_path==NULL){
+		print_usage();
+		return -1;
+	}
+	if(cpu>=0){
+		cpu_set_t set;
+		CPU_ZERO(&set);
+		CPU_SET(cpu, &set);
+		if(sched_setaffinity(0, sizeof(set), &set)) perror("sched_setaffinity");
+	}
+
+	// balance.c prints on every engage and disengage, keep stdout for the JSON
+	fflush(stdout);
+	saved = dup(STDOUT_FILENO);
+	if(freopen("/dev/null", "w", stdout)==NULL) return -1;
+	record_replay();
+	first_line("git rev-parse --short HEAD 2>/dev/null", git, sizeof(git));
+	gethostname(host, sizeof(host));
+	host[sizeof(host)-1] = '\0';
+	now = time(NULL);
+	strftime(date, sizeof(date), "%Y-%m-%dT%H:%M:%SZ", gmtime(&now));
+
+	n += snprintf(json+n, MAX_JSON-n, "{\"date\":\"%s\",\"git\":\"%s\",\"host\":\"%s\",\n",\
+			date, git, host);
+	record_d1_inputs();
+	n += check_mpc(json+n, MAX_JSON-n);
+	n += check_codec(json+n, MAX_JSON-n, &codec_failed);
+	n += snprintf(json+n, MAX_JSON-n, "\"micro\":{");
+	for(i=0;i<NUM_BENCHES;i++){
+		s = run_bench(&benches[i]);
+		n += snprintf(json+n, MAX_JSON-n, "%s\n\"%s\":{\"median_ns\":%.2f,\"mad_ns\":%.2f,"\
+			"\"min_ns\":%.2f,\"n\":%d}", i ? "," : "", benches[i].name,\
+			s.median, s.mad, s.min, s.n);
+	}
+	fflush(stdout);
+	dup2(saved, STDOUT_FILENO);
+	close(saved);
+	sim_failed = run_sim(sim, sizeof(sim));
+	n += snprintf(json+n, MAX_JSON-n, "},\n\"closed_loop\":%s}\n", sim);
+
+	f = stdout;
+	if(out_path!=NULL && (f=fopen(out_path, "w"))==NULL){
+		perror(out_path);
+		return -1;
+	}
+	fputs(json, f);
+	if(f!=stdout) fclose(f);
+	// an empty closed_loop would pass every comparison and blank the baseline
+	if(sim_failed){
+		fprintf(stderr,"ERROR: no closed loop results, history and baseline left alone\n");
+		return 1;
+	}
+
+	if(hist_path!=NULL){
+		if((f=fopen(hist_path, "a"))==NULL) perror(hist_path);
+		else{
+			for(p=json; *p; p++) if(*p!='\n') fputc(*p, f);
+			fputc('\n', f);
+			fclose(f);
+		}
+	}
+
+	if(base_path==NULL) return codec_failed ? 1 : 0;
+	if(update){
+		if((f=fopen(base_path, "w"))==NULL){
+			perror(base_path);
+			return -1;
+		}
+		fputs(json, f);
+		fclose(f);
+		fprintf(stderr, "baseline written to %s\n", base_path);
+		return 0;
+	}
+	base = read_file(base_path);
+	if(base==NULL){
+		perror(base_path);
+		return -1;
+	}
+	regressions = compare(base, json) + codec_failed;
+	free(base);
+	fprintf(stderr, "\n%d regression%s\n", regressions, regressions==1 ? "" : "s");
+	return regressions ? 1 : 0;
+}
@@ -0,0 +1,39 @@
+/*******************************************************************************
+* comp_adapt.c
+*
+* Weight table behind comp_adapt.h
+*******************************************************************************/
+
+#include <stdio.h>
+#include <string.h>
+#include "comp_adapt.h"
+
+/*******************************************************************************
+* int comp_adapt_init(comp_adapt_t* c)
+*
+* Entry i covers dist from i/inv_step up. Below FILTER_ADAPT_DEADBAND, the
+* accelerometer noise floor, the crossover stays at FILTER_W. Past it the
+* crossover falls toward FILTER_W_MIN and is halfway down
+* FILTER_ADAPT_DIST_REF later.
+*******************************************************************************/
+int comp_adapt_init(comp_adapt_t* c){
+	float d, r, w;
+	int i;
+
+	if(FILTER_ADAPT_N<2 || FILTER_ADAPT_DIST_MAX<=0 || FILTER_ADAPT_DIST_REF<=0 ||\
+	   FILTER_W_MIN<=0 || FILTER_W_MIN>FILTER_W){
+		fprintf(stderr,"ERROR: bad FILTER_ADAPT settings in balance_config.h\n");
+		return -1;
+	}
+	memset(c, 0, sizeof(comp_adapt_t));
+	c->attack = DT_D1/(FILTER_ADAPT_ATTACK+DT_D1);
+	c->release = DT_D1/(FILTER_ADAPT_RELEASE+DT_D1);
+	c->inv_step = FILTER_ADAPT_N/FILTER_ADAPT_DIST_MAX;
+	for(i=0;i<FILTER_ADAPT_N;i++){
+		d = i/c->inv_step;
+		r = d>FILTER_ADAPT_DEADBAND ? (d-FILTER_ADAPT_DEADBAND)/FILTER_ADAPT_DIST_REF : 0;
+		w = FILTER_W_MIN + (FILTER_W-FILTER_W_MIN)/(1.0f + r*r);
+		c->alpha[i] = w*DT_D1;
+	}
+	return 0;
+}
@@ -0,0 +1,50 @@
+/*******************************************************************************
+* comp_adapt.h
+*
+* Adaptive crossover for the balancer() complementary filter. While the
+* robot accelerates the accelerometer no longer points at gravity and
+* |a|^2/g^2 moves away from 1. That deviation is tracked with a fast
+* attack and a slow release, and indexes a table of filter weights filled
+* at startup, so the crossover drops toward FILTER_W_MIN and the gyro carries
+* theta until the disturbance is over. Per tick this costs a handful of
+* multiplies and one table read.
+*
+* Built in with make ADAPTIVE=1, see FILTER_ADAPT_* in balance_config.h.
+*******************************************************************************/
+
+#ifndef COMP_ADAPT_H
+#define COMP_ADAPT_H
+
+#include "balance_config.h"
+
+#define COMP_ADAPT_G	9.81f
+
+typedef struct comp_adapt_t{
+	float dist;		// smoothed |a|^2/g^2-1
+	float attack;		// per tick rise of dist
+	float release;		// per tick decay of dist
+	float inv_step;		// table entries per unit of dist
+	float alpha[FILTER_ADAPT_N];	// FILTER_W*DT_D1 at dist 0
+}comp_adapt_t;
+
+int comp_adapt_init(comp_adapt_t* c);
+
+/*******************************************************************************
+* static inline float comp_adapt_alpha(comp_adapt_t* c, const float accel[3])
+*
+* filter weight for this tick, use it for both the low and high pass so the
+* two halves still add up to one
+*******************************************************************************/
+static inline float comp_adapt_alpha(comp_adapt_t* c, const float accel[3]){
+	const float inv_g2 = 1.0f/(COMP_ADAPT_G*COMP_ADAPT_G);
+	float d = (accel[0]*accel[0] + accel[1]*accel[1] + accel[2]*accel[2])*inv_g2 - 1.0f;
+	int i;
+
+	if(d<0) d = -d;
+	c->dist += (d>c->dist ? c->attack : c->release)*(d - c->dist);
+	i = (int)(c->dist*c->inv_step);
+	if(i>FILTER_ADAPT_N-1) i = FILTER_ADAPT_N-1;
+	return c->alpha[i];
+}
+
+#endif	//COMP_ADAPT_H
@@ -0,0 +1,73 @@
+/*******************************************************************************
+* ctrl_stage.c
+*
+* Setup behind ctrl_stage.h
+*******************************************************************************/
+
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include "ctrl_stage.h"
+
+/*******************************************************************************
+* void ctrl_aw_split(const float* den, int order, float aw, float* f, float* t)
+*
+* r is the largest real root of z^n + den[1] z^(n-1) + ... Deflating den by
+* (1 - r z^-1) leaves q, q[i] = den[i] + r q[i-1]. Without such a root, or
+* one under CTRL_AW_POLE_MIN, f is den and t is zero.
+*******************************************************************************/
+void ctrl_aw_split(const float* den, int order, float aw, float* f, float* t){
+	double r=0, disc, q[CTRL_ORDER_MAX+1];
+	int i;
+
+	if(order==1) r = -den[1];
+	else if(order==2){
+		disc = den[1]*den[1] - 4.0*den[2];
+		if(disc>=0) r = (-den[1] + sqrt(disc))/2;
+	}
+	f[0] = 1;
+	t[0] = 0;
+	if(order<1 || r<CTRL_AW_POLE_MIN){
+		for(i=1;i<=order;i++){
+			f[i] = den[i];
+			t[i] = 0;
+		}
+		return;
+	}
+	q[0] = 1;
+	for(i=1;i<order;i++) q[i] = den[i] + r*q[i-1];
+	q[order] = 0;
+	for(i=1;i<=order;i++){
+		f[i] = q[i] - (1-aw)*r*q[i-1];
+		t[i] = den[i] - f[i];
+	}
+}
+
+int ctrl_stage_init(ctrl_stage_t* s, const float* num, const float* den, int order,\
+				float gain, float limit, float aw){
+	int i;
+
+	if(order<0 || order>CTRL_ORDER_MAX){
+		fprintf(stderr,"ERROR: controller order %d, at most %d\n", order, CTRL_ORDER_MAX);
+		return -1;
+	}
+	if(!(limit>0) || aw<0 || aw>1){
+		fprintf(stderr,"ERROR: controller limit %g and anti-windup gain %g\n", limit, aw);
+		return -1;
+	}
+	memset(s, 0, sizeof(ctrl_stage_t));
+	s->order = order;
+	s->gain = gain;
+	for(i=0;i<=order;i++) s->num[i] = num[i];
+	ctrl_aw_split(den, order, aw, s->f, s->t);
+	s->min = -limit;
+	s->max = limit;
+	return 0;
+}
+
+void ctrl_stage_reset(ctrl_stage_t* s){
+	memset(s->in, 0, sizeof(s->in));
+	memset(s->out, 0, sizeof(s->out));
+	memset(s->lim, 0, sizeof(s->lim));
+	s->sat = 0;
+}
@@ -0,0 +1,107 @@
+/*******************************************************************************
+* ctrl_stage.h
+*
+* One controller of the D1/D2/D3 cascade: the difference equation balance.c
+* always ran, u = scale*gain*(num.in - den.out) with a monic denominator,
+* plus output limits and back calculation anti-windup in its state update.
+*
+* Only a pole at or near z=1 can wind up, so the denominator is split into
+* that pole and the rest, (1 - r z^-1) Q, and the slow mode is fed back from
+* what the stage delivered instead of what it asked for, with tracking gain
+* aw. The recursion then runs on two histories, the raw outputs u and the
+* limited outputs y:
+*
+*	u = scale*gain*(num.in - f.u - t.y)
+*	f = Q (1 - (1-aw) r z^-1),  t = den - f
+*
+* While nothing saturates y = u and this is the plain filter for any aw.
+* aw 0 turns anti-windup off, 1 makes the integrating D1 stop charging the
+* moment the motors can give no more, while its lead keeps acting on the
+* raw output so the loop doesn't lose its phase margin on the limit.
+* balance runs D1 with it off on purpose, see D1_AW_GAIN. A stage whose slowest pole is
+* under CTRL_AW_POLE_MIN (D2, D3) can't wind up and only gets its limits.
+* fixed_ctrl.h does the same for make FIXED=1.
+*
+* sat says which limit the last step hit, for the saturation timeout and
+* the telemetry (SAT_* in balance.h).
+*******************************************************************************/
+
+#ifndef CTRL_STAGE_H
+#define CTRL_STAGE_H
+
+#define CTRL_ORDER_MAX		2
+#define CTRL_AW_POLE_MIN	0.9	// slower poles count as integrating
+
+typedef struct ctrl_stage_t{
+	int order;
+	float gain;
+	float num[CTRL_ORDER_MAX+1];
+	float f[CTRL_ORDER_MAX+1];	// on raw outputs, f[0] unused
+	float t[CTRL_ORDER_MAX+1];	// on limited outputs, t[0] unused
+	float in[CTRL_ORDER_MAX+1];	// newest first
+	float out[CTRL_ORDER_MAX];	// raw outputs, newest first
+	float lim[CTRL_ORDER_MAX];	// limited outputs, newest first
+	float min, max;
+	int sat;			// -1 on min, +1 on max, 0 inside
+}ctrl_stage_t;
+
+// f and t from den as above, also used by fixed_ctrl.c
+void ctrl_aw_split(const float* den, int order, float aw, float* f, float* t);
+
+// -1 if the order is over CTRL_ORDER_MAX or the limits or aw make no sense
+int ctrl_stage_init(ctrl_stage_t* s, const float* num, const float* den, int order,\
+				float gain, float limit, float aw);
+void ctrl_stage_reset(ctrl_stage_t* s);
+
+// limits that move with the battery, every tick if need be
+static inline void ctrl_stage_set_limits(ctrl_stage_t* s, float min, float max){
+	s->min = min;
+	s->max = max;
+}
+
+// numerator from a gain schedule, the gain and the denominator stay
+static inline void ctrl_stage_set_num(ctrl_stage_t* s, const float* num){
+	int i;
+	for(i=0;i<=s->order;i++) s->num[i] = num[i];
+}
+
+/*******************************************************************************
+* static inline float ctrl_stage_step(ctrl_stage_t* s, float e, float scale)
+*
+* scale multiplies the output before it is limited and stored, like the soft
+* start on D1. Returns the limited output.
+*******************************************************************************/
+static inline float ctrl_stage_step(ctrl_stage_t* s, float e, float scale){
+	float u, y;
+	int i;
+
+	for(i=s->order;i>0;i--) s->in[i] = s->in[i-1];
+	s->in[0] = e;
+	u = s->num[0]*e;
+	for(i=1;i<=s->order;i++) u += s->num[i]*s->in[i] - s->f[i]*s->out[i-1] - s->t[i]*s->lim[i-1];
+	u *= s->gain*scale;
+
+	if(u>s->max){
+		y = s->max;
+		s->sat = 1;
+	}
+	else if(u<s->min){
+		y = s->min;
+		s->sat = -1;
+	}
+	else{
+		y = u;
+		s->sat = 0;
+	}
+	for(i=s->order-1;i>0;i--){
+		s->out[i] = s->out[i-1];
+		s->lim[i] = s->lim[i-1];
+	}
+	if(s->order>0){
+		s->out[0] = u;
+		s->lim[0] = y;
+	}
+	return y;
+}
+
+#endif	//CTRL_STAGE_H
@@ -0,0 +1,515 @@
+/*******************************************************************************
+* ctrl_math.c
+*
+* polynomial, matrix and discretization routines behind ctrl_math.h
+*******************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <math.h>
+#include "ctrl_math.h"
+
+/*******************************************************************************
+* polynomials
+*******************************************************************************/
+poly_t poly_const(double k){
+	poly_t p;
+	memset(&p, 0, sizeof(p));
+	p.deg = 0;
+	p.c[0] = k;
+	return p;
+}
+
+// drop leading zero coefficients so c[0] is the true leading term
+static poly_t poly_trim(poly_t a){
+	int lead=0, i;
+	while(lead<a.deg && a.c[lead]==0.0) lead++;
+	if(lead==0) return a;
+	for(i=0;i<=a.deg-lead;i++) a.c[i] = a.c[i+lead];
+	for(;i<=a.deg;i++) a.c[i] = 0;
+	a.deg -= lead;
+	return a;
+}
+
+poly_t poly_mul(poly_t a, poly_t b){
+	poly_t p;
+	int i, j;
+	memset(&p, 0, sizeof(p));
+	if(a.deg+b.deg>MAX_DEG){
+		fprintf(stderr,"ERROR: polynomial degree above %d\n",MAX_DEG);
+		exit(-1);
+	}
+	p.deg = a.deg+b.deg;
+	for(i=0;i<=a.deg;i++){
+		for(j=0;j<=b.deg;j++) p.c[i+j] += a.c[i]*b.c[j];
+	}
+	return p;
+}
+
+poly_t poly_add(poly_t a, poly_t b){
+	poly_t p;
+	int k;
+	memset(&p, 0, sizeof(p));
+	p.deg = a.deg>b.deg ? a.deg : b.deg;
+	for(k=0;k<=a.deg;k++) p.c[p.deg-k] += a.c[a.deg-k];
+	for(k=0;k<=b.deg;k++) p.c[p.deg-k] += b.c[b.deg-k];
+	return poly_trim(p);
+}
+
+poly_t poly_scale(poly_t a, double k){
+	int i;
+	for(i=0;i<=a.deg;i++) a.c[i] *= k;
+	return a;
+}
+
+/*******************************************************************************
+* int poly_parse(const char* str, poly_t* p)
+*
+* Read coefficients highest power first. Any separator works, so "1 -1.379",
+* "1,-1.379" and "{1 , -1.379, .3793}" copied out of balance_config.h all parse.
+*******************************************************************************/
+int poly_parse(const char* str, poly_t* p){
+	char* end;
+	int n=0;
+	memset(p, 0, sizeof(poly_t));
+	while(*str){
+		if(isdigit((unsigned char)*str) || *str=='-' || *str=='+' || *str=='.'){
+			if(n>MAX_DEG) return -1;
+			p->c[n] = strtod(str, &end);
+			if(end==str) return -1;
+			n++;
+			str = end;
+		}
+		else str++;
+	}
+	if(n==0) return -1;
+	p->deg = n-1;
+	*p = poly_trim(*p);
+	return 0;
+}
+
+/*******************************************************************************
+* void poly_roots(poly_t p, double* re, double* im)
+*
+* Durand-Kerner iteration, writes p.deg roots
+*******************************************************************************/
+void poly_roots(poly_t p, double* re, double* im){
+	double zr[MAX_DEG], zi[MAX_DEG];
+	double nr, ni, dr, di, tr, mag, cr, ci, step;
+	int n, it, i, j;
+
+	p = poly_trim(p);
+	n = p.deg;
+	for(i=0;i<n;i++){
+		// distinct starting points on a slowly shrinking spiral
+		mag = pow(0.985, i);
+		zr[i] = mag*cos(i*1.15);
+		zi[i] = mag*sin(i*1.15);
+	}
+	for(it=0; it<500; it++){
+		step = 0;
+		for(i=0;i<n;i++){
+			nr = 1; ni = 0;
+			for(j=1;j<=n;j++){
+				tr = nr*zr[i]-ni*zi[i] + p.c[j]/p.c[0];
+				ni = nr*zi[i]+ni*zr[i];
+				nr = tr;
+			}
+			dr = 1; di = 0;
+			for(j=0;j<n;j++){
+				if(j==i) continue;
+				tr = dr*(zr[i]-zr[j]) - di*(zi[i]-zi[j]);
+				di = dr*(zi[i]-zi[j]) + di*(zr[i]-zr[j]);
+				dr = tr;
+			}
+			mag = dr*dr+di*di;
+			if(mag==0) mag = 1e-300;
+			cr = (nr*dr+ni*di)/mag;
+			ci = (ni*dr-nr*di)/mag;
+			zr[i] -= cr;
+			zi[i] -= ci;
+			// keep real roots from decaying into slow denormal arithmetic
+			if(fabs(zi[i])<1e-150) zi[i] = 0;
+			step += fabs(cr)+fabs(ci);
+		}
+		if(step<1e-12 || step!=step) break;
+	}
+	for(i=0;i<n;i++){
+		re[i] = zr[i];
+		im[i] = zi[i];
+	}
+}
+
+/*******************************************************************************
+* int poly_schur_stable(poly_t p)
+*
+* Schur-Cohn reflection coefficient recursion, O(n^2) and no root finding,
+* which is what lets batch mode check thousands of candidates quickly.
+*******************************************************************************/
+int poly_schur_stable(poly_t p){
+	double a[MAX_DEG+1], b[MAX_DEG+1], k;
+	int n, i;
+
+	p = poly_trim(p);
+	n = p.deg;
+	// a[i] is the coefficient of z^i
+	for(i=0;i<=n;i++) a[i] = p.c[n-i];
+	while(n>0){
+		if(a[n]==0) return 0;
+		k = a[0]/a[n];
+		if(fabs(k)>=1.0) return 0;
+		for(i=0;i<n;i++) b[i] = a[i+1]-k*a[n-1-i];
+		n--;
+		for(i=0;i<=n;i++) a[i] = b[i];
+	}
+	return 1;
+}
+
+double poly_spectral_radius(poly_t p){
+	double re[MAX_DEG], im[MAX_DEG], r=0, m;
+	int i;
+	p = poly_trim(p);
+	poly_roots(p, re, im);
+	for(i=0;i<p.deg;i++){
+		m = sqrt(re[i]*re[i]+im[i]*im[i]);
+		if(m>r) r = m;
+	}
+	return r;
+}
+
+/*******************************************************************************
+* matrices
+*******************************************************************************/
+mat_t mat_zero(int n, int m){
+	mat_t r;
+	memset(&r, 0, sizeof(r));
+	r.n = n;
+	r.m = m;
+	return r;
+}
+
+mat_t mat_eye(int n){
+	mat_t r = mat_zero(n, n);
+	int i;
+	for(i=0;i<n;i++) r.a[i][i] = 1;
+	return r;
+}
+
+mat_t mat_mul(const mat_t* a, const mat_t* b){
+	mat_t r = mat_zero(a->n, b->m);
+	int i, j, k;
+	for(i=0;i<a->n;i++){
+		for(k=0;k<a->m;k++){
+			for(j=0;j<b->m;j++) r.a[i][j] += a->a[i][k]*b->a[k][j];
+		}
+	}
+	return r;
+}
+
+mat_t mat_add(const mat_t* a, const mat_t* b){
+	mat_t r = *a;
+	int i, j;
+	for(i=0;i<a->n;i++){
+		for(j=0;j<a->m;j++) r.a[i][j] += b->a[i][j];
+	}
+	return r;
+}
+
+mat_t mat_scale(const mat_t* a, double k){
+	mat_t r = *a;
+	int i, j;
+	for(i=0;i<a->n;i++){
+		for(j=0;j<a->m;j++) r.a[i][j] *= k;
+	}
+	return r;
+}
+
+mat_t mat_transpose(const mat_t* a){
+	mat_t r = mat_zero(a->m, a->n);
+	int i, j;
+	for(i=0;i<a->n;i++){
+		for(j=0;j<a->m;j++) r.a[j][i] = a->a[i][j];
+	}
+	return r;
+}
+
+/*******************************************************************************
+* int mat_inverse(const mat_t* a, mat_t* inv)
+*
+* Gauss-Jordan with partial pivoting, -1 if a is singular
+*******************************************************************************/
+int mat_inverse(const mat_t* a, mat_t* inv){
+	mat_t w = *a;
+	double t;
+	int n = a->n, i, j, k, piv;
+
+	*inv = mat_eye(n);
+	for(k=0;k<n;k++){
+		piv = k;
+		for(i=k+1;i<n;i++) if(fabs(w.a[i][k])>fabs(w.a[piv][k])) piv = i;
+		if(fabs(w.a[piv][k])<1e-300) return -1;
+		for(j=0;j<n;j++){
+			t = w.a[k][j]; w.a[k][j] = w.a[piv][j]; w.a[piv][j] = t;
+			t = inv->a[k][j]; inv->a[k][j] = inv->a[piv][j]; inv->a[piv][j] = t;
+		}
+		t = w.a[k][k];
+		for(j=0;j<n;j++){
+			w.a[k][j] /= t;
+			inv->a[k][j] /= t;
+		}
+		for(i=0;i<n;i++){
+			if(i==k) continue;
+			t = w.a[i][k];
+			for(j=0;j<n;j++){
+				w.a[i][j] -= t*w.a[k][j];
+				inv->a[i][j] -= t*inv->a[k][j];
+			}
+		}
+	}
+	return 0;
+}
+
+/*******************************************************************************
+* mat_t mat_expm(const mat_t* a)
+*
+* matrix exponential by scaling and squaring a truncated Taylor series
+*******************************************************************************/
+mat_t mat_expm(const mat_t* a){
+	mat_t x, term, sum;
+	double norm=0, row;
+	int i, j, s=0;
+
+	for(i=0;i<a->n;i++){
+		row = 0;
+		for(j=0;j<a->m;j++) row += fabs(a->a[i][j]);
+		if(row>norm) norm = row;
+	}
+	while(norm>0.5){
+		norm /= 2;
+		s++;
+	}
+	x = mat_scale(a, ldexp(1.0, -s));
+	sum = mat_eye(a->n);
+	term = mat_eye(a->n);
+	for(i=1;i<=18;i++){
+		term = mat_mul(&term, &x);
+		term = mat_scale(&term, 1.0/i);
+		sum = mat_add(&sum, &term);
+	}
+	for(i=0;i<s;i++) sum = mat_mul(&sum, &sum);
+	return sum;
+}
+
+/*******************************************************************************
+* void c2d_ss(const mat_t* a, const mat_t* b, double T, mat_t* ad, mat_t* bd)
+*
+* exp([A B;0 0]T) holds Ad and Bd in its top block row
+*******************************************************************************/
+void c2d_ss(const mat_t* a, const mat_t* b, double T, mat_t* ad, mat_t* bd){
+	int n = a->n, m = b->m, i, j;
+	mat_t big = mat_zero(n+m, n+m);
+	mat_t e;
+
+	for(i=0;i<n;i++){
+		for(j=0;j<n;j++) big.a[i][j] = a->a[i][j]*T;
+		for(j=0;j<m;j++) big.a[i][n+j] = b->a[i][j]*T;
+	}
+	e = mat_expm(&big);
+	*ad = mat_zero(n, n);
+	*bd = mat_zero(n, m);
+	for(i=0;i<n;i++){
+		for(j=0;j<n;j++) ad->a[i][j] = e.a[i][j];
+		for(j=0;j<m;j++) bd->a[i][j] = e.a[i][n+j];
+	}
+}
+
+/*******************************************************************************
+* static void normalize(poly_t* numd, poly_t* dend)
+*
+* scale so the denominator is monic, matching D1_DEN = {1, ...}
+*******************************************************************************/
+static void normalize(poly_t* numd, poly_t* dend){
+	double lead = dend->c[0];
+	*numd = poly_scale(*numd, 1.0/lead);
+	*dend = poly_scale(*dend, 1.0/lead);
+}
+
+/*******************************************************************************
+* int c2d_tustin(...)
+*
+* Bilinear transform s = k(z-1)/(z+1) with k = 2/T, or w/tan(wT/2) when a
+* prewarp frequency is given so the response matches exactly at w.
+*******************************************************************************/
+int c2d_tustin(poly_t num, poly_t den, double T, double w_prewarp, poly_t* numd, poly_t* dend){
+	poly_t zm1, zp1, term, out[2], src[2];
+	double k;
+	int n, i, j, p;
+
+	num = poly_trim(num);
+	den = poly_trim(den);
+	if(num.deg>den.deg || T<=0) return -1;
+	n = den.deg;
+	if(w_prewarp>0) k = w_prewarp/tan(w_prewarp*T/2);
+	else k = 2.0/T;
+	poly_parse("1 -1", &zm1);
+	poly_parse("1 1", &zp1);
+	src[0] = num;
+	src[1] = den;
+	for(p=0;p<2;p++){
+		out[p] = poly_const(0);
+		for(i=0;i<=src[p].deg;i++){
+			// s^j becomes k^j (z-1)^j (z+1)^(n-j) after clearing (z+1)^n
+			int pw = src[p].deg-i;
+			term = poly_const(src[p].c[i]*pow(k, pw));
+			for(j=0;j<pw;j++) term = poly_mul(term, zm1);
+			for(j=0;j<n-pw;j++) term = poly_mul(term, zp1);
+			out[p] = poly_add(out[p], term);
+		}
+	}
+	*numd = out[0];
+	*dend = out[1];
+	normalize(numd, dend);
+	return 0;
+}
+
+/*******************************************************************************
+* int c2d_zoh(...)
+*
+* Step invariant discretization. Builds the controllable canonical form,
+* discretizes it with c2d_ss and turns it back into a transfer function with
+* the Faddeev-LeVerrier recursion, which gives det(zI-Ad) and adj(zI-Ad)
+* together.
+*******************************************************************************/
+int c2d_zoh(poly_t num, poly_t den, double T, poly_t* numd, poly_t* dend){
+	mat_t a, b, ad, bd, mk, am, tmp;
+	double d0, cpoly[MAX_DIM+1], cn[MAX_DIM], nprime[MAX_DIM];
+	double tr, v;
+	int n, i, j, k;
+
+	num = poly_trim(num);
+	den = poly_trim(den);
+	if(num.deg>den.deg || T<=0 || den.deg>MAX_DIM-1) return -1;
+	n = den.deg;
+	num = poly_scale(num, 1.0/den.c[0]);
+	den = poly_scale(den, 1.0/den.c[0]);
+	if(n==0){
+		*numd = num;
+		*dend = den;
+		return 0;
+	}
+	// direct feedthrough and strictly proper remainder
+	d0 = num.deg==n ? num.c[0] : 0;
+	for(i=0;i<n;i++){
+		int k2 = n-1-i;	// power of s
+		v = (k2<=num.deg) ? num.c[num.deg-k2] : 0;
+		nprime[i] = v - d0*den.c[i+1];
+	}
+	a = mat_zero(n, n);
+	b = mat_zero(n, 1);
+	for(j=0;j<n;j++) a.a[0][j] = -den.c[j+1];
+	for(i=1;i<n;i++) a.a[i][i-1] = 1;
+	b.a[0][0] = 1;
+	c2d_ss(&a, &b, T, &ad, &bd);
+
+	// Faddeev-LeVerrier: M0=I, ck=-tr(Ad*M(k-1))/k, Mk=Ad*M(k-1)+ck*I
+	cpoly[0] = 1;
+	mk = mat_eye(n);
+	for(k=0;k<n;k++){
+		// numerator coefficient of z^(n-1-k) is C*Mk*Bd
+		tmp = mat_mul(&mk, &bd);
+		cn[k] = 0;
+		for(i=0;i<n;i++) cn[k] += nprime[i]*tmp.a[i][0];
+		am = mat_mul(&ad, &mk);
+		tr = 0;
+		for(i=0;i<n;i++) tr += am.a[i][i];
+		cpoly[k+1] = -tr/(k+1);
+		mk = am;
+		for(i=0;i<n;i++) mk.a[i][i] += cpoly[k+1];
+	}
+	memset(dend, 0, sizeof(poly_t));
+	memset(numd, 0, sizeof(poly_t));
+	dend->deg = n;
+	numd->deg = n;
+	for(k=0;k<=n;k++){
+		dend->c[k] = cpoly[k];
+		numd->c[k] = d0*cpoly[k] + (k>0 ? cn[k-1] : 0);
+	}
+	return 0;
+}
+
+/*******************************************************************************
+* poly_t mat_charpoly(const mat_t* a)
+*
+* Faddeev-LeVerrier, as in c2d_zoh()
+*******************************************************************************/
+poly_t mat_charpoly(const mat_t* a){
+	mat_t mk, am;
+	poly_t p;
+	double tr;
+	int n = a->n, i, k;
+
+	memset(&p, 0, sizeof(p));
+	p.deg = n;
+	p.c[0] = 1;
+	mk = mat_eye(n);
+	for(k=0;k<n;k++){
+		am = mat_mul(a, &mk);
+		tr = 0;
+		for(i=0;i<n;i++) tr += am.a[i][i];
+		p.c[k+1] = -tr/(k+1);
+		mk = am;
+		for(i=0;i<n;i++) mk.a[i][i] += p.c[k+1];
+	}
+	return p;
+}
+
+/*******************************************************************************
+* int dlqr(const mat_t* a, const mat_t* b, const mat_t* q, const mat_t* r,
+*						mat_t* k, mat_t* p)
+*
+* Iterates the discrete Riccati difference equation
+*
+*	K = (R + B'PB)^-1 B'PA
+*	P = Q + A'PA - A'PB K
+*
+* from P = Q until P stops changing. The models here are a handful of
+* states, so the plain iteration converges in a few thousand steps and
+* needs nothing but the helpers above. Returns -1 if it doesn't converge,
+* which happens when (A,B) can't be stabilized.
+*******************************************************************************/
+int dlqr(const mat_t* a, const mat_t* b, const mat_t* q, const mat_t* r, mat_t* k, mat_t* p){
+	mat_t at = mat_transpose(a), bt = mat_transpose(b);
+	mat_t pa, pb, s, si, bpa, apb, next;
+	double diff, big;
+	int it, i, j;
+
+	*p = *q;
+	for(it=0;it<100000;it++){
+		pa = mat_mul(p, a);
+		pb = mat_mul(p, b);
+		s = mat_mul(&bt, &pb);
+		s = mat_add(&s, r);
+		if(mat_inverse(&s, &si)) return -1;
+		bpa = mat_mul(&bt, &pa);
+		*k = mat_mul(&si, &bpa);
+		apb = mat_mul(&at, &pb);
+		next = mat_mul(&apb, k);
+		next = mat_scale(&next, -1);
+		pa = mat_mul(&at, &pa);
+		next = mat_add(&next, &pa);
+		next = mat_add(&next, q);
+		diff = big = 0;
+		for(i=0;i<next.n;i++){
+			for(j=0;j<next.m;j++){
+				if(fabs(next.a[i][j]-p->a[i][j])>diff) diff = fabs(next.a[i][j]-p->a[i][j]);
+				if(fabs(next.a[i][j])>big) big = fabs(next.a[i][j]);
+			}
+		}
+		*p = next;
+		if(!(big<1e12)) return -1;
+		if(diff<=1e-12*big) return 0;
+	}
+	return -1;
+}
@@ -0,0 +1,58 @@
+/*******************************************************************************
+* ctrl_math.h
+*
+* Small fixed size polynomial and matrix helpers for the design tool.
+* Polynomials are stored highest power first, the same order as the
+* D1_NUM/D1_DEN arrays in balance_config.h.
+*******************************************************************************/
+
+#ifndef CTRL_MATH_H
+#define CTRL_MATH_H
+
+#define MAX_DEG		12
+#define MAX_DIM		12
+
+typedef struct poly_t{
+	int deg;
+	double c[MAX_DEG+1];	// c[0] multiplies s^deg or z^deg
+}poly_t;
+
+typedef struct mat_t{
+	int n, m;
+	double a[MAX_DIM][MAX_DIM];
+}mat_t;
+
+// polynomials
+poly_t poly_const(double k);
+poly_t poly_mul(poly_t a, poly_t b);
+poly_t poly_add(poly_t a, poly_t b);
+poly_t poly_scale(poly_t a, double k);
+int poly_parse(const char* str, poly_t* p);
+void poly_roots(poly_t p, double* re, double* im);
+// 1 if every root is strictly inside the unit circle (Schur-Cohn test)
+int poly_schur_stable(poly_t p);
+// largest root magnitude
+double poly_spectral_radius(poly_t p);
+
+// matrices
+mat_t mat_zero(int n, int m);
+mat_t mat_eye(int n);
+mat_t mat_mul(const mat_t* a, const mat_t* b);
+mat_t mat_add(const mat_t* a, const mat_t* b);
+mat_t mat_scale(const mat_t* a, double k);
+mat_t mat_transpose(const mat_t* a);
+int mat_inverse(const mat_t* a, mat_t* inv);
+mat_t mat_expm(const mat_t* a);
+
+// continuous to discrete transfer functions at sample time T
+int c2d_tustin(poly_t num, poly_t den, double T, double w_prewarp, poly_t* numd, poly_t* dend);
+int c2d_zoh(poly_t num, poly_t den, double T, poly_t* numd, poly_t* dend);
+// zero order hold discretization of xdot=Ax+Bu
+void c2d_ss(const mat_t* a, const mat_t* b, double T, mat_t* ad, mat_t* bd);
+
+// det(zI-A), highest power first
+poly_t mat_charpoly(const mat_t* a);
+// discrete LQR, u=-Kx minimizing sum x'Qx+u'Ru, P the Riccati solution
+int dlqr(const mat_t* a, const mat_t* b, const mat_t* q, const mat_t* r, mat_t* k, mat_t* p);
+
+#endif	//CTRL_MATH_H
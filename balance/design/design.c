@@ -0,0 +1,376 @@
+/*******************************************************************************
+* design.c
+*
+* Controller redesign tool. Takes a continuous time lead/lag, PID or general
+* transfer function spec, discretizes it (Tustin with optional prewarping, or
+* ZOH), checks the closed loop against a continuous plant discretized with a
+* zero order hold, and writes the result in the balance_config.h format.
+* The lqr type instead solves the discrete Riccati equation for a full state
+* feedback gain on the linearized EduMIP, for make LQR=1.
+*
+*	design -p "num;den" D1 lead K z1 p1 [z2 p2 ...]
+*	design -m zoh -r 20 D2 pid Kp Ki Kd [N]
+*	design -p "num;den" -b < candidates.txt
+*	design LQR lqr Qtheta Qtheta_dot Qphi Qphi_dot R
+*******************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include "ctrl_math.h"
+#include "mip_model.h"
+#include "../balance_config.h"
+
+#define MAX_TOKENS	32
+#define LQR_STATES	MIP_STATES
+#define LQR_GAINS	MIP_MEAS
+#define PID_N_DEFAULT	0.5	// default derivative filter pole, fraction of Nyquist
+
+/*******************************************************************************
+* design_t
+*
+* one candidate controller, continuous spec in, discrete coefficients out
+*******************************************************************************/
+typedef struct design_t{
+	char name[16];
+	double rate_hz;
+	double gain;
+	poly_t num, den;	// continuous, gain pulled out
+	poly_t numd, dend;	// discrete, monic denominator
+	int checked;		// a plant was given
+	int stable;
+	double radius;		// largest closed loop pole magnitude
+	int lqr;		// full state feedback instead of a transfer function
+	double q[LQR_STATES], r;	// LQR weights, diagonal Q
+	double k[LQR_GAINS];	// LQR gain on what balancer() measures
+}design_t;
+
+// options shared by every candidate
+static int use_zoh=0;
+static double w_prewarp=0;
+static double rate_override=0;
+static int have_plant=0;
+static poly_t plant_num, plant_den;
+
+static void print_usage(){
+	printf("\nUsage: design [options] NAME TYPE PARAMS...\n");
+	printf("       design [options] -b < file    one 'NAME TYPE PARAMS' per line\n");
+	printf("TYPE   lead K z1 p1 [z2 p2 ...]   K(s+z1)(s+z2)../((s+p1)(s+p2)..)\n");
+	printf("       pid Kp Ki Kd [N]            Kp + Ki/s + Kd s/(s/N+1)\n");
+	printf("                                   N in rad/s below Nyquist, default half of it\n");
+	printf("       tf NUM DEN                  coefficient lists, highest power first\n");
+	printf("       lqr Qth Qthd Qphi Qphid R    state weights and duty weight\n");
+	printf("-r hz        sample rate, default from NAME (D1 and D3 %d, D2 %d)\n",\
+		SAMPLE_RATE_D1_HZ, SAMPLE_RATE_D2_HZ);
+	printf("-m tustin|zoh  discretization (default tustin)\n");
+	printf("-w rad/s     tustin prewarp frequency (default none)\n");
+	printf("-p \"num;den\" continuous plant for the closed loop stability check\n");
+	printf("-o file      write the header there instead of stdout\n");
+	printf("-b           batch mode, one result line per candidate\n\n");
+}
+
+/*******************************************************************************
+* static double default_rate(const char* name)
+*
+* D3 runs inside balancer() so it shares the D1 rate
+*******************************************************************************/
+static double default_rate(const char* name){
+	if(strcmp(name,"D2")==0) return SAMPLE_RATE_D2_HZ;
+	return SAMPLE_RATE_D1_HZ;
+}
+
+/*******************************************************************************
+* static int parse_spec(int n, char** tok, design_t* d)
+*
+* tok[0] is the name, tok[1] the type, the rest its parameters
+*******************************************************************************/
+static int parse_spec(int n, char** tok, design_t* d){
+	poly_t f;
+	double kp, ki, kd, nf, nyquist;
+	int i;
+
+	if(n<3) return -1;
+	memset(d, 0, sizeof(design_t));
+	strncpy(d->name, tok[0], sizeof(d->name)-1);
+	d->rate_hz = rate_override>0 ? rate_override : default_rate(d->name);
+
+	if(strcmp(tok[1],"lead")==0 || strcmp(tok[1],"lag")==0){
+		if(n<5 || (n-3)%2) return -1;
+		d->gain = atof(tok[2]);
+		d->num = poly_const(1);
+		d->den = poly_const(1);
+		for(i=3;i<n;i+=2){
+			f = poly_const(1);
+			f.deg = 1;
+			f.c[1] = atof(tok[i]);
+			d->num = poly_mul(d->num, f);
+			f.c[1] = atof(tok[i+1]);
+			d->den = poly_mul(d->den, f);
+		}
+	}
+	else if(strcmp(tok[1],"pid")==0){
+		if(n<5) return -1;
+		kp = atof(tok[2]);
+		ki = atof(tok[3]);
+		kd = atof(tok[4]);
+		// the filter pole has to be below Nyquist at this stage's rate
+		nyquist = M_PI*d->rate_hz;
+		nf = n>5 ? atof(tok[5]) : PID_N_DEFAULT*nyquist;
+		if(nf<=0 || nf>=nyquist){
+			fprintf(stderr,"ERROR: N %g rad/s must be above 0 and below Nyquist, %g rad/s at %gHz\n",\
+				nf, nyquist, d->rate_hz);
+			return -1;
+		}
+		d->gain = 1;
+		// (Kp s (s/N+1) + Ki (s/N+1) + Kd s^2) / (s (s/N+1))
+		d->num.deg = 2;
+		d->num.c[0] = kp/nf + kd;
+		d->num.c[1] = kp + ki/nf;
+		d->num.c[2] = ki;
+		d->den.deg = 2;
+		d->den.c[0] = 1.0/nf;
+		d->den.c[1] = 1;
+		d->den.c[2] = 0;
+		if(ki==0 && kd==0){
+			d->num = poly_const(kp);
+			d->den = poly_const(1);
+		}
+	}
+	else if(strcmp(tok[1],"tf")==0){
+		if(n!=4) return -1;
+		d->gain = 1;
+		if(poly_parse(tok[2], &d->num) || poly_parse(tok[3], &d->den)) return -1;
+	}
+	else if(strcmp(tok[1],"lqr")==0){
+		if(n!=3+LQR_STATES) return -1;
+		d->lqr = 1;
+		d->gain = 1;
+		for(i=0;i<LQR_STATES;i++){
+			d->q[i] = atof(tok[2+i]);
+			if(d->q[i]<0) return -1;
+		}
+		d->r = atof(tok[2+LQR_STATES]);
+		if(d->r<=0) return -1;
+	}
+	else return -1;
+	return 0;
+}
+
+/*******************************************************************************
+* static int run_lqr(design_t* d)
+*
+* zero order hold model at the D1 rate and dlqr give u = -K x. balancer()
+* has no phi_dot worth feeding back, so it is rebuilt from what it does have
+* (mip_rate_coefs()), which is linear in (theta, theta_dot, phi, phi', u')
+* and folds into K:
+*
+*	u = -(k0 theta + k1 theta_dot + k2 phi + k3 phi' + k4 u')
+*
+* The radius reported is for that controller on the model, x, phi' and u'.
+*******************************************************************************/
+static int run_lqr(design_t* d){
+	mat_t ad, bd, q, r, k, p, cl;
+	double c[LQR_GAINS];
+	int i, j, n=LQR_STATES;
+
+	mip_model_d(d->rate_hz, &ad, &bd);
+	q = mat_zero(n, n);
+	for(i=0;i<n;i++) q.a[i][i] = d->q[i];
+	r = mat_zero(1, 1);
+	r.a[0][0] = d->r;
+	if(dlqr(&ad, &bd, &q, &r, &k, &p)) return -1;
+
+	if(mip_rate_coefs(&ad, &bd, c)) return -1;
+	for(j=0;j<3;j++) d->k[j] = k.a[0][j] + k.a[0][3]*c[j];
+	d->k[3] = k.a[0][3]*c[3];
+	d->k[4] = k.a[0][3]*c[4];
+
+	// closed loop on (x, phi', u'), the duty row feeds x through Bd
+	cl = mat_zero(n+2, n+2);
+	for(j=0;j<3;j++) cl.a[n+1][j] = -d->k[j];
+	cl.a[n+1][n] = -d->k[3];
+	cl.a[n+1][n+1] = -d->k[4];
+	for(i=0;i<n;i++){
+		for(j=0;j<n+2;j++) cl.a[i][j] = (j<n ? ad.a[i][j] : 0) + bd.a[i][0]*cl.a[n+1][j];
+	}
+	cl.a[n][2] = 1;
+	d->checked = 1;
+	d->radius = poly_spectral_radius(mat_charpoly(&cl));
+	d->stable = d->radius<1;
+	return 0;
+}
+
+/*******************************************************************************
+* static int run_design(design_t* d)
+*
+* discretize and, with a plant, check 1 + C(z)P(z) = 0 for stability
+*******************************************************************************/
+static int run_design(design_t* d){
+	static poly_t pd_num, pd_den;
+	static double pd_rate=0;
+	poly_t cl, a, b;
+	double T = 1.0/d->rate_hz;
+
+	if(d->lqr) return run_lqr(d);
+	if(use_zoh){
+		if(c2d_zoh(d->num, d->den, T, &d->numd, &d->dend)) return -1;
+	}
+	else if(c2d_tustin(d->num, d->den, T, w_prewarp, &d->numd, &d->dend)) return -1;
+
+	if(!have_plant) return 0;
+	// the plant only needs discretizing again when the rate changes
+	if(pd_rate!=d->rate_hz){
+		if(c2d_zoh(plant_num, plant_den, T, &pd_num, &pd_den)) return -1;
+		pd_rate = d->rate_hz;
+	}
+	a = poly_mul(d->dend, pd_den);
+	b = poly_mul(poly_scale(d->numd, d->gain), pd_num);
+	cl = poly_add(a, b);
+	d->checked = 1;
+	d->stable = poly_schur_stable(cl);
+	d->radius = poly_spectral_radius(cl);
+	return 0;
+}
+
+static void print_coefs(FILE* f, poly_t p){
+	int i;
+	fprintf(f, "{");
+	for(i=0;i<=p.deg;i++) fprintf(f, "%s%.6g", i ? ", " : "", p.c[i]);
+	fprintf(f, "}");
+}
+
+/*******************************************************************************
+* static void write_header(FILE* f, design_t* d, const char* spec)
+*
+* same layout as the controller blocks in balance_config.h
+*******************************************************************************/
+static void write_header(FILE* f, design_t* d, const char* spec){
+	int i;
+
+	fprintf(f, "// %s\n", spec);
+	if(d->lqr){
+		fprintf(f, "// dlqr at %gHz on the linearized EduMIP, closed loop %s, max |z| %.4f\n",\
+			d->rate_hz, d->stable ? "stable" : "UNSTABLE", d->radius);
+		fprintf(f, "#define %s_K\t\t{", d->name);
+		for(i=0;i<LQR_GAINS;i++) fprintf(f, "%s%.6g", i ? ", " : "", d->k[i]);
+		fprintf(f, "}\n");
+		return;
+	}
+	fprintf(f, "// %s at %gHz", use_zoh ? "zoh" : "tustin", d->rate_hz);
+	if(!use_zoh && w_prewarp>0) fprintf(f, " prewarped at %g rad/s", w_prewarp);
+	if(d->checked) fprintf(f, ", closed loop %s, max |z| %.4f",\
+				d->stable ? "stable" : "UNSTABLE", d->radius);
+	fprintf(f, "\n#define %s_GAIN\t\t%.6g\n", d->name, d->gain);
+	fprintf(f, "#define %s_NUM\t\t", d->name);
+	print_coefs(f, d->numd);
+	fprintf(f, "\n#define %s_DEN\t\t", d->name);
+	print_coefs(f, d->dend);
+	fprintf(f, "\n");
+
+	// balance.c hard codes the length of each difference equation
+	if((strcmp(d->name,"D1")==0 && d->dend.deg!=2) || \
+	   ((strcmp(d->name,"D2")==0 || strcmp(d->name,"D3")==0) && d->dend.deg!=1)){
+		fprintf(stderr,"WARNING: %s is order %d, balance.c expects %d\n",\
+			d->name, d->dend.deg, strcmp(d->name,"D1")==0 ? 2 : 1);
+	}
+}
+
+/*******************************************************************************
+* static int batch(FILE* in)
+*
+* one candidate per input line, one result line per candidate on stdout
+*******************************************************************************/
+static int batch(FILE* in){
+	char line[1024];
+	char* tok[MAX_TOKENS];
+	design_t d;
+	struct timespec t0, t1;
+	long count=0, stable=0;
+	int n, lineno=0;
+
+	clock_gettime(CLOCK_MONOTONIC, &t0);
+	while(fgets(line, sizeof(line), in)){
+		lineno++;
+		if(line[0]=='#') continue;
+		n = 0;
+		tok[n] = strtok(line, " \t\r\n");
+		while(tok[n]!=NULL && n<MAX_TOKENS-1) tok[++n] = strtok(NULL, " \t\r\n");
+		if(n==0) continue;
+		if(parse_spec(n, tok, &d) || run_design(&d)){
+			fprintf(stderr,"line %d: bad candidate\n", lineno);
+			continue;
+		}
+		count++;
+		stable += d.stable;
+		printf("%d %s %s %.5f %.6g ", lineno, d.name,\
+			d.checked ? (d.stable ? "stable" : "unstable") : "unchecked",\
+			d.radius, d.gain);
+		if(d.lqr){
+			printf("{%.6g, %.6g, %.6g, %.6g, %.6g}\n", d.k[0], d.k[1], d.k[2],\
+				d.k[3], d.k[4]);
+			continue;
+		}
+		print_coefs(stdout, d.numd);
+		printf(" ");
+		print_coefs(stdout, d.dend);
+		printf("\n");
+	}
+	clock_gettime(CLOCK_MONOTONIC, &t1);
+	fprintf(stderr, "%ld candidates, %ld stable, %.3fs\n", count, stable,\
+		(t1.tv_sec-t0.tv_sec)+(t1.tv_nsec-t0.tv_nsec)*1e-9);
+	return 0;
+}
+
+int main(int argc, char* argv[]){
+	design_t d;
+	FILE* out=stdout;
+	char spec[512]="";
+	char* sep;
+	int i, batch_mode=0;
+
+	for(i=1;i<argc && argv[i][0]=='-' && argv[i][1]!='\0' && !(argv[i][1]>='0' && argv[i][1]<='9');i++){
+		if(strcmp(argv[i],"-b")==0) batch_mode=1;
+		else if(i+1<argc && strcmp(argv[i],"-r")==0) rate_override=atof(argv[++i]);
+		else if(i+1<argc && strcmp(argv[i],"-w")==0) w_prewarp=atof(argv[++i]);
+		else if(i+1<argc && strcmp(argv[i],"-m")==0) use_zoh = strcmp(argv[++i],"zoh")==0;
+		else if(i+1<argc && strcmp(argv[i],"-o")==0){
+			out = fopen(argv[++i], "w");
+			if(out==NULL){
+				perror(argv[i]);
+				return -1;
+			}
+		}
+		else if(i+1<argc && strcmp(argv[i],"-p")==0){
+			sep = strchr(argv[++i], ';');
+			if(sep==NULL){
+				print_usage();
+				return -1;
+			}
+			*sep = '\0';
+			if(poly_parse(argv[i], &plant_num) || poly_parse(sep+1, &plant_den)){
+				fprintf(stderr,"ERROR: can't parse plant\n");
+				return -1;
+			}
+			have_plant = 1;
+		}
+		else{
+			print_usage();
+			return -1;
+		}
+	}
+	if(batch_mode) return batch(stdin);
+
+	if(parse_spec(argc-i, &argv[i], &d) || run_design(&d)){
+		print_usage();
+		return -1;
+	}
+	for(;i<argc;i++){
+		strncat(spec, argv[i], sizeof(spec)-strlen(spec)-2);
+		strncat(spec, " ", sizeof(spec)-strlen(spec)-1);
+	}
+	write_header(out, &d, spec);
+	if(out!=stdout) fclose(out);
+	return d.checked && !d.stable;
+}
@@ -0,0 +1,80 @@
+/*******************************************************************************
+* mip_model.c
+*
+* Physical constants are the published EduMIP values ../sim/mip_plant.c
+* integrates, geometry and gearing come from balance_config.h.
+*******************************************************************************/
+
+#include "mip_model.h"
+#include "../balance_config.h"
+
+#define G_ACCEL		9.81
+#define M_BODY		0.263		// kg
+#define M_WHEELS	0.054		// kg, both wheels
+#define L_COM		0.0477		// m, axle to body centre of mass
+#define I_BODY		0.0004		// kg m^2 about the axle
+#define I_WHEELS	3.12e-5		// kg m^2, both wheels
+#define STALL_TORQUE	0.003		// Nm at the motor shaft
+#define FREE_SPEED	1760.0		// rad/s at the motor shaft
+
+/*******************************************************************************
+* void mip_model(mat_t* a, mat_t* b)
+*
+* ../sim/mip_plant.c linearized about upright. Both motors together give
+* tau = ku*u - kw*(phi_dot-theta_dot) and
+*
+*	(a phi'' + b theta'' = tau, b phi'' + c theta'' - mgl theta = -tau)
+*******************************************************************************/
+void mip_model(mat_t* a, mat_t* b){
+	double ma = I_WHEELS + (M_BODY+M_WHEELS)*WHEEL_RADIUS_M*WHEEL_RADIUS_M;
+	double mb = M_BODY*WHEEL_RADIUS_M*L_COM;
+	double mc = I_BODY + M_BODY*L_COM*L_COM;
+	double mgl = M_BODY*G_ACCEL*L_COM;
+	double det = ma*mc - mb*mb;
+	double ku = 2*GEARBOX*STALL_TORQUE;
+	double kw = ku*GEARBOX/FREE_SPEED;
+
+	*a = mat_zero(MIP_STATES, MIP_STATES);
+	*b = mat_zero(MIP_STATES, 1);
+	a->a[0][1] = 1;
+	a->a[1][0] = ma*mgl/det;
+	a->a[1][1] = -(ma+mb)*kw/det;
+	a->a[1][3] = (ma+mb)*kw/det;
+	b->a[1][0] = -(ma+mb)*ku/det;
+	a->a[2][3] = 1;
+	a->a[3][0] = -mb*mgl/det;
+	a->a[3][1] = (mc+mb)*kw/det;
+	a->a[3][3] = -(mc+mb)*kw/det;
+	b->a[3][0] = (mc+mb)*ku/det;
+}
+
+void mip_model_d(double rate_hz, mat_t* ad, mat_t* bd){
+	mat_t a, b;
+	mip_model(&a, &b);
+	c2d_ss(&a, &b, 1.0/rate_hz, ad, bd);
+}
+
+/*******************************************************************************
+* int mip_rate_coefs(const mat_t* ad, const mat_t* bd, double c[MIP_MEAS])
+*
+* balancer() has no phi_dot worth feeding back, the encoder difference lags
+* the wheel by half a tick and the wheel answers the duty within a few
+* milliseconds. Rows 0-2 of x = Ad x' + Bd u' and phi' = x'[2] fix last
+* tick's x', and phi_dot = Ad[3].x' + Bd[3] u', linear in the measurements.
+*******************************************************************************/
+int mip_rate_coefs(const mat_t* ad, const mat_t* bd, double c[MIP_MEAS]){
+	mat_t m, minv;
+	int i, j, n=MIP_STATES;
+
+	m = mat_zero(n, n);
+	for(i=0;i<3;i++) for(j=0;j<n;j++) m.a[i][j] = ad->a[i][j];
+	m.a[3][2] = 1;
+	if(mat_inverse(&m, &minv)) return -1;
+	c[n] = bd->a[3][0];
+	for(j=0;j<n;j++){
+		c[j] = 0;
+		for(i=0;i<n;i++) c[j] += ad->a[3][i]*minv.a[i][j];
+		if(j<3) c[n] -= c[j]*bd->a[j][0];
+	}
+	return 0;
+}
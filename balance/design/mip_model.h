@@ -0,0 +1,24 @@
+/*******************************************************************************
+* mip_model.h
+*
+* The EduMIP linearized about upright and discretized at the D1 rate, with
+* the rebuild of phi_dot from what balancer() measures. Shared by design's
+* lqr type and ../mpcgen.
+*******************************************************************************/
+
+#ifndef MIP_MODEL_H
+#define MIP_MODEL_H
+
+#include "ctrl_math.h"
+
+#define MIP_STATES	4	// theta, theta_dot, phi, phi_dot
+#define MIP_MEAS	5	// theta, theta_dot, phi, and phi and duty of the last tick
+
+// x = [theta theta_dot phi phi_dot], u the duty on both motors at V_NOMINAL
+void mip_model(mat_t* a, mat_t* b);
+// zero order hold at rate_hz
+void mip_model_d(double rate_hz, mat_t* ad, mat_t* bd);
+// phi_dot = c.(theta, theta_dot, phi, phi', u'), -1 if it can't be rebuilt
+int mip_rate_coefs(const mat_t* ad, const mat_t* bd, double c[MIP_MEAS]);
+
+#endif	//MIP_MODEL_H
@@ -0,0 +1,214 @@
+/*******************************************************************************
+* fixed_ctrl.c
+*
+* Fixed point complementary filter and difference equations, see fixed_ctrl.h
+*******************************************************************************/
+
+#include <math.h>
+#include <string.h>
+#include "balance_config.h"
+#include "fixed_ctrl.h"
+#include "ctrl_stage.h"
+
+// filter constants in Q1.31, fixed at compile time from balance_config.h
+#define COMP_WT		FIX_Q(FILTER_W*DT_D1, 31)
+#define COMP_1_WT	FIX_Q(1.0-FILTER_W*DT_D1, 31)
+#define COMP_MOUNT	FIX_Q(MOUNT_ANGLE, FIX_ANGLE_FRAC)
+// deg/s in Q11.20 times this, shifted by 23, is rad per tick in Q3.28
+#define COMP_GYRO_K	FIX_Q(DT_D1*M_PI/180.0, 31)
+#define COMP_GYRO_SHIFT	(31+FIX_SENSOR_FRAC-FIX_ANGLE_FRAC)
+
+#define CORDIC_ITERATIONS	28
+#define CORDIC_LIMIT		(1<<29)	// leaves room for the 1.65 CORDIC gain
+
+// atan(2^-i) in Q3.28
+static const q31_t cordic_atan[CORDIC_ITERATIONS] = {
+	210828714, 124459457, 65760959, 33381290, 16755422, 8385879, 4193963,
+	2097109, 1048571, 524287, 262144, 131072, 65536, 32768, 16384, 8192,
+	4096, 2048, 1024, 512, 256, 128, 64, 32, 16, 8, 4, 2
+};
+
+/*******************************************************************************
+* static int frac_for(double max)
+*
+* most fractional bits a Q31 word can have while still holding +-max
+*******************************************************************************/
+static int frac_for(double max){
+	int int_bits=0;
+	while(int_bits<31 && max>=(double)(1LL<<int_bits)) int_bits++;
+	return 31-int_bits;
+}
+
+/*******************************************************************************
+* int fix_filter_init(fix_filter_t* f, const float* num, const float* den,
+*						int order, float gain)
+*
+* Converts the float coefficients once, the scaling comes from their range
+* and that of the full anti-windup split, so any aw fits later.
+* Returns -1 if the order is more than FIX_ORDER_MAX.
+*******************************************************************************/
+int fix_filter_init(fix_filter_t* f, const float* num, const float* den, int order, float gain){
+	float fa[FIX_ORDER_MAX+1], ta[FIX_ORDER_MAX+1];
+	double max=0;
+	int i;
+
+	if(order<0 || order>FIX_ORDER_MAX || order>CTRL_ORDER_MAX) return -1;
+	memset(f, 0, sizeof(fix_filter_t));
+	ctrl_aw_split(den, order, 1, fa, ta);
+	for(i=0;i<=order;i++) if(fabs(num[i])>max) max = fabs(num[i]);
+	for(i=1;i<=order;i++){
+		if(fabs(den[i])>max) max = fabs(den[i]);
+		if(fabs(fa[i])>max) max = fabs(fa[i]);
+		if(fabs(ta[i])>max) max = fabs(ta[i]);
+	}
+	f->order = order;
+	f->coef_frac = frac_for(max);
+	for(i=0;i<=order;i++) f->num[i] = fix_from_float(num[i], f->coef_frac);
+	fix_filter_set_aw(f, den, 0);
+	f->gain_frac = frac_for(fabs(gain));
+	f->gain = fix_from_float(gain, f->gain_frac);
+	f->min = -INT32_MAX;
+	f->max = INT32_MAX;
+	return 0;
+}
+
+int fix_filter_set_aw(fix_filter_t* f, const float* den, float aw){
+	float fa[FIX_ORDER_MAX+1], ta[FIX_ORDER_MAX+1];
+	int i;
+
+	if(aw<0 || aw>1) return -1;
+	ctrl_aw_split(den, f->order, aw, fa, ta);
+	for(i=0;i<=f->order;i++){
+		f->f[i] = i ? fix_from_float(fa[i], f->coef_frac) : 0;
+		f->t[i] = i ? fix_from_float(ta[i], f->coef_frac) : 0;
+	}
+	return 0;
+}
+
+void fix_filter_reset(fix_filter_t* f){
+	memset(f->in, 0, sizeof(f->in));
+	memset(f->out, 0, sizeof(f->out));
+	memset(f->lim, 0, sizeof(f->lim));
+	f->sat = 0;
+}
+
+/*******************************************************************************
+* q31_t fix_filter_step(fix_filter_t* f, q31_t x, q31_t scale)
+*
+* y = scale*gain*(num.in - f.out - t.lim), the same order as the float
+* code. Each product is rounded back to the signal format before summing so
+* the 64 bit accumulator can't overflow, then the sum saturates to 32 bits.
+* The limit follows ctrl_stage_step().
+*******************************************************************************/
+q31_t fix_filter_step(fix_filter_t* f, q31_t x, q31_t scale){
+	int64_t acc=0;
+	q31_t y, lim;
+	int i;
+
+	for(i=f->order;i>0;i--) f->in[i] = f->in[i-1];
+	f->in[0] = x;
+	for(i=0;i<=f->order;i++){
+		acc += fix_round_shift((int64_t)f->num[i]*f->in[i], f->coef_frac);
+	}
+	for(i=1;i<=f->order;i++){
+		acc -= fix_round_shift((int64_t)f->f[i]*f->out[i-1], f->coef_frac);
+		acc -= fix_round_shift((int64_t)f->t[i]*f->lim[i-1], f->coef_frac);
+	}
+	y = fix_mul(fix_sat(acc), f->gain, f->gain_frac);
+	y = fix_mul(y, scale, FIX_SCALE_FRAC);
+	if(y>f->max){
+		lim = f->max;
+		f->sat = 1;
+	}
+	else if(y<f->min){
+		lim = f->min;
+		f->sat = -1;
+	}
+	else{
+		lim = y;
+		f->sat = 0;
+	}
+	for(i=f->order-1;i>0;i--){
+		f->out[i] = f->out[i-1];
+		f->lim[i] = f->lim[i-1];
+	}
+	if(f->order>0){
+		f->out[0] = y;
+		f->lim[0] = lim;
+	}
+	return lim;
+}
+
+/*******************************************************************************
+* q31_t fix_atan2(q31_t y, q31_t x)
+*
+* CORDIC in vectoring mode. The vector is first scaled to just under
+* CORDIC_LIMIT, so a short one keeps its bits, and turned into the right
+* half plane, then rotated onto the x axis by +-atan(2^-i) steps using only
+* shifts and adds, in 32 bit arithmetic. Good to 3e-8 rad at any length.
+*******************************************************************************/
+q31_t fix_atan2(q31_t y, q31_t x){
+	int64_t x64=x, y64=y;
+	int32_t xx, yy, t;
+	q31_t angle=0;
+	int i;
+
+	if(x64==0 && y64==0) return 0;
+	while(x64>=CORDIC_LIMIT || x64<=-CORDIC_LIMIT || y64>=CORDIC_LIMIT || y64<=-CORDIC_LIMIT){
+		x64 >>= 1;
+		y64 >>= 1;
+	}
+	// and a short vector up to it, the shifted out bits would lose the angle
+	while(x64<CORDIC_LIMIT/2 && x64>-CORDIC_LIMIT/2 && y64<CORDIC_LIMIT/2 && y64>-CORDIC_LIMIT/2){
+		x64 <<= 1;
+		y64 <<= 1;
+	}
+	// below CORDIC_LIMIT the rotations stay inside 32 bits
+	xx = (int32_t)x64;
+	yy = (int32_t)y64;
+	if(xx<0){
+		angle = yy>=0 ? FIX_Q(M_PI, FIX_ANGLE_FRAC) : -FIX_Q(M_PI, FIX_ANGLE_FRAC);
+		xx = -xx;
+		yy = -yy;
+	}
+	for(i=0;i<CORDIC_ITERATIONS;i++){
+		t = xx;
+		if(yy>0){
+			xx += yy>>i;
+			yy -= t>>i;
+			angle += cordic_atan[i];
+		}
+		else{
+			xx -= yy>>i;
+			yy += t>>i;
+			angle -= cordic_atan[i];
+		}
+	}
+	return angle;
+}
+
+void fix_comp_init(fix_comp_t* c){
+	memset(c, 0, sizeof(fix_comp_t));
+	c->mount = COMP_MOUNT;
+}
+
+/*******************************************************************************
+* q31_t fix_comp_step(fix_comp_t* c, q31_t accel_y, q31_t accel_z, q31_t gyro_x)
+*
+* same filter as balancer(), low pass on the accelerometer angle (from the
+* previous tick, as in the float code) plus high pass on the integrated gyro
+*******************************************************************************/
+q31_t fix_comp_step(fix_comp_t* c, q31_t accel_y, q31_t accel_z, q31_t gyro_x){
+	q31_t a_raw, step;
+
+	a_raw = fix_atan2(fix_sub(0, accel_z), accel_y);
+	step = fix_mul(gyro_x, COMP_GYRO_K, COMP_GYRO_SHIFT);
+	c->g_raw = (q31_t)((uint32_t)c->g_raw + (uint32_t)step);
+
+	c->theta_a = fix_add(fix_mul(c->last_a_raw, COMP_WT, 31), fix_mul(c->theta_a, COMP_1_WT, 31));
+	c->theta_g = fix_add(fix_mul(c->theta_g, COMP_1_WT, 31),\
+			(q31_t)((uint32_t)c->g_raw - (uint32_t)c->last_g_raw));
+	c->last_a_raw = a_raw;
+	c->last_g_raw = c->g_raw;
+	return fix_add(fix_add(c->theta_a, c->theta_g), c->mount);
+}
@@ -0,0 +1,76 @@
+/*******************************************************************************
+* fixed_ctrl.h
+*
+* Fixed point versions of the complementary filter and the D1/D2/D3 difference
+* equations used by balance.c when built with USE_FIXED_POINT (make FIXED=1).
+* Both follow the float code step for step, including where the filter gain
+* and soft start are applied, the output limits and the anti-windup of
+* ctrl_stage.h, so the two builds balance the same way.
+*******************************************************************************/
+
+#ifndef FIXED_CTRL_H
+#define FIXED_CTRL_H
+
+#include "fixed_point.h"
+
+#define FIX_ORDER_MAX	2
+
+/*******************************************************************************
+* fix_filter_t
+*
+* One difference equation with a monic denominator. The input and output
+* share one signal format, the coefficients get as many fractional bits as
+* the largest of them leaves room for, and so does the gain. The denominator
+* is kept split as in ctrl_stage.h, f on the raw outputs and t on the limited
+* ones. Unlimited with no anti-windup until fix_filter_set_aw() and
+* fix_filter_set_limits().
+*******************************************************************************/
+typedef struct fix_filter_t{
+	int order;
+	int coef_frac;
+	int gain_frac;
+	q31_t num[FIX_ORDER_MAX+1];
+	q31_t f[FIX_ORDER_MAX+1];	// f[0] and t[0] unused
+	q31_t t[FIX_ORDER_MAX+1];
+	q31_t gain;
+	q31_t in[FIX_ORDER_MAX+1];	// newest first
+	q31_t out[FIX_ORDER_MAX];	// raw outputs
+	q31_t lim[FIX_ORDER_MAX];	// limited outputs
+	q31_t min, max;			// signal format
+	int sat;			// -1 on min, +1 on max, 0 inside
+}fix_filter_t;
+
+/*******************************************************************************
+* fix_comp_t
+*
+* Complementary filter state, all angles Q3.28. The integrated gyro angle is
+* allowed to wrap since only its change from one tick to the next is used.
+*******************************************************************************/
+typedef struct fix_comp_t{
+	q31_t theta_a, theta_g;		// filtered accel and gyro angles
+	q31_t last_a_raw, last_g_raw;
+	q31_t g_raw;
+	q31_t mount;			// added to the output, MOUNT_ANGLE after init
+}fix_comp_t;
+
+int fix_filter_init(fix_filter_t* f, const float* num, const float* den, int order, float gain);
+void fix_filter_reset(fix_filter_t* f);
+// den as given to fix_filter_init(), -1 unless 0 <= aw <= 1, see ctrl_stage.h
+int fix_filter_set_aw(fix_filter_t* f, const float* den, float aw);
+// scale is Q1.30 and multiplies the output before it is limited and stored,
+// like soft_start. Returns the limited output.
+q31_t fix_filter_step(fix_filter_t* f, q31_t x, q31_t scale);
+
+static inline void fix_filter_set_limits(fix_filter_t* f, q31_t min, q31_t max){
+	f->min = min;
+	f->max = max;
+}
+
+void fix_comp_init(fix_comp_t* c);
+// accel in m/s^2 and gyro in deg/s as Q11.20, returns theta Q3.28
+q31_t fix_comp_step(fix_comp_t* c, q31_t accel_y, q31_t accel_z, q31_t gyro_x);
+
+// angle of (x,y) in Q3.28 radians, any common input format
+q31_t fix_atan2(q31_t y, q31_t x);
+
+#endif	//FIXED_CTRL_H
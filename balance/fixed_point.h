@@ -0,0 +1,66 @@
+/*******************************************************************************
+* fixed_point.h
+*
+* Saturating 32 bit fixed point helpers for the USE_FIXED_POINT build.
+* A value in format Q<frac> is stored as round(x*2^frac) in an int32_t. Every
+* operation rounds and clips to the int32_t range instead of wrapping, so an
+* out of range controller output pins at full scale like the float path
+* would clip it at the motor.
+*******************************************************************************/
+
+#ifndef FIXED_POINT_H
+#define FIXED_POINT_H
+
+#include <stdint.h>
+
+typedef int32_t q31_t;
+
+#define FIX_ANGLE_FRAC	28	// Q3.28 body angle, angle errors and duty, +-8
+#define FIX_WHEEL_FRAC	20	// Q11.20 wheel angles, phi and gamma, +-2048 rad
+#define FIX_SENSOR_FRAC	20	// Q11.20 accel in m/s^2 and gyro in deg/s
+#define FIX_SCALE_FRAC	30	// Q1.30 soft start and battery scale, 1.0 is exact
+
+// constant to fixed point, folds at compile time when x is a constant
+#define FIX_Q(x,frac)	((q31_t)((x)*(double)(1LL<<(frac)) + ((x)>=0 ? 0.5 : -0.5)))
+// fixed point to float, for telemetry and the motor calls only
+#define FIX_FLOAT(q,frac)	((float)(q)*(1.0f/(float)(1LL<<(frac))))
+
+static inline q31_t fix_sat(int64_t x){
+	if(x>INT32_MAX) return INT32_MAX;
+	if(x<INT32_MIN) return INT32_MIN;
+	return (q31_t)x;
+}
+
+// shift right by s rounding to nearest, s may be 0
+static inline int64_t fix_round_shift(int64_t x, int s){
+	return s>0 ? (x + (1LL<<(s-1))) >> s : x;
+}
+
+static inline q31_t fix_add(q31_t a, q31_t b){
+	return fix_sat((int64_t)a + b);
+}
+
+static inline q31_t fix_sub(q31_t a, q31_t b){
+	return fix_sat((int64_t)a - b);
+}
+
+// a*b with the result in a's format when b has frac fractional bits
+static inline q31_t fix_mul(q31_t a, q31_t b, int frac){
+	return fix_sat(fix_round_shift((int64_t)a*b, frac));
+}
+
+// move between formats, left shifts saturate
+static inline q31_t fix_convert(q31_t x, int from, int to){
+	if(to>=from) return fix_sat((int64_t)x << (to-from));
+	return (q31_t)fix_round_shift(x, from-to);
+}
+
+// runtime float input, saturates instead of overflowing
+static inline q31_t fix_from_float(float x, int frac){
+	float s = x*(float)(1LL<<frac);
+	if(s>=2147483647.0f) return INT32_MAX;
+	if(s<=-2147483648.0f) return INT32_MIN;
+	return (q31_t)(s>=0 ? s+0.5f : s-0.5f);
+}
+
+#endif	//FIXED_POINT_H
@@ -0,0 +1,178 @@
+/*******************************************************************************
+* flight.c
+*
+* Prints a flight recorder dump or log from balance (see ../flight_recorder.h)
+* as whitespace separated text, one D1 tick per row, ready for gnuplot or
+* ../sysid. Time is in seconds relative to the event that caused the dump,
+* or to the start of a log.
+*
+*	flight /var/log/balance/flight_20261019_101500_tip.bin
+*	flight -c dump.bin > dump.csv
+*	flight -i dump.bin		header only
+*	flight -s 60 -e 70 log.frz	ten seconds out of a long log
+*******************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "../flight_recorder.h"
+#include "../fr_codec.h"
+
+static const char* reason_names[] = {"?", "tip", "saturation", "signal"};
+static const char* sep=" ";
+static double t_start=-1e300, t_end=1e300;
+
+static void print_usage(){
+	printf("\nUsage: flight [options] dump.bin|log.frz\n");
+	printf("-c    comma separated instead of whitespace\n");
+	printf("-i    print the header only, and the size of a log\n");
+	printf("-s t  start at t seconds\n");
+	printf("-e t  end at t seconds\n\n");
+}
+
+static const char* reason_name(uint32_t r){
+	if(r>=sizeof(reason_names)/sizeof(reason_names[0])) return "?";
+	return reason_names[r];
+}
+
+static void print_columns(){
+	printf("# t%stick%src_state%scontrol%sax%say%saz%sgx%sgy%sgz%stheta%stheta_a%stheta_g"\
+		"%swheel_l%swheel_r%sphi%sgamma%stheta_ref%sphi_ref%sgamma_ref%sd1%sd2%sd3%svbatt%ssat\n",\
+		sep,sep,sep,sep,sep,sep,sep,sep,sep,sep,sep,sep,sep,sep,sep,sep,sep,sep,sep,sep,sep,sep,sep,sep);
+}
+
+static void print_record(const fr_record_t* r, uint64_t t0_ns){
+	double t = ((double)r->t_ns-(double)t0_ns)*1e-9;
+
+	if(t<t_start || t>t_end) return;
+	printf("%.4f%s%u%s%d%s%d", t, sep, r->tick, sep, r->rc_state, sep, r->control_state);
+	printf("%s%.4f%s%.4f%s%.4f%s%.3f%s%.3f%s%.3f", sep, r->accel[0], sep, r->accel[1],\
+		sep, r->accel[2], sep, r->gyro[0], sep, r->gyro[1], sep, r->gyro[2]);
+	printf("%s%.5f%s%.5f%s%.5f%s%.4f%s%.4f%s%.4f%s%.4f", sep, r->theta, sep, r->theta_a,\
+		sep, r->theta_g, sep, r->wheel_angle_l, sep, r->wheel_angle_r, sep, r->phi,\
+		sep, r->gamma);
+	printf("%s%.5f%s%.4f%s%.4f%s%.4f%s%.4f%s%.4f%s%.3f%s%u\n", sep, r->theta_ref, sep,\
+		r->phi_ref, sep, r->gamma_ref, sep, r->d1_out, sep, r->d2_out, sep, r->d3_out,\
+		sep, r->v_batt, sep, r->saturated);
+}
+
+/*******************************************************************************
+* static int print_log(FILE* f, const char* path, int info)
+*
+* Blocks that end before -s are skipped by their header, reading stops at
+* the first block that starts after -e. Damaged blocks and ticks the log
+* thread missed are reported on stderr and the rest still prints.
+*******************************************************************************/
+static int print_log(FILE* f, const char* path, int info){
+	static uint8_t buf[FR_CODEC_MAX_BYTES];
+	static fr_record_t rec[FR_CODEC_BLOCK];
+	fr_log_header_t hdr;
+	fr_block_t blk;
+	unsigned long long ticks=0, lost=0, blocks=0, damaged=0;
+	long bytes;
+	int i, n, decoded;
+
+	if(fread(&hdr, sizeof(hdr), 1, f)!=1){
+		fprintf(stderr,"ERROR: %s ends inside the log header\n", path);
+		return -1;
+	}
+	if(fr_codec_check(&hdr)){
+		fprintf(stderr,"ERROR: %s is a log of version %u codec %u, expected %u codec %u\n",\
+			path, hdr.version, hdr.codec, FR_VERSION, FR_CODEC_VERSION);
+		return -1;
+	}
+	if(!info) print_columns();
+	while(fr_log_next(f, &blk)){
+		decoded = 0;
+		if(info || blk.t_last_ns<hdr.t_ns || (double)(blk.t_last_ns-hdr.t_ns)*1e-9<t_start){
+			fr_log_skip(f, &blk);
+			n = blk.count;
+		}
+		else if((double)(blk.t_ns-hdr.t_ns)*1e-9>t_end) break;
+		else if((n=fr_log_decode(f, &hdr, &blk, buf, rec))<0){
+			damaged++;
+			continue;
+		}
+		else decoded = 1;
+		blocks++;
+		ticks += n;
+		lost += blk.lost;
+		if(blk.lost && !info) fprintf(stderr,"WARNING: %u ticks lost before tick %u\n",\
+						blk.lost, blk.tick);
+		if(decoded) for(i=0;i<n;i++) print_record(&rec[i], hdr.t_ns);
+	}
+	if(damaged) fprintf(stderr,"WARNING: %s has %llu damaged blocks\n", path, damaged);
+	if(info){
+		bytes = ftell(f);
+		printf("# log, %llu ticks in %llu blocks, %llu lost, %ld bytes, %.1f:1\n",\
+			ticks, blocks, lost, bytes, bytes>0 ? (double)ticks*sizeof(fr_record_t)/bytes : 0);
+	}
+	return 0;
+}
+
+int main(int argc, char* argv[]){
+	const char* path=NULL;
+	fr_header_t hdr;
+	fr_record_t r;
+	FILE* f;
+	uint32_t i;
+	int a, info=0, ret;
+
+	for(a=1;a<argc;a++){
+		if(strcmp(argv[a],"-c")==0) sep=",";
+		else if(strcmp(argv[a],"-i")==0) info=1;
+		else if(a+1<argc && strcmp(argv[a],"-s")==0) t_start=atof(argv[++a]);
+		else if(a+1<argc && strcmp(argv[a],"-e")==0) t_end=atof(argv[++a]);
+		else if(argv[a][0]!='-' && path==NULL) path=argv[a];
+		else{
+			print_usage();
+			return -1;
+		}
+	}
+	if(path==NULL){
+		print_usage();
+		return -1;
+	}
+	f = fopen(path, "rb");
+	if(f==NULL){
+		perror(path);
+		return -1;
+	}
+	if(fread(&hdr.magic, sizeof(hdr.magic), 1, f)==1 && hdr.magic==FR_LOG_MAGIC){
+		rewind(f);
+		ret = print_log(f, path, info);
+		fclose(f);
+		return ret;
+	}
+	rewind(f);
+	if(fread(&hdr, sizeof(hdr), 1, f)!=1 || hdr.magic!=FR_MAGIC){
+		fprintf(stderr,"ERROR: %s is not a flight recorder dump\n", path);
+		fclose(f);
+		return -1;
+	}
+	if(hdr.version!=FR_VERSION || hdr.record_size!=sizeof(fr_record_t)){
+		fprintf(stderr,"ERROR: %s has version %u record size %u, expected %u size %u\n",\
+			path, hdr.version, hdr.record_size, FR_VERSION, (unsigned)sizeof(fr_record_t));
+		fclose(f);
+		return -1;
+	}
+
+	printf("# %s, %u ticks", reason_name(hdr.reason), hdr.count);
+	if(hdr.reason==FR_SIGNAL) printf(", signal %u", hdr.signal);
+	printf("\n");
+	if(info){
+		fclose(f);
+		return 0;
+	}
+	print_columns();
+	for(i=0;i<hdr.count;i++){
+		if(fread(&r, sizeof(r), 1, f)!=1){
+			fprintf(stderr,"ERROR: %s ends after %u of %u ticks\n", path, i, hdr.count);
+			fclose(f);
+			return -1;
+		}
+		print_record(&r, hdr.t_ns);
+	}
+	fclose(f);
+	return 0;
+}
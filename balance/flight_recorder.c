@@ -0,0 +1,387 @@
+/*******************************************************************************
+* flight_recorder.c
+*
+* Ring, dump thread and signal path behind flight_recorder.h
+*******************************************************************************/
+
+#include <stdio.h>
+#include <string.h>
+#include <signal.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <semaphore.h>
+#include <stdatomic.h>
+#include <sys/stat.h>
+#include "balance_config.h"
+#include "flight_recorder.h"
+#include "fr_codec.h"
+
+#define FR_MASK		(FR_RING_SIZE-1)
+#define FR_WINDOW	((uint64_t)((FLIGHT_RECORDER_S+FLIGHT_RECORDER_POST_S)*SAMPLE_RATE_D1_HZ))
+#define FR_POST		((uint64_t)(FLIGHT_RECORDER_POST_S*SAMPLE_RATE_D1_HZ))
+#if FR_CODEC_BLOCK*2>FR_RING_SIZE
+#error "the flight log needs a ring of at least two FR_CODEC_BLOCKs"
+#endif
+
+static fr_record_t ring[FR_RING_SIZE];
+static fr_record_t snap[FR_RING_SIZE];	// dump thread's copy of the window
+static _Atomic uint64_t head=0;		// records written so far
+static _Atomic int pending=0;		// fr_reason_t waiting for the thread
+static _Atomic uint64_t trig_head, trig_t_ns;
+static _Atomic int running=0;
+static volatile int stopping=0;
+static sem_t wake;
+static pthread_t thread;
+static char dir_path[200];
+static char crash_path[256];
+static struct sigaction old_term, old_segv, old_bus;
+static volatile sig_atomic_t dumping=0;
+static const char* reason_names[] = {"", "tip", "saturation", "signal"};
+// continuous log, see fr_log_start()
+static _Atomic int logging=0;		// balancer() wakes the log thread
+static int log_running=0;		// the log thread exists, main thread only
+static sem_t log_wake;
+static pthread_t log_thread_id;
+static FILE* log_file=NULL;
+static char log_path[512];
+static uint64_t log_next;		// first record not logged yet
+static uint64_t log_lost, log_pending_lost, log_records, log_bytes;
+static fr_record_t log_block[FR_CODEC_BLOCK];
+static uint8_t log_buf[FR_CODEC_MAX_BYTES];
+
+static uint64_t now_ns(){
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec*1000000000ULL + ts.tv_nsec;
+}
+
+void fr_record(const fr_record_t* r){
+	uint64_t h = atomic_load_explicit(&head, memory_order_relaxed);
+	ring[h & FR_MASK] = *r;
+	atomic_store_explicit(&head, h+1, memory_order_release);
+	if(((h+1) & (FR_CODEC_BLOCK-1))==0 && atomic_load_explicit(&logging, memory_order_relaxed)){
+		sem_post(&log_wake);
+	}
+}
+
+void fr_trigger(fr_reason_t reason){
+	if(!atomic_load_explicit(&running, memory_order_acquire)) return;
+	atomic_store_explicit(&trig_head, atomic_load_explicit(&head, memory_order_acquire),\
+				memory_order_relaxed);
+	atomic_store_explicit(&trig_t_ns, now_ns(), memory_order_relaxed);
+	atomic_store_explicit(&pending, reason, memory_order_release);
+	sem_post(&wake);
+}
+
+static void fill_header(fr_header_t* hdr, uint32_t count, uint32_t reason, uint32_t sig,\
+							uint64_t t_ns){
+	memset(hdr, 0, sizeof(fr_header_t));
+	hdr->magic = FR_MAGIC;
+	hdr->version = FR_VERSION;
+	hdr->record_size = sizeof(fr_record_t);
+	hdr->count = count;
+	hdr->reason = reason;
+	hdr->signal = sig;
+	hdr->t_ns = t_ns;
+}
+
+/*******************************************************************************
+* static int dump_window(int reason, uint64_t end, uint64_t t_ns)
+*
+* Copy the window ending at record end, then drop any record at the old end
+* that balancer() overwrote while it was being copied.
+*******************************************************************************/
+static int dump_window(int reason, uint64_t end, uint64_t t_ns){
+	char path[512], date[32];
+	fr_header_t hdr;
+	uint64_t h, start, i, skip=0;
+	time_t now;
+	FILE* f;
+
+	h = atomic_load_explicit(&head, memory_order_acquire);
+	if(end>h) end = h;
+	start = end>FR_WINDOW ? end-FR_WINDOW : 0;
+	for(i=start;i<end;i++) snap[i-start] = ring[i & FR_MASK];
+	h = atomic_load_explicit(&head, memory_order_acquire);
+	if(h+1>start+FR_RING_SIZE) skip = h+1-FR_RING_SIZE-start;
+	if(skip>end-start) skip = end-start;
+
+	now = time(NULL);
+	strftime(date, sizeof(date), "%Y%m%d_%H%M%S", localtime(&now));
+	snprintf(path, sizeof(path), "%s/flight_%s_%s.bin", dir_path, date, reason_names[reason]);
+	f = fopen(path, "w");
+	if(f==NULL){
+		perror(path);
+		return -1;
+	}
+	fill_header(&hdr, end-start-skip, reason, 0, t_ns);
+	fwrite(&hdr, sizeof(hdr), 1, f);
+	fwrite(&snap[skip], sizeof(fr_record_t), end-start-skip, f);
+	fclose(f);
+	printf("flight recorder: %s\n", path);
+	return 0;
+}
+
+static void* dump_thread(void* arg){
+	uint64_t end;
+	int reason;
+
+	while(1){
+		sem_wait(&wake);
+		reason = atomic_exchange_explicit(&pending, 0, memory_order_acquire);
+		if(reason){
+			// let the fall or the stall play out before copying
+			end = atomic_load_explicit(&trig_head, memory_order_relaxed) + FR_POST;
+			while(!stopping && atomic_load_explicit(&head, memory_order_acquire)<end){
+				usleep(10000);
+			}
+			dump_window(reason, end, atomic_load_explicit(&trig_t_ns, memory_order_relaxed));
+		}
+		if(stopping) break;
+	}
+	return NULL;
+}
+
+/*******************************************************************************
+* static int log_block_out(uint64_t end)
+*
+* Encode and write the records from log_next up to end, one block at most.
+* Like dump_window() the copy drops what balancer() may have overwritten,
+* those and any the ring lost before are carried into the block's lost
+* count. Returns -1 if the write failed.
+*******************************************************************************/
+static int log_block_out(uint64_t end){
+	uint64_t h, start=log_next, skip=0;
+	int n, bytes;
+
+	h = atomic_load_explicit(&head, memory_order_acquire);
+	if(h+1>start+FR_RING_SIZE){
+		log_pending_lost += h+1-FR_RING_SIZE-start;
+		start = h+1-FR_RING_SIZE;
+	}
+	if(end<start) end = start;
+	if(end>start+FR_CODEC_BLOCK) end = start+FR_CODEC_BLOCK;
+	for(h=start;h<end;h++) log_block[h-start] = ring[h & FR_MASK];
+	h = atomic_load_explicit(&head, memory_order_acquire);
+	if(h+1>start+FR_RING_SIZE) skip = h+1-FR_RING_SIZE-start;
+	if(skip>end-start) skip = end-start;
+	log_pending_lost += skip;
+	log_next = end;
+	n = end-start-skip;
+	if(n==0) return 0;
+	bytes = fr_codec_encode(&log_block[skip], n, log_pending_lost, log_buf);
+	if(fwrite(log_buf, 1, bytes, log_file)!=(size_t)bytes || fflush(log_file)){
+		perror(log_path);
+		return -1;
+	}
+	log_lost += log_pending_lost;
+	log_pending_lost = 0;
+	log_records += n;
+	log_bytes += bytes;
+	return 0;
+}
+
+static void* log_thread(void* arg){
+	uint64_t h;
+	int stop;
+
+	while(1){
+		sem_wait(&log_wake);
+		stop = !atomic_load_explicit(&logging, memory_order_acquire);
+		h = atomic_load_explicit(&head, memory_order_acquire);
+		while(h-log_next>=FR_CODEC_BLOCK || (stop && log_next<h)){
+			if(log_block_out(stop ? h : log_next+FR_CODEC_BLOCK)){
+				atomic_store_explicit(&logging, 0, memory_order_relaxed);
+				return NULL;
+			}
+		}
+		if(stop) break;
+	}
+	return NULL;
+}
+
+int fr_log_start(){
+	char date[32];
+	fr_log_header_t hdr;
+	time_t now;
+
+	if(log_running) return 0;
+	if(!atomic_load_explicit(&running, memory_order_acquire)){
+		fprintf(stderr,"ERROR: the flight log needs fr_init()\n");
+		return -1;
+	}
+	now = time(NULL);
+	strftime(date, sizeof(date), "%Y%m%d_%H%M%S", localtime(&now));
+	snprintf(log_path, sizeof(log_path), "%s/log_%s_%d.frz", dir_path, date, (int)getpid());
+	log_file = fopen(log_path, "w");
+	if(log_file==NULL){
+		perror(log_path);
+		return -1;
+	}
+	fr_codec_header(&hdr, now_ns());
+	if(fwrite(&hdr, sizeof(hdr), 1, log_file)!=1){
+		perror(log_path);
+		fclose(log_file);
+		return -1;
+	}
+	log_next = atomic_load_explicit(&head, memory_order_acquire);
+	log_lost = log_pending_lost = log_records = 0;
+	log_bytes = sizeof(hdr);
+	atomic_store_explicit(&logging, 1, memory_order_release);
+	if(pthread_create(&log_thread_id, NULL, log_thread, NULL)){
+		perror("flight log thread");
+		atomic_store_explicit(&logging, 0, memory_order_release);
+		fclose(log_file);
+		return -1;
+	}
+	log_running = 1;
+	printf("flight log: %s\n", log_path);
+	return 0;
+}
+
+void fr_log_stop(){
+	if(!log_running) return;
+	atomic_store_explicit(&logging, 0, memory_order_release);
+	sem_post(&log_wake);
+	pthread_join(log_thread_id, NULL);
+	fclose(log_file);
+	log_running = 0;
+	printf("flight log: %llu ticks in %llu bytes, %.1f:1, %llu lost\n",\
+		(unsigned long long)log_records, (unsigned long long)log_bytes,\
+		log_bytes ? (double)log_records*sizeof(fr_record_t)/log_bytes : 0,\
+		(unsigned long long)(log_lost+log_pending_lost));
+}
+
+int fr_log_running(){
+	return log_running;
+}
+
+int fr_latest(fr_record_t* out, int n){
+	uint64_t h = atomic_load_explicit(&head, memory_order_acquire);
+	int i;
+
+	if((uint64_t)n>h) n = h;
+	if(n>FR_RING_SIZE) n = FR_RING_SIZE;
+	for(i=0;i<n;i++) out[i] = ring[(h-n+i) & FR_MASK];
+	return n;
+}
+
+/*******************************************************************************
+* static void dump_signal(int sig)
+*
+* Only async signal safe calls from here on. The whole ring goes out in at
+* most two writes, the newest record may be torn if balancer() was in the
+* middle of it on another thread.
+*******************************************************************************/
+static void dump_signal(int sig){
+	fr_header_t hdr;
+	struct timespec ts;
+	uint64_t h, n, first;
+	int fd;
+
+	if(dumping) return;
+	dumping = 1;
+	fd = open(crash_path, O_WRONLY|O_CREAT|O_TRUNC, 0644);
+	if(fd<0) return;
+	h = atomic_load_explicit(&head, memory_order_acquire);
+	n = h<FR_RING_SIZE ? h : FR_RING_SIZE;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	fill_header(&hdr, n, FR_SIGNAL, sig, (uint64_t)ts.tv_sec*1000000000ULL + ts.tv_nsec);
+	if(write(fd, &hdr, sizeof(hdr))<0) goto done;
+	first = (h-n) & FR_MASK;
+	if(first+n<=FR_RING_SIZE){
+		if(write(fd, &ring[first], n*sizeof(fr_record_t))<0) goto done;
+	}
+	else{
+		if(write(fd, &ring[first], (FR_RING_SIZE-first)*sizeof(fr_record_t))<0) goto done;
+		if(write(fd, &ring[0], (first+n-FR_RING_SIZE)*sizeof(fr_record_t))<0) goto done;
+	}
+done:
+	close(fd);
+}
+
+/*******************************************************************************
+* static void on_signal(int sig, siginfo_t* info, void* ctx)
+*
+* Dump, then hand SIGTERM on to the cape library's handler so balance still
+* shuts down cleanly. Faults go back to the default action and are raised
+* again so the core dump and exit status are unchanged.
+*******************************************************************************/
+static void on_signal(int sig, siginfo_t* info, void* ctx){
+	struct sigaction* old;
+
+	dump_signal(sig);
+	old = sig==SIGTERM ? &old_term : (sig==SIGSEGV ? &old_segv : &old_bus);
+	if(old->sa_flags & SA_SIGINFO){
+		old->sa_sigaction(sig, info, ctx);
+		return;
+	}
+	if(old->sa_handler==SIG_IGN) return;
+	if(old->sa_handler!=SIG_DFL){
+		old->sa_handler(sig);
+		return;
+	}
+	signal(sig, SIG_DFL);
+	raise(sig);
+}
+
+/*******************************************************************************
+* int fr_init(const char* dir)
+*
+* Recording works without this, only the dumps need it. Returns -1 if the
+* directory can't be made or the thread won't start.
+*******************************************************************************/
+int fr_init(const char* dir){
+	struct sigaction sa;
+
+	if(FR_WINDOW+SAMPLE_RATE_D1_HZ>FR_RING_SIZE){
+		fprintf(stderr,"ERROR: FLIGHT_RECORDER_S needs a larger FR_RING_SIZE\n");
+		return -1;
+	}
+	if(mkdir(dir, 0755) && errno!=EEXIST){
+		perror(dir);
+		return -1;
+	}
+	snprintf(dir_path, sizeof(dir_path), "%s", dir);
+	// the name is made here, snprintf isn't safe in a signal handler
+	snprintf(crash_path, sizeof(crash_path), "%s/flight_crash_%ld.bin", dir, (long)time(NULL));
+
+	if(sem_init(&wake, 0, 0) || sem_init(&log_wake, 0, 0)){
+		perror("sem_init");
+		return -1;
+	}
+	stopping = 0;
+	if(pthread_create(&thread, NULL, dump_thread, NULL)){
+		perror("flight recorder thread");
+		sem_destroy(&wake);
+		sem_destroy(&log_wake);
+		return -1;
+	}
+	atomic_store_explicit(&running, 1, memory_order_release);
+
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_sigaction = on_signal;
+	sa.sa_flags = SA_SIGINFO;
+	sigemptyset(&sa.sa_mask);
+	sigaction(SIGTERM, &sa, &old_term);
+	sigaction(SIGSEGV, &sa, &old_segv);
+	sigaction(SIGBUS, &sa, &old_bus);
+	return 0;
+}
+
+void fr_cleanup(){
+	if(!atomic_load_explicit(&running, memory_order_acquire)) return;
+	fr_log_stop();
+	sigaction(SIGTERM, &old_term, NULL);
+	sigaction(SIGSEGV, &old_segv, NULL);
+	sigaction(SIGBUS, &old_bus, NULL);
+	atomic_store_explicit(&running, 0, memory_order_release);
+	stopping = 1;
+	sem_post(&wake);
+	pthread_join(thread, NULL);
+	sem_destroy(&wake);
+	sem_destroy(&log_wake);
+}
@@ -0,0 +1,86 @@
+/*******************************************************************************
+* flight_recorder.h
+*
+* Always on record of every D1 tick. balancer() copies one fr_record_t into
+* a preallocated ring per tick and nothing else. When it tips over or D1
+* saturates, fr_trigger() wakes a low priority thread that waits
+* FLIGHT_RECORDER_POST_S so the aftermath is in the window, copies the last
+* FLIGHT_RECORDER_S+FLIGHT_RECORDER_POST_S seconds out of the ring and
+* writes them to FLIGHT_RECORDER_DIR. SIGSEGV, SIGBUS and SIGTERM write the
+* whole ring from the signal handler with open() and write() only.
+*
+* Dumps are an fr_header_t followed by the records oldest first, in the
+* native byte order. flight/ turns them into text.
+*
+* fr_log_start() also writes every tick to FLIGHT_RECORDER_DIR/log_<date>_<pid>.frz
+* until fr_log_stop(), compressed in blocks by fr_codec.h. balancer() only
+* wakes a low priority thread once a block has filled, that thread copies
+* the block out of the ring, encodes and writes it. If it falls more than
+* the ring behind, the ticks it missed are counted in the next block.
+*******************************************************************************/
+
+#ifndef FLIGHT_RECORDER_H
+#define FLIGHT_RECORDER_H
+
+#include <stdint.h>
+
+#define FR_MAGIC	0x4D495046	// "MIPF"
+#define FR_VERSION	2
+#define FR_RING_SIZE	1024		// power of two, ticks
+
+typedef enum fr_reason_t{
+	FR_TIP = 1,
+	FR_SATURATION,
+	FR_SIGNAL
+}fr_reason_t;
+
+/*******************************************************************************
+* fr_record_t
+*
+* One D1 tick, only fixed size types so flight/ doesn't need roboticscape
+*******************************************************************************/
+typedef struct fr_record_t{
+	uint64_t t_ns;		// CLOCK_MONOTONIC
+	uint32_t tick;
+	int16_t rc_state;	// rc_state_t
+	int16_t control_state;	// control_state_t
+	float accel[3];		// m/s^2
+	float gyro[3];		// deg/s, after the cached gyro bias
+	float theta, theta_a, theta_g;
+	float wheel_angle_l, wheel_angle_r;
+	float phi, gamma;
+	float theta_ref, phi_ref, gamma_ref;
+	float d1_out, d2_out, d3_out;
+	float v_batt;
+	uint32_t saturated;	// controllers on a limit, SAT_* in balance.h
+}fr_record_t;
+
+typedef struct fr_header_t{
+	uint32_t magic;
+	uint32_t version;
+	uint32_t record_size;	// sizeof(fr_record_t) of the writer
+	uint32_t count;		// records that follow
+	uint32_t reason;	// fr_reason_t
+	uint32_t signal;	// signal number with FR_SIGNAL, otherwise 0
+	uint64_t t_ns;		// when the event happened
+}fr_header_t;
+
+// start the dump thread and install the signal handlers, after rc_initialize()
+int fr_init(const char* dir);
+// flush a pending dump and stop the thread
+void fr_cleanup();
+// from the one thread that runs balancer()
+void fr_record(const fr_record_t* r);
+// safe from any thread, a later trigger replaces one not dumped yet
+void fr_trigger(fr_reason_t reason);
+// continuous compressed log, after fr_init(). Start while logging is a no-op.
+int fr_log_start();
+// write the last partial block, close the log and print its size
+void fr_log_stop();
+// 1 between fr_log_start() and fr_log_stop()
+int fr_log_running();
+// copy the newest n records oldest first, returns how many there were.
+// Only while balancer() isn't running, for ../bench.
+int fr_latest(fr_record_t* out, int n);
+
+#endif	//FLIGHT_RECORDER_H
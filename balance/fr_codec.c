@@ -0,0 +1,341 @@
+/*******************************************************************************
+* fr_codec.c
+*
+* Block codec behind fr_codec.h. One field at a time across the block:
+* quantize the column, pick the predictor, write the first value as a
+* varint, a width byte and the packed residuals, byte aligned per field.
+*******************************************************************************/
+
+#include <math.h>
+#include <string.h>
+#include <stddef.h>
+#include "balance_config.h"
+#include "fr_codec.h"
+
+#define FIELD_MAX	(1LL<<40)	// quanta a float is clamped to
+#define FIELD_NAN	(-(1LL<<41))	// stands for NaN
+#define WIDTH_MAX	57		// bits a residual can need, see pack()
+#define ORDER_2		0x80		// in the width byte, line prediction
+
+typedef enum field_type_t{
+	FIELD_U64,
+	FIELD_U32,
+	FIELD_I16,
+	FIELD_F32
+}field_type_t;
+
+typedef struct field_t{
+	size_t offset;
+	field_type_t type;
+	double quantum;		// 1 for integers, ns for the timestamp
+}field_t;
+
+#define F32(m, q)	{offsetof(fr_record_t, m), FIELD_F32, q}
+#define ENCODER_COUNT	(2.0*M_PI/(ENCODER_RES*GEARBOX))	// rad of wheel
+
+// order and count are part of FR_CODEC_VERSION
+static const field_t fields[FR_CODEC_FIELDS] = {
+	{offsetof(fr_record_t, t_ns), FIELD_U64, 1000},
+	{offsetof(fr_record_t, tick), FIELD_U32, 1},
+	{offsetof(fr_record_t, rc_state), FIELD_I16, 1},
+	{offsetof(fr_record_t, control_state), FIELD_I16, 1},
+	F32(accel[0], 1.0/1024),	// m/s^2, under the 4g LSB
+	F32(accel[1], 1.0/1024),
+	F32(accel[2], 1.0/1024),
+	F32(gyro[0], 1.0/64),		// deg/s, under the 1000 deg/s LSB
+	F32(gyro[1], 1.0/64),
+	F32(gyro[2], 1.0/64),
+	F32(theta, 1e-5),		// rad
+	F32(theta_a, 1e-5),
+	F32(theta_g, 1e-5),
+	F32(wheel_angle_l, ENCODER_COUNT),
+	F32(wheel_angle_r, ENCODER_COUNT),
+	F32(phi, 1e-4),
+	F32(gamma, 1e-4),
+	F32(theta_ref, 1e-5),
+	F32(phi_ref, 1e-4),
+	F32(gamma_ref, 1e-4),
+	F32(d1_out, 1e-4),		// duty
+	F32(d2_out, 1e-5),		// rad, theta_ref before the clamp
+	F32(d3_out, 1e-4),
+	F32(v_batt, 1e-3),		// V
+	{offsetof(fr_record_t, saturated), FIELD_U32, 1}
+};
+
+// CRC-32 (IEEE) four bits at a time
+static const uint32_t crc_nibble[16] = {
+	0x00000000, 0x1DB71064, 0x3B6E20C8, 0x26D930AC, 0x76DC4190, 0x6B6B51F4,
+	0x4DB26158, 0x5005713C, 0xEDB88320, 0xF00F9344, 0xD6D6A3E8, 0xCB61B38C,
+	0x9B64C2B0, 0x86D3D2D4, 0xA00AE278, 0xBDBDF21C
+};
+
+static uint32_t crc32(const uint8_t* p, size_t n){
+	uint32_t crc = 0xFFFFFFFF;
+
+	while(n--){
+		crc ^= *p++;
+		crc = (crc>>4) ^ crc_nibble[crc&15];
+		crc = (crc>>4) ^ crc_nibble[crc&15];
+	}
+	return ~crc;
+}
+
+static inline uint64_t zigzag(int64_t v){
+	return ((uint64_t)v<<1) ^ (uint64_t)(v>>63);
+}
+
+static inline int64_t unzigzag(uint64_t v){
+	return (int64_t)(v>>1) ^ -(int64_t)(v&1);
+}
+
+static inline int width_of(uint64_t v){
+	return v ? 64-__builtin_clzll(v) : 0;
+}
+
+static int64_t quantize(const field_t* f, const fr_record_t* r){
+	const uint8_t* p = (const uint8_t*)r + f->offset;
+	uint64_t u64;
+	uint32_t u32;
+	int16_t i16;
+	float x;
+	double q;
+
+	switch(f->type){
+	case FIELD_U64:
+		memcpy(&u64, p, sizeof(u64));
+		return (int64_t)((u64+(uint64_t)f->quantum/2)/(uint64_t)f->quantum);
+	case FIELD_U32:
+		memcpy(&u32, p, sizeof(u32));
+		return u32;
+	case FIELD_I16:
+		memcpy(&i16, p, sizeof(i16));
+		return i16;
+	default:
+		memcpy(&x, p, sizeof(x));
+		if(isnan(x)) return FIELD_NAN;
+		q = x/f->quantum;
+		if(q>FIELD_MAX) return FIELD_MAX;
+		if(q<-FIELD_MAX) return -FIELD_MAX;
+		return llrint(q);
+	}
+}
+
+static void restore(const field_t* f, double quantum, int64_t v, fr_record_t* r){
+	uint8_t* p = (uint8_t*)r + f->offset;
+	uint64_t u64;
+	uint32_t u32;
+	int16_t i16;
+	float x;
+
+	switch(f->type){
+	case FIELD_U64:
+		u64 = (uint64_t)v*(uint64_t)quantum;
+		memcpy(p, &u64, sizeof(u64));
+		break;
+	case FIELD_U32:
+		u32 = (uint32_t)v;
+		memcpy(p, &u32, sizeof(u32));
+		break;
+	case FIELD_I16:
+		i16 = (int16_t)v;
+		memcpy(p, &i16, sizeof(i16));
+		break;
+	default:
+		x = v==FIELD_NAN ? NAN : (float)(v*quantum);
+		memcpy(p, &x, sizeof(x));
+	}
+}
+
+static uint8_t* put_varint(uint8_t* p, uint64_t v){
+	while(v>=0x80){
+		*p++ = (uint8_t)(v|0x80);
+		v >>= 7;
+	}
+	*p++ = (uint8_t)v;
+	return p;
+}
+
+static const uint8_t* get_varint(const uint8_t* p, const uint8_t* end, uint64_t* v){
+	int shift=0;
+
+	*v = 0;
+	while(p<end && shift<64){
+		*v |= (uint64_t)(*p&0x7F) << shift;
+		if(!(*p++&0x80)) return p;
+		shift += 7;
+	}
+	return NULL;
+}
+
+/*******************************************************************************
+* static uint8_t* pack(uint8_t* p, const uint64_t* v, int n, int w)
+*
+* n values of w bits, least significant first. The accumulator holds at most
+* 7 bits between values, so w up to WIDTH_MAX never loses a bit.
+*******************************************************************************/
+static uint8_t* pack(uint8_t* p, const uint64_t* v, int n, int w){
+	uint64_t acc=0;
+	int i, bits=0;
+
+	if(w==0) return p;
+	for(i=0;i<n;i++){
+		acc |= v[i] << bits;
+		bits += w;
+		while(bits>=8){
+			*p++ = (uint8_t)acc;
+			acc >>= 8;
+			bits -= 8;
+		}
+	}
+	if(bits) *p++ = (uint8_t)acc;
+	return p;
+}
+
+static const uint8_t* unpack(const uint8_t* p, uint64_t* v, int n, int w){
+	uint64_t acc=0, mask=(1ULL<<w)-1;
+	int i, bits=0;
+
+	if(w==0){
+		memset(v, 0, n*sizeof(uint64_t));
+		return p;
+	}
+	for(i=0;i<n;i++){
+		while(bits<w){
+			acc |= (uint64_t)*p++ << bits;
+			bits += 8;
+		}
+		v[i] = acc & mask;
+		acc >>= w;
+		bits -= w;
+	}
+	return p;
+}
+
+void fr_codec_header(fr_log_header_t* h, uint64_t t_ns){
+	int i;
+
+	memset(h, 0, sizeof(fr_log_header_t));
+	h->magic = FR_LOG_MAGIC;
+	h->version = FR_VERSION;
+	h->codec = FR_CODEC_VERSION;
+	h->fields = FR_CODEC_FIELDS;
+	h->block = FR_CODEC_BLOCK;
+	h->t_ns = t_ns;
+	for(i=0;i<FR_CODEC_FIELDS;i++) h->quantum[i] = fields[i].quantum;
+}
+
+int fr_codec_check(const fr_log_header_t* h){
+	if(h->magic!=FR_LOG_MAGIC || h->version!=FR_VERSION || h->codec!=FR_CODEC_VERSION ||\
+	   h->fields!=FR_CODEC_FIELDS || h->block==0 || h->block>FR_CODEC_BLOCK) return -1;
+	return 0;
+}
+
+/*******************************************************************************
+* int fr_codec_encode(const fr_record_t* r, int n, uint32_t lost, uint8_t* out)
+*
+* Residuals of the first record after the first value are always from the
+* previous value, the line needs two.
+*******************************************************************************/
+int fr_codec_encode(const fr_record_t* r, int n, uint32_t lost, uint8_t* out){
+	int64_t col[FR_CODEC_BLOCK];
+	uint64_t d1[FR_CODEC_BLOCK], d2[FR_CODEC_BLOCK], or1, or2;
+	fr_block_t hdr;
+	uint8_t* p = out + sizeof(fr_block_t);
+	int f, i, w1, w2;
+
+	if(n<1 || n>FR_CODEC_BLOCK) return -1;
+	for(f=0;f<FR_CODEC_FIELDS;f++){
+		for(i=0;i<n;i++) col[i] = quantize(&fields[f], &r[i]);
+		or1 = or2 = 0;
+		for(i=1;i<n;i++){
+			d1[i-1] = zigzag(col[i]-col[i-1]);
+			d2[i-1] = i>1 ? zigzag(col[i]-2*col[i-1]+col[i-2]) : d1[i-1];
+			or1 |= d1[i-1];
+			or2 |= d2[i-1];
+		}
+		w1 = width_of(or1);
+		w2 = width_of(or2);
+		p = put_varint(p, zigzag(col[0]));
+		if(w2<w1){
+			*p++ = ORDER_2 | w2;
+			p = pack(p, d2, n-1, w2);
+		}
+		else{
+			*p++ = w1;
+			p = pack(p, d1, n-1, w1);
+		}
+	}
+	memset(&hdr, 0, sizeof(hdr));
+	hdr.magic = FR_BLOCK_MAGIC;
+	hdr.bytes = p - out - sizeof(fr_block_t);
+	hdr.crc = crc32(out+sizeof(fr_block_t), hdr.bytes);
+	hdr.count = n;
+	hdr.lost = lost;
+	hdr.tick = r[0].tick;
+	hdr.t_ns = r[0].t_ns;
+	hdr.t_last_ns = r[n-1].t_ns;
+	memcpy(out, &hdr, sizeof(hdr));
+	return p - out;
+}
+
+int fr_codec_decode(const fr_log_header_t* h, const uint8_t* in, size_t len, fr_record_t* out){
+	int64_t col[FR_CODEC_BLOCK];
+	uint64_t d[FR_CODEC_BLOCK], v;
+	const uint8_t *p, *end;
+	fr_block_t hdr;
+	int f, i, n, w, order2;
+
+	if(len<sizeof(hdr)) return -1;
+	memcpy(&hdr, in, sizeof(hdr));
+	if(hdr.magic!=FR_BLOCK_MAGIC || hdr.count<1 || hdr.count>h->block ||\
+	   hdr.bytes>len-sizeof(hdr)) return -1;
+	p = in + sizeof(hdr);
+	end = p + hdr.bytes;
+	if(crc32(p, hdr.bytes)!=hdr.crc) return -1;
+	n = hdr.count;
+	memset(out, 0, n*sizeof(fr_record_t));
+	for(f=0;f<FR_CODEC_FIELDS;f++){
+		p = get_varint(p, end, &v);
+		if(p==NULL || p>=end) return -1;
+		col[0] = unzigzag(v);
+		order2 = *p & ORDER_2;
+		w = *p++ & ~ORDER_2;
+		if(w>WIDTH_MAX || end-p < ((int64_t)w*(n-1)+7)/8) return -1;
+		p = unpack(p, d, n-1, w);
+		for(i=1;i<n;i++){
+			if(order2 && i>1) col[i] = 2*col[i-1]-col[i-2] + unzigzag(d[i-1]);
+			else col[i] = col[i-1] + unzigzag(d[i-1]);
+		}
+		for(i=0;i<n;i++) restore(&fields[f], h->quantum[f], col[i], &out[i]);
+	}
+	return n;
+}
+
+int fr_log_next(FILE* f, fr_block_t* blk){
+	long pos;
+
+	while(1){
+		pos = ftell(f);
+		if(fread(blk, sizeof(fr_block_t), 1, f)!=1) return 0;
+		if(blk->magic==FR_BLOCK_MAGIC && blk->bytes<=FR_CODEC_MAX_BYTES-sizeof(fr_block_t) &&\
+		   blk->count>=1 && blk->count<=FR_CODEC_BLOCK) return 1;
+		if(fseek(f, pos+1, SEEK_SET)) return 0;
+	}
+}
+
+int fr_log_decode(FILE* f, const fr_log_header_t* h, const fr_block_t* blk, uint8_t* buf,\
+							fr_record_t* out){
+	long pos = ftell(f);
+	int n=-1;
+
+	memcpy(buf, blk, sizeof(fr_block_t));
+	if(fread(buf+sizeof(fr_block_t), 1, blk->bytes, f)==blk->bytes){
+		n = fr_codec_decode(h, buf, sizeof(fr_block_t)+blk->bytes, out);
+	}
+	if(n<0) fseek(f, pos+1-(long)sizeof(fr_block_t), SEEK_SET);
+	return n;
+}
+
+int fr_log_skip(FILE* f, const fr_block_t* blk){
+	return fseek(f, blk->bytes, SEEK_CUR);
+}
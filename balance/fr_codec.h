@@ -0,0 +1,84 @@
+/*******************************************************************************
+* fr_codec.h
+*
+* Compression of fr_record_t streams for long recordings, see fr_log_start()
+* in flight_recorder.h. Records go in blocks of FR_CODEC_BLOCK, each block
+* decodes on its own so a reader can seek by the block headers alone and a
+* damaged block only loses itself.
+*
+* Every field is quantized to the resolution the robot can resolve: the
+* IMU's LSB, one encoder count, the precision flight/ prints estimates at.
+* Within a block each field is stored as its first value (zigzag varint)
+* and then the differences from a prediction, zigzagged and bit packed at
+* the width of the largest one. The prediction is the previous value or,
+* if that packs tighter for this block, the straight line through the two
+* before it (timestamps, ticks and wheel angles). Decoded floats are within
+* half a quantum of the recorded ones, NaN stays NaN. Counters, states
+* and flags are exact, timestamps are rounded to the microsecond.
+*
+* A log is an fr_log_header_t with the quanta it was written with, then
+* blocks, each an fr_block_t and its payload, in the native byte order.
+* fr_codec.c has to follow fr_record_t, FR_VERSION changes with it.
+*******************************************************************************/
+
+#ifndef FR_CODEC_H
+#define FR_CODEC_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stddef.h>
+#include "flight_recorder.h"
+
+#define FR_LOG_MAGIC		0x5A50494D	// "MIPZ"
+#define FR_BLOCK_MAGIC		0x4B4C4246	// "FBLK"
+#define FR_CODEC_VERSION	1
+#define FR_CODEC_FIELDS		25
+#define FR_CODEC_BLOCK		128		// records, power of two
+// largest encoded block, fr_block_t included
+#define FR_CODEC_MAX_BYTES	(sizeof(fr_block_t)+FR_CODEC_FIELDS*(11+(57*(FR_CODEC_BLOCK-1)+7)/8))
+
+typedef struct fr_log_header_t{
+	uint32_t magic;
+	uint32_t version;	// FR_VERSION of the records
+	uint32_t codec;		// FR_CODEC_VERSION
+	uint32_t fields;	// FR_CODEC_FIELDS
+	uint32_t block;		// FR_CODEC_BLOCK
+	uint32_t reserved;
+	uint64_t t_ns;		// when logging started, CLOCK_MONOTONIC
+	double quantum[FR_CODEC_FIELDS];
+}fr_log_header_t;
+
+typedef struct fr_block_t{
+	uint32_t magic;
+	uint32_t bytes;		// payload that follows
+	uint32_t crc;		// CRC-32 of the payload
+	uint32_t count;		// records, FR_CODEC_BLOCK but in the last block
+	uint32_t lost;		// records dropped right before this block
+	uint32_t tick;		// of the first record
+	uint64_t t_ns;		// of the first record
+	uint64_t t_last_ns;	// of the last, so a reader can seek by time
+}fr_block_t;
+
+// magic, versions and the quanta this build encodes with
+void fr_codec_header(fr_log_header_t* h, uint64_t t_ns);
+// 1 to FR_CODEC_BLOCK records into out, at least FR_CODEC_MAX_BYTES long.
+// Returns the bytes written, header and payload, or -1 if n is out of range.
+int fr_codec_encode(const fr_record_t* r, int n, uint32_t lost, uint8_t* out);
+// One block, header and payload, of len bytes as written with h. Returns
+// the records decoded into out (FR_CODEC_BLOCK long) or -1 if the block is
+// short, damaged or not from a log h describes.
+int fr_codec_decode(const fr_log_header_t* h, const uint8_t* in, size_t len, fr_record_t* out);
+// -1 unless h is a log this build can decode
+int fr_codec_check(const fr_log_header_t* h);
+
+// Reading a log file block by block, after its fr_log_header_t. Next finds
+// the following block header, scanning past damage, and returns 1, or 0 at
+// the end of f. Then either decode that block, with buf FR_CODEC_MAX_BYTES
+// long, or skip it by its header alone. A block that fails to decode
+// returns -1 and the next call scans on from just after its magic.
+int fr_log_next(FILE* f, fr_block_t* blk);
+int fr_log_decode(FILE* f, const fr_log_header_t* h, const fr_block_t* blk, uint8_t* buf,\
+							fr_record_t* out);
+int fr_log_skip(FILE* f, const fr_block_t* blk);
+
+#endif	//FR_CODEC_H
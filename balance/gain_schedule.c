@@ -0,0 +1,49 @@
+/*******************************************************************************
+* gain_schedule.c
+*
+* Table fill and lookup behind gain_schedule.h
+*******************************************************************************/
+
+#include <stdio.h>
+#include <string.h>
+#include "gain_schedule.h"
+
+/*******************************************************************************
+* int gain_schedule_init(gain_schedule_t* s)
+*
+* Every point is 1+D1_SCHED_TILT_GAIN*(|theta|/max)^2, so the controller
+* pushes harder the further it has been knocked over.
+*******************************************************************************/
+int gain_schedule_init(gain_schedule_t* s){
+	float th;
+	int j;
+
+	if(D1_SCHED_THETA_N<2 || D1_SCHED_THETA_MAX<=0 || D1_SCHED_TILT_GAIN<=-1){
+		fprintf(stderr,"ERROR: bad D1_SCHED settings in balance_config.h\n");
+		return -1;
+	}
+	memset(s, 0, sizeof(gain_schedule_t));
+	s->th_inv_step = (D1_SCHED_THETA_N-1)/D1_SCHED_THETA_MAX;
+	for(j=0;j<D1_SCHED_THETA_N;j++){
+		th = j/(float)(D1_SCHED_THETA_N-1);
+		s->k[j] = 1.0f + D1_SCHED_TILT_GAIN*th*th;
+	}
+	return 0;
+}
+
+/*******************************************************************************
+* float gain_schedule_lookup(const gain_schedule_t* s, float abs_theta)
+*
+* linear between the two surrounding points, clamped to the table
+*******************************************************************************/
+float gain_schedule_lookup(const gain_schedule_t* s, float abs_theta){
+	float y = abs_theta*s->th_inv_step;
+	int j;
+
+	if(y<0) y = 0;
+	if(y>D1_SCHED_THETA_N-1) y = D1_SCHED_THETA_N-1;
+	j = (int)y;
+	if(j>D1_SCHED_THETA_N-2) j = D1_SCHED_THETA_N-2;
+	y -= j;
+	return s->k[j] + y*(s->k[j+1]-s->k[j]);
+}
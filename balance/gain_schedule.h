@@ -0,0 +1,31 @@
+/*******************************************************************************
+* gain_schedule.h
+*
+* D1 gain over |theta|, looked up once per D1 tick with linear
+* interpolation. This is a scalar gain table, not a set of designs: every
+* point scales D1_NUM by a factor that is 1 upright, while D1_GAIN and
+* D1_DEN stay, so the poles stay where D1_DEN puts them, the zeros stay
+* where D1_NUM puts them and only the loop gain moves. Battery voltage is
+* not in the table, balancer() compensates it after D1 the same way with
+* or without the schedule. The table is filled once at startup, the lookup
+* does no divisions, no searching and touches two entries.
+*
+* Built in with make SCHEDULE=1, see D1_SCHED_* in balance_config.h.
+*******************************************************************************/
+
+#ifndef GAIN_SCHEDULE_H
+#define GAIN_SCHEDULE_H
+
+#include "balance_config.h"
+
+typedef struct gain_schedule_t{
+	float th_inv_step;
+	float k[D1_SCHED_THETA_N];	// times D1_NUM, 1 at theta 0
+}gain_schedule_t;
+
+// fill the table from the tilt factor
+int gain_schedule_init(gain_schedule_t* s);
+// what D1_NUM is multiplied with at this tilt
+float gain_schedule_lookup(const gain_schedule_t* s, float abs_theta);
+
+#endif	//GAIN_SCHEDULE_H
@@ -0,0 +1,21 @@
+/*******************************************************************************
+* imu_online.c
+*
+* Setup behind imu_online.h
+*******************************************************************************/
+
+#include <stdio.h>
+#include <string.h>
+#include "imu_online.h"
+
+int imu_online_init(imu_online_t* o){
+	if(IMU_ONLINE_BIAS_TAU<=DT_D1 || IMU_ONLINE_MOUNT_TAU<=DT_D1 || IMU_ONLINE_SETTLE_S<0){
+		fprintf(stderr,"ERROR: bad IMU_ONLINE settings in balance_config.h\n");
+		return -1;
+	}
+	memset(o, 0, sizeof(imu_online_t));
+	o->k_bias = DT_D1/IMU_ONLINE_BIAS_TAU;
+	o->k_mount = DT_D1/IMU_ONLINE_MOUNT_TAU;
+	o->settle = IMU_ONLINE_SETTLE_S*SAMPLE_RATE_D1_HZ;
+	return 0;
+}
@@ -0,0 +1,60 @@
+/*******************************************************************************
+* imu_online.h
+*
+* Gyro bias and mount angle tracked while the robot balances. Upright and
+* holding station the body angle can't keep growing, so the gyro's long
+* run mean is its bias, and the body sits where gravity balances it, so the
+* long run mean of the estimated theta is how far the mount angle is off.
+* Both are first order recursive averages over the ticks that look quasi
+* static (|gyro| and |theta| inside the IMU_ONLINE_GATE_* limits) once the
+* controller has been engaged for IMU_ONLINE_SETTLE_S. No history is kept,
+* a tick is two compares and two multiply-adds.
+*
+* The estimates are the values balancer() already corrects with, the gyro
+* bias and mount angle in its imu_cal_t, so the complementary filter sees
+* them from the next tick and main() saves them to the calibration file.
+* See IMU_ONLINE_* in balance_config.h.
+*******************************************************************************/
+
+#ifndef IMU_ONLINE_H
+#define IMU_ONLINE_H
+
+#include "balance_config.h"
+
+typedef struct imu_online_t{
+	float k_bias;			// per tick weight, DT_D1 over the time constant
+	float k_mount;
+	int settle;			// engaged ticks before updates start
+	int engaged_ticks;
+	unsigned long updates;		// ticks that moved the estimates
+}imu_online_t;
+
+int imu_online_init(imu_online_t* o);
+
+/*******************************************************************************
+* static inline int imu_online_step(imu_online_t* o, int engaged, float gyro_x,
+*				float theta, float* bias, float* mount)
+*
+* gyro_x in deg/s and theta in rad both already corrected with *bias and
+* *mount, which are moved toward their long run values. Returns 1 when the
+* tick was used.
+*******************************************************************************/
+static inline int imu_online_step(imu_online_t* o, int engaged, float gyro_x,\
+				float theta, float* bias, float* mount){
+	if(!engaged){
+		o->engaged_ticks = 0;
+		return 0;
+	}
+	if(o->engaged_ticks<o->settle){
+		o->engaged_ticks++;
+		return 0;
+	}
+	if(gyro_x>IMU_ONLINE_GATE_RATE || gyro_x<-IMU_ONLINE_GATE_RATE ||\
+	   theta>IMU_ONLINE_GATE_THETA || theta<-IMU_ONLINE_GATE_THETA) return 0;
+	*bias += o->k_bias*gyro_x;
+	*mount -= o->k_mount*theta;
+	o->updates++;
+	return 1;
+}
+
+#endif	//IMU_ONLINE_H
@@ -0,0 +1,49 @@
+/*******************************************************************************
+* lqr.c
+*
+* Setup and reference handling behind lqr.h
+*******************************************************************************/
+
+#include <stdio.h>
+#include <string.h>
+#include "lqr.h"
+
+int lqr_init(lqr_t* l){
+	const float k[] = LQR_K;
+
+	if(sizeof(k)!=sizeof(l->k)){
+		fprintf(stderr,"ERROR: LQR_K needs %d gains, see ../design\n", LQR_GAINS);
+		return -1;
+	}
+	memset(l, 0, sizeof(lqr_t));
+	memcpy(l->k, k, sizeof(l->k));
+	l->u_max = 1;
+	return 0;
+}
+
+void lqr_reset(lqr_t* l){
+	memset(l->x, 0, sizeof(l->x));
+	l->phi_last = 0;
+	l->u_last = 0;
+	l->sat = 0;
+	l->phi_ref = 0;
+	l->phi_rate_ref = 0;
+	l->ref_age = 0;
+	l->primed = 0;
+}
+
+/*******************************************************************************
+* void lqr_set_ref(lqr_t* l, float phi_ref)
+*
+* The trajectory runs at SETPOINT_MANAGER_HZ, so the rate is the change over
+* however many D1 ticks passed since the previous setpoint.
+*******************************************************************************/
+void lqr_set_ref(lqr_t* l, float phi_ref){
+	if(l->ref_age>0) l->phi_rate_ref = (phi_ref-l->phi_ref)*SAMPLE_RATE_D1_HZ/l->ref_age;
+	l->phi_ref = phi_ref;
+	l->ref_age = 0;
+}
+
+void lqr_set_limit(lqr_t* l, float u_max){
+	l->u_max = u_max;
+}
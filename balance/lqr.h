@@ -0,0 +1,100 @@
+/*******************************************************************************
+* lqr.h
+*
+* Full state feedback in place of the D1/D2 cascade, gain designed offline
+* by ../design (design LQR lqr ...) for x = [theta, theta_dot, phi, phi_dot].
+* phi is tracked against the trajectory inside balancer(), so outer_loop()
+* and its 20Hz timing drop out of the balance path.
+*
+* theta comes from the complementary filter, theta_dot from the gyro and phi
+* from the encoders plus theta. phi_dot is not measured: the difference of
+* two encoder readings lags the wheel by half a tick, which is enough to set
+* a high gain loop oscillating at the tick rate. The design tool rebuilds it
+* through the model from this tick's phi and last tick's phi and duty, and
+* folds that into the gain, so each tick is one five element dot product:
+*
+*	u = -(k0 theta + k1 theta_dot + k2 e + k3 e' + k4 u')
+*
+* e is phi minus its setpoint, e' and u' last tick's phi error and duty.
+* Built in with make LQR=1, see LQR_K in balance_config.h.
+*******************************************************************************/
+
+#ifndef LQR_H
+#define LQR_H
+
+#include "balance_config.h"
+
+#define LQR_GAINS	5
+
+typedef struct lqr_t{
+	float k[LQR_GAINS];		// u = -k.x
+	float x[LQR_GAINS];		// what the last tick fed back
+	float phi_last;			// phi of the last tick
+	float u_last;			// duty of the last tick as the motors saw it
+	float u_max;			// +- duty limit before battery compensation
+	int sat;			// the last duty was clamped to it
+	float phi_ref, phi_rate_ref;
+	int ref_age;			// ticks since phi_ref last changed
+	int primed;			// phi_last holds a reading
+}lqr_t;
+
+int lqr_init(lqr_t* l);
+// forget the state and reference, on every engage
+void lqr_reset(lqr_t* l);
+// new phi setpoint from the trajectory, its rate is taken from the last one
+void lqr_set_ref(lqr_t* l, float phi_ref);
+// vBatt/V_NOMINAL, the duty that comes out as full duty once compensated
+void lqr_set_limit(lqr_t* l, float u_max);
+
+/*******************************************************************************
+* static inline void lqr_measure(lqr_t* l, float theta, float theta_dot,
+*							float phi)
+*
+* fills l->x for this tick, theta and phi in rad, theta_dot in rad/s
+*******************************************************************************/
+static inline void lqr_measure(lqr_t* l, float theta, float theta_dot, float phi){
+	if(!l->primed){
+		l->phi_last = phi;
+		l->primed = 1;
+	}
+	l->ref_age++;
+	l->x[0] = theta;
+	l->x[1] = theta_dot;
+	l->x[2] = phi - l->phi_ref;
+	// last tick's error against where the setpoint was then
+	l->x[3] = l->phi_last - l->phi_ref + l->phi_rate_ref*DT_D1;
+	l->x[4] = l->u_last;
+}
+
+// clamps the duty to u_max and remembers it and phi for the next tick
+static inline float lqr_commit(lqr_t* l, float u, float phi){
+	// the wheels can't be driven past full duty, nor can the model
+	l->sat = 1;
+	if(u>=l->u_max) u = l->u_max;
+	else if(u<=-l->u_max) u = -l->u_max;
+	else l->sat = 0;
+	l->u_last = u;
+	l->phi_last = phi;
+	return u;
+}
+
+/*******************************************************************************
+* static inline float lqr_step(lqr_t* l, float theta, float theta_dot,
+*							float phi, float scale)
+*
+* scale is the soft start factor the duty is multiplied by. Returns the duty
+* before battery compensation, which is the duty the model sees at V_NOMINAL,
+* within +-u_max so it stays within full duty once compensated.
+*******************************************************************************/
+static inline float lqr_step(lqr_t* l, float theta, float theta_dot, float phi,\
+							float scale){
+	float u=0;
+	int i;
+
+	lqr_measure(l, theta, theta_dot, phi);
+	for(i=0;i<LQR_GAINS;i++) u -= l->k[i]*l->x[i];
+	u *= scale;
+	return lqr_commit(l, u, phi);
+}
+
+#endif	//LQR_H
@@ -0,0 +1,132 @@
+/*******************************************************************************
+* monitor.c
+*
+* Reads the state balance exports to shared memory (see ../shm_export.h)
+* from a separate process. Prints a status line, a CSV log or the task
+* statistics at any rate without touching the balance process.
+*
+*	monitor			status line at 10hz
+*	monitor -l -r 100	CSV log at 100hz
+*	monitor -k		task runner statistics
+*******************************************************************************/
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include "../shm_export.h"
+
+#define ENGAGED		0	// control_state_t in balance.h
+
+static volatile sig_atomic_t running=1;
+static const char* state_names[] = {"UNINITIALIZED", "RUNNING", "PAUSED", "EXITING"};
+
+static void on_signal(int sig){
+	running = 0;
+}
+
+static void print_usage(){
+	printf("\nUsage: monitor [options]\n");
+	printf("-r hz       print rate (default 10)\n");
+	printf("-l          CSV log instead of a status line\n");
+	printf("-k          task runner statistics\n");
+	printf("-n name     segment name (default %s)\n\n", SHM_EXPORT_NAME);
+}
+
+static uint64_t now_ns(){
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec*1000000000ULL + ts.tv_nsec;
+}
+
+static void sleep_ns(uint64_t ns){
+	struct timespec ts = {ns/1000000000ULL, ns%1000000000ULL};
+	nanosleep(&ts, NULL);
+}
+
+/*******************************************************************************
+* normal use
+*******************************************************************************/
+static const char* state_name(int32_t s){
+	if(s<0 || s>=(int32_t)(sizeof(state_names)/sizeof(state_names[0]))) return "?";
+	return state_names[s];
+}
+
+static void print_status(const shm_payload_t* p, uint64_t now){
+	printf("\r%7.3f |%7.3f |%7.3f |%7.3f |%7.3f |%7.3f |%7.3f |%6.2f | %-10s| %-13s|%6.1fms ",\
+		p->theta, p->theta_ref, p->phi, p->phi_ref, p->gamma, p->d1_out, p->d3_out,\
+		p->v_batt, p->control_state==ENGAGED ? "ENGAGED" : "DISENGAGED",\
+		state_name(p->rc_state), (now-p->t_ns)/1e6);
+	fflush(stdout);
+}
+
+static void print_csv(const shm_payload_t* p){
+	printf("%llu,%.6f,%d,%d,%f,%f,%f,%f,%f,%f,%f,%f,%f,%f,%f,%f,%u\n",\
+		(unsigned long long)p->count, p->t_ns*1e-9, p->rc_state, p->control_state,\
+		p->theta, p->theta_ref, p->phi, p->phi_ref, p->gamma, p->gamma_ref,\
+		p->wheel_angle_l, p->wheel_angle_r, p->d1_out, p->d2_out, p->d3_out,\
+		p->v_batt, p->saturated);
+}
+
+static void print_tasks(const shm_payload_t* p){
+	uint32_t i;
+	printf("\n%-16s %5s %10s %8s %8s\n", "task", "hz", "runs", "missed", "max us");
+	for(i=0;i<p->num_tasks && i<SHM_MAX_TASKS;i++){
+		printf("%-16.16s %5u %10llu %8llu %8u\n", p->tasks[i].name, p->tasks[i].hz,\
+			(unsigned long long)p->tasks[i].runs,\
+			(unsigned long long)p->tasks[i].missed, p->tasks[i].max_us);
+	}
+}
+
+int main(int argc, char* argv[]){
+	const char* name=SHM_EXPORT_NAME;
+	const shm_export_t* shm;
+	shm_payload_t p;
+	uint64_t last=0, period;
+	double hz=10;
+	int i, csv=0, tasks=0;
+
+	for(i=1;i<argc;i++){
+		if(i+1<argc && strcmp(argv[i],"-r")==0) hz=atof(argv[++i]);
+		else if(strcmp(argv[i],"-l")==0) csv=1;
+		else if(strcmp(argv[i],"-k")==0) tasks=1;
+		else if(i+1<argc && strcmp(argv[i],"-n")==0) name=argv[++i];
+		else{
+			print_usage();
+			return -1;
+		}
+	}
+	if(hz<=0){
+		print_usage();
+		return -1;
+	}
+	signal(SIGINT, on_signal);
+	signal(SIGTERM, on_signal);
+
+	shm = shm_export_open(name, 0);
+	if(shm==NULL){
+		fprintf(stderr,"ERROR: is balance running?\n");
+		return -1;
+	}
+	if(csv) printf("count,t,rc_state,control_state,theta,theta_ref,phi,phi_ref,"\
+			"gamma,gamma_ref,wheel_l,wheel_r,d1,d2,d3,vbatt,sat\n");
+	else if(!tasks){
+		printf("    θ    |  θ_ref  |    φ    |  φ_ref  |    γ    |  D1_u   |  D3_u   | vBatt | control   | state        | age\n");
+	}
+	period = 1e9/hz;
+	while(running){
+		if(shm_export_read(shm, &p)==0 && p.count!=last){
+			last = p.count;
+			if(csv) print_csv(&p);
+			else if(tasks) print_tasks(&p);
+			else print_status(&p, now_ns());
+		}
+		sleep_ns(period);
+	}
+	printf("\n");
+	shm_export_close((shm_export_t*)shm, name, 0);
+	return 0;
+}
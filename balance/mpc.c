@@ -0,0 +1,113 @@
+/*******************************************************************************
+* mpc.c
+*
+* Tree walk and region check behind mpc.h, over the table in mpc_table.h
+*******************************************************************************/
+
+#include <stdio.h>
+#include <string.h>
+#include "mpc.h"
+#include "mpc_table.h"
+
+// a state on a shared facet may round to outside both regions
+#define MPC_FACET_TOL	1e-5f
+
+static inline float dot4(const float a[MPC_STATES], const float x[MPC_STATES]){
+	return a[0]*x[0] + a[1]*x[1] + a[2]*x[2] + a[3]*x[3];
+}
+
+int mpc_init(mpc_t* m){
+	if(sizeof(mpc_rate)/sizeof(mpc_rate[0])!=LQR_GAINS){
+		fprintf(stderr,"ERROR: mpc_table.h doesn't match lqr.h, run ./mpcgen\n");
+		return -1;
+	}
+	memset(m, 0, sizeof(mpc_t));
+	m->meas.u_max = 1;
+	m->region = -1;
+	return 0;
+}
+
+void mpc_reset(mpc_t* m){
+	lqr_reset(&m->meas);
+	memset(m->x, 0, sizeof(m->x));
+	m->region = -1;
+	m->dots = 0;
+}
+
+void mpc_set_ref(mpc_t* m, float phi_ref){
+	lqr_set_ref(&m->meas, phi_ref);
+}
+
+void mpc_set_limit(mpc_t* m, float u_max){
+	lqr_set_limit(&m->meas, u_max);
+}
+
+void mpc_get_box(float box[MPC_STATES]){
+	memcpy(box, mpc_box, sizeof(mpc_box));
+}
+
+/*******************************************************************************
+* float mpc_lookup(const float x[MPC_STATES], int* region, int* dots)
+*
+* One dot product per tree level, then one per facet of each region the leaf
+* lists until one holds x. A table without a tree has one node sending
+* everything to leaf 0.
+*******************************************************************************/
+float mpc_lookup(const float x[MPC_STATES], int* region, int* dots){
+	const mpc_region_t* r;
+	const mpc_leaf_t* leaf;
+	int node=0, n=0, i, j;
+	float u;
+
+	while(node>=0){
+		n++;
+		node = mpc_nodes[node].child[dot4(mpc_nodes[node].h,x) > mpc_nodes[node].c];
+	}
+	leaf = &mpc_leaves[-1-node];
+
+	for(i=0;i<leaf->n;i++){
+		r = &mpc_regions[mpc_leaf_regions[leaf->first+i]];
+		for(j=0;j<r->n_facets;j++){
+			n++;
+			if(dot4(mpc_facets[r->facet+j].a,x) > mpc_facets[r->facet+j].b+MPC_FACET_TOL) break;
+		}
+		if(j<r->n_facets) continue;
+		if(region) *region = r-mpc_regions;
+		if(dots) *dots = n+1;
+		return dot4(r->f,x) + r->g;
+	}
+
+	// no region, the constraints can't all be met from here
+	u = -dot4(mpc_k,x);
+	if(region) *region = -1;
+	if(dots) *dots = n+1;
+	return u>1 ? 1 : (u<-1 ? -1 : u);
+}
+
+/*******************************************************************************
+* float mpc_step(mpc_t* m, float theta, float theta_dot, float phi, float scale)
+*
+* phi_dot comes from the measurements through mpc_rate, then the state is
+* clamped into the box the table was built over. Outside it the table says
+* nothing, and the box is well past where balancing is still possible.
+*******************************************************************************/
+float mpc_step(mpc_t* m, float theta, float theta_dot, float phi, float scale){
+	const float* v = m->meas.x;
+	float u;
+	int i;
+
+	lqr_measure(&m->meas, theta, theta_dot, phi);
+	m->x[0] = v[0];
+	m->x[1] = v[1];
+	m->x[2] = v[2];
+	m->x[3] = 0;
+	for(i=0;i<LQR_GAINS;i++) m->x[3] += mpc_rate[i]*v[i];
+	for(i=0;i<MPC_STATES;i++){
+		if(m->x[i]>mpc_box[i]) m->x[i] = mpc_box[i];
+		else if(m->x[i]<-mpc_box[i]) m->x[i] = -mpc_box[i];
+	}
+	u = mpc_lookup(m->x, &m->region, &m->dots);
+	if(m->region<0) m->fallbacks++;
+	u *= scale;
+	return lqr_commit(&m->meas, u, phi);
+}
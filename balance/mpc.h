@@ -0,0 +1,80 @@
+/*******************************************************************************
+* mpc.h
+*
+* Explicit MPC in place of the D1/D2 cascade. Over a 0.3s horizon the duty
+* stays inside +-1 and theta inside THETA_REF_MAX by prediction, where the
+* cascade only finds out from the saturation timeout after it happened.
+*
+* The QP is solved offline by ./mpcgen for every state it can be asked
+* about. Its answer is affine in the state inside each of a few dozen
+* polyhedral regions, which mpcgen writes to mpc_table.h together with a
+* binary tree over the regions. A tick walks the tree to a leaf and checks
+* the handful of regions the leaf lists, so the worst case is MPC_WORST_DOTS
+* four element dot products whatever the state. A state in no region, one
+* the constraints can't be met from, gets the LQR clamped to the duty limit.
+*
+* x = [theta, theta_dot, phi, phi_dot] with phi_dot rebuilt the same way as
+* LQR=1 (lqr.h), whose measurement and setpoint handling this shares.
+* Built in with make MPC=1, regenerate the table after changing the model.
+*******************************************************************************/
+
+#ifndef MPC_H
+#define MPC_H
+
+#include <stdint.h>
+#include "lqr.h"
+
+#define MPC_STATES	4
+
+// the table's layout, see ./mpcgen
+typedef struct mpc_region_t{
+	float f[MPC_STATES];		// u = f.x + g inside
+	float g;
+	uint16_t facet, n_facets;	// a.x <= b for each of its facets
+}mpc_region_t;
+
+typedef struct mpc_facet_t{
+	float a[MPC_STATES];
+	float b;
+}mpc_facet_t;
+
+typedef struct mpc_node_t{
+	float h[MPC_STATES];		// h.x <= c goes to child[0]
+	float c;
+	int16_t child[2];		// node index, or -1-leaf for a leaf
+}mpc_node_t;
+
+typedef struct mpc_leaf_t{
+	uint16_t first, n;		// regions in mpc_leaf_regions[]
+}mpc_leaf_t;
+
+typedef struct mpc_t{
+	lqr_t meas;			// x[0..4] as LQR=1 feeds back, k unused
+	float x[MPC_STATES];		// state looked up last tick
+	int region;			// its region, -1 for the LQR fallback
+	int dots;			// dot products the lookup took
+	unsigned long fallbacks;	// ticks no region held the state
+}mpc_t;
+
+int mpc_init(mpc_t* m);
+// forget the state and reference, on every engage
+void mpc_reset(mpc_t* m);
+// new phi setpoint from the trajectory
+void mpc_set_ref(mpc_t* m, float phi_ref);
+// as lqr_set_limit(), the table itself only knows +-1
+void mpc_set_limit(mpc_t* m, float u_max);
+
+// the +- limits on each state the table was built over
+void mpc_get_box(float box[MPC_STATES]);
+// duty for state x, which must be inside the table's box. region and dots
+// report where it was found and what it cost, either may be NULL
+float mpc_lookup(const float x[MPC_STATES], int* region, int* dots);
+
+/*******************************************************************************
+* float mpc_step(mpc_t* m, float theta, float theta_dot, float phi, float scale)
+*
+* same arguments and return as lqr_step()
+*******************************************************************************/
+float mpc_step(mpc_t* m, float theta, float theta_dot, float phi, float scale);
+
+#endif	//MPC_H
@@ -0,0 +1,202 @@
+/*******************************************************************************
+* mpc_table.h
+*
+* Written by mpcgen, don't edit. Read by mpc.c only.
+* 25 regions, 96 facets, 21 tree nodes, 22 leaves, at most 19 dot products.
+* 100.00% of 5000 fresh states match the QP (worst 0 duty), 0.6% infeasible.
+*******************************************************************************/
+
+#define MPC_REGIONS	25
+#define MPC_FACETS	96
+#define MPC_NODES	21
+#define MPC_LEAVES	22
+#define MPC_WORST_DOTS	19
+
+// phi_dot from theta, theta_dot, phi, and phi and duty of the last tick
+static const float mpc_rate[5] = {-1.26405545,0.147281775,85.6735584,-85.6735584,7.08870879};
+// state box the table covers, the state is clamped into it
+static const float mpc_box[4] = {0.45,6,1,20};
+// LQR outside every region, clamped to +-1
+static const float mpc_k[4] = {-3.53018798,-0.341659342,-0.208407539,-0.135980309};
+
+static const mpc_region_t mpc_regions[25] = {
+	{{3.88917661,0.369610797,0.226813733,0.150971422},0,0,4},
+	{{4.08109106,0.0810556247,-0.0372367894,-0.0180749683},-1.83770731,4,3},
+	{{4.08109106,0.0810556247,-0.0372367894,-0.0180749683},1.83770731,7,3},
+	{{4.1929772,0.139347663,0.00595209711,0.0155915319},-1.38583123,10,4},
+	{{0,0,0,0},-1,14,4},
+	{{0,0,0,0},1,18,4},
+	{{0,0,0,0},1,22,4},
+	{{0,0,0,0},1,26,4},
+	{{0,0,0,0},-1,30,5},
+	{{0,0,0,0},1,35,5},
+	{{0,0,0,0},-1,40,5},
+	{{0,0,0,0},1,45,5},
+	{{4.1929772,0.139347663,0.00595209711,0.0155915319},1.38583123,50,4},
+	{{0,0,0,0},-1,54,4},
+	{{0,0,0,0},-1,58,4},
+	{{0,0,0,0},1,62,4},
+	{{0,0,0,0},1,66,3},
+	{{0,0,0,0},-1,69,3},
+	{{0,0,0,0},-1,72,4},
+	{{6.98794992,0.219605577,0,0.0526596593},-0.488979828,76,2},
+	{{0,0,0,0},1,78,4},
+	{{6.98794992,0.219605577,0,0.0526596593},0.488979828,82,2},
+	{{0,0,0,0},1,84,4},
+	{{0,0,0,0},-1,88,4},
+	{{0,0,0,0},-1,92,4},
+};
+
+static const mpc_facet_t mpc_facets[96] = {
+	{{0.659154682,-0.499600828,-0.479202442,-0.293733106},3.00683145},
+	{{-0.659154682,0.499600828,0.479202442,0.293733106},3.00683145},
+	{{0.993102139,0.0943802016,0.0579169385,0.0385505873},0.255350229},
+	{{-0.993102139,-0.0943802016,-0.0579169385,-0.0385505873},0.255350229},
+	{{0.813525194,0.423841992,0.314026824,0.244789458},-3.28559544},
+	{{-0.999751424,-0.0198563264,0.00912195603,0.00442785398},-0.205214503},
+	{{-0.998489431,-0.0475911181,-0.0127906247,-0.0242969409},0.463280194},
+	{{-0.813525194,-0.423841992,-0.314026824,-0.244789458},-3.28559544},
+	{{0.999751424,0.0198563264,-0.00912195603,-0.00442785398},-0.205214503},
+	{{0.998489431,0.0475911181,0.0127906247,0.0242969409},0.463280194},
+	{{-0.659154682,0.499600828,0.479202442,0.293733106},-3.00683145},
+	{{-0.813525194,-0.423841992,-0.314026824,-0.244789458},3.28559544},
+	{{0.999440314,0.0332149844,0.00141874509,0.00371640599},0.568688024},
+	{{-0.999440314,-0.0332149844,-0.00141874509,-0.00371640599},-0.0919669418},
+	{{0.999478208,0.0314099258,0,0.00753184874},-0.0730906105},
+	{{-0.999478208,-0.0314099258,0,-0.00753184874},0.67905637},
+	{{0.999332716,0.0353888205,0,0.00904182514},-0.0989418473},
+	{{0.99339272,0.0934828371,0.0491806062,0.0448679193},-0.578753687},
+	{{-0.999507989,-0.0305617021,0.000670725981,-0.00702225775},-0.0661904771},
+	{{-0.999611128,-0.0266392285,0.00738872829,-0.00365387834},-0.0267957457},
+	{{0.99339272,0.0934828371,0.0491806062,0.0448679193},0.578753687},
+	{{-0.994179791,-0.0863246815,-0.0508828813,-0.0395667081},-0.411258304},
+	{{-0.998877966,-0.0405626461,-0.0182666952,-0.016242215},-0.175471237},
+	{{-0.765821691,-0.436336339,-0.399152786,-0.252596102},-2.69424736},
+	{{0.958264871,0.213137488,0.148600914,0.119241839},1.60714642},
+	{{0.999591469,0.0275072107,-0.00654328443,0.00417541187},0.0323782608},
+	{{0.999478208,0.0314099258,0,0.00753184874},0.67905637},
+	{{-0.999478208,-0.0314099258,0,-0.00753184874},-0.0730906105},
+	{{-0.999332716,-0.0353888205,0,-0.00904182514},-0.0989418473},
+	{{-0.99339272,-0.0934828371,-0.0491806062,-0.0448679193},-0.578753687},
+	{{-0.907165813,0.270466382,0.275480599,0.16735759},-1.78175513},
+	{{-0.998733615,-0.0426249326,-0.0202296753,-0.0174654506},0.188509505},
+	{{-0.772985113,-0.460739208,-0.344124179,-0.267940193},3.61320973},
+	{{0.999440314,0.0332149844,0.00141874509,0.00371640599},0.0919669418},
+	{{-0.999507685,-0.0305706325,0.000662485529,-0.00702746381},0.0662456723},
+	{{0.907165813,-0.270466382,-0.275480599,-0.16735759},2.03322612},
+	{{-0.907165813,0.270466382,0.275480599,0.16735759},1.78175513},
+	{{0.765821691,0.436336339,0.399152786,0.252596102},2.69424736},
+	{{-0.993102139,-0.0943802016,-0.0579169385,-0.0385505873},-0.255350229},
+	{{0.994179791,0.0863246815,0.0508828813,0.0395667081},0.411258304},
+	{{0.907165813,-0.270466382,-0.275480599,-0.16735759},1.78175513},
+	{{-0.907165813,0.270466382,0.275480599,0.16735759},2.03322612},
+	{{-0.765821691,-0.436336339,-0.399152786,-0.252596102},2.69424736},
+	{{0.993102139,0.0943802016,0.0579169385,0.0385505873},-0.255350229},
+	{{-0.994179791,-0.0863246815,-0.0508828813,-0.0395667081},0.411258304},
+	{{0.907165813,-0.270466382,-0.275480599,-0.16735759},-1.78175513},
+	{{0.998733615,0.0426249326,0.0202296753,0.0174654506},0.188509505},
+	{{0.772985113,0.460739208,0.344124179,0.267940193},3.61320973},
+	{{-0.999440314,-0.0332149844,-0.00141874509,-0.00371640599},0.0919669418},
+	{{0.999507685,0.0305706325,-0.000662485529,0.00702746381},0.0662456723},
+	{{0.659154682,-0.499600828,-0.479202442,-0.293733106},-3.00683145},
+	{{0.813525194,0.423841992,0.314026824,0.244789458},3.28559544},
+	{{0.999440314,0.0332149844,0.00141874509,0.00371640599},-0.0919669418},
+	{{-0.999440314,-0.0332149844,-0.00141874509,-0.00371640599},0.568688024},
+	{{0.999507989,0.0305617021,-0.000670725981,0.00702225775},-0.0661904771},
+	{{0.999611128,0.0266392285,-0.00738872829,0.00365387834},-0.0267957457},
+	{{-0.99339272,-0.0934828371,-0.0491806062,-0.0448679193},0.578753687},
+	{{0.994179791,0.0863246815,0.0508828813,0.0395667081},-0.411258304},
+	{{-0.999865544,-0.0162991239,0,-0.00179807754},-0.0250640046},
+	{{0.772985113,0.460739208,0.344124179,0.267940193},-3.61320973},
+	{{0.999751424,0.0198563264,-0.00912195603,-0.00442785398},0.205214503},
+	{{-0.999478208,-0.0314099258,0,-0.00753184874},0.0730906105},
+	{{0.999865544,0.0162991239,0,0.00179807754},-0.0250640046},
+	{{-0.772985113,-0.460739208,-0.344124179,-0.267940193},-3.61320973},
+	{{-0.999751424,-0.0198563264,0.00912195603,0.00442785398},0.205214503},
+	{{0.999478208,0.0314099258,0,0.00753184874},0.0730906105},
+	{{-0.999865544,-0.0162991239,0,-0.00179807754},0.0250640046},
+	{{-0.958264871,-0.213137488,-0.148600914,-0.119241839},-1.60714642},
+	{{0.999332716,0.0353888205,0,0.00904182514},0.0989418473},
+	{{0.999865544,0.0162991239,0,0.00179807754},0.0250640046},
+	{{0.958264871,0.213137488,0.148600914,0.119241839},-1.60714642},
+	{{-0.999332716,-0.0353888205,0,-0.00904182514},0.0989418473},
+	{{0.998877966,0.0405626461,0.0182666952,0.016242215},-0.175471237},
+	{{0.765821691,0.436336339,0.399152786,0.252596102},-2.69424736},
+	{{-0.958264871,-0.213137488,-0.148600914,-0.119241839},1.60714642},
+	{{-0.999591469,-0.0275072107,0.00654328443,-0.00417541187},0.0323782608},
+	{{-0.999478208,-0.0314099258,0,-0.00753184874},0.0730906105},
+	{{0.998489431,0.0475911181,0.0127906247,0.0242969409},-0.463280194},
+	{{-0.999493748,-0.0309532001,0,-0.00735852803},-0.070123374},
+	{{0.999611128,0.0266392285,-0.00738872829,0.00365387834},0.0267957457},
+	{{0.999332716,0.0353888205,0,0.00904182514},0.0989418473},
+	{{-0.999591469,-0.0275072107,0.00654328443,-0.00417541187},-0.0323782608},
+	{{0.999478208,0.0314099258,0,0.00753184874},0.0730906105},
+	{{-0.998489431,-0.0475911181,-0.0127906247,-0.0242969409},-0.463280194},
+	{{0.998877966,0.0405626461,0.0182666952,0.016242215},0.175471237},
+	{{-0.998733615,-0.0426249326,-0.0202296753,-0.0174654506},-0.188509505},
+	{{-0.999865544,-0.0162991239,0,-0.00179807754},0.0250640046},
+	{{0.999493748,0.0309532001,0,0.00735852803},0.070123374},
+	{{-0.998877966,-0.0405626461,-0.0182666952,-0.016242215},0.175471237},
+	{{0.998733615,0.0426249326,0.0202296753,0.0174654506},-0.188509505},
+	{{0.999865544,0.0162991239,0,0.00179807754},0.0250640046},
+	{{-0.999493748,-0.0309532001,0,-0.00735852803},0.070123374},
+	{{0.999493748,0.0309532001,0,0.00735852803},-0.070123374},
+	{{-0.999611128,-0.0266392285,0.00738872829,-0.00365387834},0.0267957457},
+	{{-0.999332716,-0.0353888205,0,-0.00904182514},0.0989418473},
+	{{0.999591469,0.0275072107,-0.00654328443,0.00417541187},-0.0323782608},
+};
+
+static const mpc_node_t mpc_nodes[21] = {
+	{{0.993102139,0.0943802016,0.0579169385,0.0385505873},0.255350229,{1,12}},
+	{{-0.994179791,-0.0863246815,-0.0508828813,-0.0395667081},0.411258304,{2,6}},
+	{{0.907165813,-0.270466382,-0.275480599,-0.16735759},1.78175513,{3,4}},
+	{{-0.659154682,0.499600828,0.479202442,0.293733106},3.00683145,{-1,-2}},
+	{{-0.999440314,-0.0332149844,-0.00141874509,-0.00371640599},-0.0919669418,{-3,5}},
+	{{-0.998733615,-0.0426249326,-0.0202296753,-0.0174654506},0.188509505,{-4,-5}},
+	{{-0.772985113,-0.460739208,-0.344124179,-0.267940193},3.61320973,{7,10}},
+	{{0.999507989,0.0305617021,-0.000670725981,0.00702225775},-0.0661904771,{8,9}},
+	{{0.999611128,0.0266392285,-0.00738872829,0.00365387834},-0.0267957457,{-6,-7}},
+	{{-0.998733615,-0.0426249326,-0.0202296753,-0.0174654506},0.188509505,{-8,-9}},
+	{{-0.999751424,-0.0198563264,0.00912195603,0.00442785398},-0.205214503,{-10,11}},
+	{{0.999478208,0.0314099258,0,0.00753184874},-0.0730906105,{-11,-12}},
+	{{-0.813525194,-0.423841992,-0.314026824,-0.244789458},-3.28559544,{13,15}},
+	{{0.999751424,0.0198563264,-0.00912195603,-0.00442785398},-0.205214503,{-13,14}},
+	{{0.999865544,0.0162991239,0,0.00179807754},-0.0250640046,{-14,-15}},
+	{{-0.999478208,-0.0314099258,0,-0.00753184874},-0.0730906105,{16,18}},
+	{{-0.99339272,-0.0934828371,-0.0491806062,-0.0448679193},-0.578753687,{-16,17}},
+	{{0.994179791,0.0863246815,0.0508828813,0.0395667081},0.411258304,{-17,-18}},
+	{{0.998733615,0.0426249326,0.0202296753,0.0174654506},0.188509505,{19,20}},
+	{{0.907165813,-0.270466382,-0.275480599,-0.16735759},-1.78175513,{-19,-20}},
+	{{-0.998877966,-0.0405626461,-0.0182666952,-0.016242215},-0.175471237,{-21,-22}},
+};
+
+static const mpc_leaf_t mpc_leaves[22] = {
+	{0,3},
+	{3,2},
+	{5,3},
+	{8,2},
+	{10,2},
+	{12,2},
+	{14,2},
+	{16,2},
+	{18,2},
+	{20,3},
+	{23,2},
+	{25,3},
+	{28,3},
+	{31,3},
+	{34,3},
+	{37,3},
+	{40,1},
+	{41,3},
+	{44,3},
+	{47,1},
+	{48,2},
+	{50,2},
+};
+
+static const uint16_t mpc_leaf_regions[52] = {
+	0,10,18,12,2,3,1,0,8,14,18,23,4,13,18,24,8,3,23,18,
+	1,19,4,4,17,14,17,18,2,21,7,15,7,11,7,16,6,7,6,20,
+	9,5,6,20,11,12,5,9,6,9,22,20
+};
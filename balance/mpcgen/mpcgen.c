@@ -0,0 +1,797 @@
+/*******************************************************************************
+* mpcgen.c
+*
+* Offline generator for the explicit MPC table balance uses with make MPC=1.
+*
+* The MPC minimizes the LQR cost over MPC_N ticks of the linearized EduMIP
+* (../design/mip_model.c) with the Riccati solution as the terminal cost,
+* subject to |duty| <= 1 on every tick and |theta| <= THETA_REF_MAX at the
+* checked ticks. The duty is held over blocks of ticks so the QP has only a
+* handful of free moves. Its solution is piecewise affine in the state: one
+* affine law per set of active constraints, valid over a polytope. The
+* generator samples the state box, solves the QP at every sample not yet
+* covered by a known region, keeps each new region with its redundant
+* facets removed by LP, and then builds a binary tree of facet hyperplanes
+* over the samples so balancer() finds the region with a bounded number of
+* dot products. Fresh samples are used to check the table against the QP.
+*
+*	mpcgen -o ../mpc_table.h
+*	mpcgen -N 30 -u "1 2 4" -c "5 10 20 30" -q "10 0.1 1 0.1" -r 1
+*******************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <math.h>
+#include <time.h>
+#include "ctrl_math.h"
+#include "mip_model.h"
+#include "../balance_config.h"
+
+#define NX		MIP_STATES
+#define MAX_U		6		// free moves
+#define MAX_N		100		// prediction horizon, ticks
+#define MAX_CON		32		// constraint rows, two per bound
+#define MAX_FACETS	(MAX_CON+2*NX)
+#define MAX_REGIONS	4096
+#define MAX_SAMPLES	1000000
+#define MAX_NODES	8192
+#define LEAF_REGIONS	3		// stop splitting at this many regions
+#define MAX_DEPTH	16
+#define SCORE_SAMPLES	4000		// samples a split is scored on
+#define TOL		1e-9
+
+/*******************************************************************************
+* qp_t
+*
+* J = 1/2 U'HU + x'F'U subject to GU <= w + Sx, U the free moves
+*******************************************************************************/
+typedef struct qp_t{
+	int nu, nc;
+	double h[MAX_U][MAX_U], hinv[MAX_U][MAX_U];
+	double f[MAX_U][NX];
+	double g[MAX_CON][MAX_U];
+	double w[MAX_CON], s[MAX_CON][NX];
+	double d[MAX_CON][NX];		// S + G H^-1 F, the dual's dependence on x
+	double hinv_f[MAX_U][NX];	// H^-1 F
+}qp_t;
+
+// u0 = f.x + g over {x : a x <= b}
+typedef struct region_t{
+	uint32_t active;
+	double f[NX], g;
+	int nf;
+	double a[MAX_FACETS][NX], b[MAX_FACETS];
+}region_t;
+
+typedef struct node_t{
+	double h[NX], c;		// h.x <= c goes to child[0]
+	int child[2];			// node index, or -1-leaf
+}node_t;
+
+typedef struct leaf_t{
+	int first, n;			// into leaf_regions
+	int depth;
+}leaf_t;
+
+typedef struct sample_t{
+	double x[NX];
+	int region;			// -1 when the QP is infeasible
+}sample_t;
+
+// options
+static int horizon=30;
+static int blocks[MAX_U]={1,2,4}, num_blocks=3;
+static int checks[MAX_CON/2]={5,10,20,30}, num_checks=4;
+static double qw[NX]={10,0.1,1,0.1}, rw=1;
+static double box[NX]={0.45,6.0,1.0,20.0};
+static int num_samples=100000, num_valid=5000;
+
+static qp_t qp;
+static mat_t ad, bd, kl, pl;
+static double rate[MIP_MEAS];
+static region_t* regions;
+static int num_regions=0;
+static sample_t* samples;
+static node_t nodes[MAX_NODES];
+static int num_nodes=0;
+static leaf_t leaves[MAX_NODES];
+static int num_leaves=0;
+static int* leaf_regions;
+static int num_leaf_regions=0;
+static uint64_t rng=0x9e3779b97f4a7c15ULL;
+
+static void print_usage(){
+	printf("\nUsage: mpcgen [options]\n");
+	printf("-N ticks     prediction horizon (default %d)\n", horizon);
+	printf("-u \"b1 b2..\" duty held over blocks of b ticks, the last move holds\n");
+	printf("             to the end of the horizon (default \"1 2 4\")\n");
+	printf("-c \"k1 k2..\" ticks |theta| <= THETA_REF_MAX is checked at (default \"5 10 20 30\")\n");
+	printf("-q \"Qth Qthd Qphi Qphid\"  state weights (default \"10 0.1 1 0.1\")\n");
+	printf("-r R         duty weight (default 1)\n");
+	printf("-b \"th thd phi phid\"  state box the table covers (default \"0.45 6 1 20\")\n");
+	printf("-s n         samples (default %d)\n", num_samples);
+	printf("-v n         validation samples (default %d)\n", num_valid);
+	printf("-o file      write the table there instead of stdout\n\n");
+}
+
+static double urand(){
+	rng ^= rng<<13;
+	rng ^= rng>>7;
+	rng ^= rng<<17;
+	return (rng>>11)*(1.0/9007199254740992.0);
+}
+
+static int parse_list(const char* str, double* v, int max){
+	char* end;
+	int n=0;
+	while(n<max){
+		v[n] = strtod(str, &end);
+		if(end==str) break;
+		str = end;
+		n++;
+	}
+	return n;
+}
+
+static double dot(const double* a, const double* b, int n){
+	double s=0;
+	int i;
+	for(i=0;i<n;i++) s += a[i]*b[i];
+	return s;
+}
+
+/*******************************************************************************
+* static int build_qp()
+*
+* Condenses the horizon: x_k = Ad^k x + sum Ad^(k-1-j) Bd u_j with u_j the
+* move of the block tick j falls in. Q on x_1..x_N-1, the Riccati P on x_N,
+* R on every tick's duty.
+*******************************************************************************/
+static int build_qp(){
+	mat_t q, r, phi, tmp;
+	double gam[NX][MAX_U], next[NX][MAX_U], w[NX][NX];
+	int move[MAX_N];
+	int i, j, k, l, t, c;
+
+	mip_model_d(SAMPLE_RATE_D1_HZ, &ad, &bd);
+	q = mat_zero(NX, NX);
+	for(i=0;i<NX;i++) q.a[i][i] = qw[i];
+	r = mat_zero(1, 1);
+	r.a[0][0] = rw;
+	if(dlqr(&ad, &bd, &q, &r, &kl, &pl) || mip_rate_coefs(&ad, &bd, rate)) return -1;
+
+	// which move each tick uses, the last one runs to the horizon
+	for(t=0,k=0;k<num_blocks;k++){
+		for(i=0;i<blocks[k] && t<horizon;i++) move[t++] = k;
+	}
+	for(;t<horizon;t++) move[t] = num_blocks-1;
+
+	memset(&qp, 0, sizeof(qp));
+	qp.nu = num_blocks;
+	for(t=0;t<horizon;t++) qp.h[move[t]][move[t]] += 2*rw;
+
+	phi = mat_eye(NX);
+	memset(gam, 0, sizeof(gam));
+	c = 0;
+	for(t=1;t<=horizon;t++){
+		// x_t = phi x + gam U, from x_t-1 and u_t-1
+		for(i=0;i<NX;i++){
+			for(k=0;k<qp.nu;k++){
+				next[i][k] = 0;
+				for(j=0;j<NX;j++) next[i][k] += ad.a[i][j]*gam[j][k];
+			}
+			next[i][move[t-1]] += bd.a[i][0];
+		}
+		memcpy(gam, next, sizeof(gam));
+		tmp = mat_mul(&ad, &phi);
+		phi = tmp;
+
+		// weight on x_t
+		for(i=0;i<NX;i++) for(j=0;j<NX;j++) w[i][j] = t<horizon ? q.a[i][j] : pl.a[i][j];
+		for(k=0;k<qp.nu;k++){
+			for(l=0;l<qp.nu;l++){
+				for(i=0;i<NX;i++) for(j=0;j<NX;j++) qp.h[k][l] += 2*gam[i][k]*w[i][j]*gam[j][l];
+			}
+			for(l=0;l<NX;l++){
+				for(i=0;i<NX;i++) for(j=0;j<NX;j++) qp.f[k][l] += 2*gam[i][k]*w[i][j]*phi.a[j][l];
+			}
+		}
+
+		// +-theta_t <= THETA_REF_MAX -+ phi[0].x
+		for(i=0;i<num_checks;i++) if(checks[i]==t) break;
+		if(i==num_checks) continue;
+		for(k=0;k<qp.nu;k++){
+			qp.g[c][k] = gam[0][k];
+			qp.g[c+1][k] = -gam[0][k];
+		}
+		qp.w[c] = qp.w[c+1] = THETA_REF_MAX;
+		for(l=0;l<NX;l++){
+			qp.s[c][l] = -phi.a[0][l];
+			qp.s[c+1][l] = phi.a[0][l];
+		}
+		c += 2;
+	}
+	// +-U_k <= 1
+	for(k=0;k<qp.nu;k++){
+		qp.g[c][k] = 1;
+		qp.g[c+1][k] = -1;
+		qp.w[c] = qp.w[c+1] = 1;
+		c += 2;
+	}
+	qp.nc = c;
+
+	tmp = mat_zero(qp.nu, qp.nu);
+	for(k=0;k<qp.nu;k++) for(l=0;l<qp.nu;l++) tmp.a[k][l] = qp.h[k][l];
+	if(mat_inverse(&tmp, &phi)) return -1;
+	for(k=0;k<qp.nu;k++) for(l=0;l<qp.nu;l++) qp.hinv[k][l] = phi.a[k][l];
+	for(k=0;k<qp.nu;k++){
+		for(l=0;l<NX;l++){
+			qp.hinv_f[k][l] = 0;
+			for(j=0;j<qp.nu;j++) qp.hinv_f[k][l] += qp.hinv[k][j]*qp.f[j][l];
+		}
+	}
+	for(i=0;i<qp.nc;i++){
+		for(l=0;l<NX;l++){
+			qp.d[i][l] = qp.s[i][l];
+			for(k=0;k<qp.nu;k++) qp.d[i][l] += qp.g[i][k]*qp.hinv_f[k][l];
+		}
+	}
+	return 0;
+}
+
+/*******************************************************************************
+* static int active_law(uint32_t active, double ux[][NX], double uc[],
+*					double lx[][NX], double lc[])
+*
+* With the constraints in active held with equality, U = ux x + uc and the
+* multipliers lambda = lx x + lc, one row per active constraint in index
+* order. -1 when the active rows are linearly dependent.
+*******************************************************************************/
+static int active_law(uint32_t active, double ux[][NX], double uc[],\
+				double lx[][NX], double lc[]){
+	int idx[MAX_U], na=0, i, j, k, l;
+	double hg[MAX_U][MAX_U], t;
+	mat_t m, mi, chk;
+
+	for(i=0;i<qp.nc;i++){
+		if(!(active&(1u<<i))) continue;
+		if(na==qp.nu) return -1;
+		idx[na++] = i;
+	}
+	for(k=0;k<qp.nu;k++){
+		for(l=0;l<NX;l++) ux[k][l] = -qp.hinv_f[k][l];
+		uc[k] = 0;
+	}
+	if(na==0) return 0;
+
+	// H^-1 G_A' and G_A H^-1 G_A'
+	for(k=0;k<qp.nu;k++){
+		for(j=0;j<na;j++){
+			hg[k][j] = 0;
+			for(l=0;l<qp.nu;l++) hg[k][j] += qp.hinv[k][l]*qp.g[idx[j]][l];
+		}
+	}
+	m = mat_zero(na, na);
+	for(i=0;i<na;i++){
+		for(j=0;j<na;j++){
+			m.a[i][j] = 0;
+			for(k=0;k<qp.nu;k++) m.a[i][j] += qp.g[idx[i]][k]*hg[k][j];
+		}
+	}
+	if(mat_inverse(&m, &mi)) return -1;
+	chk = mat_mul(&m, &mi);
+	for(i=0;i<na;i++){
+		for(j=0;j<na;j++) if(fabs(chk.a[i][j]-(i==j))>1e-6) return -1;
+	}
+	// lambda = -Mi (w_A + D_A x)
+	for(i=0;i<na;i++){
+		lc[i] = 0;
+		for(l=0;l<NX;l++) lx[i][l] = 0;
+		for(j=0;j<na;j++){
+			lc[i] -= mi.a[i][j]*qp.w[idx[j]];
+			for(l=0;l<NX;l++) lx[i][l] -= mi.a[i][j]*qp.d[idx[j]][l];
+		}
+	}
+	// U = -H^-1 (F x + G_A' lambda)
+	for(k=0;k<qp.nu;k++){
+		for(j=0;j<na;j++){
+			t = hg[k][j];
+			uc[k] -= t*lc[j];
+			for(l=0;l<NX;l++) ux[k][l] -= t*lx[j][l];
+		}
+	}
+	return 0;
+}
+
+/*******************************************************************************
+* static int solve_at(const double x[NX], uint32_t* active)
+*
+* Exact QP solution at x by trying active sets smallest first. The QP is
+* strictly convex, so the first set that is primal feasible with
+* nonnegative multipliers gives the optimum. -1 when none is, the QP is
+* infeasible at x. Slow, only used for samples no known region covers.
+*******************************************************************************/
+static int try_set(uint32_t a, const double x[NX]){
+	double ux[MAX_U][NX], uc[MAX_U], lx[MAX_U][NX], lc[MAX_U], u[MAX_U];
+	int i, k, na=0;
+
+	if(active_law(a, ux, uc, lx, lc)) return 0;
+	for(i=0;i<qp.nc;i++){
+		if(!(a&(1u<<i))) continue;
+		if(dot(lx[na], x, NX)+lc[na] < -TOL) return 0;
+		na++;
+	}
+	for(k=0;k<qp.nu;k++) u[k] = dot(ux[k], x, NX)+uc[k];
+	for(i=0;i<qp.nc;i++){
+		if(a&(1u<<i)) continue;
+		if(dot(qp.g[i], u, qp.nu) > qp.w[i]+dot(qp.s[i], x, NX)+TOL) return 0;
+	}
+	return 1;
+}
+
+static int solve_rec(const double x[NX], uint32_t a, int from, int left, uint32_t* active){
+	int i;
+	if(left==0) return try_set(a, x) ? (*active=a, 0) : -1;
+	for(i=from;i<qp.nc;i++){
+		// +bound and -bound of the same row can't both hold
+		if((i&1) && (a&(1u<<(i-1)))) continue;
+		if(solve_rec(x, a|(1u<<i), i+1, left-1, active)==0) return 0;
+	}
+	return -1;
+}
+
+static int solve_at(const double x[NX], uint32_t* active){
+	int n;
+	for(n=0;n<=qp.nu;n++) if(solve_rec(x, 0, 0, n, active)==0) return 0;
+	return -1;
+}
+
+static int in_region(const region_t* r, const double x[NX], double tol){
+	int i;
+	for(i=0;i<r->nf;i++) if(dot(r->a[i], x, NX) > r->b[i]+tol) return 0;
+	return 1;
+}
+
+/*******************************************************************************
+* static int lp_max(int m, double a[][NX], const double* r, const double* c,
+*						double* val)
+*
+* max c.y subject to a y <= r with r >= 0, y free, by the tableau simplex
+* with Bland's rule from y = 0. y = p - q with p, q >= 0. Returns -1 when
+* unbounded, which the box rows rule out.
+*******************************************************************************/
+static int lp_max(int m, double a[][NX], const double* r, const double* c, double* val){
+	static double t[MAX_FACETS+1][2*NX+MAX_FACETS+1];
+	int basis[MAX_FACETS];
+	int nv=2*NX, cols=nv+m, i, j, e, lv, it;
+	double best, ratio, p;
+
+	memset(t, 0, sizeof(t));
+	for(i=0;i<m;i++){
+		for(j=0;j<NX;j++){
+			t[i][j] = a[i][j];
+			t[i][NX+j] = -a[i][j];
+		}
+		t[i][nv+i] = 1;
+		t[i][cols] = r[i]>0 ? r[i] : 0;
+		basis[i] = nv+i;
+	}
+	for(j=0;j<NX;j++){
+		t[m][j] = -c[j];
+		t[m][NX+j] = c[j];
+	}
+	for(it=0;it<1000;it++){
+		for(e=0;e<cols;e++) if(t[m][e] < -1e-12) break;
+		if(e==cols) break;
+		lv = -1;
+		best = 0;
+		for(i=0;i<m;i++){
+			if(t[i][e] <= 1e-12) continue;
+			ratio = t[i][cols]/t[i][e];
+			if(lv<0 || ratio<best-1e-15 || (ratio<best+1e-15 && basis[i]<basis[lv])){
+				lv = i;
+				best = ratio;
+			}
+		}
+		if(lv<0) return -1;
+		p = t[lv][e];
+		for(j=0;j<=cols;j++) t[lv][j] /= p;
+		for(i=0;i<=m;i++){
+			if(i==lv || t[i][e]==0) continue;
+			p = t[i][e];
+			for(j=0;j<=cols;j++) t[i][j] -= p*t[lv][j];
+		}
+		basis[lv] = e;
+	}
+	*val = t[m][cols];
+	return 0;
+}
+
+/*******************************************************************************
+* static int add_region(uint32_t active, const double x0[NX])
+*
+* Region of the active set x0 was solved with: the multiplier rows of the
+* active constraints and the primal rows of the inactive ones, pruned
+* against each other and the box by LP from x0. Returns its index.
+*******************************************************************************/
+static int add_region(uint32_t active, const double x0[NX]){
+	double ux[MAX_U][NX], uc[MAX_U], lx[MAX_U][NX], lc[MAX_U];
+	double a[MAX_FACETS][NX], b[MAX_FACETS], rr[MAX_FACETS];
+	double ta[MAX_FACETS][NX], val;
+	int keep[MAX_FACETS];
+	int n=0, na=0, i, j, k, l, m;
+	region_t* rg;
+
+	if(num_regions==MAX_REGIONS){
+		fprintf(stderr,"ERROR: more than %d regions\n", MAX_REGIONS);
+		return -1;
+	}
+	if(active_law(active, ux, uc, lx, lc)) return -1;
+	for(i=0;i<qp.nc;i++){
+		if(active&(1u<<i)){
+			// lambda >= 0
+			for(l=0;l<NX;l++) a[n][l] = -lx[na][l];
+			b[n++] = lc[na++];
+			continue;
+		}
+		// G_i (ux x + uc) <= w_i + S_i x
+		for(l=0;l<NX;l++){
+			a[n][l] = -qp.s[i][l];
+			for(k=0;k<qp.nu;k++) a[n][l] += qp.g[i][k]*ux[k][l];
+		}
+		b[n] = qp.w[i] - dot(qp.g[i], uc, qp.nu);
+		n++;
+	}
+	// the box, only there to bound the LPs
+	for(l=0;l<NX;l++){
+		for(j=0;j<2;j++){
+			memset(a[n], 0, sizeof(a[n]));
+			a[n][l] = j ? -1 : 1;
+			b[n++] = box[l];
+		}
+	}
+	// drop rows that are all zero, then every row the others already imply
+	for(i=0;i<n;i++){
+		keep[i] = 1;
+		if(dot(a[i], a[i], NX) < 1e-24) keep[i] = 0;
+	}
+	for(i=0;i<n-2*NX;i++){
+		if(!keep[i]) continue;
+		for(m=0,j=0;j<n;j++){
+			if(j==i || !keep[j]) continue;
+			memcpy(ta[m], a[j], sizeof(ta[m]));
+			rr[m++] = b[j] - dot(a[j], x0, NX);
+		}
+		if(lp_max(m, ta, rr, a[i], &val)==0 && val <= b[i]-dot(a[i], x0, NX)+1e-9) keep[i] = 0;
+	}
+
+	rg = &regions[num_regions];
+	rg->active = active;
+	for(l=0;l<NX;l++) rg->f[l] = ux[0][l];
+	rg->g = uc[0];
+	rg->nf = 0;
+	for(i=0;i<n-2*NX;i++){
+		if(!keep[i]) continue;
+		// unit normals, so the tolerance online is a distance
+		val = sqrt(dot(a[i], a[i], NX));
+		for(l=0;l<NX;l++) rg->a[rg->nf][l] = a[i][l]/val;
+		rg->b[rg->nf++] = b[i]/val;
+	}
+	return num_regions++;
+}
+
+static void random_state(double x[NX]){
+	int i;
+	for(i=0;i<NX;i++) x[i] = (2*urand()-1)*box[i];
+}
+
+/*******************************************************************************
+* static int label(const double x[NX])
+*
+* region holding x, a new one if no known region does, -1 if infeasible
+*******************************************************************************/
+static int label(const double x[NX]){
+	uint32_t active;
+	int i;
+
+	for(i=0;i<num_regions;i++) if(in_region(&regions[i], x, 1e-9)) return i;
+	if(solve_at(x, &active)) return -1;
+	for(i=0;i<num_regions;i++) if(regions[i].active==active) return i;
+	return add_region(active, x);
+}
+
+/*******************************************************************************
+* static int build_tree(int* idx, int n, int depth)
+*
+* Splits the samples on the facet hyperplane that leaves the fewest regions
+* on the worse side, scored on a stride of the samples. Returns the node
+* index, or -1-leaf.
+*******************************************************************************/
+static int count_side(int* idx, int n, int stride, const double* h, double c, int side,\
+			int* stamp, int mark){
+	int i, cnt=0, r;
+	for(i=0;i<n;i+=stride){
+		if((dot(h, samples[idx[i]].x, NX) <= c) != (side==0)) continue;
+		r = samples[idx[i]].region;
+		if(r<0 || stamp[r]==mark) continue;
+		stamp[r] = mark;
+		cnt++;
+	}
+	return cnt;
+}
+
+static int build_tree(int* idx, int n, int depth){
+	static int stamp[MAX_REGIONS], mark=0;
+	static int cand[MAX_REGIONS];
+	int ncand=0, i, j, k, r, stride, nl, nr, worst, best=-1, best_sum=0;
+	int bi=0, bj=0, me;
+	double* h;
+	node_t* nd;
+	leaf_t* lf;
+
+	mark++;
+	for(i=0;i<n;i++){
+		r = samples[idx[i]].region;
+		if(r<0 || stamp[r]==mark) continue;
+		stamp[r] = mark;
+		cand[ncand++] = r;
+	}
+	stride = n>SCORE_SAMPLES ? n/SCORE_SAMPLES : 1;
+	if(ncand>LEAF_REGIONS && depth<MAX_DEPTH && num_nodes<MAX_NODES){
+		for(i=0;i<ncand;i++){
+			for(j=0;j<regions[cand[i]].nf;j++){
+				h = regions[cand[i]].a[j];
+				nl = count_side(idx, n, stride, h, regions[cand[i]].b[j], 0, stamp, ++mark);
+				nr = count_side(idx, n, stride, h, regions[cand[i]].b[j], 1, stamp, ++mark);
+				if(nl==0 || nr==0) continue;
+				worst = nl>nr ? nl : nr;
+				if(best<0 || worst<best || (worst==best && nl+nr<best_sum)){
+					best = worst;
+					best_sum = nl+nr;
+					bi = cand[i];
+					bj = j;
+				}
+			}
+		}
+	}
+	if(best<0 || best>=ncand){
+		lf = &leaves[num_leaves];
+		lf->first = num_leaf_regions;
+		lf->n = ncand;
+		lf->depth = depth;
+		for(i=0;i<ncand;i++) leaf_regions[num_leaf_regions++] = cand[i];
+		return -1-num_leaves++;
+	}
+
+	me = num_nodes++;
+	nd = &nodes[me];
+	memcpy(nd->h, regions[bi].a[bj], sizeof(nd->h));
+	nd->c = regions[bi].b[bj];
+	// partition in place, h.x <= c first
+	for(i=0,k=n;i<k;){
+		if(dot(nd->h, samples[idx[i]].x, NX) <= nd->c) i++;
+		else{
+			j = idx[i];
+			idx[i] = idx[--k];
+			idx[k] = j;
+		}
+	}
+	nodes[me].child[0] = build_tree(idx, k, depth+1);
+	nodes[me].child[1] = build_tree(idx+k, n-k, depth+1);
+	return me;
+}
+
+/*******************************************************************************
+* static double lookup(const double x[NX], int* region, int* dots)
+*
+* what mpc_lookup() in ../mpc.c does with the written table, in double
+*******************************************************************************/
+static double fallback(const double x[NX]){
+	double u=0;
+	int i;
+	for(i=0;i<NX;i++) u -= kl.a[0][i]*x[i];
+	return u>1 ? 1 : (u<-1 ? -1 : u);
+}
+
+static double lookup(const double x[NX], int* region, int* dots){
+	int n=0, d=0, i;
+	const leaf_t* lf;
+	const region_t* r;
+
+	if(num_nodes==0) n = -1;
+	while(n>=0){
+		d++;
+		n = nodes[n].child[dot(nodes[n].h, x, NX) <= nodes[n].c ? 0 : 1];
+	}
+	lf = &leaves[-1-n];
+	for(i=0;i<lf->n;i++){
+		r = &regions[leaf_regions[lf->first+i]];
+		d += r->nf;
+		if(!in_region(r, x, 1e-6)) continue;
+		*region = leaf_regions[lf->first+i];
+		*dots = d+1;
+		return dot(r->f, x, NX)+r->g;
+	}
+	*region = -1;
+	*dots = d+1;
+	return fallback(x);
+}
+
+static int worst_dots(){
+	int i, j, d, worst=0;
+	for(i=0;i<num_leaves;i++){
+		d = leaves[i].depth+1;
+		for(j=0;j<leaves[i].n;j++) d += regions[leaf_regions[leaves[i].first+j]].nf;
+		if(d>worst) worst = d;
+	}
+	return worst;
+}
+
+// round off from the solves left as is would print as 1e-17 gains
+#define SNAP(v)		(fabs(v)<1e-9 ? 0.0 : (v))
+
+static void print_floats(FILE* f, const double* v, int n){
+	int i;
+	fprintf(f, "{");
+	for(i=0;i<n;i++) fprintf(f, "%s%.9g", i ? "," : "", SNAP(v[i]));
+	fprintf(f, "}");
+}
+
+static void write_table(FILE* f, const char* spec, int facets, int worst, double match,\
+			double max_err, double infeasible){
+	int i, j, k;
+
+	fprintf(f, "/*******************************************************************************\n");
+	fprintf(f, "* mpc_table.h\n*\n* Written by mpcgen%s, don't edit. Read by mpc.c only.\n", spec);
+	fprintf(f, "* %d regions, %d facets, %d tree nodes, %d leaves, at most %d dot products.\n",\
+		num_regions, facets, num_nodes, num_leaves, worst);
+	fprintf(f, "* %.2f%% of %d fresh states match the QP (worst %.2g duty), %.1f%% infeasible.\n",\
+		100*match, num_valid, max_err, 100*infeasible);
+	fprintf(f, "*******************************************************************************/\n\n");
+	fprintf(f, "#define MPC_REGIONS\t%d\n#define MPC_FACETS\t%d\n#define MPC_NODES\t%d\n",\
+		num_regions, facets, num_nodes);
+	fprintf(f, "#define MPC_LEAVES\t%d\n#define MPC_WORST_DOTS\t%d\n\n", num_leaves, worst);
+
+	fprintf(f, "// phi_dot from theta, theta_dot, phi, and phi and duty of the last tick\n");
+	fprintf(f, "static const float mpc_rate[%d] = ", MIP_MEAS);
+	print_floats(f, rate, MIP_MEAS);
+	fprintf(f, ";\n// state box the table covers, the state is clamped into it\nstatic const float mpc_box[%d] = ", NX);
+	print_floats(f, box, NX);
+	fprintf(f, ";\n// LQR outside every region, clamped to +-1\nstatic const float mpc_k[%d] = ", NX);
+	print_floats(f, kl.a[0], NX);
+	fprintf(f, ";\n\nstatic const mpc_region_t mpc_regions[%d] = {\n", num_regions);
+	for(i=0,k=0;i<num_regions;i++){
+		fprintf(f, "\t{");
+		print_floats(f, regions[i].f, NX);
+		fprintf(f, ",%.9g,%d,%d},\n", SNAP(regions[i].g), k, regions[i].nf);
+		k += regions[i].nf;
+	}
+	fprintf(f, "};\n\nstatic const mpc_facet_t mpc_facets[%d] = {\n", facets);
+	for(i=0;i<num_regions;i++){
+		for(j=0;j<regions[i].nf;j++){
+			fprintf(f, "\t{");
+			print_floats(f, regions[i].a[j], NX);
+			fprintf(f, ",%.9g},\n", SNAP(regions[i].b[j]));
+		}
+	}
+	fprintf(f, "};\n\nstatic const mpc_node_t mpc_nodes[%d] = {\n", num_nodes ? num_nodes : 1);
+	for(i=0;i<num_nodes;i++){
+		fprintf(f, "\t{");
+		print_floats(f, nodes[i].h, NX);
+		fprintf(f, ",%.9g,{%d,%d}},\n", SNAP(nodes[i].c), nodes[i].child[0], nodes[i].child[1]);
+	}
+	if(num_nodes==0) fprintf(f, "\t{{0,0,0,0},0,{-1,-1}},\n");
+	fprintf(f, "};\n\nstatic const mpc_leaf_t mpc_leaves[%d] = {\n", num_leaves);
+	for(i=0;i<num_leaves;i++) fprintf(f, "\t{%d,%d},\n", leaves[i].first, leaves[i].n);
+	fprintf(f, "};\n\nstatic const uint16_t mpc_leaf_regions[%d] = {", num_leaf_regions);
+	for(i=0;i<num_leaf_regions;i++) fprintf(f, "%s%s%d", i ? "," : "", i%20 ? "" : "\n\t", leaf_regions[i]);
+	fprintf(f, "\n};\n");
+}
+
+int main(int argc, char* argv[]){
+	FILE* out=stdout;
+	char spec[512]="";
+	double v[MAX_CON], x[NX], u, uq, err, max_err=0;
+	double ux[MAX_U][NX], uc[MAX_U], lx[MAX_U][NX], lc[MAX_U];
+	struct timespec t0, t1;
+	int* idx;
+	int i, n, r, d, match=0, infeasible=0, facets=0;
+	uint32_t active;
+
+	for(i=1;i<argc;i++){
+		if(i+1>=argc){
+			print_usage();
+			return -1;
+		}
+		// options as given, for the header of the table
+		if(strcmp(argv[i],"-o")!=0){
+			n = strlen(spec);
+			snprintf(spec+n, sizeof(spec)-n, strchr(argv[i+1],' ') ? " %s \"%s\"" : " %s %s",\
+				argv[i], argv[i+1]);
+		}
+		if(strcmp(argv[i],"-N")==0) horizon = atoi(argv[++i]);
+		else if(strcmp(argv[i],"-r")==0) rw = atof(argv[++i]);
+		else if(strcmp(argv[i],"-s")==0) num_samples = atoi(argv[++i]);
+		else if(strcmp(argv[i],"-v")==0) num_valid = atoi(argv[++i]);
+		else if(strcmp(argv[i],"-u")==0){
+			num_blocks = parse_list(argv[++i], v, MAX_U);
+			for(n=0;n<num_blocks;n++) blocks[n] = (int)v[n];
+		}
+		else if(strcmp(argv[i],"-c")==0){
+			num_checks = parse_list(argv[++i], v, MAX_CON/2);
+			for(n=0;n<num_checks;n++) checks[n] = (int)v[n];
+		}
+		else if(strcmp(argv[i],"-q")==0){
+			if(parse_list(argv[++i], qw, NX)!=NX) num_blocks = 0;
+		}
+		else if(strcmp(argv[i],"-b")==0){
+			if(parse_list(argv[++i], box, NX)!=NX) num_blocks = 0;
+		}
+		else if(strcmp(argv[i],"-o")==0){
+			out = fopen(argv[++i], "w");
+			if(out==NULL){
+				perror(argv[i]);
+				return -1;
+			}
+		}
+		else num_blocks = 0;
+	}
+	if(num_blocks<1 || horizon<1 || horizon>MAX_N || rw<=0 || num_samples<1 ||\
+	   num_samples>MAX_SAMPLES || 2*(num_blocks+num_checks)>MAX_CON){
+		print_usage();
+		return -1;
+	}
+	if(build_qp()){
+		fprintf(stderr,"ERROR: can't build the QP, check the weights\n");
+		return -1;
+	}
+
+	regions = malloc(MAX_REGIONS*sizeof(region_t));
+	samples = malloc(num_samples*sizeof(sample_t));
+	idx = malloc(num_samples*sizeof(int));
+	// leaves split the samples, so they can't list more regions than that
+	leaf_regions = malloc(num_samples*sizeof(int));
+	if(regions==NULL || samples==NULL || idx==NULL || leaf_regions==NULL){
+		fprintf(stderr,"ERROR: out of memory\n");
+		return -1;
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &t0);
+	// the unconstrained region first, it covers most of what balancing sees
+	memset(x, 0, sizeof(x));
+	label(x);
+	for(i=0;i<num_samples;i++){
+		random_state(samples[i].x);
+		samples[i].region = label(samples[i].x);
+		idx[i] = i;
+	}
+	build_tree(idx, num_samples, 0);
+	clock_gettime(CLOCK_MONOTONIC, &t1);
+	for(i=0;i<num_regions;i++) facets += regions[i].nf;
+
+	// fresh states against the QP itself
+	for(i=0;i<num_valid;i++){
+		random_state(x);
+		u = lookup(x, &r, &d);
+		if(solve_at(x, &active) || active_law(active, ux, uc, lx, lc)){
+			infeasible++;
+			uq = fallback(x);
+		}
+		else uq = dot(ux[0], x, NX)+uc[0];
+		err = fabs(u-uq);
+		if(err<1e-4) match++;
+		if(err>max_err) max_err = err;
+	}
+
+	fprintf(stderr, "%d regions, %d facets, %d nodes, %d leaves, worst case %d dot products\n",\
+		num_regions, facets, num_nodes, num_leaves, worst_dots());
+	fprintf(stderr, "%.2f%% of %d fresh states match the QP, worst %.3g duty, %.1f%% infeasible\n",\
+		100.0*match/num_valid, num_valid, max_err, 100.0*infeasible/num_valid);
+	fprintf(stderr, "generated in %.1fs\n", (t1.tv_sec-t0.tv_sec)+(t1.tv_nsec-t0.tv_nsec)/1e9);
+	write_table(out, spec, facets, worst_dots(), (double)match/num_valid, max_err,\
+		(double)infeasible/num_valid);
+	if(out!=stdout) fclose(out);
+	return 0;
+}
@@ -0,0 +1,391 @@
+/*******************************************************************************
+* perf_prof.c
+*
+* perf_event_open implementation of perf_prof.h. A run is two read()s of
+* the group and two clock_gettime()s, a few us on the BeagleBone, and the
+* counts include the tail of the first read and the head of the second.
+*******************************************************************************/
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <stdatomic.h>
+#include <sys/syscall.h>
+#include <sys/resource.h>
+#include <linux/perf_event.h>
+#include "perf_prof.h"
+
+#ifndef PERF_FLAG_FD_CLOEXEC
+#define PERF_FLAG_FD_CLOEXEC	(1UL<<3)
+#endif
+
+#define HIST_SUB_BITS	2	// 4 bins per power of two, 25% wide
+#define HIST_BINS	256	// covers all of uint64_t
+
+typedef struct perf_event_t{
+	uint32_t type;
+	uint64_t config;
+}perf_event_t;
+
+static const perf_event_t events[PERF_NUM_METRICS] = {
+	{0, 0},		// PERF_NS is the clock
+	{PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES},
+	{PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS},
+	{PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES},
+	{PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES},
+	{PERF_TYPE_SOFTWARE, PERF_COUNT_SW_CONTEXT_SWITCHES}
+};
+
+static const char* metric_names[PERF_NUM_METRICS] = {
+	"ns", "cycles", "instructions", "cache-misses", "branch-misses", "ctx-switches"
+};
+
+/*******************************************************************************
+* perf_group_t
+*
+* One thread's counters, all read at once through the leader
+*******************************************************************************/
+typedef struct perf_group_t{
+	pid_t tid;
+	int leader;			// -1 when nothing opened
+	int fd[PERF_NUM_METRICS];	// -1 if not open, fd[PERF_NS] unused
+	int slot[PERF_NUM_METRICS];	// position in a group read, -1 if not open
+	int nr;
+	int user_only;			// hardware events leave out the kernel
+	int hw_errno;			// why the first missing hardware event failed
+	int rusage_cs;			// context switches from getrusage() instead
+}perf_group_t;
+
+typedef struct perf_run_t{
+	uint64_t run;			// which run of the region, from 0
+	uint64_t v[PERF_NUM_METRICS];
+	unsigned int valid;		// bit per metric
+}perf_run_t;
+
+typedef struct perf_region_t{
+	const char* name;
+	perf_group_t* group;		// of the thread that enters it
+	uint64_t start[PERF_NUM_METRICS];
+	uint64_t start_enabled, start_running;
+	int start_ok;
+	uint64_t runs;
+	uint64_t partial;		// runs the group was multiplexed out for
+	uint64_t n[PERF_NUM_METRICS];	// runs each metric was counted in
+	uint64_t sum[PERF_NUM_METRICS];
+	uint64_t max[PERF_NUM_METRICS];
+	uint32_t hist[PERF_NUM_METRICS][HIST_BINS];
+	perf_run_t worst[PERF_WORST];	// slowest first
+	int num_worst;
+}perf_region_t;
+
+static perf_region_t regions[PERF_MAX_REGIONS];
+static _Atomic int num_regions=0;
+static perf_group_t groups[PERF_MAX_THREADS];
+static _Atomic int num_groups=0;
+static __thread perf_group_t* thread_group=NULL;
+static __thread int thread_tried=0;
+
+static uint64_t now_ns(){
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec*1000000000ULL + ts.tv_nsec;
+}
+
+static uint64_t thread_ctx_switches(){
+	struct rusage u;
+	if(getrusage(RUSAGE_THREAD, &u)) return 0;
+	return u.ru_nvcsw + u.ru_nivcsw;
+}
+
+/*******************************************************************************
+* static int hist_bin(uint64_t v)
+*
+* exact below 8, then 4 bins per power of two
+*******************************************************************************/
+static int hist_bin(uint64_t v){
+	int e;
+
+	if(v < (2<<HIST_SUB_BITS)) return (int)v;
+	e = 63-__builtin_clzll(v);
+	return ((e-HIST_SUB_BITS+1)<<HIST_SUB_BITS) +\
+		(int)((v>>(e-HIST_SUB_BITS)) - (1<<HIST_SUB_BITS));
+}
+
+// middle of the values that land in bin b
+static uint64_t hist_mid(int b){
+	int e;
+
+	if(b < (2<<HIST_SUB_BITS)) return b;
+	e = (b>>HIST_SUB_BITS) + HIST_SUB_BITS - 1;
+	return ((uint64_t)((b&((1<<HIST_SUB_BITS)-1)) + (1<<HIST_SUB_BITS)) << (e-HIST_SUB_BITS)) +\
+		((1ULL<<(e-HIST_SUB_BITS))>>1);
+}
+
+// value below which permille/1000 of the n runs fall, to a bin
+static uint64_t hist_percentile(const uint32_t* h, uint64_t n, int permille, uint64_t max){
+	uint64_t want=(n*permille+999)/1000, seen=0, v;
+	int b;
+
+	if(want==0) want = 1;
+	for(b=0;b<HIST_BINS;b++){
+		seen += h[b];
+		if(seen>=want){
+			v = hist_mid(b);
+			return v>max ? max : v;
+		}
+	}
+	return max;
+}
+
+static int open_event(int m, int group_fd, int user_only){
+	struct perf_event_attr a;
+
+	memset(&a, 0, sizeof(a));
+	a.size = sizeof(a);
+	a.type = events[m].type;
+	a.config = events[m].config;
+	a.read_format = PERF_FORMAT_GROUP | PERF_FORMAT_TOTAL_TIME_ENABLED |\
+			PERF_FORMAT_TOTAL_TIME_RUNNING;
+	a.exclude_kernel = user_only;
+	a.exclude_hv = user_only;
+	return syscall(SYS_perf_event_open, &a, 0, -1, group_fd, PERF_FLAG_FD_CLOEXEC);
+}
+
+/*******************************************************************************
+* static void open_group(perf_group_t* g)
+*
+* Counters for the calling thread, on any CPU. The hardware events are
+* tried with the kernel first, then in user space only if that is refused.
+* Context switches happen in the kernel, they need a kernel counting event
+* or else come from getrusage().
+*******************************************************************************/
+static void open_group(perf_group_t* g){
+	int m, fd;
+
+	memset(g, 0, sizeof(perf_group_t));
+	g->tid = syscall(SYS_gettid);
+	g->leader = -1;
+	for(m=0;m<PERF_NUM_METRICS;m++){
+		g->fd[m] = -1;
+		g->slot[m] = -1;
+	}
+	for(m=PERF_CYCLES;m<=PERF_BRANCH_MISSES;m++){
+		fd = open_event(m, g->leader, g->user_only);
+		if(fd<0 && g->leader<0 && (errno==EACCES || errno==EPERM)){
+			g->user_only = 1;
+			fd = open_event(m, g->leader, 1);
+		}
+		if(fd<0){
+			if(g->hw_errno==0) g->hw_errno = errno;
+			continue;
+		}
+		if(g->leader<0) g->leader = fd;
+		g->fd[m] = fd;
+		g->slot[m] = g->nr++;
+	}
+	fd = open_event(PERF_CTX_SWITCHES, g->leader, 0);
+	if(fd<0){
+		g->rusage_cs = 1;
+		return;
+	}
+	if(g->leader<0) g->leader = fd;
+	g->fd[PERF_CTX_SWITCHES] = fd;
+	g->slot[PERF_CTX_SWITCHES] = g->nr++;
+}
+
+// the calling thread's group, opened on its first call, NULL if out of room
+static perf_group_t* this_thread_group(){
+	int i;
+
+	if(thread_tried) return thread_group;
+	thread_tried = 1;
+	i = atomic_fetch_add_explicit(&num_groups, 1, memory_order_relaxed);
+	if(i>=PERF_MAX_THREADS) return NULL;
+	open_group(&groups[i]);
+	thread_group = &groups[i];
+	return thread_group;
+}
+
+static int read_group(const perf_group_t* g, uint64_t* v, uint64_t* enabled, uint64_t* running){
+	uint64_t buf[3+PERF_NUM_METRICS];
+	int m;
+
+	if(g->leader<0) return -1;
+	if(read(g->leader, buf, sizeof(buf)) < (ssize_t)((3+g->nr)*sizeof(uint64_t))) return -1;
+	*enabled = buf[1];
+	*running = buf[2];
+	for(m=PERF_CYCLES;m<PERF_NUM_METRICS;m++){
+		if(g->slot[m]>=0) v[m] = buf[3+g->slot[m]];
+	}
+	return 0;
+}
+
+int perf_prof_region(const char* name){
+	int i = atomic_fetch_add_explicit(&num_regions, 1, memory_order_relaxed);
+
+	if(i>=PERF_MAX_REGIONS){
+		fprintf(stderr,"ERROR: no room to profile %s\n",name);
+		return -1;
+	}
+	memset(&regions[i], 0, sizeof(perf_region_t));
+	regions[i].name = name;
+	return i;
+}
+
+void perf_prof_begin(int region){
+	perf_region_t* r;
+
+	if(region<0 || region>=PERF_MAX_REGIONS) return;
+	r = &regions[region];
+	if(r->group==NULL) r->group = this_thread_group();
+	r->start_ok = r->group!=NULL &&\
+		read_group(r->group, r->start, &r->start_enabled, &r->start_running)==0;
+	if(r->group!=NULL && r->group->rusage_cs) r->start[PERF_CTX_SWITCHES] = thread_ctx_switches();
+	r->start[PERF_NS] = now_ns();
+}
+
+/*******************************************************************************
+* static void record(perf_region_t* r, const perf_run_t* run)
+*
+* into the sums and histograms, and the slowest list if it is slow enough
+*******************************************************************************/
+static void record(perf_region_t* r, const perf_run_t* run){
+	int m, i;
+
+	for(m=0;m<PERF_NUM_METRICS;m++){
+		if(!(run->valid & (1u<<m))) continue;
+		r->n[m]++;
+		r->sum[m] += run->v[m];
+		if(run->v[m]>r->max[m]) r->max[m] = run->v[m];
+		r->hist[m][hist_bin(run->v[m])]++;
+	}
+	for(i=r->num_worst; i>0 && r->worst[i-1].v[PERF_NS]<run->v[PERF_NS]; i--){
+		if(i<PERF_WORST) r->worst[i] = r->worst[i-1];
+	}
+	if(i<PERF_WORST){
+		r->worst[i] = *run;
+		if(r->num_worst<PERF_WORST) r->num_worst++;
+	}
+}
+
+void perf_prof_end(int region){
+	uint64_t now[PERF_NUM_METRICS], t, enabled, running;
+	perf_region_t* r;
+	perf_group_t* g;
+	perf_run_t run;
+	int m, counted;
+
+	if(region<0 || region>=PERF_MAX_REGIONS) return;
+	t = now_ns();
+	r = &regions[region];
+	g = r->group;
+	memset(&run, 0, sizeof(run));
+	run.run = r->runs++;
+	run.v[PERF_NS] = t-r->start[PERF_NS];
+	run.valid = 1u<<PERF_NS;
+	if(g==NULL){
+		record(r, &run);
+		return;
+	}
+	// counts are only whole if the group ran for all of the time it was enabled
+	counted = r->start_ok && read_group(g, now, &enabled, &running)==0 &&\
+		enabled-r->start_enabled==running-r->start_running;
+	if(g->leader>=0 && !counted) r->partial++;
+	for(m=PERF_CYCLES;m<PERF_NUM_METRICS;m++){
+		if(counted && g->slot[m]>=0){
+			run.v[m] = now[m]-r->start[m];
+			run.valid |= 1u<<m;
+		}
+	}
+	if(g->rusage_cs){
+		run.v[PERF_CTX_SWITCHES] = thread_ctx_switches()-r->start[PERF_CTX_SWITCHES];
+		run.valid |= 1u<<PERF_CTX_SWITCHES;
+	}
+	record(r, &run);
+}
+
+static void report_group(FILE* f, const perf_group_t* g){
+	int m, missing=0;
+
+	fprintf(f, "thread %d counts", (int)g->tid);
+	for(m=PERF_CYCLES;m<PERF_NUM_METRICS;m++){
+		if(g->slot[m]>=0) fprintf(f, " %s", metric_names[m]);
+	}
+	if(g->rusage_cs) fprintf(f, " %s (getrusage)", metric_names[PERF_CTX_SWITCHES]);
+	if(g->user_only) fprintf(f, ", user space only");
+	for(m=PERF_CYCLES;m<=PERF_BRANCH_MISSES;m++){
+		if(g->slot[m]>=0) continue;
+		fprintf(f, "%s %s", missing ? "" : ", not", metric_names[m]);
+		missing = 1;
+	}
+	if(missing) fprintf(f, " (%s)", strerror(g->hw_errno));
+	fprintf(f, "\n");
+}
+
+/*******************************************************************************
+* void perf_prof_report(FILE* f)
+*
+* Per region the runs each metric was counted in, its mean, median, 99th
+* percentile and max, then the slowest runs with every metric so a long run
+* can be told apart as cache misses, a context switch or just more work.
+* Percentiles are to the 25% histogram bins.
+*******************************************************************************/
+void perf_prof_report(FILE* f){
+	const perf_region_t* r;
+	int i, m, k, nr, ng;
+
+	nr = atomic_load_explicit(&num_regions, memory_order_acquire);
+	ng = atomic_load_explicit(&num_groups, memory_order_acquire);
+	if(nr>PERF_MAX_REGIONS) nr = PERF_MAX_REGIONS;
+	if(ng>PERF_MAX_THREADS) ng = PERF_MAX_THREADS;
+	fprintf(f, "\nperf profile:\n");
+	for(i=0;i<ng;i++) report_group(f, &groups[i]);
+	for(i=0;i<nr;i++){
+		r = &regions[i];
+		if(r->group==NULL && r->runs==0) continue;
+		fprintf(f, "%s: %llu runs", r->name, (unsigned long long)r->runs);
+		if(r->group) fprintf(f, " on thread %d", (int)r->group->tid);
+		if(r->partial) fprintf(f, ", %llu not counted (multiplexed)", (unsigned long long)r->partial);
+		fprintf(f, "\n  %-14s %10s %12s %10s %10s %10s\n", "", "runs", "mean", "p50", "p99", "max");
+		for(m=0;m<PERF_NUM_METRICS;m++){
+			if(r->n[m]==0){
+				fprintf(f, "  %-14s %10s\n", metric_names[m], "n/a");
+				continue;
+			}
+			fprintf(f, "  %-14s %10llu %12.1f %10llu %10llu %10llu\n", metric_names[m],\
+				(unsigned long long)r->n[m], (double)r->sum[m]/r->n[m],\
+				(unsigned long long)hist_percentile(r->hist[m], r->n[m], 500, r->max[m]),\
+				(unsigned long long)hist_percentile(r->hist[m], r->n[m], 990, r->max[m]),\
+				(unsigned long long)r->max[m]);
+		}
+		fprintf(f, "  slowest runs:");
+		for(m=0;m<PERF_NUM_METRICS;m++) fprintf(f, " %12s", metric_names[m]);
+		fprintf(f, "\n");
+		for(k=0;k<r->num_worst;k++){
+			fprintf(f, "  %13llu", (unsigned long long)r->worst[k].run);
+			for(m=0;m<PERF_NUM_METRICS;m++){
+				if(r->worst[k].valid & (1u<<m)) fprintf(f, " %12llu", (unsigned long long)r->worst[k].v[m]);
+				else fprintf(f, " %12s", "-");
+			}
+			fprintf(f, "\n");
+		}
+	}
+}
+
+void perf_prof_cleanup(){
+	int i, m, ng;
+
+	ng = atomic_load_explicit(&num_groups, memory_order_acquire);
+	if(ng>PERF_MAX_THREADS) ng = PERF_MAX_THREADS;
+	for(i=0;i<ng;i++){
+		for(m=0;m<PERF_NUM_METRICS;m++){
+			if(groups[i].fd[m]>=0) close(groups[i].fd[m]);
+			groups[i].fd[m] = -1;
+		}
+		groups[i].leader = -1;
+	}
+}
@@ -0,0 +1,51 @@
+/*******************************************************************************
+* perf_prof.h
+*
+* Hardware counter profile of balancer() and the housekeeping tasks, built in
+* with make PERF=1. Each profiled piece of code is a region. The first time a
+* thread enters a region it opens one perf_event_open group counting that
+* thread only: cycles, instructions, cache misses, branch misses and context
+* switches. The group is read on the way in and out of every run and the
+* differences, with the wall time, go into preallocated log scale
+* histograms. perf_prof_report() prints them and the slowest runs in full.
+*
+* Nothing here needs the counters. Events the CPU or the kernel won't give
+* are left out and listed in the report (a VM often has no hardware events,
+* perf_event_paranoid 2 leaves user space only), context switches fall back
+* to getrusage(), and with no group at all only the wall time is kept.
+* When the kernel multiplexes the group out during a run, that run keeps its
+* wall time and drops its counts.
+*******************************************************************************/
+
+#ifndef PERF_PROF_H
+#define PERF_PROF_H
+
+#include <stdio.h>
+#include <stdint.h>
+
+#define PERF_MAX_REGIONS	10
+#define PERF_MAX_THREADS	8
+#define PERF_WORST		4	// slowest runs kept per region
+
+typedef enum perf_metric_t{
+	PERF_NS,		// wall time, CLOCK_MONOTONIC
+	PERF_CYCLES,
+	PERF_INSTRUCTIONS,
+	PERF_CACHE_MISSES,
+	PERF_BRANCH_MISSES,
+	PERF_CTX_SWITCHES,
+	PERF_NUM_METRICS
+}perf_metric_t;
+
+// name must outlive the report, a string literal. Safe from any thread,
+// returns -1 once PERF_MAX_REGIONS are taken.
+int perf_prof_region(const char* name);
+// a region is only ever entered from one thread, -1 is ignored
+void perf_prof_begin(int region);
+void perf_prof_end(int region);
+// histogram summary of every region, after the threads in them are done
+void perf_prof_report(FILE* f);
+// close every thread's counters
+void perf_prof_cleanup();
+
+#endif	//PERF_PROF_H
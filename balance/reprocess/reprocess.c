@@ -0,0 +1,557 @@
+/*******************************************************************************
+* reprocess.c
+*
+* Runs logged IMU data back through a bank of body angle filters, any
+* number of complementary filter crossovers and Kalman filter tunings, and
+* reports how far each one is from a reference column or from the first
+* filter. Answers "what would theta have been with FILTER_W=x" over a whole
+* archive of flight recorder dumps and text logs in one pass.
+*
+*	reprocess -w 0.1:10:32 /var/log/balance/flight_*.bin
+*	reprocess -w 0.55,1,2 -k 0.001,0.003,0.03 -r 10 -m 0.35 dump.txt
+*	reprocess -ay 3 -az 4 -gx 5 ../../hw2_p3/plot.txt
+*******************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include "../balance_config.h"
+#include "../flight_recorder.h"
+#include "../../common/comp_filter.h"
+
+#define MAX_FILTERS	256
+#define MAX_FILES	1024
+#define MAX_COLS	32
+#define MAX_THREADS	64
+#define BLOCK		256	// samples per block, their angles and rates stay in L1
+#define CHUNK		65536	// samples per work item handed to a thread
+#define WARMUP_TAU	12	// warm up a chunk for this many slowest time constants
+#define KALMAN_WARMUP_S	20.0	// and at least this long with a Kalman filter in the bank
+
+/*******************************************************************************
+* trace_t
+*
+* one log file, the columns the filters need as float arrays
+*******************************************************************************/
+typedef struct trace_t{
+	const char* name;
+	float* ay;
+	float* az;
+	float* gx;
+	float* ref;	// NULL without -r
+	int n;
+}trace_t;
+
+/*******************************************************************************
+* bank_t
+*
+* The filters as one array per parameter, so a sample updates every filter
+* of a kind in a loop the compiler turns into SIMD. Complementary filters
+* come first in the output order, Kalman filters after them.
+*******************************************************************************/
+typedef struct bank_t{
+	int nc, nk;
+	float w[MAX_FILTERS];			// complementary crossover, rad/s
+	float alpha[MAX_FILTERS], beta[MAX_FILTERS];
+	float q_angle[MAX_FILTERS], q_bias[MAX_FILTERS], r[MAX_FILTERS];
+	float gyro_scale;			// dt*DEG_TO_RAD
+	float dt;
+}bank_t;
+
+/*******************************************************************************
+* state_t
+*
+* Filter state of one thread. Kalman P is symmetric, p01 is both corners.
+*******************************************************************************/
+typedef struct state_t{
+	float last_a;				// accelerometer angle of the last sample
+	float ta[MAX_FILTERS], tg[MAX_FILTERS];
+	float kt[MAX_FILTERS], kb[MAX_FILTERS];	// Kalman theta and gyro bias
+	float p00[MAX_FILTERS], p01[MAX_FILTERS], p11[MAX_FILTERS];
+	float out[MAX_FILTERS];
+	float a[BLOCK], d[BLOCK];		// angles and rate*dt of the block
+	float sum[MAX_FILTERS], max[MAX_FILTERS];	// squared error of the block
+}state_t;
+
+typedef struct acc_t{
+	double sum[MAX_FILTERS];		// squared error
+	float max[MAX_FILTERS];			// worst squared error
+	long n;
+}acc_t;
+
+typedef struct worker_t{
+	pthread_t thread;
+	state_t s;
+	acc_t acc;
+}worker_t;
+
+typedef struct item_t{
+	int trace;
+	int start, end;
+}item_t;
+
+static bank_t bank;
+static trace_t traces[MAX_FILES];
+static int num_traces=0;
+static item_t* items=NULL;
+static int num_items=0;
+static atomic_int next_item;
+static int warmup=0;
+static float offset=0;
+static int col_ay=5, col_az=6, col_gx=7, col_ref=-1;	// flight's text layout
+
+static void print_usage(){
+	printf("\nUsage: reprocess [options] file [file ...]\n");
+	printf("files are flight recorder dumps or whitespace or comma separated\n");
+	printf("text, one sample per row, accel in any unit and gyro in deg/s\n");
+	printf("-w list    complementary crossovers in rad/s, a,b,c or lo:hi:n log\n");
+	printf("           spaced (default FILTER_W)\n");
+	printf("-k q,b,r   add a Kalman filter with angle and bias process noise q\n");
+	printf("           and b and accelerometer angle noise r, repeatable\n");
+	printf("-r col     reference angle column, otherwise the first filter\n");
+	printf("-m rad     added to every filter output, MOUNT_ANGLE to compare with\n");
+	printf("           a theta logged by balance (default 0)\n");
+	printf("-ay col    accelerometer y column, 0 based (default %d)\n", col_ay);
+	printf("-az col    accelerometer z column (default %d)\n", col_az);
+	printf("-gx col    gyro x column (default %d)\n", col_gx);
+	printf("-dt s      sample time (default DT_D1)\n");
+	printf("-t n       threads (default one per cpu)\n");
+	printf("-j         print the results as one JSON object\n\n");
+}
+
+static double now_s(){
+	struct timespec t;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return t.tv_sec + t.tv_nsec*1e-9;
+}
+
+/*******************************************************************************
+* static int add_sample(trace_t* t, int* cap, const double* col, int ncol)
+*
+* append one row if it has every column asked for
+*******************************************************************************/
+static int add_sample(trace_t* t, int* cap, const double* col, int ncol){
+	if(ncol<=col_ay || ncol<=col_az || ncol<=col_gx || ncol<=col_ref) return 0;
+	if(t->n==*cap){
+		*cap = *cap ? 2*(*cap) : 4096;
+		t->ay = realloc(t->ay, *cap*sizeof(float));
+		t->az = realloc(t->az, *cap*sizeof(float));
+		t->gx = realloc(t->gx, *cap*sizeof(float));
+		if(col_ref>=0) t->ref = realloc(t->ref, *cap*sizeof(float));
+		if(t->ay==NULL || t->az==NULL || t->gx==NULL || (col_ref>=0 && t->ref==NULL)){
+			fprintf(stderr,"ERROR: out of memory loading %s\n", t->name);
+			return -1;
+		}
+	}
+	t->ay[t->n] = col[col_ay];
+	t->az[t->n] = col[col_az];
+	t->gx[t->n] = col[col_gx];
+	if(col_ref>=0) t->ref[t->n] = col[col_ref];
+	t->n++;
+	return 0;
+}
+
+/*******************************************************************************
+* static int record_cols(const fr_record_t* r, const fr_header_t* h, double* col)
+*
+* a dump record laid out in the same columns flight prints
+*******************************************************************************/
+static int record_cols(const fr_record_t* r, const fr_header_t* h, double* col){
+	const float f[] = {r->accel[0], r->accel[1], r->accel[2], r->gyro[0], r->gyro[1],\
+		r->gyro[2], r->theta, r->theta_a, r->theta_g, r->wheel_angle_l,\
+		r->wheel_angle_r, r->phi, r->gamma, r->theta_ref, r->phi_ref, r->gamma_ref,\
+		r->d1_out, r->d2_out, r->d3_out, r->v_batt, r->saturated};
+	int i;
+
+	col[0] = ((double)r->t_ns-(double)h->t_ns)*1e-9;
+	col[1] = r->tick;
+	col[2] = r->rc_state;
+	col[3] = r->control_state;
+	for(i=0;i<(int)(sizeof(f)/sizeof(f[0]));i++) col[4+i] = f[i];
+	return 4+i;
+}
+
+/*******************************************************************************
+* static int load_trace(const char* name, trace_t* t)
+*
+* Flight recorder dumps are recognized by their magic number, anything else
+* is read as text. Lines that don't start with a number are skipped.
+*******************************************************************************/
+static int load_trace(const char* name, trace_t* t){
+	FILE* f;
+	fr_header_t h;
+	fr_record_t r;
+	char line[1024];
+	char *p, *end;
+	double col[MAX_COLS];
+	int cap=0, ncol;
+	unsigned i;
+
+	memset(t, 0, sizeof(trace_t));
+	t->name = name;
+	f = fopen(name, "rb");
+	if(f==NULL){
+		perror(name);
+		return -1;
+	}
+	if(fread(&h, sizeof(h), 1, f)==1 && h.magic==FR_MAGIC){
+		if(h.version!=FR_VERSION || h.record_size!=sizeof(fr_record_t)){
+			fprintf(stderr,"ERROR: %s has version %u record size %u, expected %u size %u\n",\
+				name, h.version, h.record_size, FR_VERSION, (unsigned)sizeof(fr_record_t));
+			fclose(f);
+			return -1;
+		}
+		for(i=0;i<h.count && fread(&r, sizeof(r), 1, f)==1;i++){
+			ncol = record_cols(&r, &h, col);
+			if(add_sample(t, &cap, col, ncol)){
+				fclose(f);
+				return -1;
+			}
+		}
+		if(i<h.count) fprintf(stderr,"WARNING: %s ends after %u of %u ticks\n",\
+					name, i, h.count);
+		fclose(f);
+		return 0;
+	}
+	rewind(f);
+	while(fgets(line, sizeof(line), f)){
+		p = line;
+		for(ncol=0; ncol<MAX_COLS; ncol++){
+			col[ncol] = strtod(p, &end);
+			if(end==p) break;
+			p = end;
+			while(*p==',') p++;
+		}
+		if(add_sample(t, &cap, col, ncol)){
+			fclose(f);
+			return -1;
+		}
+	}
+	fclose(f);
+	return 0;
+}
+
+/*******************************************************************************
+* static int parse_w(const char* arg)
+*
+* crossovers as a,b,c or lo:hi:n spaced evenly in log
+*******************************************************************************/
+static int parse_w(const char* arg){
+	double lo, hi;
+	int n, i;
+	char* end;
+
+	if(sscanf(arg, "%lf:%lf:%d", &lo, &hi, &n)==3){
+		if(lo<=0 || hi<lo || n<1 || bank.nc+n>MAX_FILTERS) return -1;
+		for(i=0;i<n;i++){
+			bank.w[bank.nc++] = n==1 ? lo : lo*pow(hi/lo, (double)i/(n-1));
+		}
+		return 0;
+	}
+	while(*arg){
+		if(bank.nc==MAX_FILTERS) return -1;
+		bank.w[bank.nc] = strtod(arg, &end);
+		if(end==arg || bank.w[bank.nc]<=0) return -1;
+		bank.nc++;
+		arg = end;
+		if(*arg==',') arg++;
+	}
+	return 0;
+}
+
+static int parse_k(const char* arg){
+	float q, b, r;
+	if(sscanf(arg, "%f,%f,%f", &q, &b, &r)!=3 || q<0 || b<0 || r<=0) return -1;
+	if(bank.nc+bank.nk==MAX_FILTERS) return -1;
+	bank.q_angle[bank.nk] = q;
+	bank.q_bias[bank.nk] = b;
+	bank.r[bank.nk] = r;
+	bank.nk++;
+	return 0;
+}
+
+/*******************************************************************************
+* static int init_bank(float dt)
+*
+* coefficients from comp_filter_init() so a filter in the bank is the one
+* balance runs
+*******************************************************************************/
+static int init_bank(float dt){
+	comp_filter_t c;
+	double w_min=1e9;
+	int i;
+
+	if(bank.nc+bank.nk>MAX_FILTERS){
+		fprintf(stderr,"ERROR: at most %d filters\n", MAX_FILTERS);
+		return -1;
+	}
+	for(i=0;i<bank.nc;i++){
+		if(comp_filter_init(&c, bank.w[i], dt)) return -1;
+		bank.alpha[i] = c.alpha;
+		bank.beta[i] = c.beta;
+		if(bank.w[i]<w_min) w_min = bank.w[i];
+	}
+	bank.gyro_scale = dt*COMP_FILTER_DEG_TO_RAD;
+	bank.dt = dt;
+	warmup = bank.nc ? (int)ceil(WARMUP_TAU/(w_min*dt)) : 0;
+	if(bank.nk && warmup<KALMAN_WARMUP_S/dt) warmup = ceil(KALMAN_WARMUP_S/dt);
+	return 0;
+}
+
+/*******************************************************************************
+* static void reset_state(state_t* s, const trace_t* t, int i)
+*
+* Every filter starts out at the reference of sample i, or without one at
+* its accelerometer angle. A dump that begins mid flight is then scored
+* from its first sample instead of after the filters have pulled in from
+* zero. Kalman filters start with a variance of 1 rad^2 and no bias.
+*******************************************************************************/
+static void reset_state(state_t* s, const trace_t* t, int i){
+	float a = atan2f(-t->az[i], t->ay[i]);
+	float th = t->ref ? t->ref[i]-offset : a;
+	int k;
+
+	memset(s, 0, sizeof(state_t));
+	s->last_a = a;
+	for(k=0;k<bank.nc;k++) s->ta[k] = th;
+	for(k=0;k<bank.nk;k++){
+		s->kt[k] = th;
+		s->p00[k] = s->p11[k] = 1.0f;
+	}
+}
+
+/*******************************************************************************
+* static void run_block(state_t* s, const trace_t* t, int i0, int i1, acc_t* acc)
+*
+* Samples i0 to i1, at most BLOCK of them, through every filter. The
+* accelerometer angles go first in a loop of their own, then every sample
+* updates the whole bank one filter kind at a time. acc NULL only warms
+* the filters up.
+*******************************************************************************/
+static void run_block(state_t* s, const trace_t* t, int i0, int i1, acc_t* acc){
+	const int nc=bank.nc, nk=bank.nk, nf=bank.nc+bank.nk;
+	const float dt=bank.dt;
+	float a, d, ref, e, pt, s_inv, k0, k1, y;
+	int i, j, k;
+
+	for(i=i0;i<i1;i++){
+		s->a[i-i0] = atan2f(-t->az[i], t->ay[i]);
+		s->d[i-i0] = bank.gyro_scale*t->gx[i];
+	}
+	for(j=0;j<i1-i0;j++){
+		a = s->a[j];
+		d = s->d[j];
+		// complementary, see comp_filter_step()
+		for(k=0;k<nc;k++){
+			s->ta[k] = bank.alpha[k]*s->last_a + bank.beta[k]*s->ta[k];
+			s->tg[k] = bank.beta[k]*s->tg[k] + d;
+			s->out[k] = s->ta[k] + s->tg[k] + offset;
+		}
+		s->last_a = a;
+		// two state Kalman on angle and gyro bias, accelerometer angle measured
+		for(k=0;k<nk;k++){
+			s->kt[k] += d - dt*s->kb[k];
+			s->p00[k] += dt*(dt*s->p11[k] - 2.0f*s->p01[k] + bank.q_angle[k]);
+			s->p01[k] -= dt*s->p11[k];
+			s->p11[k] += dt*bank.q_bias[k];
+			s_inv = 1.0f/(s->p00[k] + bank.r[k]);
+			k0 = s->p00[k]*s_inv;
+			k1 = s->p01[k]*s_inv;
+			y = a - s->kt[k];
+			s->kt[k] += k0*y;
+			s->kb[k] += k1*y;
+			pt = s->p01[k];
+			s->p11[k] -= k1*pt;
+			s->p01[k] -= k0*pt;
+			s->p00[k] -= k0*s->p00[k];
+			s->out[nc+k] = s->kt[k] + offset;
+		}
+		if(acc==NULL) continue;
+		ref = t->ref ? t->ref[i0+j] : s->out[0];
+		for(k=0;k<nf;k++){
+			e = s->out[k] - ref;
+			s->sum[k] += e*e;
+			s->max[k] = fmaxf(s->max[k], e*e);
+		}
+	}
+	if(acc==NULL) return;
+	// float sums over a block, double across blocks
+	for(k=0;k<nf;k++){
+		acc->sum[k] += s->sum[k];
+		if(s->max[k]>acc->max[k]) acc->max[k] = s->max[k];
+		s->sum[k] = 0;
+		s->max[k] = 0;
+	}
+	acc->n += i1-i0;
+}
+
+/*******************************************************************************
+* static void run_item(worker_t* w, const item_t* it)
+*
+* A chunk that doesn't start a trace begins warmup samples early, by then
+* the history it missed has decayed to noise.
+*******************************************************************************/
+static void run_item(worker_t* w, const item_t* it){
+	const trace_t* t = &traces[it->trace];
+	int i = it->start - warmup;
+	int e;
+
+	if(i<0) i = 0;
+	reset_state(&w->s, t, i);
+	for(; i<it->start; i=e){
+		e = i+BLOCK < it->start ? i+BLOCK : it->start;
+		run_block(&w->s, t, i, e, NULL);
+	}
+	for(; i<it->end; i=e){
+		e = i+BLOCK < it->end ? i+BLOCK : it->end;
+		run_block(&w->s, t, i, e, &w->acc);
+	}
+}
+
+static void* worker_fn(void* arg){
+	worker_t* w = arg;
+	int i;
+	while((i=atomic_fetch_add(&next_item, 1))<num_items) run_item(w, &items[i]);
+	return NULL;
+}
+
+/*******************************************************************************
+* static int make_items()
+*
+* every trace cut into chunks of CHUNK samples
+*******************************************************************************/
+static int make_items(){
+	int t, s, cap=0;
+	for(t=0;t<num_traces;t++) cap += traces[t].n/CHUNK + 1;
+	items = malloc(cap*sizeof(item_t));
+	if(items==NULL){
+		fprintf(stderr,"ERROR: out of memory\n");
+		return -1;
+	}
+	for(t=0;t<num_traces;t++){
+		for(s=0;s<traces[t].n;s+=CHUNK){
+			items[num_items].trace = t;
+			items[num_items].start = s;
+			items[num_items].end = s+CHUNK < traces[t].n ? s+CHUNK : traces[t].n;
+			num_items++;
+		}
+	}
+	return 0;
+}
+
+static void print_name(int k, char* buf, int len){
+	if(k<bank.nc) snprintf(buf, len, "comp w=%.4g", bank.w[k]);
+	else snprintf(buf, len, "kalman q=%g,%g,%g", bank.q_angle[k-bank.nc],\
+			bank.q_bias[k-bank.nc], bank.r[k-bank.nc]);
+}
+
+/*******************************************************************************
+* int main(int argc, char* argv[])
+*******************************************************************************/
+int main(int argc, char* argv[]){
+	worker_t* workers;
+	acc_t total;
+	float dt=DT_D1;
+	double t0, t1, t2, rms, best=INFINITY;
+	long samples=0;
+	int nthreads=sysconf(_SC_NPROCESSORS_ONLN), json=0, nf, i, k, kbest=0;
+	char name[64];
+
+	for(i=1;i<argc;i++){
+		if(strcmp(argv[i],"-w")==0 && i+1<argc){
+			if(parse_w(argv[++i])){
+				fprintf(stderr,"ERROR: bad crossover list %s\n", argv[i]);
+				return -1;
+			}
+		}
+		else if(strcmp(argv[i],"-k")==0 && i+1<argc){
+			if(parse_k(argv[++i])){
+				fprintf(stderr,"ERROR: bad Kalman filter %s\n", argv[i]);
+				return -1;
+			}
+		}
+		else if(strcmp(argv[i],"-r")==0 && i+1<argc) col_ref = atoi(argv[++i]);
+		else if(strcmp(argv[i],"-m")==0 && i+1<argc) offset = atof(argv[++i]);
+		else if(strcmp(argv[i],"-ay")==0 && i+1<argc) col_ay = atoi(argv[++i]);
+		else if(strcmp(argv[i],"-az")==0 && i+1<argc) col_az = atoi(argv[++i]);
+		else if(strcmp(argv[i],"-gx")==0 && i+1<argc) col_gx = atoi(argv[++i]);
+		else if(strcmp(argv[i],"-dt")==0 && i+1<argc) dt = atof(argv[++i]);
+		else if(strcmp(argv[i],"-t")==0 && i+1<argc) nthreads = atoi(argv[++i]);
+		else if(strcmp(argv[i],"-j")==0) json = 1;
+		else if(argv[i][0]!='-' && num_traces<MAX_FILES) traces[num_traces++].name = argv[i];
+		else{
+			print_usage();
+			return -1;
+		}
+	}
+	if(num_traces==0 || nthreads<1 || col_ay<0 || col_az<0 || col_gx<0 ||\
+	   col_ay>=MAX_COLS || col_az>=MAX_COLS || col_gx>=MAX_COLS || col_ref>=MAX_COLS){
+		print_usage();
+		return -1;
+	}
+	if(nthreads>MAX_THREADS) nthreads = MAX_THREADS;
+	if(bank.nc+bank.nk==0) bank.w[bank.nc++] = FILTER_W;
+	if(init_bank(dt)) return -1;
+	nf = bank.nc + bank.nk;
+
+	t0 = now_s();
+	for(i=0;i<num_traces;i++){
+		if(load_trace(traces[i].name, &traces[i])) return -1;
+		samples += traces[i].n;
+	}
+	if(make_items()) return -1;
+	t1 = now_s();
+
+	workers = calloc(nthreads, sizeof(worker_t));
+	if(workers==NULL){
+		fprintf(stderr,"ERROR: out of memory\n");
+		return -1;
+	}
+	atomic_init(&next_item, 0);
+	for(i=0;i<nthreads;i++){
+		if(pthread_create(&workers[i].thread, NULL, worker_fn, &workers[i])){
+			perror("pthread_create");
+			return -1;
+		}
+	}
+	memset(&total, 0, sizeof(total));
+	for(i=0;i<nthreads;i++){
+		pthread_join(workers[i].thread, NULL);
+		for(k=0;k<nf;k++){
+			total.sum[k] += workers[i].acc.sum[k];
+			if(workers[i].acc.max[k]>total.max[k]) total.max[k] = workers[i].acc.max[k];
+		}
+		total.n += workers[i].acc.n;
+	}
+	t2 = now_s();
+
+	for(k=(col_ref<0);k<nf;k++){
+		rms = total.n ? sqrt(total.sum[k]/total.n) : 0;
+		if(rms<best){
+			best = rms;
+			kbest = k;
+		}
+	}
+	if(json) printf("{\"samples\":%ld,\"reference\":\"%s\",\"filters\":[", samples,\
+			col_ref<0 ? "first filter" : "column");
+	else printf("%ld samples from %d files, error against %s\n%-32s %10s %10s\n",\
+			samples, num_traces, col_ref<0 ? "the first filter" : "the reference column",\
+			"filter", "rms", "max");
+	for(k=0;k<nf;k++){
+		print_name(k, name, sizeof(name));
+		rms = total.n ? sqrt(total.sum[k]/total.n) : 0;
+		if(json) printf("%s\n{\"name\":\"%s\",\"rms\":%.6g,\"max\":%.6g}", k ? "," : "",\
+				name, rms, sqrt(total.max[k]));
+		else printf("%-32s %10.6f %10.6f%s\n", name, rms, sqrt(total.max[k]),\
+				k==kbest && nf>1 ? "  best" : "");
+	}
+	if(json) printf("]}\n");
+	fprintf(stderr, "%d filters, %d threads: load %.3fs, filter %.3fs, %.1fM filter "\
+		"samples/s\n", nf, nthreads, t1-t0, t2-t1, samples*(double)nf/(t2-t1)*1e-6);
+	return 0;
+}
@@ -0,0 +1,126 @@
+/*******************************************************************************
+* sample_bus.c
+*
+* Lock-free single-writer rings backing sample_bus.h
+* Each slot carries its own sequence lock: odd while the writer is filling it,
+* 2*seq once the sample with that seq is complete.
+*******************************************************************************/
+
+#include <string.h>
+#include <time.h>
+#include <stdatomic.h>
+#include "sample_bus.h"
+
+#define BUS_MASK	(BUS_RING_SIZE-1)
+#define BUS_READ_TRIES	4
+
+typedef struct bus_slot_t{
+	atomic_uint_fast64_t lock;
+	bus_sample_t sample;
+}bus_slot_t;
+
+typedef struct bus_ring_t{
+	atomic_uint_fast64_t head;	// seq of the newest complete sample
+	bus_slot_t slot[BUS_RING_SIZE];
+}bus_ring_t;
+
+static bus_ring_t rings[BUS_NUM_TOPICS];
+
+/*******************************************************************************
+* uint64_t bus_now_ns()
+*
+* monotonic time in nanoseconds
+*******************************************************************************/
+uint64_t bus_now_ns(){
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec*1000000000ULL + ts.tv_nsec;
+}
+
+/*******************************************************************************
+* int bus_publish(bus_topic_t topic, const float* v, int n)
+*
+* stamp and append a sample, only ever call from the topic's one writer
+*******************************************************************************/
+int bus_publish(bus_topic_t topic, const float* v, int n){
+	bus_ring_t* r;
+	bus_slot_t* s;
+	uint64_t seq;
+	int i;
+
+	if(topic<0 || topic>=BUS_NUM_TOPICS || n>BUS_SAMPLE_WIDTH) return -1;
+	r = &rings[topic];
+	seq = atomic_load_explicit(&r->head, memory_order_relaxed) + 1;
+	s = &r->slot[seq & BUS_MASK];
+
+	atomic_store_explicit(&s->lock, 2*seq-1, memory_order_relaxed);
+	atomic_thread_fence(memory_order_release);
+	s->sample.seq = seq;
+	s->sample.t_ns = bus_now_ns();
+	for(i=0;i<n;i++) s->sample.v[i] = v[i];
+	for(;i<BUS_SAMPLE_WIDTH;i++) s->sample.v[i] = 0.0f;
+	atomic_store_explicit(&s->lock, 2*seq, memory_order_release);
+	atomic_store_explicit(&r->head, seq, memory_order_release);
+	return 0;
+}
+
+/*******************************************************************************
+* static int read_slot(bus_ring_t* r, uint64_t seq, bus_sample_t* out)
+*
+* copy the sample with sequence number seq, -1 if it was overwritten
+*******************************************************************************/
+static int read_slot(bus_ring_t* r, uint64_t seq, bus_sample_t* out){
+	bus_slot_t* s = &r->slot[seq & BUS_MASK];
+	uint64_t l1, l2;
+	int i;
+
+	for(i=0;i<BUS_READ_TRIES;i++){
+		l1 = atomic_load_explicit(&s->lock, memory_order_acquire);
+		if(l1 > 2*seq) return -1;	// lapped by the writer
+		if(l1 != 2*seq) continue;	// writer is mid-update
+		memcpy(out, &s->sample, sizeof(bus_sample_t));
+		atomic_thread_fence(memory_order_acquire);
+		l2 = atomic_load_explicit(&s->lock, memory_order_relaxed);
+		if(l1 == l2) return 0;
+	}
+	return -1;
+}
+
+/*******************************************************************************
+* int bus_latest(bus_topic_t topic, bus_sample_t* out)
+*
+* newest complete sample on a topic
+*******************************************************************************/
+int bus_latest(bus_topic_t topic, bus_sample_t* out){
+	bus_ring_t* r;
+	uint64_t head;
+	int i;
+
+	if(topic<0 || topic>=BUS_NUM_TOPICS) return -1;
+	r = &rings[topic];
+	for(i=0;i<BUS_READ_TRIES;i++){
+		head = atomic_load_explicit(&r->head, memory_order_acquire);
+		if(head==0) return -1;
+		if(read_slot(r, head, out)==0) return 0;
+	}
+	return -1;
+}
+
+/*******************************************************************************
+* int bus_latest_before(bus_topic_t topic, uint64_t t_ns, bus_sample_t* out)
+*
+* newest sample stamped at or before t_ns, walks back at most one ring
+*******************************************************************************/
+int bus_latest_before(bus_topic_t topic, uint64_t t_ns, bus_sample_t* out){
+	bus_ring_t* r;
+	uint64_t head, seq;
+
+	if(topic<0 || topic>=BUS_NUM_TOPICS) return -1;
+	r = &rings[topic];
+	head = atomic_load_explicit(&r->head, memory_order_acquire);
+	for(seq=head; seq>0 && head-seq<BUS_RING_SIZE; seq--){
+		if(read_slot(r, seq, out)) return -1;
+		if(out->t_ns <= t_ns) return 0;
+	}
+	return -1;
+}
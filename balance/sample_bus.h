@@ -0,0 +1,54 @@
+/*******************************************************************************
+* sample_bus.h
+*
+* Timestamped publish/subscribe sample bus shared by balancer() and the
+* housekeeping threads. Every topic is a single-writer ring of samples guarded
+* per slot by a sequence counter, so the writer never blocks and readers never
+* take a lock. A reader that races the writer simply retries the slot.
+*******************************************************************************/
+
+#ifndef SAMPLE_BUS_H
+#define SAMPLE_BUS_H
+
+#include <stdint.h>
+
+#define BUS_RING_SIZE		64	// samples kept per topic, power of two
+#define BUS_SAMPLE_WIDTH	4	// floats carried by one sample
+
+/*******************************************************************************
+* bus_topic_t
+*
+* one topic per producer, each topic must only be published by one thread
+*******************************************************************************/
+typedef enum bus_topic_t{
+	BUS_IMU,	// theta, theta_a, theta_g, gyro rate (rad/s)
+	BUS_ENCODERS,	// wheelAngleL, wheelAngleR, gamma
+	BUS_BATTERY,	// vBatt
+	BUS_SETPOINT,	// theta, phi, gamma
+	BUS_CONTROL,	// d1_out, d2_out, d3_out, saturated
+	BUS_NUM_TOPICS
+}bus_topic_t;
+
+/*******************************************************************************
+* bus_sample_t
+*
+* seq counts up from 1 on every topic, t_ns is CLOCK_MONOTONIC at publish time
+*******************************************************************************/
+typedef struct bus_sample_t{
+	uint64_t seq;
+	uint64_t t_ns;
+	float v[BUS_SAMPLE_WIDTH];
+}bus_sample_t;
+
+// time base used for all samples
+uint64_t bus_now_ns();
+
+// writer side, n values are copied, the rest of the sample is zeroed
+int bus_publish(bus_topic_t topic, const float* v, int n);
+
+// reader side, both return -1 when nothing matching is in the ring
+int bus_latest(bus_topic_t topic, bus_sample_t* out);
+// newest sample stamped at or before t_ns
+int bus_latest_before(bus_topic_t topic, uint64_t t_ns, bus_sample_t* out);
+
+#endif	//SAMPLE_BUS_H
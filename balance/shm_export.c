@@ -0,0 +1,119 @@
+/*******************************************************************************
+* shm_export.c
+*
+* POSIX shared memory segment and seqlock behind shm_export.h
+*******************************************************************************/
+
+#include <stdio.h>
+#include <string.h>
+#include <fcntl.h>
+#include <sched.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "shm_export.h"
+
+#define SHM_READ_TRIES	100
+#define SHM_YIELD_AFTER	10	// writer is probably preempted, let it finish
+
+/*******************************************************************************
+* shm_export_t* shm_export_open(const char* name, int writer)
+*
+* The writer creates or resets the segment. Readers map it read only and
+* reject it unless magic, version and size all match what they were built
+* with. Returns NULL on failure.
+*******************************************************************************/
+shm_export_t* shm_export_open(const char* name, int writer){
+	shm_export_t* shm;
+	struct stat st;
+	int fd;
+
+	fd = shm_open(name, writer ? O_CREAT|O_RDWR : O_RDONLY, 0644);
+	if(fd<0){
+		perror(name);
+		return NULL;
+	}
+	if(writer && ftruncate(fd, sizeof(shm_export_t))){
+		perror("ftruncate");
+		close(fd);
+		return NULL;
+	}
+	if(fstat(fd, &st) || st.st_size<(off_t)sizeof(shm_export_t)){
+		fprintf(stderr,"ERROR: %s is smaller than this layout\n", name);
+		close(fd);
+		return NULL;
+	}
+	shm = mmap(NULL, sizeof(shm_export_t), writer ? PROT_READ|PROT_WRITE : PROT_READ,\
+			MAP_SHARED, fd, 0);
+	close(fd);
+	if(shm==MAP_FAILED){
+		perror("mmap");
+		return NULL;
+	}
+
+	if(writer){
+		// size and version before magic so a reader never sees half a header
+		atomic_store_explicit(&shm->seq, 0, memory_order_relaxed);
+		shm->size = sizeof(shm_export_t);
+		shm->version = SHM_EXPORT_VERSION;
+		atomic_thread_fence(memory_order_release);
+		shm->magic = SHM_EXPORT_MAGIC;
+		return shm;
+	}
+	if(shm->magic!=SHM_EXPORT_MAGIC || shm->version!=SHM_EXPORT_VERSION ||\
+	   shm->size!=sizeof(shm_export_t)){
+		fprintf(stderr,"ERROR: %s has layout version %u size %u, expected %u size %u\n",\
+			name, shm->version, shm->size, SHM_EXPORT_VERSION, (unsigned)sizeof(shm_export_t));
+		munmap(shm, sizeof(shm_export_t));
+		return NULL;
+	}
+	return shm;
+}
+
+/*******************************************************************************
+* void shm_export_close(shm_export_t* shm, const char* name, int writer)
+*
+* the writer also removes the name, readers that still have it mapped keep
+* seeing the last snapshot
+*******************************************************************************/
+void shm_export_close(shm_export_t* shm, const char* name, int writer){
+	if(shm==NULL) return;
+	munmap(shm, sizeof(shm_export_t));
+	if(writer) shm_unlink(name);
+}
+
+/*******************************************************************************
+* void shm_export_write(shm_export_t* shm, const shm_payload_t* p)
+*
+* only ever call from one thread
+*******************************************************************************/
+void shm_export_write(shm_export_t* shm, const shm_payload_t* p){
+	uint32_t seq = atomic_load_explicit(&shm->seq, memory_order_relaxed);
+
+	atomic_store_explicit(&shm->seq, seq+1, memory_order_relaxed);
+	atomic_thread_fence(memory_order_release);
+	memcpy(&shm->data, p, sizeof(shm_payload_t));
+	atomic_store_explicit(&shm->seq, seq+2, memory_order_release);
+}
+
+/*******************************************************************************
+* int shm_export_read(const shm_export_t* shm, shm_payload_t* p)
+*
+* copy the latest snapshot, retrying while the writer is in the middle of one
+*******************************************************************************/
+int shm_export_read(const shm_export_t* shm, shm_payload_t* p){
+	uint32_t s1, s2;
+	int i;
+
+	for(i=0;i<SHM_READ_TRIES;i++){
+		if(i>=SHM_YIELD_AFTER) sched_yield();
+		s1 = atomic_load_explicit(&shm->seq, memory_order_acquire);
+		if(s1==0) return -1;
+		if(s1&1) continue;
+		memcpy(p, (const void*)&shm->data, sizeof(shm_payload_t));
+		atomic_thread_fence(memory_order_acquire);
+		s2 = atomic_load_explicit(&shm->seq, memory_order_relaxed);
+		if(s1==s2) return 0;
+	}
+	return -1;
+}
@@ -0,0 +1,76 @@
+/*******************************************************************************
+* shm_export.h
+*
+* Latest robot state in a POSIX shared memory segment for monitors, loggers
+* and GUIs running as separate processes. One writer, any number of readers.
+* A sequence counter in the header is odd while the writer copies a new
+* snapshot in, readers copy the snapshot out and retry if the counter moved.
+* Readers never make a syscall after mapping the segment and never hold up
+* the writer.
+*
+* The layout only uses fixed size types so readers don't need roboticscape
+* or balance.h. Any change to shm_payload_t must bump SHM_EXPORT_VERSION,
+* readers refuse a segment with a version they were not built for.
+*******************************************************************************/
+
+#ifndef SHM_EXPORT_H
+#define SHM_EXPORT_H
+
+#include <stdint.h>
+#include <stdatomic.h>
+
+#define SHM_EXPORT_NAME		"/mip_balance"
+#define SHM_EXPORT_MAGIC	0x4D495042	// "MIPB"
+#define SHM_EXPORT_VERSION	2
+#define SHM_MAX_TASKS		8
+
+typedef struct shm_task_t{
+	char name[16];
+	uint32_t hz;
+	uint32_t max_us;	// longest single run
+	uint64_t runs;
+	uint64_t missed;
+}shm_task_t;
+
+/*******************************************************************************
+* shm_payload_t
+*
+* One snapshot. count is repeated at the end so a reader can double check
+* the copy it got is whole.
+*******************************************************************************/
+typedef struct shm_payload_t{
+	uint64_t count;		// snapshots written so far, this one included
+	uint64_t t_ns;		// CLOCK_MONOTONIC when it was taken
+	int32_t rc_state;	// rc_state_t
+	// core_state_t
+	float wheel_angle_l, wheel_angle_r;
+	float theta, phi, gamma;
+	float v_batt;
+	float d1_out, d2_out, d3_out;
+	uint32_t saturated;	// SAT_* bits, controllers on a limit
+	// setpoint_t
+	int32_t control_state;	// control_state_t
+	float theta_ref, phi_ref, gamma_ref;
+	// task runner statistics
+	uint32_t num_tasks;
+	shm_task_t tasks[SHM_MAX_TASKS];
+	uint64_t count_end;
+}shm_payload_t;
+
+typedef struct shm_export_t{
+	uint32_t magic;
+	uint32_t version;
+	uint32_t size;		// sizeof(shm_export_t) of the writer
+	_Atomic uint32_t seq;	// odd while a write is in progress
+	shm_payload_t data;
+}shm_export_t;
+
+// writer creates the segment, readers map it read only and check the layout
+shm_export_t* shm_export_open(const char* name, int writer);
+void shm_export_close(shm_export_t* shm, const char* name, int writer);
+
+void shm_export_write(shm_export_t* shm, const shm_payload_t* p);
+// 0 on a whole snapshot, -1 if nothing was written yet or the writer kept racing
+int shm_export_read(const shm_export_t* shm, shm_payload_t* p);
+
+#endif	//SHM_EXPORT_H
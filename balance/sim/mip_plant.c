@@ -0,0 +1,168 @@
+/*******************************************************************************
+* mip_plant.c
+*
+* Equations of motion from the Lagrangian of a wheeled inverted pendulum:
+*
+*  (Iw+(mb+mw)r^2) phi''  + mb r l cos(theta) theta'' - mb r l sin(theta) theta'^2 = tau
+*   mb r l cos(theta) phi'' + (Ib+mb l^2) theta'' - mb g l sin(theta) = push - tau
+*
+* tau is the total gearbox torque of both motors, stall torque scaled by the
+* duty and battery voltage minus back EMF drag on the wheel/body speed.
+* Physical constants are the published EduMIP values, geometry comes from
+* balance_config.h so the plant and controller always agree.
+*******************************************************************************/
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include "mip_plant.h"
+#include "../balance_config.h"
+
+#define G_ACCEL		9.81
+#define M_BODY		0.263		// kg
+#define M_WHEELS	0.054		// kg, both wheels
+#define L_COM		0.0477		// m, axle to body centre of mass
+#define I_BODY		0.0004		// kg m^2 about the axle
+#define I_WHEELS	3.12e-5		// kg m^2, both wheels
+#define STALL_TORQUE	0.003		// Nm at the motor shaft
+#define FREE_SPEED	1760.0		// rad/s at the motor shaft
+#define SUBSTEP		0.001
+
+typedef struct deriv_t{
+	double theta, theta_dot, phi, phi_dot, delta, delta_dot;
+}deriv_t;
+
+void mip_plant_init(mip_plant_t* p, double theta0){
+	memset(p, 0, sizeof(mip_plant_t));
+	p->theta = theta0;
+	p->v_batt = V_NOMINAL;
+	p->seed = 1;
+}
+
+// torque one motor puts on its wheel through the gearbox
+static double motor_torque(double duty, double v_batt, double rel_speed){
+	if(duty>1) duty = 1;
+	if(duty<-1) duty = -1;
+	return GEARBOX*STALL_TORQUE*(duty*v_batt/V_NOMINAL \
+			- GEARBOX*rel_speed/FREE_SPEED);
+}
+
+static deriv_t derivs(const mip_plant_t* p, const deriv_t* x, double uL, double uR,\
+			double* accel){
+	deriv_t d;
+	double a = I_WHEELS + (M_BODY+M_WHEELS)*WHEEL_RADIUS_M*WHEEL_RADIUS_M;
+	double b = M_BODY*WHEEL_RADIUS_M*L_COM;
+	double c = I_BODY + M_BODY*L_COM*L_COM;
+	double wL = x->phi_dot - x->delta_dot - x->theta_dot;
+	double wR = x->phi_dot + x->delta_dot - x->theta_dot;
+	double tL = motor_torque(uL, p->v_batt, wL);
+	double tR = motor_torque(uR, p->v_batt, wR);
+	double tau = tL+tR;
+	double ct = cos(x->theta), st = sin(x->theta);
+	double r1, r2, det;
+
+	d.theta = x->theta_dot;
+	d.phi = x->phi_dot;
+	d.delta = x->delta_dot;
+	if(p->held){
+		// body fixed, wheels spin against their own inertia only
+		d.theta_dot = 0;
+		d.phi_dot = tau/I_WHEELS;
+	}
+	else{
+		r1 = tau + b*st*x->theta_dot*x->theta_dot;
+		r2 = M_BODY*G_ACCEL*L_COM*st + p->push - tau;
+		det = a*c - b*b*ct*ct;
+		d.phi_dot = (c*r1 - b*ct*r2)/det;
+		d.theta_dot = (a*r2 - b*ct*r1)/det;
+	}
+	// wheel difference turns the robot, driven by the torque difference
+	d.delta_dot = (tR-tL)/(2.0*a);
+	if(p->stalled){
+		d.phi = d.delta = 0;
+		d.phi_dot = d.delta_dot = 0;
+	}
+	if(accel) *accel = WHEEL_RADIUS_M*d.phi_dot;
+	return d;
+}
+
+static deriv_t add_scaled(const deriv_t* x, const deriv_t* k, double h){
+	deriv_t r;
+	r.theta = x->theta + h*k->theta;
+	r.theta_dot = x->theta_dot + h*k->theta_dot;
+	r.phi = x->phi + h*k->phi;
+	r.phi_dot = x->phi_dot + h*k->phi_dot;
+	r.delta = x->delta + h*k->delta;
+	r.delta_dot = x->delta_dot + h*k->delta_dot;
+	return r;
+}
+
+void mip_plant_step(mip_plant_t* p, double dutyL, double dutyR, double dt){
+	deriv_t x, k1, k2, k3, k4, t;
+	double h, elapsed=0;
+
+	while(elapsed < dt-1e-12){
+		h = dt-elapsed < SUBSTEP ? dt-elapsed : SUBSTEP;
+		x.theta = p->theta;		x.theta_dot = p->theta_dot;
+		x.phi = p->phi;			x.phi_dot = p->phi_dot;
+		x.delta = p->delta;		x.delta_dot = p->delta_dot;
+		k1 = derivs(p, &x, dutyL, dutyR, &p->accel);
+		t = add_scaled(&x, &k1, h/2);
+		k2 = derivs(p, &t, dutyL, dutyR, NULL);
+		t = add_scaled(&x, &k2, h/2);
+		k3 = derivs(p, &t, dutyL, dutyR, NULL);
+		t = add_scaled(&x, &k3, h);
+		k4 = derivs(p, &t, dutyL, dutyR, NULL);
+		p->theta += h/6*(k1.theta + 2*k2.theta + 2*k3.theta + k4.theta);
+		p->theta_dot += h/6*(k1.theta_dot + 2*k2.theta_dot + 2*k3.theta_dot + k4.theta_dot);
+		p->phi += h/6*(k1.phi + 2*k2.phi + 2*k3.phi + k4.phi);
+		p->phi_dot += h/6*(k1.phi_dot + 2*k2.phi_dot + 2*k3.phi_dot + k4.phi_dot);
+		p->delta += h/6*(k1.delta + 2*k2.delta + 2*k3.delta + k4.delta);
+		p->delta_dot += h/6*(k1.delta_dot + 2*k2.delta_dot + 2*k3.delta_dot + k4.delta_dot);
+		elapsed += h;
+	}
+	// lying on the floor
+	if(fabs(p->theta)>M_PI/2){
+		p->theta = p->theta>0 ? M_PI/2 : -M_PI/2;
+		p->theta_dot = 0;
+	}
+}
+
+// Box-Muller normal sample from the plant's own generator so runs repeat
+static double gauss(mip_plant_t* p){
+	double u1 = (rand_r(&p->seed)+1.0)/(RAND_MAX+2.0);
+	double u2 = (rand_r(&p->seed)+1.0)/(RAND_MAX+2.0);
+	return sqrt(-2.0*log(u1))*cos(2.0*M_PI*u2);
+}
+
+/*******************************************************************************
+* void mip_plant_imu(mip_plant_t* p, float accel[3], float gyro[3])
+*
+* The IMU is mounted MOUNT_ANGLE+mount_err off the body axis, so balancer()
+* reads atan2(-accel[2],accel[1]) = theta-MOUNT_ANGLE-mount_err when the
+* robot is still.
+* Axle acceleration is added to the specific force to show its effect on the
+* accelerometer angle.
+*******************************************************************************/
+void mip_plant_imu(mip_plant_t* p, float accel[3], float gyro[3]){
+	double th = p->theta - MOUNT_ANGLE - p->mount_err;
+	double a = p->held ? 0 : p->accel;
+	accel[0] = p->noise*gauss(p);
+	accel[1] = a*sin(th) + G_ACCEL*cos(th) + p->noise*gauss(p);
+	accel[2] = a*cos(th) - G_ACCEL*sin(th) + p->noise*gauss(p);
+	gyro[0] = p->theta_dot*180.0/M_PI + p->gyro_bias + p->noise*gauss(p);
+	gyro[1] = p->noise*gauss(p);
+	gyro[2] = (p->delta_dot*2.0*WHEEL_RADIUS_M/TRACK_WIDTH_M)*180.0/M_PI \
+							+ p->noise*gauss(p);
+}
+
+/*******************************************************************************
+* void mip_plant_encoders(const mip_plant_t* p, int* left, int* right)
+*
+* inverse of the wheel angle conversion in balancer(), truncated to counts
+*******************************************************************************/
+void mip_plant_encoders(const mip_plant_t* p, int* left, int* right){
+	double counts_per_rad = GEARBOX*ENCODER_RES/(2.0*M_PI);
+	*left  = (int)lrint((p->phi - p->delta - p->theta)*ENCODER_POLARITY_L*counts_per_rad);
+	*right = (int)lrint((p->phi + p->delta - p->theta)*ENCODER_POLARITY_R*counts_per_rad);
+}
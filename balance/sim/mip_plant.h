@@ -0,0 +1,35 @@
+/*******************************************************************************
+* mip_plant.h
+*
+* Nonlinear model of the EduMIP: body pendulum on two wheels driven through
+* the gearbox by DC motors with back EMF. theta is body tilt from vertical,
+* phi the wheel angle measured against the ground (so the encoders read
+* phi-theta), delta half the difference between the right and left wheels.
+*******************************************************************************/
+
+#ifndef MIP_PLANT_H
+#define MIP_PLANT_H
+
+typedef struct mip_plant_t{
+	double theta, theta_dot;
+	double phi, phi_dot;
+	double delta, delta_dot;
+	double accel;		// forward acceleration of the axle, seen by the IMU
+	double v_batt;
+	double push;		// external torque on the body, Nm
+	int held;		// body held still by hand, wheels spin freely
+	int stalled;		// wheels blocked, driven into a wall
+	double gyro_bias;	// deg/s added to the gyro
+	double mount_err;	// rad the IMU sits past MOUNT_ANGLE
+	double noise;		// standard deviation of IMU noise, m/s^2 and deg/s
+	unsigned int seed;
+}mip_plant_t;
+
+void mip_plant_init(mip_plant_t* p, double theta0);
+// integrate dt seconds with fixed duties, in 1 ms RK4 steps
+void mip_plant_step(mip_plant_t* p, double dutyL, double dutyR, double dt);
+// what the IMU and encoders would read in the current state
+void mip_plant_imu(mip_plant_t* p, float accel[3], float gyro[3]);
+void mip_plant_encoders(const mip_plant_t* p, int* left, int* right);
+
+#endif	//MIP_PLANT_H
@@ -0,0 +1,223 @@
+/*******************************************************************************
+* rc_sim.c
+*
+* Stand-in implementation of the robotics cape calls used by balance.c.
+* Hardware calls just read or write rc_sim, ring buffers behave like the real
+* library: position 0 is the newest value.
+*******************************************************************************/
+
+#include <rc_usefulincludes.h>
+#include "rc_sim.h"
+
+rc_sim_t rc_sim = {
+	.state = UNINITIALIZED,
+	.battery_v = 7.4f,
+};
+
+/*******************************************************************************
+* cape
+*******************************************************************************/
+int rc_initialize(){
+	rc_sim.state = PAUSED;
+	return 0;
+}
+
+int rc_cleanup(){
+	rc_sim.state = EXITING;
+	return 0;
+}
+
+rc_state_t rc_get_state(){
+	return rc_sim.state;
+}
+
+int rc_set_state(rc_state_t new_state){
+	rc_sim.state = new_state;
+	return 0;
+}
+
+void rc_usleep(unsigned int us){
+	struct timespec ts;
+	ts.tv_sec = us/1000000;
+	ts.tv_nsec = (us%1000000)*1000;
+	nanosleep(&ts, NULL);
+}
+
+uint64_t rc_nanos_since_boot(){
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec*1000000000ULL + ts.tv_nsec;
+}
+
+/*******************************************************************************
+* leds and buttons
+*******************************************************************************/
+int rc_set_led(rc_led_t led, int state){
+	rc_sim.led[led] = state;
+	return 0;
+}
+
+int rc_blink_led(rc_led_t led, float hz, float period){
+	return 0;
+}
+
+int rc_set_pause_pressed_func(void (*func)(void)){
+	rc_sim.pause_pressed = func;
+	return 0;
+}
+
+int rc_set_pause_released_func(void (*func)(void)){
+	rc_sim.pause_released = func;
+	return 0;
+}
+
+int rc_set_mode_pressed_func(void (*func)(void)){
+	rc_sim.mode_pressed = func;
+	return 0;
+}
+
+int rc_set_mode_released_func(void (*func)(void)){
+	rc_sim.mode_released = func;
+	return 0;
+}
+
+rc_button_state_t rc_get_pause_button(){
+	return rc_sim.pause_button;
+}
+
+rc_button_state_t rc_get_mode_button(){
+	return rc_sim.mode_button;
+}
+
+/*******************************************************************************
+* motors, encoders, battery
+*******************************************************************************/
+int rc_enable_motors(){
+	rc_sim.motors_enabled = 1;
+	return 0;
+}
+
+int rc_disable_motors(){
+	int i;
+	rc_sim.motors_enabled = 0;
+	for(i=0;i<RC_SIM_CHANNELS;i++) rc_sim.duty[i] = 0;
+	return 0;
+}
+
+int rc_set_motor(int motor, float duty){
+	if(motor<1 || motor>=RC_SIM_CHANNELS) return -1;
+	if(duty>1) duty = 1;
+	if(duty<-1) duty = -1;
+	rc_sim.duty[motor] = duty;
+	rc_sim.motor_writes++;
+	return 0;
+}
+
+int rc_set_motor_all(float duty){
+	int i;
+	for(i=1;i<RC_SIM_CHANNELS;i++) rc_sim.duty[i] = duty;
+	rc_sim.motor_writes++;
+	return 0;
+}
+
+float rc_sim_motor(int ch){
+	if(!rc_sim.motors_enabled || ch<1 || ch>=RC_SIM_CHANNELS) return 0;
+	return rc_sim.duty[ch];
+}
+
+int rc_get_encoder_pos(int ch){
+	if(ch<1 || ch>=RC_SIM_CHANNELS) return 0;
+	return rc_sim.encoder_raw[ch]-rc_sim.encoder_offset[ch];
+}
+
+int rc_set_encoder_pos(int ch, int value){
+	if(ch<1 || ch>=RC_SIM_CHANNELS) return -1;
+	rc_sim.encoder_offset[ch] = rc_sim.encoder_raw[ch]-value;
+	return 0;
+}
+
+float rc_battery_voltage(){
+	return rc_sim.battery_v;
+}
+
+/*******************************************************************************
+* imu, data is written into the caller's struct by the simulator
+*******************************************************************************/
+rc_imu_config_t rc_default_imu_config(){
+	rc_imu_config_t conf;
+	conf.dmp_sample_rate = 100;
+	conf.dmp_interrupt_priority = 98;
+	return conf;
+}
+
+int rc_initialize_imu(rc_imu_data_t* data, rc_imu_config_t conf){
+	return 0;
+}
+
+int rc_initialize_imu_dmp(rc_imu_data_t* data, rc_imu_config_t conf){
+	return 0;
+}
+
+int rc_read_accel_data(rc_imu_data_t* data){
+	return 0;
+}
+
+int rc_read_gyro_data(rc_imu_data_t* data){
+	return 0;
+}
+
+int rc_set_imu_interrupt_func(void (*func)(void)){
+	rc_sim.imu_interrupt = func;
+	return 0;
+}
+
+int rc_power_off_imu(){
+	return 0;
+}
+
+/*******************************************************************************
+* ring buffers
+*******************************************************************************/
+rc_ringbuf_t rc_empty_ringbuf(){
+	rc_ringbuf_t buf;
+	buf.d = NULL;
+	buf.size = 0;
+	buf.index = 0;
+	buf.initialized = 0;
+	return buf;
+}
+
+int rc_alloc_ringbuf(rc_ringbuf_t* buf, int size){
+	if(size<2) return -1;
+	buf->d = calloc(size, sizeof(float));
+	if(buf->d==NULL) return -1;
+	buf->size = size;
+	buf->index = 0;
+	buf->initialized = 1;
+	return 0;
+}
+
+int rc_reset_ringbuf(rc_ringbuf_t* buf){
+	if(!buf->initialized) return -1;
+	memset(buf->d, 0, buf->size*sizeof(float));
+	buf->index = 0;
+	return 0;
+}
+
+int rc_insert_new_ringbuf_value(rc_ringbuf_t* buf, float val){
+	int new_index;
+	if(!buf->initialized) return -1;
+	new_index = buf->index+1;
+	if(new_index>=buf->size) new_index = 0;
+	buf->d[new_index] = val;
+	buf->index = new_index;
+	return 0;
+}
+
+float rc_get_ringbuf_value(rc_ringbuf_t* buf, int position){
+	int i;
+	if(!buf->initialized || position<0 || position>=buf->size) return -1;
+	i = buf->index-position;
+	if(i<0) i += buf->size;
+	return buf->d[i];
+}
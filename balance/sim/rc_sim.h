@@ -0,0 +1,39 @@
+/*******************************************************************************
+* rc_sim.h
+*
+* Simulator side of the stand-in robotics cape library. The simulator writes
+* encoder counts and battery voltage here and reads back what balance.c did
+* to the motors, LEDs and program state.
+*******************************************************************************/
+
+#ifndef RC_SIM_H
+#define RC_SIM_H
+
+#include "roboticscape.h"
+
+#define RC_SIM_CHANNELS	5	// motor and encoder channels are 1 to 4
+
+typedef struct rc_sim_t{
+	rc_state_t state;
+	int motors_enabled;
+	float duty[RC_SIM_CHANNELS];		// last duty written, 0 while disabled
+	unsigned long motor_writes;		// rc_set_motor/rc_set_motor_all calls
+	int encoder_raw[RC_SIM_CHANNELS];	// counts produced by the plant
+	int encoder_offset[RC_SIM_CHANNELS];	// moved by rc_set_encoder_pos
+	float battery_v;
+	int led[2];
+	rc_button_state_t pause_button;
+	rc_button_state_t mode_button;
+	void (*pause_pressed)(void);
+	void (*pause_released)(void);
+	void (*mode_pressed)(void);
+	void (*mode_released)(void);
+	void (*imu_interrupt)(void);
+}rc_sim_t;
+
+extern rc_sim_t rc_sim;
+
+// duty a motor channel is actually driven with
+float rc_sim_motor(int ch);
+
+#endif	//RC_SIM_H
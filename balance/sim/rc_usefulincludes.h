@@ -0,0 +1,25 @@
+/*******************************************************************************
+* rc_usefulincludes.h
+*
+* Simulated stand-in, the common system includes balance.c relies on
+*******************************************************************************/
+
+#ifndef RC_USEFUL_INCLUDES
+#define RC_USEFUL_INCLUDES
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <signal.h>
+#include <errno.h>
+#include <time.h>
+
+#endif	//RC_USEFUL_INCLUDES
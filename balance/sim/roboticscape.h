@@ -0,0 +1,100 @@
+/*******************************************************************************
+* roboticscape.h
+*
+* Simulated stand-in for the robotics cape library header. Only the part of
+* the API used by balance.c is provided, with the same names and signatures,
+* so balance.c compiles unchanged against rc_sim.c on any Linux machine.
+*******************************************************************************/
+
+#ifndef ROBOTICS_CAPE
+#define ROBOTICS_CAPE
+
+#include <stdint.h>
+
+#define PI		3.14159265358979323846
+#define TWO_PI		6.28318530717958647692
+#define DEG_TO_RAD	0.0174532925199
+#define RAD_TO_DEG	57.295779513
+#define ON		1
+#define OFF		0
+
+typedef enum rc_state_t{
+	UNINITIALIZED,
+	RUNNING,
+	PAUSED,
+	EXITING
+}rc_state_t;
+
+typedef enum rc_led_t{
+	GREEN,
+	RED
+}rc_led_t;
+
+typedef enum rc_button_state_t{
+	RELEASED,
+	PRESSED
+}rc_button_state_t;
+
+typedef struct rc_ringbuf_t{
+	float* d;
+	int size;
+	int index;
+	int initialized;
+}rc_ringbuf_t;
+
+typedef struct rc_imu_data_t{
+	float accel[3];		// m/s^2
+	float gyro[3];		// deg/s
+	float mag[3];
+	float temp;
+}rc_imu_data_t;
+
+typedef struct rc_imu_config_t{
+	int dmp_sample_rate;
+	int dmp_interrupt_priority;
+}rc_imu_config_t;
+
+// cape
+int rc_initialize();
+int rc_cleanup();
+rc_state_t rc_get_state();
+int rc_set_state(rc_state_t new_state);
+void rc_usleep(unsigned int us);
+uint64_t rc_nanos_since_boot();
+
+// leds and buttons
+int rc_set_led(rc_led_t led, int state);
+int rc_blink_led(rc_led_t led, float hz, float period);
+int rc_set_pause_pressed_func(void (*func)(void));
+int rc_set_pause_released_func(void (*func)(void));
+int rc_set_mode_pressed_func(void (*func)(void));
+int rc_set_mode_released_func(void (*func)(void));
+rc_button_state_t rc_get_pause_button();
+rc_button_state_t rc_get_mode_button();
+
+// motors, encoders, battery
+int rc_enable_motors();
+int rc_disable_motors();
+int rc_set_motor(int motor, float duty);
+int rc_set_motor_all(float duty);
+int rc_get_encoder_pos(int ch);
+int rc_set_encoder_pos(int ch, int value);
+float rc_battery_voltage();
+
+// imu
+rc_imu_config_t rc_default_imu_config();
+int rc_initialize_imu(rc_imu_data_t* data, rc_imu_config_t conf);
+int rc_initialize_imu_dmp(rc_imu_data_t* data, rc_imu_config_t conf);
+int rc_read_accel_data(rc_imu_data_t* data);
+int rc_read_gyro_data(rc_imu_data_t* data);
+int rc_set_imu_interrupt_func(void (*func)(void));
+int rc_power_off_imu();
+
+// ring buffers
+rc_ringbuf_t rc_empty_ringbuf();
+int rc_alloc_ringbuf(rc_ringbuf_t* buf, int size);
+int rc_reset_ringbuf(rc_ringbuf_t* buf);
+int rc_insert_new_ringbuf_value(rc_ringbuf_t* buf, float val);
+float rc_get_ringbuf_value(rc_ringbuf_t* buf, int position);
+
+#endif	//ROBOTICS_CAPE
@@ -0,0 +1,474 @@
+/*******************************************************************************
+* sim.c
+*
+* Closed loop simulation of balance.c. balancer(), outer_loop(),
+* battery_checker() and traj_task() run unchanged against the stand-in cape library in
+* rc_sim.c and the nonlinear MIP model in mip_plant.c, tick for tick at the
+* rates in balance_config.h. Each scenario reports its outcome and step
+* response numbers, and can save its trace or compare it to a saved one.
+*
+*	sim all			run every scenario, one process each
+*	sim -t ref/ all		also write ref/<scenario>.txt traces
+*	sim -c ref/ all		compare against traces saved earlier
+*******************************************************************************/
+
+#include <rc_usefulincludes.h>
+#include <sys/wait.h>
+#include "../balance_config.h"
+#include "../balance.h"
+#include "../trajectory.h"
+#include "../flight_recorder.h"
+#include "../fr_codec.h"
+#include "../perf_prof.h"
+#include "rc_sim.h"
+#include "mip_plant.h"
+
+#define WARMUP_S	8.0	// held still first so the complementary filter settles
+#define SETTLE_BAND	0.02	// rad, theta counts as settled inside this
+#define TRACE_COLS	12
+#define MAX_SCENARIOS	16
+
+/*******************************************************************************
+* scenario_t
+*
+* event() is called every D1 tick before the plant is stepped, t=0 is the
+* moment the controller is engaged
+*******************************************************************************/
+typedef struct scenario_t{
+	const char* name;
+	const char* expect;	// "balanced" or "disengaged"
+	double theta0;
+	double duration;
+	void (*event)(double t, mip_plant_t* p);
+}scenario_t;
+
+/*******************************************************************************
+* result_t
+*
+* what one run reports back to the parent process
+*******************************************************************************/
+typedef struct result_t{
+	char outcome[32];
+	int ok;
+	double settle;		// last time |theta| left SETTLE_BAND while engaged
+	double overshoot;	// % of theta0 on the far side of upright
+	double max_theta;
+	double drift;		// m the robot rolled away from where it started
+	double max_duty;
+	double ise;		// integral of theta^2 while engaged
+	double est;		// rms error of the theta estimate while engaged
+	double dev;		// worst deviation from the reference trace, in tolerances
+	int compared;
+}result_t;
+
+static double duration_override=0;
+static double battery_v=V_NOMINAL;
+static double tol_scale=1.0;
+static double imu_noise=0;
+static double gyro_bias=0;
+static double mount_err=0;
+static const char* trace_prefix=NULL;
+static const char* compare_prefix=NULL;
+static const char* flight_dir=NULL;
+static int flight_log=0;
+static int verbose=0;
+static int json=0;
+// perf_prof.h regions of the tasks with PERF=1, balancer() has its own
+static int prof_traj=-1, prof_outer=-1, prof_batt=-1;
+
+/*******************************************************************************
+* scenario events
+*******************************************************************************/
+static void ev_none(double t, mip_plant_t* p){
+}
+
+// a sharp shove on the body, about 1 rad/s of tilt rate
+static void ev_push(double t, mip_plant_t* p){
+	p->push = (t>=1.0 && t<1.05) ? 0.02 : 0;
+}
+
+// a shove D1 saturates on and D2 runs into THETA_REF_MAX
+static void ev_shove(double t, mip_plant_t* p){
+	p->push = (t>=1.0 && t<1.05) ? 0.32 : 0;
+}
+
+// a shove no controller could catch
+static void ev_tip(double t, mip_plant_t* p){
+	p->push = (t>=1.0 && t<1.3) ? 0.15 : 0;
+}
+
+// driven into a wall and left leaning on it, D1 winds up and saturates
+static void ev_saturate(double t, mip_plant_t* p){
+	if(t>=0.5){
+		p->held = 1;
+		p->stalled = 1;
+		p->theta_dot = p->theta<0.3 ? 1.0 : 0;	// tipped over in 0.3s
+		p->phi_dot = 0;
+		p->delta_dot = 0;
+	}
+}
+
+// paused for a second while held, then resumed and re-engaged like main() would
+static void ev_pause(double t, mip_plant_t* p){
+	if(t>=1.0 && t<2.0){
+		rc_set_state(PAUSED);
+		p->held = 1;
+		p->theta_dot = 0;
+	}
+	else if(t>=2.0 && p->held){
+		rc_set_state(RUNNING);
+		p->held = 0;
+		if(setpoint.control_state==DISENGAGED && fabs(state.theta)<START_ANGLE){
+			engage_controller();
+		}
+	}
+}
+
+// drive forward half a metre, then turn 90 degrees in place
+static void ev_drive(double t, mip_plant_t* p){
+	static int sent=0;
+	if(t>=0.5 && !sent){
+		traj_command("wp 2 15 0; wp 4 15 1.57");
+		sent = 1;
+	}
+}
+
+static scenario_t scenarios[] = {
+	{"upright",	"balanced",	0.10,	5.0,	ev_none},
+	{"push",	"balanced",	0.0,	5.0,	ev_push},
+	{"shove",	"balanced",	0.0,	8.0,	ev_shove},
+	{"tip",		"disengaged",	0.0,	3.0,	ev_tip},
+	{"saturate",	"disengaged",	0.0,	3.0,	ev_saturate},
+	{"pause",	"balanced",	0.05,	5.0,	ev_pause},
+	{"drive",	"balanced",	0.0,	6.0,	ev_drive},
+};
+#define NUM_SCENARIOS (int)(sizeof(scenarios)/sizeof(scenarios[0]))
+
+static void print_usage(){
+	int i;
+	printf("\nUsage: sim [options] scenario|all\n");
+	printf("-T s       override the scenario duration\n");
+	printf("-b volts   battery voltage (default V_NOMINAL)\n");
+	printf("-n sigma   IMU noise, m/s^2 and deg/s (default 0)\n");
+	printf("-g deg/s   gyro bias (default 0)\n");
+	printf("-m rad     IMU mount angle error (default 0)\n");
+	printf("-t prefix  write each trace to <prefix><scenario>.txt\n");
+	printf("-c prefix  compare each trace with <prefix><scenario>.txt\n");
+	printf("-f dir     flight recorder dumps go to dir\n");
+	printf("-l         and a compressed log of every tick\n");
+	printf("-tol k     scale the compare tolerance bands by k (default 1)\n");
+	printf("-v         show balance.c output\n");
+	printf("-j         print the results as one JSON object\n");
+	printf("scenarios:");
+	for(i=0;i<NUM_SCENARIOS;i++) printf(" %s", scenarios[i].name);
+	printf("\n\n");
+}
+
+/*******************************************************************************
+* static void sense(mip_plant_t* p)
+*
+* hand the plant's state to balance.c the way the hardware would
+*******************************************************************************/
+static void sense(mip_plant_t* p){
+	int left, right;
+	mip_plant_imu(p, imu_data.accel, imu_data.gyro);
+	mip_plant_encoders(p, &left, &right);
+	rc_sim.encoder_raw[ENCODER_CHANNEL_L] = left;
+	rc_sim.encoder_raw[ENCODER_CHANNEL_R] = right;
+	rc_sim.battery_v = p->v_batt;
+}
+
+/*******************************************************************************
+* static int compare_row(FILE* ref, const double* row, double* worst)
+*
+* Tolerance bands per column, scaled by -tol. Only the physical state and
+* the motor commands are compared, those are what a tuning change moves.
+*******************************************************************************/
+static int compare_row(FILE* ref, const double* row, double* worst){
+	static const int cols[] = {1, 3, 9, 10};
+	static const double band[] = {0.01, 0.05, 0.05, 0.05};
+	double r[TRACE_COLS], d;
+	int i;
+
+	for(i=0;i<TRACE_COLS;i++){
+		if(fscanf(ref, "%lf", &r[i])!=1) return -1;
+	}
+	for(i=0;i<4;i++){
+		d = fabs(row[cols[i]]-r[cols[i]])/(band[i]*tol_scale);
+		if(d>*worst) *worst = d;
+	}
+	return 0;
+}
+
+/*******************************************************************************
+* static void run_task(void (*fn)(void), int prof)
+*
+* one housekeeping task, profiled with PERF=1 the way task_runner.c would
+*******************************************************************************/
+static void run_task(void (*fn)(void), int prof){
+#ifdef USE_PERF_PROF
+	perf_prof_begin(prof);
+	fn();
+	perf_prof_end(prof);
+#else
+	(void)prof;
+	fn();
+#endif
+}
+
+/*******************************************************************************
+* static void run(const scenario_t* sc, result_t* res)
+*
+* one scenario from power on to the end, in the calling process
+*******************************************************************************/
+static void run(const scenario_t* sc, result_t* res){
+	mip_plant_t plant;
+	FILE* trace=NULL;
+	FILE* ref=NULL;
+	char name[256];
+	double row[TRACE_COLS];
+	double t, duration, dutyL=0, dutyR=0, sign;
+	int k, warm_ticks, ticks, i, disengaged_at=-1, engaged_ticks=0;
+	const int d2_div = SAMPLE_RATE_D1_HZ/SAMPLE_RATE_D2_HZ;
+	const int batt_div = SAMPLE_RATE_D1_HZ/BATTERY_CHECK_HZ;
+	const int traj_div = SAMPLE_RATE_D1_HZ/SETPOINT_MANAGER_HZ;
+
+	memset(res, 0, sizeof(result_t));
+	duration = duration_override>0 ? duration_override : sc->duration;
+	mip_plant_init(&plant, sc->theta0);
+	plant.v_batt = battery_v;
+	plant.noise = imu_noise;
+	plant.gyro_bias = gyro_bias;
+	plant.mount_err = mount_err;
+	if(trace_prefix){
+		snprintf(name, sizeof(name), "%s%s.txt", trace_prefix, sc->name);
+		trace = fopen(name, "w");
+		if(trace==NULL) perror(name);
+	}
+	if(compare_prefix){
+		snprintf(name, sizeof(name), "%s%s.txt", compare_prefix, sc->name);
+		ref = fopen(name, "r");
+		res->compared = 1;
+		if(ref==NULL){
+			perror(name);
+			res->dev = INFINITY;	// nothing to compare with fails too
+		}
+	}
+
+	rc_initialize();
+	init_controller();
+#ifdef USE_PERF_PROF
+	prof_traj = perf_prof_region("trajectory");
+	prof_outer = perf_prof_region("outer_loop");
+	prof_batt = perf_prof_region("battery");
+#endif
+	if(flight_dir && fr_init(flight_dir)==0 && flight_log) fr_log_start();
+	rc_set_state(RUNNING);
+	warm_ticks = WARMUP_S*SAMPLE_RATE_D1_HZ;
+	ticks = duration*SAMPLE_RATE_D1_HZ;
+	plant.held = 1;
+	sign = sc->theta0>=0 ? 1 : -1;
+
+	for(k=-warm_ticks; k<ticks; k++){
+		t = (double)k/SAMPLE_RATE_D1_HZ;
+		if(k==0){
+			plant.held = 0;
+			engage_controller();
+		}
+		if(k>=0) sc->event(t, &plant);
+		mip_plant_step(&plant, dutyL, dutyR, DT_D1);
+		sense(&plant);
+
+		// same order as on the robot: IMU interrupt, then the slower tasks
+		balancer();
+		// on the robot a block takes 1.28s to fill, here the log thread
+		// gets a turn per block so it never falls a ring behind
+		if(flight_log && (k+warm_ticks)%FR_CODEC_BLOCK==0) usleep(1000);
+		if((k+warm_ticks)%traj_div==0) run_task(traj_task, prof_traj);
+		if((k+warm_ticks)%d2_div==0) run_task(outer_loop, prof_outer);
+		if((k+warm_ticks)%batt_div==0) run_task(battery_checker, prof_batt);
+		dutyL = MOTOR_POLARITY_L*rc_sim_motor(MOTOR_CHANNEL_L);
+		dutyR = MOTOR_POLARITY_R*rc_sim_motor(MOTOR_CHANNEL_R);
+		if(k<0) continue;
+
+		if(setpoint.control_state==ENGAGED){
+			if(fabs(plant.theta)>SETTLE_BAND) res->settle = t;
+			res->ise += plant.theta*plant.theta*DT_D1;
+			res->est += (state.theta-plant.theta)*(state.theta-plant.theta);
+			engaged_ticks++;
+		}
+		else if(disengaged_at<0) disengaged_at = k;
+		if(fabs(plant.theta)>res->max_theta) res->max_theta = fabs(plant.theta);
+		if(-sign*plant.theta>res->overshoot) res->overshoot = -sign*plant.theta;
+		if(fabs(dutyL)>res->max_duty) res->max_duty = fabs(dutyL);
+		if(fabs(dutyR)>res->max_duty) res->max_duty = fabs(dutyR);
+
+		row[0] = t;
+		row[1] = plant.theta;
+		row[2] = state.theta;
+		row[3] = plant.phi;
+		row[4] = state.phi;
+		row[5] = state.gamma;
+		row[6] = state.d1_out;
+		row[7] = state.d2_out;
+		row[8] = state.d3_out;
+		row[9] = dutyL;
+		row[10] = dutyR;
+		row[11] = setpoint.control_state==ENGAGED;
+		if(trace){
+			for(i=0;i<TRACE_COLS;i++) fprintf(trace, "%.6f%c", row[i], i==TRACE_COLS-1 ? '\n' : ' ');
+		}
+		if(ref && compare_row(ref, row, &res->dev)){
+			res->dev = INFINITY;	// reference is shorter than this run
+			fclose(ref);
+			ref = NULL;
+		}
+	}
+
+	// a reference with rows left over ran longer than this run
+	if(ref && fscanf(ref, "%lf", &row[0])==1) res->dev = INFINITY;
+	res->drift = fabs(plant.phi)*WHEEL_RADIUS_M;
+	res->est = engaged_ticks ? sqrt(res->est/engaged_ticks) : 0;
+	res->overshoot = sc->theta0!=0 ? 100.0*res->overshoot/fabs(sc->theta0) : 0;
+	if(setpoint.control_state==ENGAGED && fabs(plant.theta)<SETTLE_BAND*5){
+		snprintf(res->outcome, sizeof(res->outcome), "balanced");
+	}
+	else if(disengaged_at>=0){
+		snprintf(res->outcome, sizeof(res->outcome), "disengaged@%.2fs",\
+			(double)disengaged_at/SAMPLE_RATE_D1_HZ);
+	}
+	else snprintf(res->outcome, sizeof(res->outcome), "unsettled");
+	res->ok = strncmp(res->outcome, sc->expect, strlen(sc->expect))==0;
+	if(res->compared && res->dev>1.0) res->ok = 0;
+	if(trace) fclose(trace);
+	if(ref) fclose(ref);
+	fr_cleanup();
+	rc_cleanup();
+}
+
+static void print_result(const scenario_t* sc, const result_t* r){
+	if(json){
+		printf("\"%s\":{\"ok\":%d,\"outcome\":\"%s\",\"settle\":%.4f,\"overshoot\":%.3f,"\
+			"\"max_theta\":%.5f,\"drift\":%.5f,\"max_duty\":%.4f,\"ise\":%.7f,\"est\":%.6f}",\
+			sc->name, r->ok, r->outcome, r->settle, r->overshoot, r->max_theta,\
+			r->drift, r->max_duty, r->ise, r->est);
+		return;
+	}
+	printf("%-9s %-11s %-17s %6.2fs %8.1f%% %7.3f %6.1fcm %6.2f %8.5f %6.4f",\
+		sc->name, sc->expect, r->outcome, r->settle, r->overshoot,\
+		r->max_theta, r->drift*100, r->max_duty, r->ise, r->est);
+	if(r->compared) printf(" %6.2f", r->dev);
+	else printf("      -");
+	printf("  %s\n", r->ok ? "ok" : "FAIL");
+}
+
+/*******************************************************************************
+* int main(int argc, char* argv[])
+*
+* Every selected scenario runs in its own forked process since balance.c
+* keeps its state in globals. Results come back over a pipe and are printed
+* in scenario order. The exit status is the number of failed scenarios.
+*******************************************************************************/
+int main(int argc, char* argv[]){
+	int sel[MAX_SCENARIOS];
+	int fds[MAX_SCENARIOS][2];
+	pid_t pid[MAX_SCENARIOS];
+	result_t res;
+	struct timespec t0, t1;
+	int nsel=0, i, failed=0;
+
+	for(i=1;i<argc;i++){
+		if(i+1<argc && strcmp(argv[i],"-T")==0) duration_override=atof(argv[++i]);
+		else if(i+1<argc && strcmp(argv[i],"-b")==0) battery_v=atof(argv[++i]);
+		else if(i+1<argc && strcmp(argv[i],"-n")==0) imu_noise=atof(argv[++i]);
+		else if(i+1<argc && strcmp(argv[i],"-g")==0) gyro_bias=atof(argv[++i]);
+		else if(i+1<argc && strcmp(argv[i],"-m")==0) mount_err=atof(argv[++i]);
+		else if(i+1<argc && strcmp(argv[i],"-t")==0) trace_prefix=argv[++i];
+		else if(i+1<argc && strcmp(argv[i],"-c")==0) compare_prefix=argv[++i];
+		else if(i+1<argc && strcmp(argv[i],"-f")==0) flight_dir=argv[++i];
+		else if(i+1<argc && strcmp(argv[i],"-tol")==0) tol_scale=atof(argv[++i]);
+		else if(strcmp(argv[i],"-l")==0) flight_log=1;
+		else if(strcmp(argv[i],"-v")==0) verbose=1;
+		else if(strcmp(argv[i],"-j")==0) json=1;
+		else if(strcmp(argv[i],"all")==0){
+			for(nsel=0;nsel<NUM_SCENARIOS;nsel++) sel[nsel]=nsel;
+		}
+		else{
+			int j, found=0;
+			for(j=0;j<NUM_SCENARIOS;j++){
+				if(strcmp(argv[i],scenarios[j].name)==0 && nsel<MAX_SCENARIOS){
+					sel[nsel++] = j;
+					found = 1;
+				}
+			}
+			if(!found){
+				print_usage();
+				return -1;
+			}
+		}
+	}
+	if(nsel==0){
+		print_usage();
+		return -1;
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &t0);
+	fflush(stdout);
+	for(i=0;i<nsel;i++){
+		if(pipe(fds[i])){
+			perror("pipe");
+			return -1;
+		}
+		pid[i] = fork();
+		if(pid[i]==0){
+			close(fds[i][0]);
+			if(!verbose && freopen("/dev/null", "w", stdout)==NULL) return -1;
+			run(&scenarios[sel[i]], &res);
+			if(write(fds[i][1], &res, sizeof(res))!=sizeof(res)) _exit(1);
+#ifdef USE_PERF_PROF
+			// the profile follows the result down the pipe
+			{
+				FILE* f = fdopen(fds[i][1], "w");
+				if(f==NULL) _exit(1);
+				perf_prof_report(f);
+				fclose(f);
+			}
+#endif
+			_exit(0);
+		}
+		close(fds[i][1]);
+	}
+
+	if(json) printf("{");
+	else printf("scenario  expect      outcome           settle overshoot  max|θ|   drift  max|u|      ISE    est    dev\n");
+	for(i=0;i<nsel;i++){
+		if(read(fds[i][0], &res, sizeof(res))!=sizeof(res)){
+			memset(&res, 0, sizeof(res));
+			snprintf(res.outcome, sizeof(res.outcome), "crashed");
+		}
+		if(json && i) printf(",\n");
+		print_result(&scenarios[sel[i]], &res);
+		if(!res.ok) failed++;
+	}
+	clock_gettime(CLOCK_MONOTONIC, &t1);
+	if(json) printf("}\n");
+	else printf("%d of %d scenarios ok in %.2fs\n", nsel-failed, nsel,\
+		(t1.tv_sec-t0.tv_sec)+(t1.tv_nsec-t0.tv_nsec)*1e-9);
+	// anything after a result is that scenario's PERF=1 profile, on stderr
+	// so the table and the JSON stay as they are
+	fflush(stdout);
+	for(i=0;i<nsel;i++){
+		char buf[4096];
+		ssize_t n;
+		int first=1;
+		while((n=read(fds[i][0], buf, sizeof(buf)))>0){
+			if(first) fprintf(stderr, "\nscenario %s", scenarios[sel[i]].name);
+			fflush(stderr);
+			if(write(STDERR_FILENO, buf, n)!=n) break;
+			first = 0;
+		}
+		close(fds[i][0]);
+		waitpid(pid[i], NULL, 0);
+	}
+	return failed;
+}
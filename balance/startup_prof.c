@@ -0,0 +1,99 @@
+/*******************************************************************************
+* startup_prof.c
+*
+* Marks are CLOCK_BOOTTIME, the clock /proc/self/stat starttime counts in.
+*******************************************************************************/
+
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include <time.h>
+#include <unistd.h>
+#include "startup_prof.h"
+
+typedef struct startup_mark_t{
+	const char* name;
+	int64_t t_ns;
+}startup_mark_t;
+
+static startup_mark_t marks[STARTUP_MAX_MARKS];
+static _Atomic int num_marks=0;
+static int64_t exec_ns=-1;	// -1 unknown, counted from the first mark
+
+static int64_t boot_ns(){
+	struct timespec t;
+	clock_gettime(CLOCK_BOOTTIME, &t);
+	return (int64_t)t.tv_sec*1000000000LL + t.tv_nsec;
+}
+
+/*******************************************************************************
+* static int64_t read_exec_ns()
+*
+* starttime is field 22 of /proc/self/stat, in clock ticks since boot. The
+* command name in field 2 can hold spaces and parentheses, so fields are
+* counted from the last ')'.
+*******************************************************************************/
+static int64_t read_exec_ns(){
+	char buf[1024];
+	unsigned long long start;
+	char* p;
+	FILE* f;
+	size_t n;
+	long hz;
+	int field;
+
+	f = fopen("/proc/self/stat", "r");
+	if(f==NULL) return -1;
+	n = fread(buf, 1, sizeof(buf)-1, f);
+	fclose(f);
+	buf[n] = 0;
+	p = strrchr(buf, ')');
+	hz = sysconf(_SC_CLK_TCK);
+	if(p==NULL || hz<=0) return -1;
+	for(field=2; field<22 && p!=NULL; field++) p = strchr(p+1, ' ');
+	if(p==NULL || sscanf(p, " %llu", &start)!=1) return -1;
+	return (int64_t)(start*(1000000000ULL/hz));
+}
+
+void startup_mark(const char* name){
+	int64_t t = boot_ns();
+	int i = atomic_fetch_add_explicit(&num_marks, 1, memory_order_relaxed);
+
+	if(i>=STARTUP_MAX_MARKS) return;
+	// first mark comes from main() before any other thread exists
+	if(i==0) exec_ns = read_exec_ns();
+	marks[i].name = name;
+	marks[i].t_ns = t;
+}
+
+static int64_t origin_ns(){
+	return exec_ns>=0 ? exec_ns : marks[0].t_ns;
+}
+
+double startup_total_ms(){
+	int n = atomic_load_explicit(&num_marks, memory_order_acquire);
+	if(n>STARTUP_MAX_MARKS) n = STARTUP_MAX_MARKS;
+	if(n==0) return 0;
+	return (marks[n-1].t_ns-origin_ns())/1e6;
+}
+
+void startup_report(FILE* f, double budget_ms){
+	int64_t prev;
+	double total;
+	int i, n;
+
+	n = atomic_load_explicit(&num_marks, memory_order_acquire);
+	if(n>STARTUP_MAX_MARKS) n = STARTUP_MAX_MARKS;
+	if(n==0) return;
+	prev = origin_ns();
+	fprintf(f, "\nstartup, ms since %s:\n", exec_ns>=0 ? "exec" : "main");
+	for(i=0;i<n;i++){
+		fprintf(f, "  %8.1f  +%7.1f  %s\n", (marks[i].t_ns-origin_ns())/1e6,\
+			(marks[i].t_ns-prev)/1e6, marks[i].name);
+		prev = marks[i].t_ns;
+	}
+	total = startup_total_ms();
+	fprintf(f, "ready to balance %.0fms after %s\n", total, exec_ns>=0 ? "exec" : "main");
+	if(total>budget_ms) fprintf(f, "WARNING: startup took longer than %.0fms\n", budget_ms);
+}
@@ -0,0 +1,26 @@
+/*******************************************************************************
+* startup_prof.h
+*
+* Where the time between exec and "ready to balance" goes. main() marks the
+* end of every init step and balancer() its first tick, the report lists
+* each step with its duration and the time since the kernel started the
+* process. That start time comes from /proc/self/stat and has clock tick
+* resolution (10ms), so the first line includes the loader and everything
+* before main(). Without /proc times are counted from the first mark.
+*******************************************************************************/
+
+#ifndef STARTUP_PROF_H
+#define STARTUP_PROF_H
+
+#include <stdio.h>
+
+#define STARTUP_MAX_MARKS	16
+
+// name must outlive the report, a string literal. Safe from any thread.
+void startup_mark(const char* name);
+// ms from exec to the last mark
+double startup_total_ms();
+// one line per mark, and a warning past budget_ms
+void startup_report(FILE* f, double budget_ms);
+
+#endif	//STARTUP_PROF_H
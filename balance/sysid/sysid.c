@@ -0,0 +1,418 @@
+/*******************************************************************************
+* sysid.c
+*
+* Offline system identification for the MIP. Fits a discrete ARX or ARMAX
+* model  A(z)y = B(z)u + C(z)e  to recorded runs with batched least squares
+* and reports how well it fits, so a robot whose dynamics have drifted from
+* the MATLAB model behind D1_NUM/D1_DEN shows up as a bad fit or moved poles.
+*
+* Typical use, inner plant (motor duty -> theta) and outer plant (theta -> phi)
+*	sysid -u 1 -y 2 run1.txt run2.txt
+*	sysid -u 2 -y 3 -na 2 -nb 2 -nk 0 run1.txt run2.txt
+*******************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <complex.h>
+#include <time.h>
+#include "../balance_config.h"
+
+#define MAX_ORDER	8
+#define MAX_PARAMS	(3*MAX_ORDER)
+#define MAX_FILES	64
+#define BLOCK_ROWS	256	// rows per block, keeps a block of regressors in L1
+#define ELS_ITERS	10	// extended least squares passes for ARMAX
+#define MAX_COLS	32
+
+/*******************************************************************************
+* segment_t
+*
+* one recorded run, regressors never reach across two segments
+*******************************************************************************/
+typedef struct segment_t{
+	const char* name;
+	double* u;
+	double* y;
+	double* e;	// residuals from the previous pass, used by the C(z) terms
+	int n;
+}segment_t;
+
+/*******************************************************************************
+* model_t
+*
+* theta is ordered a1..a_na, b0..b_nb-1, c1..c_nc
+*******************************************************************************/
+typedef struct model_t{
+	int na, nb, nk, nc;
+	int p;
+	double theta[MAX_PARAMS];
+}model_t;
+
+static void print_usage(){
+	printf("\nUsage: sysid [options] file [file ...]\n");
+	printf("files are whitespace separated columns, one sample per row\n");
+	printf("-u col   input column, 0 based (default 1, motor duty)\n");
+	printf("-y col   output column, 0 based (default 2, theta)\n");
+	printf("-na n    number of poles (default 2)\n");
+	printf("-nb n    number of zeros+1 (default 3)\n");
+	printf("-nk n    input delay in samples (default 1)\n");
+	printf("-nc n    noise model order, >0 fits ARMAX (default 0)\n");
+	printf("-dt s    sample time (default DT_D1)\n\n");
+}
+
+/*******************************************************************************
+* static int load_segment(const char* name, int ucol, int ycol, segment_t* s)
+*
+* read two columns of a text log, lines that don't start with a number are
+* treated as headers or comments and skipped. A file with no row that has
+* both columns is an error, usually a column number off by one.
+*******************************************************************************/
+static int load_segment(const char* name, int ucol, int ycol, segment_t* s){
+	FILE* f;
+	char line[1024];
+	char* p;
+	char* end;
+	double col[MAX_COLS];
+	double *u, *y;
+	int cap=4096, ncol, rows=0;
+
+	f = fopen(name, "r");
+	if(f==NULL){
+		perror(name);
+		return -1;
+	}
+	s->name = name;
+	s->n = 0;
+	s->u = malloc(cap*sizeof(double));
+	s->y = malloc(cap*sizeof(double));
+	s->e = NULL;
+	if(s->u==NULL || s->y==NULL) goto no_memory;
+	while(fgets(line, sizeof(line), f)){
+		p = line;
+		for(ncol=0; ncol<MAX_COLS; ncol++){
+			col[ncol] = strtod(p, &end);
+			if(end==p) break;
+			p = end;
+		}
+		if(ncol>0) rows++;
+		if(ncol<=ucol || ncol<=ycol) continue;
+		if(s->n==cap){
+			cap *= 2;
+			u = realloc(s->u, cap*sizeof(double));
+			if(u!=NULL) s->u = u;
+			y = realloc(s->y, cap*sizeof(double));
+			if(y!=NULL) s->y = y;
+			if(u==NULL || y==NULL) goto no_memory;
+		}
+		s->u[s->n] = col[ucol];
+		s->y[s->n] = col[ycol];
+		s->n++;
+	}
+	fclose(f);
+	if(s->n==0){
+		fprintf(stderr,"ERROR: %s has %d data rows but none with columns %d and %d, "\
+			"columns count from 0\n", name, rows, ucol, ycol);
+		goto fail;
+	}
+	s->e = calloc(s->n, sizeof(double));
+	if(s->e!=NULL) return 0;
+	fprintf(stderr,"ERROR: out of memory reading %s\n", name);
+	goto fail;
+
+no_memory:
+	fprintf(stderr,"ERROR: out of memory reading %s\n", name);
+	fclose(f);
+fail:
+	free(s->u);
+	free(s->y);
+	s->u = s->y = NULL;
+	return -1;
+}
+
+/*******************************************************************************
+* static int first_row(const model_t* m)
+*
+* first sample of a segment with a complete regressor
+*******************************************************************************/
+static int first_row(const model_t* m){
+	int k = m->na;
+	if(m->nk+m->nb-1 > k) k = m->nk+m->nb-1;
+	if(m->nc > k) k = m->nc;
+	return k;
+}
+
+/*******************************************************************************
+* static double dot(const double* a, const double* b, int n)
+*
+* four independent sums so the compiler can keep them in vector lanes
+*******************************************************************************/
+static double dot(const double* restrict a, const double* restrict b, int n){
+	double s0=0, s1=0, s2=0, s3=0;
+	int i;
+	for(i=0; i+4<=n; i+=4){
+		s0 += a[i]*b[i];
+		s1 += a[i+1]*b[i+1];
+		s2 += a[i+2]*b[i+2];
+		s3 += a[i+3]*b[i+3];
+	}
+	for(; i<n; i++) s0 += a[i]*b[i];
+	return (s0+s1)+(s2+s3);
+}
+
+/*******************************************************************************
+* static void fill_block(...)
+*
+* Write the regressors of rows k..k+rows-1 column major into blk so every
+* regressor column is contiguous for the Gram matrix dot products.
+*******************************************************************************/
+static void fill_block(const model_t* m, const segment_t* s, int k, int rows,\
+				double blk[][BLOCK_ROWS], double* yb){
+	int i, j, c=0;
+	for(j=1; j<=m->na; j++, c++){
+		for(i=0;i<rows;i++) blk[c][i] = -s->y[k+i-j];
+	}
+	for(j=0; j<m->nb; j++, c++){
+		for(i=0;i<rows;i++) blk[c][i] = s->u[k+i-m->nk-j];
+	}
+	for(j=1; j<=m->nc; j++, c++){
+		for(i=0;i<rows;i++) blk[c][i] = s->e[k+i-j];
+	}
+	for(i=0;i<rows;i++) yb[i] = s->y[k+i];
+}
+
+/*******************************************************************************
+* static int solve_spd(int p, double R[][MAX_PARAMS], double* r, double* x)
+*
+* Cholesky solve of the normal equations, only the lower triangle of R is used
+*******************************************************************************/
+static int solve_spd(int p, double R[][MAX_PARAMS], double* r, double* x){
+	double L[MAX_PARAMS][MAX_PARAMS];
+	double z[MAX_PARAMS];
+	double sum, ridge=0;
+	int i, j, k;
+
+	for(i=0;i<p;i++) ridge += R[i][i];
+	ridge *= 1e-12/p;
+	for(i=0;i<p;i++){
+		for(j=0;j<=i;j++){
+			sum = R[i][j] + (i==j ? ridge : 0);
+			for(k=0;k<j;k++) sum -= L[i][k]*L[j][k];
+			if(i==j){
+				if(sum<=0) return -1;
+				L[i][i] = sqrt(sum);
+			}
+			else L[i][j] = sum/L[j][j];
+		}
+	}
+	for(i=0;i<p;i++){
+		sum = r[i];
+		for(k=0;k<i;k++) sum -= L[i][k]*z[k];
+		z[i] = sum/L[i][i];
+	}
+	for(i=p-1;i>=0;i--){
+		sum = z[i];
+		for(k=i+1;k<p;k++) sum -= L[k][i]*x[k];
+		x[i] = sum/L[i][i];
+	}
+	return 0;
+}
+
+/*******************************************************************************
+* static int fit(model_t* m, segment_t* seg, int nseg)
+*
+* One least squares pass over every segment, block by block. The Gram matrix
+* and right hand side are accumulated per block so the data is streamed once.
+*******************************************************************************/
+static int fit(model_t* m, segment_t* seg, int nseg){
+	static double blk[MAX_PARAMS][BLOCK_ROWS];
+	static double yb[BLOCK_ROWS];
+	double R[MAX_PARAMS][MAX_PARAMS];
+	double r[MAX_PARAMS];
+	int s, k, rows, i, j, k0;
+
+	memset(R, 0, sizeof(R));
+	memset(r, 0, sizeof(r));
+	k0 = first_row(m);
+	for(s=0;s<nseg;s++){
+		for(k=k0; k<seg[s].n; k+=rows){
+			rows = seg[s].n-k;
+			if(rows>BLOCK_ROWS) rows = BLOCK_ROWS;
+			fill_block(m, &seg[s], k, rows, blk, yb);
+			for(i=0;i<m->p;i++){
+				for(j=0;j<=i;j++) R[i][j] += dot(blk[i], blk[j], rows);
+				r[i] += dot(blk[i], yb, rows);
+			}
+		}
+	}
+	return solve_spd(m->p, R, r, m->theta);
+}
+
+/*******************************************************************************
+* static void residuals(const model_t* m, segment_t* s, double* sse, double* sst)
+*
+* one step ahead prediction errors, stored in s->e for the next ARMAX pass
+*******************************************************************************/
+static void residuals(const model_t* m, segment_t* s, double* sse, double* sst){
+	static double blk[MAX_PARAMS][BLOCK_ROWS];
+	static double yb[BLOCK_ROWS];
+	double pred[BLOCK_ROWS];
+	double mean=0, err, dev;
+	int k, rows, i, c, k0;
+
+	*sse = 0;
+	*sst = 0;
+	k0 = first_row(m);
+	if(s->n<=k0) return;
+	for(k=k0;k<s->n;k++) mean += s->y[k];
+	mean /= (s->n-k0);
+	for(k=k0; k<s->n; k+=rows){
+		rows = s->n-k;
+		if(rows>BLOCK_ROWS) rows = BLOCK_ROWS;
+		fill_block(m, s, k, rows, blk, yb);
+		for(i=0;i<rows;i++) pred[i] = 0;
+		for(c=0;c<m->p;c++){
+			for(i=0;i<rows;i++) pred[i] += m->theta[c]*blk[c][i];
+		}
+		for(i=0;i<rows;i++){
+			err = yb[i]-pred[i];
+			dev = yb[i]-mean;
+			s->e[k+i] = err;
+			*sse += err*err;
+			*sst += dev*dev;
+		}
+	}
+}
+
+/*******************************************************************************
+* static void poly_roots(int n, const double* a, double complex* z)
+*
+* Durand-Kerner roots of the monic polynomial z^n + a[0]z^(n-1) + ... + a[n-1]
+*******************************************************************************/
+static void poly_roots(int n, const double* a, double complex* z){
+	double complex num, den;
+	int it, i, j;
+
+	for(i=0;i<n;i++) z[i] = cpow(0.4+0.9*I, i);
+	for(it=0; it<500; it++){
+		for(i=0;i<n;i++){
+			num = 1;
+			for(j=0;j<n;j++) num = num*z[i] + a[j];
+			den = 1;
+			for(j=0;j<n;j++) if(j!=i) den *= (z[i]-z[j]);
+			z[i] -= num/den;
+		}
+	}
+}
+
+static double elapsed(struct timespec* t0){
+	struct timespec t1;
+	clock_gettime(CLOCK_MONOTONIC, &t1);
+	return (t1.tv_sec-t0->tv_sec) + (t1.tv_nsec-t0->tv_nsec)*1e-9;
+}
+
+/*******************************************************************************
+* int main(int argc, char* argv[])
+*
+* parse every option, then load every run with them, fit, print the model and
+* per run fit quality
+*******************************************************************************/
+int main(int argc, char* argv[]){
+	segment_t seg[MAX_FILES];
+	const char* files[MAX_FILES];
+	model_t m;
+	double complex z[MAX_ORDER];
+	double sse, sst, tot_sse=0, tot_sst=0, dt=DT_D1;
+	double bsum, asum;
+	long total=0;
+	int ucol=1, ycol=2, nfiles=0, nseg=0, i, it, iters;
+	struct timespec t0;
+
+	memset(&m, 0, sizeof(m));
+	m.na=2; m.nb=3; m.nk=1; m.nc=0;
+	for(i=1;i<argc;i++){
+		if(i+1<argc && strcmp(argv[i],"-u")==0)		ucol=atoi(argv[++i]);
+		else if(i+1<argc && strcmp(argv[i],"-y")==0)	ycol=atoi(argv[++i]);
+		else if(i+1<argc && strcmp(argv[i],"-na")==0)	m.na=atoi(argv[++i]);
+		else if(i+1<argc && strcmp(argv[i],"-nb")==0)	m.nb=atoi(argv[++i]);
+		else if(i+1<argc && strcmp(argv[i],"-nk")==0)	m.nk=atoi(argv[++i]);
+		else if(i+1<argc && strcmp(argv[i],"-nc")==0)	m.nc=atoi(argv[++i]);
+		else if(i+1<argc && strcmp(argv[i],"-dt")==0)	dt=atof(argv[++i]);
+		else if(argv[i][0]=='-'){
+			print_usage();
+			return -1;
+		}
+		else if(nfiles<MAX_FILES) files[nfiles++]=argv[i];
+		else{
+			fprintf(stderr,"ERROR: more than %d runs\n", MAX_FILES);
+			return -1;
+		}
+	}
+	if(nfiles==0 || m.na<1 || m.na>MAX_ORDER || m.nb<1 || m.nb>MAX_ORDER \
+			|| m.nc<0 || m.nc>MAX_ORDER || m.nk<0 || ucol<0 || ucol>=MAX_COLS || ycol<0 || ycol>=MAX_COLS){
+		print_usage();
+		return -1;
+	}
+	for(nseg=0;nseg<nfiles;nseg++){
+		if(load_segment(files[nseg], ucol, ycol, &seg[nseg])) return -1;
+		total += seg[nseg].n;
+	}
+	m.p = m.na+m.nb+m.nc;
+
+	clock_gettime(CLOCK_MONOTONIC, &t0);
+	// ARX first, ARMAX refits with the previous pass's residuals as regressors
+	iters = m.nc>0 ? ELS_ITERS : 1;
+	for(it=0; it<iters; it++){
+		if(fit(&m, seg, nseg)){
+			fprintf(stderr,"ERROR: normal equations are singular, is the input exciting enough?\n");
+			return -1;
+		}
+		for(i=0;i<nseg;i++) residuals(&m, &seg[i], &sse, &sst);
+	}
+
+	printf("\n%s(na=%d nb=%d nk=%d nc=%d) on %ld samples from %d run(s), %.3fs\n",\
+		m.nc>0 ? "ARMAX" : "ARX", m.na, m.nb, m.nk, m.nc, total, nseg, elapsed(&t0));
+	printf("A(z) = 1");
+	for(i=0;i<m.na;i++) printf(" %+.5f z^-%d", m.theta[i], i+1);
+	printf("\nB(z) =");
+	for(i=0;i<m.nb;i++) printf(" %+.5f z^-%d", m.theta[m.na+i], m.nk+i);
+	if(m.nc>0){
+		printf("\nC(z) = 1");
+		for(i=0;i<m.nc;i++) printf(" %+.5f z^-%d", m.theta[m.na+m.nb+i], i+1);
+	}
+	asum=1;
+	bsum=0;
+	for(i=0;i<m.na;i++) asum += m.theta[i];
+	for(i=0;i<m.nb;i++) bsum += m.theta[m.na+i];
+	if(fabs(asum)>1e-9) printf("\nDC gain: %g\n", bsum/asum);
+	else printf("\nDC gain: infinite, A(z) has a pole at z=1\n");
+
+	poly_roots(m.na, m.theta, z);
+	printf("poles    |z|        s=ln(z)/dt\n");
+	for(i=0;i<m.na;i++){
+		double complex s = clog(z[i])/dt;
+		printf("%8.4f%+8.4fi  %6.4f  %9.3f%+9.3fi%s\n", creal(z[i]), cimag(z[i]),\
+			cabs(z[i]), creal(s), cimag(s), cabs(z[i])>1 ? "  unstable" : "");
+	}
+
+	// final residuals give one step ahead fit per run, outliers are drifted robots
+	printf("\nrun                       samples   fit%%   resid rms\n");
+	for(i=0;i<nseg;i++){
+		residuals(&m, &seg[i], &sse, &sst);
+		tot_sse += sse;
+		tot_sst += sst;
+		printf("%-24s %8d  %6.2f  %10.3e\n", seg[i].name, seg[i].n,\
+			sst>0 ? 100.0*(1.0-sqrt(sse/sst)) : 0.0,\
+			sqrt(sse/(seg[i].n>first_row(&m) ? seg[i].n-first_row(&m) : 1)));
+	}
+	printf("%-24s %8ld  %6.2f\n\n", "all", total,\
+		tot_sst>0 ? 100.0*(1.0-sqrt(tot_sse/tot_sst)) : 0.0);
+
+	for(i=0;i<nseg;i++){
+		free(seg[i].u);
+		free(seg[i].y);
+		free(seg[i].e);
+	}
+	return 0;
+}
@@ -0,0 +1,262 @@
+/*******************************************************************************
+* task_runner.c
+*
+* timerfd/epoll implementation of task_runner.h
+*******************************************************************************/
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/timerfd.h>
+#include <sys/resource.h>
+#include "task_runner.h"
+#include "perf_prof.h"
+
+#define STOP_EVENT	0xFFFFFFFF
+
+typedef struct task_t{
+	const char* name;
+	task_fn_t fn;
+	int hz;
+	int fd;
+	uint64_t runs;
+	uint64_t missed;	// timer expirations that were never run
+	uint64_t max_ns;	// longest single run
+	int runner;		// index in runners[], 0 is the shared one
+#ifdef USE_PERF_PROF
+	int prof;		// perf_prof.h region
+#endif
+}task_t;
+
+typedef struct runner_t{
+	int priority;
+	int epoll_fd;
+	int num_tasks;
+	pthread_t thread;
+	struct rusage usage;
+}runner_t;
+
+static task_t tasks[TASK_RUNNER_MAX_TASKS];
+static int num_tasks=0;
+static runner_t runners[TASK_RUNNER_MAX_THREADS];
+static int num_runners=1;	// the shared runner always exists
+static int stop_fd=-1;
+
+static uint64_t now_ns(){
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec*1000000000ULL + ts.tv_nsec;
+}
+
+/*******************************************************************************
+* static int add(const char* name, task_fn_t fn, int hz, int runner)
+*
+* create the task's timer, it is armed by task_runner_start()
+*******************************************************************************/
+static int add(const char* name, task_fn_t fn, int hz, int runner){
+	task_t* t;
+
+	if(num_tasks>=TASK_RUNNER_MAX_TASKS || hz<=0){
+		fprintf(stderr,"ERROR: can't add task %s\n",name);
+		return -1;
+	}
+	t = &tasks[num_tasks];
+	memset(t, 0, sizeof(task_t));
+	t->name = name;
+	t->fn = fn;
+	t->hz = hz;
+	t->runner = runner;
+	t->fd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC);
+	if(t->fd<0){
+		perror("timerfd_create");
+		return -1;
+	}
+#ifdef USE_PERF_PROF
+	t->prof = perf_prof_region(name);
+#endif
+	runners[runner].num_tasks++;
+	num_tasks++;
+	return 0;
+}
+
+int task_runner_add(const char* name, task_fn_t fn, int hz){
+	return add(name, fn, hz, 0);
+}
+
+/*******************************************************************************
+* int task_runner_add_own(const char* name, task_fn_t fn, int hz, int priority)
+*
+* the task alone on a runner of its own, nothing on the shared one delays it
+*******************************************************************************/
+int task_runner_add_own(const char* name, task_fn_t fn, int hz, int priority){
+	if(num_runners>=TASK_RUNNER_MAX_THREADS){
+		fprintf(stderr,"ERROR: no runner thread left for task %s\n",name);
+		return -1;
+	}
+	memset(&runners[num_runners], 0, sizeof(runner_t));
+	runners[num_runners].priority = priority;
+	if(add(name, fn, hz, num_runners)) return -1;
+	num_runners++;
+	return 0;
+}
+
+/*******************************************************************************
+* static void* runner(void* ptr)
+*
+* one runner thread, sleeps in epoll_wait between its tasks' timer expiries
+*******************************************************************************/
+static void* runner(void* ptr){
+	runner_t* r = ptr;
+	struct epoll_event ev[TASK_RUNNER_MAX_TASKS+1];
+	uint64_t expirations, start, dt;
+	task_t* t;
+	int i, n;
+
+	while(1){
+		n = epoll_wait(r->epoll_fd, ev, r->num_tasks+1, -1);
+		for(i=0;i<n;i++){
+			if(ev[i].data.u32==STOP_EVENT){
+				getrusage(RUSAGE_THREAD, &r->usage);
+				return NULL;
+			}
+			t = &tasks[ev[i].data.u32];
+			if(read(t->fd, &expirations, sizeof(expirations))!=sizeof(expirations)) continue;
+			t->missed += expirations-1;
+			start = now_ns();
+#ifdef USE_PERF_PROF
+			perf_prof_begin(t->prof);
+			t->fn();
+			perf_prof_end(t->prof);
+#else
+			t->fn();
+#endif
+			dt = now_ns()-start;
+			if(dt>t->max_ns) t->max_ns = dt;
+			t->runs++;
+		}
+	}
+	return NULL;
+}
+
+/*******************************************************************************
+* int task_runner_start(int priority)
+*
+* Put every task timer in its runner's epoll set and the stop eventfd in all
+* of them, arm the timers so each task runs right away and then at its own
+* rate, spawn the threads. The stop eventfd is never read, so once written it
+* wakes every runner.
+*******************************************************************************/
+int task_runner_start(int priority){
+	struct epoll_event ev;
+	struct itimerspec spec;
+	long period_ns;
+	int i;
+
+	runners[0].priority = priority;
+	stop_fd = eventfd(0, EFD_CLOEXEC);
+	if(stop_fd<0){
+		perror("task runner");
+		return -1;
+	}
+	for(i=0;i<num_runners;i++){
+		runners[i].epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+		if(runners[i].epoll_fd<0){
+			perror("task runner");
+			return -1;
+		}
+		ev.events = EPOLLIN;
+		ev.data.u32 = STOP_EVENT;
+		if(epoll_ctl(runners[i].epoll_fd, EPOLL_CTL_ADD, stop_fd, &ev)){
+			perror("epoll_ctl");
+			return -1;
+		}
+	}
+	for(i=0;i<num_tasks;i++){
+		ev.events = EPOLLIN;
+		ev.data.u32 = i;
+		if(epoll_ctl(runners[tasks[i].runner].epoll_fd, EPOLL_CTL_ADD, tasks[i].fd, &ev)){
+			perror("epoll_ctl");
+			return -1;
+		}
+		period_ns = 1000000000L/tasks[i].hz;
+		spec.it_interval.tv_sec = period_ns/1000000000L;
+		spec.it_interval.tv_nsec = period_ns%1000000000L;
+		spec.it_value.tv_sec = 0;
+		spec.it_value.tv_nsec = 1;
+		if(timerfd_settime(tasks[i].fd, 0, &spec, NULL)){
+			perror("timerfd_settime");
+			return -1;
+		}
+	}
+	for(i=0;i<num_runners;i++){
+		if(pthread_create(&runners[i].thread, NULL, runner, &runners[i])){
+			fprintf(stderr,"ERROR: failed to start task runner thread\n");
+			return -1;
+		}
+		pthread_setschedprio(runners[i].thread, runners[i].priority);
+	}
+	return 0;
+}
+
+/*******************************************************************************
+* int task_runner_stop()
+*
+* Stop and join the runners. Reports runs, missed periods and worst run time
+* per task plus the context switches of each runner thread and the process max
+* RSS so the cost of housekeeping can be compared against separate threads.
+*******************************************************************************/
+int task_runner_stop(){
+	struct rusage self;
+	uint64_t one=1;
+	int i;
+
+	if(stop_fd<0) return -1;
+	if(write(stop_fd, &one, sizeof(one))!=sizeof(one)) return -1;
+	for(i=0;i<num_runners;i++) if(pthread_join(runners[i].thread, NULL)) return -1;
+	printf("\ntask runner joined\n");
+	for(i=0;i<num_tasks;i++){
+		printf("%-12s %3dhz runs %8llu missed %4llu max %6.1fus\n",\
+			tasks[i].name, tasks[i].hz, (unsigned long long)tasks[i].runs,\
+			(unsigned long long)tasks[i].missed, tasks[i].max_ns/1000.0);
+		close(tasks[i].fd);
+	}
+	getrusage(RUSAGE_SELF, &self);
+	for(i=0;i<num_runners;i++){
+		printf("runner %d (priority %d) context switches: %ld voluntary %ld involuntary\n",\
+			i, runners[i].priority, runners[i].usage.ru_nvcsw, runners[i].usage.ru_nivcsw);
+		close(runners[i].epoll_fd);
+	}
+	printf("process max RSS: %ld kB\n", self.ru_maxrss);
+	close(stop_fd);
+	stop_fd = -1;
+	memset(runners, 0, sizeof(runners));
+	num_runners = 1;
+	num_tasks = 0;
+	return 0;
+}
+
+/*******************************************************************************
+* int task_runner_stats(task_stats_t* out, int max)
+*
+* Statistics so far, returns the number of tasks copied. Each runner thread
+* updates its tasks' between runs, so a task calling this sees a consistent
+* set for the tasks on its own runner and the latest for the others.
+*******************************************************************************/
+int task_runner_stats(task_stats_t* out, int max){
+	int i;
+
+	for(i=0;i<num_tasks && i<max;i++){
+		out[i].name = tasks[i].name;
+		out[i].hz = tasks[i].hz;
+		out[i].runs = tasks[i].runs;
+		out[i].missed = tasks[i].missed;
+		out[i].max_ns = tasks[i].max_ns;
+	}
+	return i;
+}
@@ -0,0 +1,42 @@
+/*******************************************************************************
+* task_runner.h
+*
+* Runs the periodic housekeeping tasks (printer, battery checker, outer loop)
+* as timer driven callbacks on one thread instead of one sleeping pthread each.
+* Every task gets its own timerfd and all of them are waited on with a single
+* epoll set. A task that must not wait behind the others (the outer loop
+* behind printf and file I/O) can be given a runner thread of its own at a
+* higher priority. The IMU interrupt path is not touched by this.
+*******************************************************************************/
+
+#ifndef TASK_RUNNER_H
+#define TASK_RUNNER_H
+
+#include <stdint.h>
+
+#define TASK_RUNNER_MAX_TASKS	8
+#define TASK_RUNNER_MAX_THREADS	3	// the shared one and those of their own
+
+typedef void (*task_fn_t)(void);
+
+typedef struct task_stats_t{
+	const char* name;
+	int hz;
+	uint64_t runs;
+	uint64_t missed;	// timer expirations that were never run
+	uint64_t max_ns;	// longest single run
+}task_stats_t;
+
+// register a task before task_runner_start(), runs at hz starting right away
+int task_runner_add(const char* name, task_fn_t fn, int hz);
+// same, alone on a runner thread of its own at priority
+int task_runner_add_own(const char* name, task_fn_t fn, int hz, int priority);
+// spawn the runner threads, the shared one at priority
+int task_runner_start(int priority);
+// wake the runners, join them and print per task and thread statistics
+int task_runner_stop();
+// copy up to max tasks' statistics, only consistent for the tasks on the
+// caller's own runner thread
+int task_runner_stats(task_stats_t* out, int max);
+
+#endif	//TASK_RUNNER_H
@@ -0,0 +1,68 @@
+/*******************************************************************************
+* replay.c
+*
+* See replay.h
+*******************************************************************************/
+
+#include <rc_usefulincludes.h>
+#include "../balance_config.h"
+#include "../balance.h"
+#include "../trajectory.h"
+#include "rc_sim.h"
+#include "replay.h"
+
+int replay_record(replay_t* r, int ticks, double settle, double noise, replay_event_t event){
+	mip_plant_t plant;
+	double dutyL=0, dutyR=0;
+	int k, i, saved, fell=0;
+	const int warm = SAMPLE_RATE_D1_HZ;
+	const int start = settle*SAMPLE_RATE_D1_HZ;
+	const int d2_div = SAMPLE_RATE_D1_HZ/SAMPLE_RATE_D2_HZ;
+	const int traj_div = SAMPLE_RATE_D1_HZ/SETPOINT_MANAGER_HZ;
+
+	// balance.c prints on every engage and disengage
+	fflush(stdout);
+	saved = dup(STDOUT_FILENO);
+	if(freopen("/dev/null", "w", stdout)==NULL) return -1;
+
+	mip_plant_init(&plant, 0.05);
+	plant.noise = noise;
+	plant.held = 1;
+	rc_initialize();
+	init_controller();
+	rc_set_state(RUNNING);
+	for(k=-warm; k<start+ticks; k++){
+		if(k==0){
+			plant.held = 0;
+			engage_controller();
+		}
+		if(k>=0 && event) event((double)k/SAMPLE_RATE_D1_HZ, &plant);
+		mip_plant_step(&plant, dutyL, dutyR, DT_D1);
+		mip_plant_imu(&plant, imu_data.accel, imu_data.gyro);
+		mip_plant_encoders(&plant, &rc_sim.encoder_raw[ENCODER_CHANNEL_L],\
+					&rc_sim.encoder_raw[ENCODER_CHANNEL_R]);
+		balancer();
+		if((k+warm)%traj_div==0) traj_task();
+		if((k+warm)%d2_div==0) outer_loop();
+		dutyL = MOTOR_POLARITY_L*rc_sim_motor(MOTOR_CHANNEL_L);
+		dutyR = MOTOR_POLARITY_R*rc_sim_motor(MOTOR_CHANNEL_R);
+		if(k<start) continue;
+		i = k-start;
+		memcpy(r[i].accel, imu_data.accel, sizeof(imu_data.accel));
+		memcpy(r[i].gyro, imu_data.gyro, sizeof(imu_data.gyro));
+		r[i].enc_l = rc_sim.encoder_raw[ENCODER_CHANNEL_L];
+		r[i].enc_r = rc_sim.encoder_raw[ENCODER_CHANNEL_R];
+		r[i].theta = plant.theta;
+		r[i].theta_ref = setpoint.theta;
+		fell |= setpoint.control_state!=ENGAGED;
+	}
+
+	fflush(stdout);
+	dup2(saved, STDOUT_FILENO);
+	close(saved);
+	if(fell){
+		fprintf(stderr,"ERROR: recording run fell over\n");
+		return -1;
+	}
+	return 0;
+}
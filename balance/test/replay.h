@@ -0,0 +1,31 @@
+/*******************************************************************************
+* replay.h
+*
+* Sensor readings recorded from a balanced run in the simulator, for the
+* tests that check an estimator or a controller against another one
+* offline. The run goes the way ../sim runs a scenario: held for a second,
+* released at theta0, balanced by balancer() with the outer loop and the
+* trajectory task on their own ticks.
+*******************************************************************************/
+
+#ifndef REPLAY_H
+#define REPLAY_H
+
+#include "mip_plant.h"
+
+typedef struct replay_t{
+	float accel[3];
+	float gyro[3];
+	int enc_l, enc_r;
+	float theta;		// plant tilt, what the estimators should read
+	float theta_ref;	// D1 setpoint from the outer loop
+}replay_t;
+
+// called every tick once the controller is engaged, t in seconds from then
+typedef void (*replay_event_t)(double t, mip_plant_t* p);
+
+// ticks from settle seconds after the release, event NULL for none.
+// -1 if the controller didn't stay engaged for all of them.
+int replay_record(replay_t* r, int ticks, double settle, double noise, replay_event_t event);
+
+#endif	//REPLAY_H
@@ -0,0 +1,90 @@
+/*******************************************************************************
+* test_adaptive.c
+*
+* The make ADAPTIVE=1 complementary filter against the fixed FILTER_W one,
+* both fed the IMU readings of a balanced run in the simulator and scored
+* by their rms error from the plant tilt. The plant adds the axle
+* acceleration to the accelerometer, which is what the adaptive crossover
+* is there for.
+*
+*	still	nothing happens, the adaptive filter may not be much worse
+*	shoves	a shove on the body every 2s, alternating direction
+*	drive	back and forth between two points 10 wheel radians apart
+*
+* Both filters get SETTLE seconds of the run to converge before scoring
+* starts, the disturbances start with it.
+*******************************************************************************/
+
+#include <stdio.h>
+#include <math.h>
+#include "../balance_config.h"
+#include "../balance.h"
+#include "../trajectory.h"
+#include "../comp_adapt.h"
+#include "../../common/comp_filter.h"
+#include "replay.h"
+
+#define SETTLE		8	// s before scoring
+#define SECONDS		20
+#define TICKS		(SECONDS*SAMPLE_RATE_D1_HZ)
+#define NOISE		0.02	// m/s^2 and deg/s
+#define DIST_MAX	0.9	// adaptive rms over fixed rms under a disturbance
+#define STILL_MAX	1.5	// and with none
+
+static replay_t rec[TICKS];
+static int failed=0;
+
+static void ev_shoves(double t, mip_plant_t* p){
+	double s = fmod(t, 2.0);
+	int n = (int)(t/2.0);
+	p->push = (t>=SETTLE && s<0.05) ? (n%2 ? -0.15 : 0.15) : 0;
+}
+
+static void ev_drive(double t, mip_plant_t* p){
+	static int sent=0;
+	if(t>=SETTLE && !sent){
+		traj_command("wp 1.5 10 0; wp 3 0 0; wp 4.5 10 0; wp 6 0 0; wp 7.5 10 0; wp 9 0 0");
+		sent = 1;
+	}
+}
+
+// adaptive rms has to come out under max times the fixed one
+static void run(const char* name, replay_event_t event, double max){
+	comp_filter_t f, a;
+	comp_adapt_t c;
+	double sum_f=0, sum_a=0, e, rms_f, rms_a;
+	float tf, ta;
+	int i, n=0, ok;
+
+	if(replay_record(rec, TICKS, 0, NOISE, event) || comp_adapt_init(&c)){
+		printf("%-8s %-44s FAIL\n", name, "no recording");
+		failed++;
+		return;
+	}
+	comp_filter_init(&f, FILTER_W, DT_D1);
+	comp_filter_init(&a, FILTER_W, DT_D1);
+	for(i=0;i<TICKS;i++){
+		tf = comp_filter_step(&f, rec[i].accel[1], rec[i].accel[2], rec[i].gyro[0]);
+		ta = comp_filter_step_alpha(&a, rec[i].accel[1], rec[i].accel[2], rec[i].gyro[0],\
+				comp_adapt_alpha(&c, rec[i].accel));
+		if(i<SETTLE*SAMPLE_RATE_D1_HZ) continue;
+		e = tf + MOUNT_ANGLE - rec[i].theta;
+		sum_f += e*e;
+		e = ta + MOUNT_ANGLE - rec[i].theta;
+		sum_a += e*e;
+		n++;
+	}
+	rms_f = sqrt(sum_f/n);
+	rms_a = sqrt(sum_a/n);
+	ok = rms_a < max*rms_f;
+	printf("%-8s fixed %.3g rad, adaptive %.3g rad rms (%.2f, max %.2f)  %s\n",\
+		name, rms_f, rms_a, rms_a/rms_f, max, ok ? "ok" : "FAIL");
+	failed += !ok;
+}
+
+int main(){
+	run("still", NULL, STILL_MAX);
+	run("shoves", ev_shoves, DIST_MAX);
+	run("drive", ev_drive, DIST_MAX);
+	return failed!=0;
+}
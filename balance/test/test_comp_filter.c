@@ -0,0 +1,214 @@
+/*******************************************************************************
+* test_comp_filter.c
+*
+* common/comp_filter against the filters it replaced, over the IMU readings
+* of a balanced run in the simulator with a shove every 2s.
+*
+*	balance	the filter balancer() had inline, sample by sample within
+*		REF_MAX_ERR over the run twice, and comp_filter_batch()
+*		within BATCH_MAX_ERR of comp_filter_step()
+*	hw2	hw2/hw2.c (interrupt, time constant 1.7s) and hw2_p3/test.c
+*	hw2_p3	(polling, 0.7s) ran the same ring buffer filter. Those read
+*		the output ring buffers at index 1 before inserting, which
+*		feeds back y[k-2]. With that index at 0 the copy has to match
+*		the library within REF_MAX_ERR in theta and in the raw angles
+*		they print. As written, the copy has to be further from the
+*		plant tilt than the library is.
+*	-PI/2	the unbuilt hw2.c at the top level starts theta_g_raw at
+*		-PI/2. Only differences of it reach the filter, so after
+*		the first sample's step has decayed it has to match too.
+*******************************************************************************/
+
+#include <rc_usefulincludes.h>
+#include <roboticscape.h>
+#include "../balance_config.h"
+#include "../balance.h"
+#include "../../common/comp_filter.h"
+#include "replay.h"
+
+#define SECONDS		40
+#define TICKS		(SECONDS*SAMPLE_RATE_D1_HZ)
+#define NOISE		0.02	// m/s^2 and deg/s
+#define SHOVES		10	// s, when they start
+// rad, against the filters it replaced. They difference a running float
+// integral of the gyro, so they drift from the library by a few roundings
+// of that as it grows.
+#define REF_MAX_ERR	1e-5
+#define BATCH_MAX_ERR	1e-6	// rad, batch against sample by sample
+#define HW_DT		0.01	// both hw programs sample at 100Hz
+#define START_SETTLE	30	// s for the -PI/2 step to decay
+
+static replay_t rec[TICKS];
+static float ay[TICKS], az[TICKS], gx[TICKS], batch[TICKS];
+static int failed=0;
+
+/*******************************************************************************
+* balance_comp_t
+*
+* the filter balancer() had inline before it moved to common/comp_filter.c
+*******************************************************************************/
+typedef struct balance_comp_t{
+	float theta_g_raw;
+	float last_theta_a_raw, last_theta_g_raw;
+	float last_theta_a, last_theta_g;
+}balance_comp_t;
+
+static float balance_comp_step(balance_comp_t* c, const replay_t* r){
+	float theta_a_raw, theta_a, theta_g;
+
+	theta_a_raw = atan2(-r->accel[2],r->accel[1]);
+	c->theta_g_raw = c->theta_g_raw + DT_D1*(r->gyro[0]*DEG_TO_RAD) ;
+	theta_a = (FILTER_W*DT_D1*c->last_theta_a_raw)+((1-(FILTER_W*DT_D1))*c->last_theta_a);
+	theta_g = (1-(FILTER_W*DT_D1))*c->last_theta_g + c->theta_g_raw - c->last_theta_g_raw;
+	c->last_theta_a = theta_a;
+	c->last_theta_g = theta_g;
+	c->last_theta_g_raw = c->theta_g_raw;
+	c->last_theta_a_raw = theta_a_raw;
+	return theta_a + theta_g;
+}
+
+/*******************************************************************************
+* hw2_comp_t
+*
+* comp_filter() of hw2/hw2.c before common/comp_filter, the loop body of
+* hw2_p3/test.c is the same arithmetic. out is the position the output ring
+* buffers are read at, 1 as they were written.
+*******************************************************************************/
+typedef struct hw2_comp_t{
+	rc_ringbuf_t accel_in_buf, accel_out_buf;
+	rc_ringbuf_t gyro_in_buf, gyro_out_buf;
+	float w, dt;
+	float theta_a_raw, theta_g_raw;
+	int out;
+}hw2_comp_t;
+
+static int hw2_comp_init(hw2_comp_t* c, float time_constant, float theta_g_raw, int out){
+	c->accel_in_buf = rc_empty_ringbuf();
+	c->accel_out_buf = rc_empty_ringbuf();
+	c->gyro_in_buf = rc_empty_ringbuf();
+	c->gyro_out_buf = rc_empty_ringbuf();
+	if(rc_alloc_ringbuf(&c->accel_in_buf,5) || rc_alloc_ringbuf(&c->accel_out_buf,5) ||\
+	   rc_alloc_ringbuf(&c->gyro_in_buf,5) || rc_alloc_ringbuf(&c->gyro_out_buf,5)){
+		fprintf(stderr,"ERROR: ringbuf allocation failed\n");
+		return -1;
+	}
+	c->w = 1.0/time_constant;
+	c->dt = HW_DT;
+	c->theta_g_raw = theta_g_raw;
+	c->out = out;
+	return 0;
+}
+
+static float hw2_comp_step(hw2_comp_t* c, const replay_t* r){
+	const float w=c->w, dt=c->dt;
+	float accel_in_old, accel_out_old, gyro_in_old, gyro_out_old, theta_a, theta_g;
+
+	c->theta_a_raw=atan2(-r->accel[2],r->accel[1]);
+	c->theta_g_raw=c->theta_g_raw+r->gyro[0]*dt*DEG_TO_RAD;
+	rc_insert_new_ringbuf_value(&c->accel_in_buf,c->theta_a_raw);
+	rc_insert_new_ringbuf_value(&c->gyro_in_buf,c->theta_g_raw);
+	accel_in_old=rc_get_ringbuf_value(&c->accel_in_buf,1);
+	accel_out_old=rc_get_ringbuf_value(&c->accel_out_buf,c->out);
+	gyro_in_old=rc_get_ringbuf_value(&c->gyro_in_buf,1);
+	gyro_out_old=rc_get_ringbuf_value(&c->gyro_out_buf,c->out);
+	theta_a=w*dt*(accel_in_old-accel_out_old)+accel_out_old;
+	theta_g=c->theta_g_raw-gyro_in_old-(w*dt-1.0)*gyro_out_old;
+	rc_insert_new_ringbuf_value(&c->accel_out_buf,theta_a);
+	rc_insert_new_ringbuf_value(&c->gyro_out_buf,theta_g);
+	return theta_a+theta_g;
+}
+
+static void ev_shoves(double t, mip_plant_t* p){
+	double s = fmod(t, 2.0);
+	int n = (int)(t/2.0);
+	p->push = (t>=SHOVES && s<0.05) ? (n%2 ? -0.15 : 0.15) : 0;
+}
+
+static void check(const char* name, const char* what, double got, double max){
+	int ok = got<=max;
+	printf("%-8s %-44s %9.3g (max %.3g)  %s\n", name, what, got, max, ok ? "ok" : "FAIL");
+	failed += !ok;
+}
+
+static void max_err(double* m, double a, double b){
+	if(fabs(a-b)>*m) *m = fabs(a-b);
+}
+
+static void check_balance(){
+	balance_comp_t ref;
+	comp_filter_t lib, cb;
+	double max_r=0, max_b=0;
+	float tl[2*TICKS];
+	int i, k;
+
+	memset(&ref, 0, sizeof(ref));
+	comp_filter_init(&lib, FILTER_W, DT_D1);
+	for(i=0;i<2*TICKS;i++){
+		tl[i] = comp_filter_step(&lib, ay[i%TICKS], az[i%TICKS], gx[i%TICKS]);
+		max_err(&max_r, balance_comp_step(&ref, &rec[i%TICKS]), tl[i]);
+	}
+	comp_filter_init(&cb, FILTER_W, DT_D1);
+	for(i=0;i<2*TICKS;i+=TICKS){
+		comp_filter_batch(&cb, ay, az, gx, batch, TICKS);
+		for(k=0;k<TICKS;k++) max_err(&max_b, batch[k], tl[i+k]);
+	}
+	check("balance", "theta from balancer()'s filter, rad", max_r, REF_MAX_ERR);
+	check("balance", "comp_filter_batch() from comp_filter_step()", max_b, BATCH_MAX_ERR);
+}
+
+static void check_hw2(const char* name, float time_constant){
+	hw2_comp_t orig, fixed, start;
+	comp_filter_t lib;
+	double max_t=0, max_a=0, max_g=0, max_s=0, sum_o=0, sum_l=0, e;
+	float to, tf, ts, tl;
+	int i, n=0;
+
+	if(hw2_comp_init(&orig, time_constant, 0, 1) || hw2_comp_init(&fixed, time_constant, 0, 0) ||\
+	   hw2_comp_init(&start, time_constant, -PI/2, 0)){
+		failed++;
+		return;
+	}
+	comp_filter_init(&lib, 1.0/time_constant, HW_DT);
+	for(i=0;i<TICKS;i++){
+		to = hw2_comp_step(&orig, &rec[i]);
+		tf = hw2_comp_step(&fixed, &rec[i]);
+		ts = hw2_comp_step(&start, &rec[i]);
+		tl = comp_filter_step(&lib, ay[i], az[i], gx[i]);
+		max_err(&max_t, tf, tl);
+		max_err(&max_a, fixed.theta_a_raw, lib.last_a_raw);
+		max_err(&max_g, fixed.theta_g_raw, lib.theta_g_raw);
+		if(i>=START_SETTLE*SAMPLE_RATE_D1_HZ) max_err(&max_s, ts, tl);
+		// both as far as they are from the plant, once settled after the shoves began
+		if(i<SHOVES*SAMPLE_RATE_D1_HZ) continue;
+		e = to + MOUNT_ANGLE - rec[i].theta;
+		sum_o += e*e;
+		e = tl + MOUNT_ANGLE - rec[i].theta;
+		sum_l += e*e;
+		n++;
+	}
+	check(name, "theta from the y[k-1] copy, rad", max_t, REF_MAX_ERR);
+	check(name, "theta_a_raw as printed, rad", max_a, REF_MAX_ERR);
+	check(name, "theta_g_raw as printed, rad", max_g, REF_MAX_ERR);
+	check(name, "theta from the -PI/2 start once settled, rad", max_s, REF_MAX_ERR);
+	printf("%-8s rms from the plant: as written %.3g rad, library %.3g rad  %s\n",\
+		name, sqrt(sum_o/n), sqrt(sum_l/n), sum_l<sum_o ? "ok" : "FAIL");
+	failed += sum_l>=sum_o;
+}
+
+int main(){
+	int i;
+
+	if(replay_record(rec, TICKS, 0, NOISE, ev_shoves)){
+		printf("comp_filter: no recording  FAIL\n");
+		return 1;
+	}
+	for(i=0;i<TICKS;i++){
+		ay[i] = rec[i].accel[1];
+		az[i] = rec[i].accel[2];
+		gx[i] = rec[i].gyro[0];
+	}
+	check_balance();
+	check_hw2("hw2", 1.7);
+	check_hw2("hw2_p3", 0.7);
+	return failed!=0;
+}
@@ -0,0 +1,70 @@
+/*******************************************************************************
+* test_duty_limit.c
+*
+* The make LQR=1 and MPC=1 duty against the battery. balancer() multiplies
+* the duty by V_NOMINAL/vBatt, so with a sagging battery anything past
+* vBatt/V_NOMINAL would ask the motors for more than full duty and flag
+* SAT_D1 on an ordinary tick. At each voltage, for a state that asks for
+* far more than that and one that asks for little:
+*
+*	the duty stays within the limit and comes out at full duty or under
+*	once compensated, sat is set on the limit and clear under it, and
+*	the duty the model remembers for the next tick is the clamped one
+*******************************************************************************/
+
+#include <stdio.h>
+#include <math.h>
+#include "../balance_config.h"
+#include "../lqr.h"
+#include "../mpc.h"
+
+static int failed=0;
+
+static void check(const char* name, float v, const char* what, int ok){
+	printf("%-4s %.1fV  %-40s %s\n", name, v, what, ok ? "ok" : "FAIL");
+	failed += !ok;
+}
+
+// u from a state that saturates, small from one that doesn't
+static void check_step(const char* name, float v, const lqr_t* l, float u, int sat_wanted){
+	float lim = v/V_NOMINAL;
+
+	if(sat_wanted){
+		check(name, v, "far off balance: duty at the limit", fabsf(u)==lim);
+		check(name, v, "full duty once compensated", fabsf(u*(V_NOMINAL/v))<=1.0f+1e-6f);
+		check(name, v, "sat set", l->sat);
+	}
+	else{
+		check(name, v, "near balance: duty under the limit", fabsf(u)<lim);
+		check(name, v, "sat clear", !l->sat);
+	}
+	check(name, v, "model remembers the duty sent", l->u_last==u);
+}
+
+int main(){
+	const float volts[] = {V_NOMINAL, 7.0, 6.2};
+	lqr_t lqr;
+	mpc_t mpc;
+	float u;
+	int i;
+
+	if(lqr_init(&lqr) || mpc_init(&mpc)) return 1;
+	for(i=0;i<(int)(sizeof(volts)/sizeof(volts[0]));i++){
+		lqr_reset(&lqr);
+		lqr_set_limit(&lqr, volts[i]/V_NOMINAL);
+		u = lqr_step(&lqr, 0.3, 2.0, 0, 1);
+		check_step("lqr", volts[i], &lqr, u, 1);
+		lqr_reset(&lqr);
+		u = lqr_step(&lqr, 0.001, 0, 0, 1);
+		check_step("lqr", volts[i], &lqr, u, 0);
+
+		mpc_reset(&mpc);
+		mpc_set_limit(&mpc, volts[i]/V_NOMINAL);
+		u = mpc_step(&mpc, 0.3, 2.0, 0, 1);
+		check_step("mpc", volts[i], &mpc.meas, u, 1);
+		mpc_reset(&mpc);
+		u = mpc_step(&mpc, 0.001, 0, 0, 1);
+		check_step("mpc", volts[i], &mpc.meas, u, 0);
+	}
+	return failed!=0;
+}
@@ -0,0 +1,267 @@
+/*******************************************************************************
+* test_fixed.c
+*
+* The make FIXED=1 arithmetic against the float path it replaces:
+*
+*	primitives	fix_mul, fix_convert, fix_add and fix_from_float bit
+*			for bit against plain 64 bit integer arithmetic, on
+*			random words and the edges of the range
+*	atan2		fix_atan2 against atan2() in double
+*	comp_filter	fix_comp_step against common/comp_filter, what the
+*			float build runs, over a recorded balanced run
+*	d1, d2, d3	fix_filter_step against ctrl_stage_step with the
+*			balance_config.h coefficients and limits, over the
+*			same inputs with stretches driven onto the limits
+*
+* Each difference is also taken against the same arithmetic in double,
+* reported in quanta of the fixed point format, so a loss in the fixed
+* point path can be told from the float rounding it is compared with.
+*******************************************************************************/
+
+#include <rc_usefulincludes.h>
+#include <stdarg.h>
+#include "../balance_config.h"
+#include "../balance.h"
+#include "../fixed_ctrl.h"
+#include "../ctrl_stage.h"
+#include "../../common/comp_filter.h"
+#include "replay.h"
+
+#define TICKS		2000
+#define RANDOM_WORDS	1000000
+#define FIX_MAX_ERR	1e-4	// fixed point against float, rad and duty
+#define ATAN2_MAX_Q	16	// fix_atan2 against atan2(), quanta of Q3.28
+#define FILTER_MAX_Q	64	// fixed point filters against double, quanta
+
+static replay_t replay[TICKS];
+static int failed=0;
+
+static void report(const char* name, int bad, const char* fmt, ...){
+	va_list ap;
+	printf("%-12s ", name);
+	va_start(ap, fmt);
+	vprintf(fmt, ap);
+	va_end(ap);
+	printf("  %s\n", bad ? "FAIL" : "ok");
+	failed += bad;
+}
+
+static q31_t random_word(unsigned int* seed){
+	return (q31_t)(((uint32_t)rand_r(seed)<<16) ^ (uint32_t)rand_r(seed));
+}
+
+// a*b>>frac rounded half up and clipped, spelled out without fixed_point.h
+static q31_t ref_mul(q31_t a, q31_t b, int frac){
+	int64_t p = (int64_t)a*b, q = p>>frac;
+	if(frac && (p-(q<<frac)) >= (1LL<<(frac-1))) q++;
+	return q>INT32_MAX ? INT32_MAX : q<INT32_MIN ? INT32_MIN : (q31_t)q;
+}
+
+/*******************************************************************************
+* static void check_primitives()
+*******************************************************************************/
+static void check_primitives(){
+	static const q31_t edges[] = {0, 1, -1, 2, -2, INT32_MAX, INT32_MIN, INT32_MAX-1,\
+			INT32_MIN+1, 1<<30, -(1<<30), 1<<28, -(1<<28), 0x55555555, -0x55555555};
+	static const int fracs[] = {0, 1, 20, 28, 30, 31};
+	const int n_edges = sizeof(edges)/sizeof(edges[0]);
+	unsigned int seed=1;
+	long bad_mul=0, bad_conv=0, bad_add=0, bad_float=0, n=0;
+	int64_t s;
+	q31_t a, b, q;
+	float x;
+	int i, j, k, f;
+
+	for(i=0;i<RANDOM_WORDS+n_edges*n_edges;i++){
+		if(i<n_edges*n_edges){
+			a = edges[i/n_edges];
+			b = edges[i%n_edges];
+		}
+		else{
+			a = random_word(&seed);
+			// small factors too, like a gain or a filter coefficient
+			b = i&1 ? random_word(&seed) : random_word(&seed)>>(rand_r(&seed)%31);
+		}
+		for(k=0;k<(int)(sizeof(fracs)/sizeof(fracs[0]));k++){
+			f = fracs[k];
+			bad_mul += fix_mul(a, b, f)!=ref_mul(a, b, f);
+			// down to fewer fractional bits is a multiply by 2^-shift
+			for(j=0;j<=f;j+=f/2+1){
+				bad_conv += fix_convert(a, f, j)!=ref_mul(a, 1, f-j);
+			}
+			s = (int64_t)a<<(31-f);
+			bad_conv += fix_convert(a, f, 31)!=(s>INT32_MAX ? INT32_MAX : s<INT32_MIN ? INT32_MIN : s);
+		}
+		s = (int64_t)a+b;
+		bad_add += fix_add(a, b)!=(s>INT32_MAX ? INT32_MAX : s<INT32_MIN ? INT32_MIN : s);
+		s = (int64_t)a-b;
+		bad_add += fix_sub(a, b)!=(s>INT32_MAX ? INT32_MAX : s<INT32_MIN ? INT32_MIN : s);
+		// every float that fits Q11.20 exactly has to come back as itself
+		q = a>>8;
+		x = (float)q/(1<<FIX_SENSOR_FRAC);
+		bad_float += fix_from_float(x, FIX_SENSOR_FRAC)!=q;
+		n++;
+	}
+	bad_float += fix_from_float(1e9f, FIX_SENSOR_FRAC)!=INT32_MAX;
+	bad_float += fix_from_float(-1e9f, FIX_SENSOR_FRAC)!=INT32_MIN;
+	report("primitives", bad_mul||bad_conv||bad_add||bad_float,\
+		"%ld word pairs, %ld mul %ld convert %ld add/sub %ld from_float differ",\
+		n, bad_mul, bad_conv, bad_add, bad_float);
+}
+
+/*******************************************************************************
+* static void check_atan2()
+*
+* a full turn in 1e-4 rad steps at a few lengths, then the recorded accel
+*******************************************************************************/
+static void check_atan2(){
+	static const double lengths[] = {1e-3, 1.0, 9.81, 100.0, 2000.0};
+	double worst=0, e, a;
+	int i, k;
+
+	for(k=0;k<5;k++){
+		for(a=-M_PI+1e-4;a<M_PI;a+=1e-4){
+			q31_t y = FIX_Q(lengths[k]*sin(a), FIX_SENSOR_FRAC);
+			q31_t x = FIX_Q(lengths[k]*cos(a), FIX_SENSOR_FRAC);
+			e = fabs(fix_atan2(y, x)/(double)(1<<FIX_ANGLE_FRAC) - atan2(y, x));
+			if(e>worst) worst = e;
+		}
+	}
+	for(i=0;i<TICKS;i++){
+		q31_t y = fix_from_float(-replay[i].accel[2], FIX_SENSOR_FRAC);
+		q31_t x = fix_from_float(replay[i].accel[1], FIX_SENSOR_FRAC);
+		e = fabs(fix_atan2(y, x)/(double)(1<<FIX_ANGLE_FRAC) - atan2(y, x));
+		if(e>worst) worst = e;
+	}
+	e = worst*(1<<FIX_ANGLE_FRAC);
+	report("atan2", e>ATAN2_MAX_Q, "worst %.3g rad, %.1f quanta", worst, e);
+}
+
+/*******************************************************************************
+* static void check_comp_filter()
+*
+* The double reference is fed the same Q11.20 sensor values the fixed point
+* filter sees, the float filter the raw floats like the float build.
+*******************************************************************************/
+static void check_comp_filter(){
+	const double alpha = FILTER_W*DT_D1;
+	double ta=0, tg=0, last_a=0, ref, e, max_f=0, max_d=0;
+	comp_filter_t cf;
+	fix_comp_t cx;
+	q31_t ay, az, gx, tx;
+	float tf;
+	int i;
+
+	comp_filter_init(&cf, FILTER_W, DT_D1);
+	fix_comp_init(&cx);
+	for(i=0;i<TICKS;i++){
+		ay = fix_from_float(replay[i].accel[1], FIX_SENSOR_FRAC);
+		az = fix_from_float(replay[i].accel[2], FIX_SENSOR_FRAC);
+		gx = fix_from_float(replay[i].gyro[0], FIX_SENSOR_FRAC);
+		tx = fix_comp_step(&cx, ay, az, gx);
+		tf = comp_filter_step(&cf, replay[i].accel[1], replay[i].accel[2], replay[i].gyro[0])\
+			+ MOUNT_ANGLE;
+
+		ta = alpha*last_a + (1-alpha)*ta;
+		tg = (1-alpha)*tg + DT_D1*DEG_TO_RAD*gx/(double)(1<<FIX_SENSOR_FRAC);
+		last_a = atan2(-az, ay);
+		ref = ta + tg + MOUNT_ANGLE;
+
+		e = fabs(FIX_FLOAT(tx, FIX_ANGLE_FRAC) - tf);
+		if(e>max_f) max_f = e;
+		e = fabs(tx/(double)(1<<FIX_ANGLE_FRAC) - ref);
+		if(e>max_d) max_d = e;
+	}
+	e = max_d*(1<<FIX_ANGLE_FRAC);
+	report("comp_filter", max_f>FIX_MAX_ERR || e>FILTER_MAX_Q,\
+		"worst %.3g rad from float, %.1f quanta from double", max_f, e);
+}
+
+/*******************************************************************************
+* static void check_stage(...)
+*
+* One controller, fixed against float against double. The input follows
+* in[] for the first half and a square wave big enough to pin the output
+* on its limits for the second, so the limited history is used too. sat has
+* to agree on every tick the double output isn't within FILTER_MAX_Q of
+* the limit.
+*******************************************************************************/
+static void check_stage(const char* name, const float* num, const float* den, int order,\
+			float gain, float limit, float aw, int frac, const float* in, float big){
+	ctrl_stage_t sf;
+	fix_filter_t sx;
+	double f[CTRL_ORDER_MAX+1], t[CTRL_ORDER_MAX+1];
+	double x[CTRL_ORDER_MAX+1]={0}, u[CTRL_ORDER_MAX]={0}, y[CTRL_ORDER_MAX]={0};
+	double q = 1.0/(1<<frac), ud, yd, e, max_f=0, max_d=0;
+	float ff[CTRL_ORDER_MAX+1], tt[CTRL_ORDER_MAX+1], vf;
+	q31_t lim = fix_from_float(limit, frac), vx, xq;
+	int i, k, bad_sat=0, pinned=0;
+
+	ctrl_stage_init(&sf, num, den, order, gain, limit, aw);
+	fix_filter_init(&sx, num, den, order, gain);
+	fix_filter_set_aw(&sx, den, aw);
+	fix_filter_set_limits(&sx, -lim, lim);
+	ctrl_aw_split(den, order, aw, ff, tt);
+	for(k=1;k<=order;k++){
+		f[k] = ff[k];
+		t[k] = tt[k];
+	}
+	for(i=0;i<2*TICKS;i++){
+		xq = fix_from_float(i<TICKS ? in[i] : ((i/50)&1 ? big : -big), frac);
+		vx = fix_filter_step(&sx, xq, FIX_Q(1.0, FIX_SCALE_FRAC));
+		vf = ctrl_stage_step(&sf, xq*q, 1.0f);
+
+		for(k=order;k>0;k--) x[k] = x[k-1];
+		x[0] = xq*q;
+		ud = num[0]*x[0];
+		for(k=1;k<=order;k++) ud += num[k]*x[k] - f[k]*u[k-1] - t[k]*y[k-1];
+		ud *= gain;
+		yd = ud>limit ? limit : ud<-limit ? -limit : ud;
+		for(k=order-1;k>0;k--){
+			u[k] = u[k-1];
+			y[k] = y[k-1];
+		}
+		u[0] = ud;
+		y[0] = yd;
+
+		pinned += sx.sat!=0;
+		if(fabs(fabs(ud)-limit) > FILTER_MAX_Q*q) bad_sat += sx.sat!=sf.sat;
+		e = fabs(vx*q - vf);
+		if(e>max_f) max_f = e;
+		e = fabs(vx*q - yd)/q;
+		if(e>max_d) max_d = e;
+	}
+	report(name, max_f>FIX_MAX_ERR || max_d>FILTER_MAX_Q || bad_sat || !pinned,\
+		"worst %.3g from float, %.1f quanta from double, %d of %d on a limit, "\
+		"%d disagree", max_f, max_d, pinned, 2*TICKS, bad_sat);
+}
+
+int main(){
+	float d1_num[]=D1_NUM, d1_den[]=D1_DEN;
+	float d2_num[]=D2_NUM, d2_den[]=D2_DEN;
+	float d3_num[]=D3_NUM, d3_den[]=D3_DEN;
+	static float e_theta[TICKS], e_phi[TICKS], e_gamma[TICKS];
+	int i;
+
+	if(replay_record(replay, TICKS, 2.0, 0.02, NULL)) return 1;
+	for(i=0;i<TICKS;i++){
+		e_theta[i] = replay[i].theta_ref - replay[i].theta;
+		// wheel and turn angles as in balancer(), the outer loops see a
+		// few cm of drift and a slow turn
+		e_phi[i] = -(replay[i].enc_l+replay[i].enc_r)*(float)(TWO_PI/(2*GEARBOX*ENCODER_RES))\
+				- replay[i].theta;
+		e_gamma[i] = 0.3f*sinf(i*0.01f);
+	}
+
+	check_primitives();
+	check_atan2();
+	check_comp_filter();
+	check_stage("d1", d1_num, d1_den, 2, D1_GAIN, 1.0, D1_AW_GAIN, FIX_ANGLE_FRAC, e_theta, 0.5);
+	// full anti-windup, which balance has off, so its arithmetic is covered too
+	check_stage("d1 aw", d1_num, d1_den, 2, D1_GAIN, 1.0, 1.0, FIX_ANGLE_FRAC, e_theta, 0.5);
+	check_stage("d2", d2_num, d2_den, 1, D2_GAIN, THETA_REF_MAX, 0, FIX_WHEEL_FRAC, e_phi, 20);
+	check_stage("d3", d3_num, d3_den, 1, D3_GAIN, STEERING_INPUT_MAX, 0, FIX_WHEEL_FRAC,\
+			e_gamma, 20);
+	printf("fixed_point: %s\n", failed ? "FAIL" : "ok");
+	return failed ? 1 : 0;
+}
@@ -0,0 +1,225 @@
+/*******************************************************************************
+* test_shm.c
+*
+* The shm_export.h seqlock under load. One writer copies snapshots into a
+* private segment as fast as it can while reader threads in this process
+* and reader processes of their own copy them out, with a busy thread per
+* cpu on top so readers and the writer get preempted in the middle of a
+* copy. The writer derives every field of a snapshot from its count, so a
+* torn read (half of one snapshot, half of the next) or a count going
+* backwards is caught. A reader built for another layout version has to be
+* turned away.
+*******************************************************************************/
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/wait.h>
+#include "../shm_export.h"
+
+#define TEST_SECONDS	2
+#define THREAD_READERS	4
+#define PROC_READERS	2
+#define MAX_LOAD	16	// busy threads, one per cpu up to this
+
+typedef struct reader_t{
+	pthread_t thread;
+	const shm_export_t* shm;
+	uint64_t t_end;
+	unsigned long reads;
+	unsigned long busy;	// gave up while the writer kept racing
+	unsigned long torn;	// snapshot that doesn't add up
+	unsigned long stale;	// count went backwards
+}reader_t;
+
+static volatile int loaded=1;
+
+static uint64_t now_ns(){
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec*1000000000ULL + ts.tv_nsec;
+}
+
+static void fill(shm_payload_t* p, uint64_t count){
+	float f = (float)(count & 0xFFFF);
+	int i;
+
+	memset(p, 0, sizeof(shm_payload_t));
+	p->count = count;
+	p->t_ns = count*3;
+	p->wheel_angle_l = p->wheel_angle_r = p->theta = p->phi = p->gamma = f;
+	p->v_batt = p->d1_out = p->d2_out = p->d3_out = f;
+	p->saturated = count & 0x7;
+	p->theta_ref = p->phi_ref = p->gamma_ref = f;
+	p->num_tasks = SHM_MAX_TASKS;
+	for(i=0;i<SHM_MAX_TASKS;i++) p->tasks[i].runs = count+i;
+	p->count_end = count;
+}
+
+static int whole(const shm_payload_t* p){
+	float f = (float)(p->count & 0xFFFF);
+	int i;
+
+	if(p->count_end!=p->count || p->t_ns!=p->count*3) return 0;
+	if(p->theta!=f || p->wheel_angle_l!=f || p->d3_out!=f || p->gamma_ref!=f || p->v_batt!=f) return 0;
+	if(p->saturated!=(p->count & 0x7) || p->num_tasks!=SHM_MAX_TASKS) return 0;
+	for(i=0;i<SHM_MAX_TASKS;i++) if(p->tasks[i].runs!=p->count+i) return 0;
+	return 1;
+}
+
+static void* reader_fn(void* arg){
+	reader_t* r = arg;
+	shm_payload_t p;
+	uint64_t last=0;
+
+	while(now_ns()<r->t_end){
+		if(shm_export_read(r->shm, &p)){
+			r->busy++;
+			continue;
+		}
+		r->reads++;
+		if(!whole(&p)) r->torn++;
+		if(p.count<last) r->stale++;
+		last = p.count;
+	}
+	return NULL;
+}
+
+static void* load_fn(void* arg){
+	volatile unsigned long n=0;
+	while(loaded) n++;
+	return NULL;
+}
+
+// a reader in a process of its own, mapping the segment by name
+static pid_t start_reader_process(const char* name, uint64_t t_end, int* fd){
+	reader_t r;
+	int p[2];
+	pid_t pid;
+
+	if(pipe(p)){
+		perror("pipe");
+		return -1;
+	}
+	pid = fork();
+	if(pid==0){
+		close(p[0]);
+		memset(&r, 0, sizeof(r));
+		r.shm = shm_export_open(name, 0);
+		if(r.shm==NULL) _exit(1);
+		r.t_end = t_end;
+		reader_fn(&r);
+		_exit(write(p[1], &r, sizeof(r))!=sizeof(r));
+	}
+	close(p[1]);
+	*fd = p[0];
+	return pid;
+}
+
+static int print_reader(const char* kind, int i, const reader_t* r){
+	int bad = r->torn || r->stale || r->reads==0;
+	printf("%-7s %d: %10lu reads %8lu busy %lu torn %lu stale  %s\n", kind, i,\
+		r->reads, r->busy, r->torn, r->stale, bad ? "FAIL" : "ok");
+	return bad;
+}
+
+/*******************************************************************************
+* static int check_version(const char* name, shm_export_t* w)
+*
+* a segment written by another layout version, then another size, has to
+* be refused by a reader
+*******************************************************************************/
+static int check_version(const char* name, shm_export_t* w){
+	const shm_export_t* r;
+	int bad=0, saved;
+
+	// the refusals are reported on stderr, expected here
+	fflush(stderr);
+	saved = dup(STDERR_FILENO);
+	if(freopen("/dev/null", "w", stderr)==NULL) return 1;
+	w->version = SHM_EXPORT_VERSION+1;
+	r = shm_export_open(name, 0);
+	bad += r!=NULL;
+	w->version = SHM_EXPORT_VERSION;
+	w->size = sizeof(shm_export_t)-4;
+	r = shm_export_open(name, 0);
+	bad += r!=NULL;
+	w->size = sizeof(shm_export_t);
+	fflush(stderr);
+	dup2(saved, STDERR_FILENO);
+	close(saved);
+	r = shm_export_open(name, 0);
+	bad += r==NULL;
+	shm_export_close((shm_export_t*)r, name, 0);
+	printf("version: other version and size %s\n", bad ? "FAIL" : "refused, ok");
+	return bad;
+}
+
+int main(){
+	static reader_t r[THREAD_READERS+PROC_READERS];
+	pthread_t load[MAX_LOAD];
+	char name[64];
+	shm_export_t* w;
+	const shm_export_t* shm;
+	shm_payload_t p;
+	uint64_t count=0, t_end;
+	pid_t pid[PROC_READERS];
+	int i, fd[PROC_READERS], n_load, failed=0;
+
+	snprintf(name, sizeof(name), "/mip_test_shm_%d", (int)getpid());
+	w = shm_export_open(name, 1);
+	if(w==NULL) return 1;
+	shm = shm_export_open(name, 0);
+	if(shm==NULL){
+		shm_export_close(w, name, 1);
+		return 1;
+	}
+	fill(&p, ++count);
+	shm_export_write(w, &p);
+
+	n_load = sysconf(_SC_NPROCESSORS_ONLN);
+	if(n_load<1) n_load = 1;
+	if(n_load>MAX_LOAD) n_load = MAX_LOAD;
+	t_end = now_ns() + TEST_SECONDS*1000000000ULL;
+	for(i=0;i<PROC_READERS;i++) pid[i] = start_reader_process(name, t_end, &fd[i]);
+	for(i=0;i<THREAD_READERS;i++){
+		r[i].shm = shm;
+		r[i].t_end = t_end;
+		pthread_create(&r[i].thread, NULL, reader_fn, &r[i]);
+	}
+	for(i=0;i<n_load;i++) pthread_create(&load[i], NULL, load_fn, NULL);
+	while(now_ns()<t_end){
+		fill(&p, ++count);
+		shm_export_write(w, &p);
+	}
+	loaded = 0;
+	for(i=0;i<n_load;i++) pthread_join(load[i], NULL);
+
+	for(i=0;i<THREAD_READERS;i++){
+		pthread_join(r[i].thread, NULL);
+		failed += print_reader("thread", i, &r[i]);
+	}
+	for(i=0;i<PROC_READERS;i++){
+		reader_t* rp = &r[THREAD_READERS+i];
+		if(pid[i]<0 || read(fd[i], rp, sizeof(reader_t))!=sizeof(reader_t)){
+			fprintf(stderr,"ERROR: reader process %d didn't report\n", i);
+			failed++;
+		}
+		else failed += print_reader("process", i, rp);
+		if(pid[i]>0){
+			close(fd[i]);
+			waitpid(pid[i], NULL, 0);
+		}
+	}
+	printf("writer: %llu snapshots, %.0f/s with %d busy threads\n",\
+		(unsigned long long)count, (double)count/TEST_SECONDS, n_load);
+	failed += check_version(name, w);
+	shm_export_close((shm_export_t*)shm, name, 0);
+	shm_export_close(w, name, 1);
+	printf("shm_export: %s\n", failed ? "FAIL" : "ok");
+	return failed ? 1 : 0;
+}
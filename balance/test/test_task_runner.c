@@ -0,0 +1,182 @@
+/*******************************************************************************
+* test_task_runner.c
+*
+* The housekeeping loops run two ways, each in a child process of its own
+* for TEST_SECONDS: one pthread per loop sleeping between runs, the way
+* balance.c had them, and on task_runner.h with the outer loop on a runner
+* of its own as balance.c has them. The runner has to come out with fewer
+* voluntary context switches and less anonymous resident memory (stacks,
+* heap) than the threads, and every loop has to get its runs. Code pages
+* are left out, both layouts share them. Once more on the runner with the
+* printer blocking for PRINTER_BLOCK_US on every run, about what a stalled
+* terminal or fr_log_start()'s file I/O does to the shared thread: the
+* outer loop still has to get its runs.
+*******************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include "../balance_config.h"
+#include "../task_runner.h"
+
+#define TEST_SECONDS	2
+#define PRINTER_BLOCK_US	30000	// 1.5 outer loop periods
+#define NUM_LOOPS	(int)(sizeof(loops)/sizeof(loops[0]))
+
+typedef struct loop_t{
+	const char* name;
+	int hz;
+	volatile unsigned long runs;
+}loop_t;
+
+// the loops balance.c runs on the task runner at their own rates
+static loop_t loops[] = {
+	{"outer_loop",	SAMPLE_RATE_D2_HZ},
+	{"battery",	BATTERY_CHECK_HZ},
+	{"printer",	PRINTF_HZ},
+	{"input",	INPUT_HZ},
+	{"trajectory",	SETPOINT_MANAGER_HZ},
+	{"shm_export",	SHM_EXPORT_HZ},
+};
+
+typedef struct result_t{
+	long nvcsw;		// voluntary context switches of the whole process
+	long rss_kb;		// anonymous resident memory the layout added
+	int short_runs;		// loops that ran less than 90% of their periods
+}result_t;
+
+enum{THREADS, RUNNER, RUNNER_BLOCKED, NUM_LAYOUTS};
+
+static volatile int running;
+static int printer_blocks=0;
+static char line[128];
+
+// about what printer() does with its line
+static void work(loop_t* l){
+	snprintf(line, sizeof(line), "%s %7.3f |%7.3f |", l->name, l->runs*0.001, l->hz*0.5);
+	l->runs++;
+}
+
+static void task_0(){ work(&loops[0]); }
+static void task_1(){ work(&loops[1]); }
+static void task_2(){ work(&loops[2]); if(printer_blocks) usleep(PRINTER_BLOCK_US); }
+static void task_3(){ work(&loops[3]); }
+static void task_4(){ work(&loops[4]); }
+static void task_5(){ work(&loops[5]); }
+static task_fn_t task_fns[] = {task_0, task_1, task_2, task_3, task_4, task_5};
+
+static void* thread_loop(void* ptr){
+	loop_t* l = ptr;
+	while(running){
+		work(l);
+		usleep(1000000/l->hz);
+	}
+	return NULL;
+}
+
+static long rss_kb(){
+	char buf[256];
+	long kb=-1;
+	FILE* f = fopen("/proc/self/status", "r");
+
+	if(f==NULL) return -1;
+	while(fgets(buf, sizeof(buf), f)){
+		if(sscanf(buf, "RssAnon: %ld", &kb)==1) break;
+	}
+	fclose(f);
+	return kb;
+}
+
+/*******************************************************************************
+* static void run_layout(int layout, result_t* r)
+*
+* One layout for TEST_SECONDS. Resident memory is taken while the loops
+* still run, so their stacks count. With the printer blocking only the
+* outer loop's runs count.
+*******************************************************************************/
+static void run_layout(int layout, result_t* r){
+	int threads = layout==THREADS;
+	pthread_t t[NUM_LOOPS];
+	struct rusage u0, u1;
+	long rss0;
+	int i;
+
+	rss0 = rss_kb();
+	getrusage(RUSAGE_SELF, &u0);
+	running = 1;
+	for(i=0;i<NUM_LOOPS;i++){
+		if(threads) pthread_create(&t[i], NULL, thread_loop, &loops[i]);
+		else if(i==0) task_runner_add_own(loops[i].name, task_fns[i], loops[i].hz, 0);
+		else task_runner_add(loops[i].name, task_fns[i], loops[i].hz);
+	}
+	printer_blocks = layout==RUNNER_BLOCKED;
+	if(!threads && task_runner_start(0)) exit(1);
+	sleep(TEST_SECONDS);
+	r->rss_kb = rss_kb()-rss0;
+	running = 0;
+	if(threads) for(i=0;i<NUM_LOOPS;i++) pthread_join(t[i], NULL);
+	else task_runner_stop();
+	getrusage(RUSAGE_SELF, &u1);
+	r->nvcsw = u1.ru_nvcsw-u0.ru_nvcsw;
+	r->short_runs = 0;
+	for(i=0;i<(printer_blocks ? 1 : NUM_LOOPS);i++)
+		r->short_runs += loops[i].runs < 0.9*TEST_SECONDS*loops[i].hz;
+}
+
+// the layout in a child of its own, the result comes back through a pipe
+static pid_t start_layout(int layout, int* fd){
+	result_t r;
+	int p[2];
+	pid_t pid;
+
+	if(pipe(p)){
+		perror("pipe");
+		exit(1);
+	}
+	pid = fork();
+	if(pid==0){
+		close(p[0]);
+		// task_runner_stop() reports on stdout
+		if(freopen("/dev/null", "w", stdout)==NULL) _exit(1);
+		run_layout(layout, &r);
+		_exit(write(p[1], &r, sizeof(r))!=sizeof(r));
+	}
+	close(p[1]);
+	*fd = p[0];
+	return pid;
+}
+
+int main(){
+	result_t res[NUM_LAYOUTS];
+	const char* names[NUM_LAYOUTS] = {"threads", "task runner", "printer blocks"};
+	int i, fd[NUM_LAYOUTS], failed=0;
+	pid_t pid[NUM_LAYOUTS];
+
+	for(i=0;i<NUM_LAYOUTS;i++) pid[i] = start_layout(i, &fd[i]);
+	for(i=0;i<NUM_LAYOUTS;i++){
+		if(read(fd[i], &res[i], sizeof(result_t))!=sizeof(result_t)){
+			fprintf(stderr,"ERROR: %s layout didn't report\n", names[i]);
+			return 1;
+		}
+		close(fd[i]);
+		waitpid(pid[i], NULL, 0);
+		printf("%-14s %6ld voluntary context switches %5ld kB anon RSS %d loops short\n",\
+			names[i], res[i].nvcsw, res[i].rss_kb, res[i].short_runs);
+		failed += res[i].short_runs>0;
+	}
+	if(res[RUNNER].nvcsw>=res[THREADS].nvcsw){
+		fprintf(stderr,"ERROR: task runner switched as often as the threads\n");
+		failed++;
+	}
+	if(res[RUNNER].rss_kb>=res[THREADS].rss_kb){
+		fprintf(stderr,"ERROR: task runner took as much memory as the threads\n");
+		failed++;
+	}
+	printf("task_runner: %s\n", failed ? "FAIL" : "ok");
+	return failed ? 1 : 0;
+}
@@ -0,0 +1,118 @@
+/*******************************************************************************
+* test_trajectory.c
+*
+* trajectory.h across engage and disengage, driven tick by tick the way
+* balance.c drives it: traj_reset() on engage, traj_stop() on disengage,
+* traj_task() at SETPOINT_MANAGER_HZ and outer_loop() taking phi.
+*
+*	pending		a message before the first engage, like the file on
+*			the command line, survives the engage and its clock
+*			starts there, however long the robot sat before
+*	re-engage	a message sent while down starts at the next engage,
+*			the trajectory that was running when it went down
+*			doesn't come back
+*	rejected	messages that leave nothing to do, say two things at
+*			once or are malformed fail, and so do a message or a
+*			file too long to take whole
+*******************************************************************************/
+
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include "../balance_config.h"
+#include "../trajectory.h"
+
+#define TICK_HZ		SETPOINT_MANAGER_HZ
+#define LONG_FILE	"/tmp/test_trajectory.txt"
+#define LONG_BYTES	3000	// past the longest message
+
+static int failed=0;
+static float phi;		// what outer_loop() would be following
+
+static void check(const char* name, int ok, const char* what){
+	printf("%-12s %-56s %s\n", name, what, ok ? "ok" : "FAIL");
+	failed += !ok;
+}
+
+// s seconds of producer ticks, the consumer taking the newest each tick.
+// Returns the number of ticks that had a setpoint.
+static int run(double s){
+	int k, got=0;
+	for(k=0;k<s*TICK_HZ;k++){
+		traj_task();
+		if(traj_next_phi(&phi)==0) got++;
+	}
+	return got;
+}
+
+// a valid message padded with comment lines to LONG_BYTES
+static const char* long_message(){
+	static char text[LONG_BYTES+1];
+	memset(text, '#', LONG_BYTES);
+	text[LONG_BYTES] = '\0';
+	memcpy(text, "wp 1 5 0\n", 9);
+	return text;
+}
+
+// traj_init() on a file holding text, no socket
+static int init_file(const char* text){
+	FILE* f = fopen(LONG_FILE, "w");
+	int ret;
+
+	if(f==NULL) return 0;
+	fputs(text, f);
+	fclose(f);
+	ret = traj_init(NULL, LONG_FILE);
+	remove(LONG_FILE);
+	return ret;
+}
+
+int main(){
+	float before;
+
+	// the rejections print their ERROR lines in between
+	setvbuf(stdout, NULL, _IOLBF, 0);
+
+	// nothing is produced before the first engage, the file waits
+	check("pending", traj_command("wp 2 10 0")==0, "accepted before the first engage");
+	check("pending", run(5.0)==0, "no setpoints while down");
+	traj_reset();
+	run(1.0);
+	check("pending", phi>2 && phi<8, "halfway 1s after engage, not done already");
+	run(2.0);
+	check("pending", fabs(phi-10)<0.01, "at the waypoint 3s after engage");
+
+	// down halfway through a trajectory, commanded while down, picked up again
+	check("re-engage", traj_command("wp 4 -20 0")==0, "accepted while balancing");
+	run(1.0);
+	traj_stop();
+	before = phi;
+	check("re-engage", run(2.0)==0 && phi==before, "no setpoints once disengaged");
+	check("re-engage", traj_command("wp 1 3 0")==0, "accepted while down");
+	traj_reset();
+	run(0.02);
+	check("re-engage", fabs(phi)<0.01, "starts over from zero");
+	run(2.0);
+	check("re-engage", fabs(phi-3)<0.01, "goes to the message sent while down");
+	traj_stop();
+	traj_reset();
+	run(2.0);
+	check("re-engage", fabs(phi)<0.01, "nothing left over for the engage after");
+
+	check("rejected", traj_command("wp 0 5 0")==-1, "waypoints only at time 0");
+	check("rejected", traj_command("# comment only\n")==-1, "no command at all");
+	check("rejected", traj_command("wp 2 1 0; wp 1 2 0")==-1, "times going back");
+	check("rejected", traj_command("wp 1 1 0; jump")==-1, "one bad command in the message");
+	check("rejected", traj_command("wp -1 5 0; wp 1 1 0")==-1, "negative waypoint time");
+	check("rejected", traj_command("wp 1 5 0; vel 1 0")==-1, "wp and vel in one message");
+	check("rejected", traj_command("vel 1 0; hold")==-1, "vel and hold in one message");
+	check("rejected", traj_command(long_message())==-1, "message too long to take whole");
+	check("rejected", init_file(long_message())==-1, "file too long to take whole");
+	run(1.0);
+	check("rejected", fabs(phi)<0.01, "and none of them moved the setpoint");
+	check("accepted", traj_command("wp 0 1 0; wp 1 1 0")==0, "time 0 with a later waypoint");
+	check("accepted", init_file("wp 0 1 0; wp 1 2 0")==0, "a file that fits");
+
+	printf("trajectory: %s\n", failed ? "FAIL" : "ok");
+	return failed ? 1 : 0;
+}
@@ -0,0 +1,461 @@
+/*******************************************************************************
+* trajectory.c
+*
+* Command parsing, spline, rate limits and setpoint queues behind
+* trajectory.h
+*******************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <stdint.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <stdatomic.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include "balance_config.h"
+#include "trajectory.h"
+
+#define TRAJ_DT		(1.0/SETPOINT_MANAGER_HZ)
+#define TRAJ_MSG_MAX	2048
+#define QUEUE_MASK	(TRAJ_QUEUE_SIZE-1)
+
+typedef enum traj_mode_t{
+	TRAJ_HOLD,
+	TRAJ_SPLINE,
+	TRAJ_VELOCITY
+}traj_mode_t;
+
+/*******************************************************************************
+* traj_sample_t, traj_queue_t
+*
+* Single producer, single consumer ring. epoch ties a sample to the
+* traj_reset() it was produced after, the consumer drops older ones.
+*******************************************************************************/
+typedef struct traj_sample_t{
+	uint32_t epoch;
+	float v;
+}traj_sample_t;
+
+typedef struct traj_queue_t{
+	_Atomic uint32_t head;		// next to pop, written by the consumer
+	_Atomic uint32_t tail;		// next to push, written by the producer
+	traj_sample_t s[TRAJ_QUEUE_SIZE];
+}traj_queue_t;
+
+// one axis of a Hermite segment in local time, a + b t + c t^2 + d t^3
+typedef struct cubic_t{
+	double a, b, c, d;
+}cubic_t;
+
+// output of one axis after the limits
+typedef struct axis_t{
+	double pos, rate;
+	double rate_max, accel_max;
+}axis_t;
+
+/*******************************************************************************
+* traj_cmd_t
+*
+* One message as parsed, waypoint times still relative to when it starts
+*******************************************************************************/
+typedef struct traj_cmd_t{
+	int n;			// waypoints, the first is where the setpoint is then
+	double t[TRAJ_MAX_WAYPOINTS+1], phi[TRAJ_MAX_WAYPOINTS+1], gamma[TRAJ_MAX_WAYPOINTS+1];
+	int start_set;		// a wp at time 0 replaced the first point
+	int vel, hold;
+	double v_phi, v_gamma, v_time;
+}traj_cmd_t;
+
+static traj_queue_t phi_q, gamma_q;
+static _Atomic uint32_t epoch=0;
+static _Atomic int running=0;		// loops are taking setpoints
+
+// producer state, only touched by the thread running traj_task()
+static uint32_t prod_epoch=0;
+static traj_mode_t mode=TRAJ_HOLD;
+static double now=0;			// producer clock, seconds since the loops started
+static traj_cmd_t pending;		// arrived while the loops were stopped
+static int have_pending=0;
+static int num_seg=0;
+static double seg_t0[TRAJ_MAX_WAYPOINTS];
+static double seg_h[TRAJ_MAX_WAYPOINTS];
+static cubic_t seg_phi[TRAJ_MAX_WAYPOINTS];
+static cubic_t seg_gamma[TRAJ_MAX_WAYPOINTS];
+static double vel_phi, vel_gamma, vel_end;
+static axis_t phi_axis = {0, 0, TRAJ_PHI_RATE_MAX, TRAJ_PHI_ACCEL_MAX};
+static axis_t gamma_axis = {0, 0, TRAJ_GAMMA_RATE_MAX, TRAJ_GAMMA_ACCEL_MAX};
+static int sock=-1;
+
+/*******************************************************************************
+* queues
+*******************************************************************************/
+static int queue_push(traj_queue_t* q, traj_sample_t s){
+	uint32_t t = atomic_load_explicit(&q->tail, memory_order_relaxed);
+	uint32_t h = atomic_load_explicit(&q->head, memory_order_acquire);
+
+	if(t-h>=TRAJ_QUEUE_SIZE) return -1;	// consumer isn't running, drop
+	q->s[t & QUEUE_MASK] = s;
+	atomic_store_explicit(&q->tail, t+1, memory_order_release);
+	return 0;
+}
+
+static int queue_latest(traj_queue_t* q, float* v){
+	uint32_t h = atomic_load_explicit(&q->head, memory_order_relaxed);
+	uint32_t t = atomic_load_explicit(&q->tail, memory_order_acquire);
+	uint32_t e = atomic_load_explicit(&epoch, memory_order_acquire);
+	int found=-1;
+
+	for(; h!=t; h++){
+		if(q->s[h & QUEUE_MASK].epoch!=e) continue;
+		*v = q->s[h & QUEUE_MASK].v;
+		found = 0;
+	}
+	atomic_store_explicit(&q->head, h, memory_order_release);
+	return found;
+}
+
+int traj_next_phi(float* phi){
+	return queue_latest(&phi_q, phi);
+}
+
+int traj_next_gamma(float* gamma){
+	return queue_latest(&gamma_q, gamma);
+}
+
+void traj_reset(){
+	atomic_fetch_add_explicit(&epoch, 1, memory_order_release);
+	atomic_store_explicit(&running, 1, memory_order_release);
+}
+
+void traj_stop(){
+	atomic_store_explicit(&running, 0, memory_order_release);
+}
+
+/*******************************************************************************
+* static cubic_t hermite(double p0, double p1, double m0, double m1, double h)
+*
+* cubic through p0 and p1 with slopes m0 and m1 over h seconds
+*******************************************************************************/
+static cubic_t hermite(double p0, double p1, double m0, double m1, double h){
+	cubic_t c;
+	c.a = p0;
+	c.b = m0;
+	c.c = (3*(p1-p0)/h - 2*m0 - m1)/h;
+	c.d = (2*(p0-p1)/h + m0 + m1)/(h*h);
+	return c;
+}
+
+static double cubic_eval(const cubic_t* c, double t){
+	return c->a + t*(c->b + t*(c->c + t*c->d));
+}
+
+static double cubic_rate(const cubic_t* c, double t){
+	return c->b + t*(2*c->c + t*3*c->d);
+}
+
+/*******************************************************************************
+* static void build_spline(int n, double* t, double* phi, double* gamma)
+*
+* Catmull-Rom slopes inside, zero at both ends so the robot starts and stops
+* smoothly. The first point is where the setpoint is now, times increase.
+*******************************************************************************/
+static void build_spline(int n, double* t, double* phi, double* gamma){
+	double mp0, mp1, mg0, mg1;
+	int i;
+
+	for(i=0;i<n-1;i++){
+		mp0 = i>0 ? (phi[i+1]-phi[i-1])/(t[i+1]-t[i-1]) : 0;
+		mg0 = i>0 ? (gamma[i+1]-gamma[i-1])/(t[i+1]-t[i-1]) : 0;
+		mp1 = i+2<n ? (phi[i+2]-phi[i])/(t[i+2]-t[i]) : 0;
+		mg1 = i+2<n ? (gamma[i+2]-gamma[i])/(t[i+2]-t[i]) : 0;
+		seg_t0[i] = t[i];
+		seg_h[i] = t[i+1]-t[i];
+		seg_phi[i] = hermite(phi[i], phi[i+1], mp0, mp1, seg_h[i]);
+		seg_gamma[i] = hermite(gamma[i], gamma[i+1], mg0, mg1, seg_h[i]);
+	}
+	num_seg = n-1;
+	mode = TRAJ_SPLINE;
+}
+
+/*******************************************************************************
+* static int parse(const char* text, traj_cmd_t* c)
+*
+* -1 on a bad command, or a message that leaves nothing to do, like waypoints
+* all at time 0, or one that says two things at once, like wp and vel
+*******************************************************************************/
+static int parse(const char* text, traj_cmd_t* c){
+	char buf[TRAJ_MSG_MAX];
+	char *line, *save;
+	double a, b, d;
+	int k, wp=0;
+
+	memset(c, 0, sizeof(traj_cmd_t));
+	c->n = 1;
+	if(strlen(text)>=sizeof(buf)){
+		fprintf(stderr,"ERROR: trajectory message longer than %d bytes\n", TRAJ_MSG_MAX-1);
+		return -1;
+	}
+	strcpy(buf, text);
+	for(line=strtok_r(buf, ";\n", &save); line!=NULL; line=strtok_r(NULL, ";\n", &save)){
+		while(*line==' ' || *line=='\t') line++;
+		if(*line=='\0' || *line=='#') continue;
+		if(sscanf(line, "wp %lf %lf %lf", &a, &b, &d)==3){
+			if(a<0){
+				fprintf(stderr,"ERROR: negative waypoint time: %s\n", line);
+				return -1;
+			}
+			// a waypoint at time 0 replaces the start point
+			k = a>0 ? c->n++ : 0;
+			if(k>TRAJ_MAX_WAYPOINTS){
+				fprintf(stderr,"ERROR: more than %d waypoints\n", TRAJ_MAX_WAYPOINTS);
+				return -1;
+			}
+			if(k==0) c->start_set = 1;
+			c->t[k] = a>0 ? a : 0;
+			c->phi[k] = b;
+			c->gamma[k] = d;
+			wp = 1;
+		}
+		else if((k=sscanf(line, "vel %lf %lf %lf", &a, &b, &d))>=2){
+			c->v_phi = a;
+			c->v_gamma = b;
+			c->v_time = k==3 ? d : INFINITY;
+			c->vel = 1;
+		}
+		else if(strncmp(line, "hold", 4)==0) c->hold = 1;
+		else{
+			fprintf(stderr,"ERROR: bad trajectory command: %s\n", line);
+			return -1;
+		}
+	}
+	if(wp+c->vel+c->hold>1){
+		fprintf(stderr,"ERROR: wp, vel and hold can't share a message\n");
+		return -1;
+	}
+	if(!c->hold && !c->vel){
+		if(!wp){
+			fprintf(stderr,"ERROR: no trajectory command in the message\n");
+			return -1;
+		}
+		if(c->n==1){
+			fprintf(stderr,"ERROR: no waypoint after time 0, nothing to follow\n");
+			return -1;
+		}
+		for(k=1;k<c->n;k++){
+			if(c->t[k]<=c->t[k-1]){
+				fprintf(stderr,"ERROR: waypoint times must increase\n");
+				return -1;
+			}
+		}
+	}
+	return 0;
+}
+
+/*******************************************************************************
+* static void apply(traj_cmd_t* c)
+*
+* start a parsed message now, the spline from where the setpoint is
+*******************************************************************************/
+static void apply(traj_cmd_t* c){
+	int k;
+
+	if(c->hold){
+		mode = TRAJ_HOLD;
+		return;
+	}
+	if(c->vel){
+		vel_phi = c->v_phi;
+		vel_gamma = c->v_gamma;
+		vel_end = now+c->v_time;
+		mode = TRAJ_VELOCITY;
+		return;
+	}
+	if(!c->start_set){
+		c->phi[0] = phi_axis.pos;
+		c->gamma[0] = gamma_axis.pos;
+	}
+	for(k=0;k<c->n;k++) c->t[k] += now;
+	build_spline(c->n, c->t, c->phi, c->gamma);
+}
+
+/*******************************************************************************
+* int traj_command(const char* text)
+*
+* Every waypoint in one message becomes part of one new trajectory. Nothing
+* is applied if any command in the message is bad. While the loops are
+* stopped the message waits, the latest one replacing any earlier, and
+* starts when they start again.
+*******************************************************************************/
+int traj_command(const char* text){
+	traj_cmd_t c;
+
+	if(parse(text, &c)) return -1;
+	// stopped, or started again and traj_task() hasn't caught up yet
+	if(!atomic_load_explicit(&running, memory_order_acquire) ||\
+	   atomic_load_explicit(&epoch, memory_order_acquire)!=prod_epoch){
+		pending = c;
+		have_pending = 1;
+		return 0;
+	}
+	apply(&c);
+	return 0;
+}
+
+/*******************************************************************************
+* static void limit(axis_t* x, double target, double target_rate)
+*
+* Follow target moving at target_rate within the rate and acceleration
+* limits. The correction toward target is capped by the braking curve
+* sqrt(2 a |error|) so the output settles on it instead of overshooting.
+*******************************************************************************/
+static void limit(axis_t* x, double target, double target_rate){
+	double err = target - x->pos;
+	double r = fabs(err)/TRAJ_DT;
+	double brake = sqrt(2*x->accel_max*fabs(err));
+
+	if(r>brake) r = brake;
+	r = target_rate + (err>0 ? r : -r);
+	if(r > x->rate + x->accel_max*TRAJ_DT) r = x->rate + x->accel_max*TRAJ_DT;
+	if(r < x->rate - x->accel_max*TRAJ_DT) r = x->rate - x->accel_max*TRAJ_DT;
+	if(r > x->rate_max) r = x->rate_max;
+	if(r < -x->rate_max) r = -x->rate_max;
+	x->rate = r;
+	x->pos += r*TRAJ_DT;
+}
+
+/*******************************************************************************
+* void traj_task()
+*
+* Drain the socket, advance the trajectory one tick and hand the limited
+* setpoints to the loops. After a traj_reset() everything starts over at
+* zero, matching zero_out_controller(), with the message that waited for
+* it if there is one. While stopped the clock stands still and nothing is
+* pushed.
+*******************************************************************************/
+void traj_task(){
+	char msg[TRAJ_MSG_MAX];
+	double target_phi, target_gamma, rate_phi=0, rate_gamma=0, tau;
+	uint32_t e;
+	traj_sample_t s;
+	ssize_t len;
+	int i, run;
+
+	// traj_reset() moves the epoch before it sets running
+	run = atomic_load_explicit(&running, memory_order_acquire);
+	e = atomic_load_explicit(&epoch, memory_order_acquire);
+	if(run && e!=prod_epoch){
+		prod_epoch = e;
+		mode = TRAJ_HOLD;
+		now = 0;
+		phi_axis.pos = phi_axis.rate = 0;
+		gamma_axis.pos = gamma_axis.rate = 0;
+		if(have_pending) apply(&pending);
+		have_pending = 0;
+	}
+	if(sock>=0){
+		// MSG_TRUNC returns the whole datagram's length, a cut one is dropped
+		while((len=recv(sock, msg, sizeof(msg)-1, MSG_DONTWAIT|MSG_TRUNC))>0){
+			if(len>=(ssize_t)sizeof(msg)){
+				fprintf(stderr,"ERROR: trajectory message longer than %d bytes\n", TRAJ_MSG_MAX-1);
+				continue;
+			}
+			msg[len] = '\0';
+			traj_command(msg);
+		}
+	}
+	if(!run) return;
+
+	now += TRAJ_DT;
+	target_phi = phi_axis.pos;
+	target_gamma = gamma_axis.pos;
+	if(mode==TRAJ_SPLINE){
+		for(i=0;i<num_seg-1 && now>=seg_t0[i]+seg_h[i];i++);
+		tau = now-seg_t0[i];
+		if(tau<0) tau = 0;
+		if(tau<seg_h[i]){
+			rate_phi = cubic_rate(&seg_phi[i], tau);
+			rate_gamma = cubic_rate(&seg_gamma[i], tau);
+		}
+		else tau = seg_h[i];
+		target_phi = cubic_eval(&seg_phi[i], tau);
+		target_gamma = cubic_eval(&seg_gamma[i], tau);
+	}
+	else if(mode==TRAJ_VELOCITY){
+		if(now>=vel_end) mode = TRAJ_HOLD;
+		else{
+			rate_phi = vel_phi;
+			rate_gamma = vel_gamma;
+		}
+	}
+	limit(&phi_axis, target_phi, rate_phi);
+	limit(&gamma_axis, target_gamma, rate_gamma);
+
+	s.epoch = prod_epoch;
+	s.v = phi_axis.pos;
+	queue_push(&phi_q, s);
+	s.v = gamma_axis.pos;
+	queue_push(&gamma_q, s);
+}
+
+/*******************************************************************************
+* int traj_init(const char* socket_path, const char* file)
+*
+* Open the command socket and apply the file as one message. Returns -1 if
+* either fails or the file is longer than one message, the loops still run
+* and hold position.
+*******************************************************************************/
+int traj_init(const char* socket_path, const char* file){
+	struct sockaddr_un addr;
+	char buf[TRAJ_MSG_MAX];
+	FILE* f;
+	size_t n;
+	int ret=0;
+
+	if(file!=NULL){
+		f = fopen(file, "r");
+		if(f==NULL){
+			perror(file);
+			ret = -1;
+		}
+		else{
+			n = fread(buf, 1, sizeof(buf), f);
+			fclose(f);
+			if(n==sizeof(buf)){
+				fprintf(stderr,"ERROR: %s is longer than %d bytes\n", file, TRAJ_MSG_MAX-1);
+				ret = -1;
+			}
+			else{
+				buf[n] = '\0';
+				if(traj_command(buf)) ret = -1;
+			}
+		}
+	}
+	if(socket_path==NULL) return ret;
+
+	sock = socket(AF_UNIX, SOCK_DGRAM, 0);
+	if(sock<0){
+		perror("trajectory socket");
+		return -1;
+	}
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	strncpy(addr.sun_path, socket_path, sizeof(addr.sun_path)-1);
+	unlink(socket_path);
+	if(bind(sock, (struct sockaddr*)&addr, sizeof(addr))){
+		perror(socket_path);
+		close(sock);
+		sock = -1;
+		return -1;
+	}
+	return ret;
+}
+
+void traj_cleanup(const char* socket_path){
+	if(sock<0) return;
+	close(sock);
+	sock = -1;
+	if(socket_path!=NULL) unlink(socket_path);
+}
@@ -0,0 +1,56 @@
+/*******************************************************************************
+* trajectory.h
+*
+* Commanded motion for balance. Text commands arrive on a UNIX datagram
+* socket or from a file given on the command line:
+*
+*	wp T PHI GAMMA		waypoint, T>=0 seconds after the message starts
+*	vel VPHI VGAMMA [S]	wheel and turn rates in rad/s, for S seconds
+*	hold			stop where the setpoint is now
+*
+* Several commands may share one message, separated by ';' or newlines,
+* as long as they are all wp, all vel or all hold. A message, or the file,
+* holds at most 2047 bytes.
+* The waypoints of one message replace the current trajectory and are joined
+* by a cubic Hermite spline whose coefficients are computed once when the
+* message starts. A message starts when it arrives while balancing. One
+* that arrives while the robot is down, like the file given on the command
+* line, waits for the next engage and starts there, the latest one replacing
+* any earlier. A trajectory that was running when the robot went down is
+* dropped, it doesn't resume on its own.
+*
+* traj_task() runs on the task runner, evaluates the spline or integrates
+* the velocity command, applies the rate and acceleration limits from
+* balance_config.h and pushes one setpoint per tick into two single
+* producer, single consumer queues: phi for outer_loop() and gamma for
+* balancer(). Nothing blocks on either side and a new command reaches the
+* loops within one traj_task() period plus one consumer period.
+*
+*	echo "wp 2 31.4 0; wp 4 31.4 1.57" | socat - UNIX-SENDTO:/tmp/mip_traj.sock
+*******************************************************************************/
+
+#ifndef TRAJECTORY_H
+#define TRAJECTORY_H
+
+#define TRAJ_MAX_WAYPOINTS	32
+#define TRAJ_QUEUE_SIZE		16	// power of two
+
+// socket and file are both optional, pass NULL to skip either
+int traj_init(const char* socket_path, const char* file);
+void traj_cleanup(const char* socket_path);
+// parse and apply one message, only from the thread running traj_task()
+// or before the task runner starts, -1 on a bad command or nothing to do
+int traj_command(const char* text);
+// producer, run at SETPOINT_MANAGER_HZ
+void traj_task();
+// on engage: drop the trajectory, start again from zero with the message
+// that waited if there is one. Safe from any thread.
+void traj_reset();
+// on disengage: messages from now on wait for traj_reset(). Safe from any thread.
+void traj_stop();
+
+// consumers, newest setpoint since the last call, -1 if there is none
+int traj_next_phi(float* phi);
+int traj_next_gamma(float* gamma);
+
+#endif	//TRAJECTORY_H
@@ -0,0 +1,72 @@
+/*******************************************************************************
+* comp_filter.c
+*
+* Setup and the batch form of comp_filter.h
+*******************************************************************************/
+
+#include <stdio.h>
+#include <string.h>
+#include "comp_filter.h"
+
+/*******************************************************************************
+* int comp_filter_init(comp_filter_t* f, float w, float dt)
+*
+* w*dt has to stay inside (0,1] or the discrete filter is no longer stable
+*******************************************************************************/
+int comp_filter_init(comp_filter_t* f, float w, float dt){
+	if(w<=0 || dt<=0 || w*dt>1.0f){
+		fprintf(stderr,"ERROR: complementary filter needs 0 < w*dt <= 1\n");
+		return -1;
+	}
+	memset(f, 0, sizeof(comp_filter_t));
+	f->alpha = w*dt;
+	f->beta = 1.0f - f->alpha;
+	f->gyro_scale = dt*COMP_FILTER_DEG_TO_RAD;
+	return 0;
+}
+
+/*******************************************************************************
+* void comp_filter_reset(comp_filter_t* f)
+*******************************************************************************/
+void comp_filter_reset(comp_filter_t* f){
+	f->last_a_raw = 0;
+	f->theta_g_raw = 0;
+	f->theta_a = 0;
+	f->theta_g = 0;
+}
+
+/*******************************************************************************
+* int comp_filter_batch(comp_filter_t* f, const float* accel_y,
+*	const float* accel_z, const float* gyro_x, float* theta, int n)
+*
+* Same as n calls to comp_filter_step(), continuing from and leaving the
+* state in f. The atan2 of every sample doesn't depend on the filter so it
+* goes first in a loop of its own, which the compiler can vectorize where
+* the libm has a vector atan2f. What remains is the two one pole
+* recurrences, a couple of multiply-adds per sample.
+*******************************************************************************/
+int comp_filter_batch(comp_filter_t* f, const float* restrict accel_y,\
+		const float* restrict accel_z, const float* restrict gyro_x,\
+		float* restrict theta, int n){
+	float a_raw, d;
+	int i;
+
+	if(n<0 || (n>0 && (accel_y==NULL || accel_z==NULL || gyro_x==NULL ||\
+					theta==NULL))){
+		fprintf(stderr,"ERROR: bad arguments to comp_filter_batch\n");
+		return -1;
+	}
+	// accelerometer angles, parked in the output until the second pass
+	for(i=0;i<n;i++) theta[i] = atan2f(-accel_z[i], accel_y[i]);
+
+	for(i=0;i<n;i++){
+		a_raw = theta[i];
+		d = f->gyro_scale*gyro_x[i];
+		f->theta_a = f->alpha*f->last_a_raw + f->beta*f->theta_a;
+		f->theta_g = f->beta*f->theta_g + d;
+		f->last_a_raw = a_raw;
+		f->theta_g_raw += d;
+		theta[i] = f->theta_a + f->theta_g;
+	}
+	return 0;
+}
@@ -0,0 +1,80 @@
+/*******************************************************************************
+* comp_filter.h
+*
+* The complementary filter every program in this repo estimates body angle
+* with. The accelerometer angle atan2(-z,y) goes through the low pass
+* w*dt/(z+(w*dt-1)) and the gyro rate through the matching high pass of
+* its Euler integral, so the two halves add up to one and theta is their
+* sum. The accelerometer half sees the previous sample, like the filter
+* balance was tuned with.
+*
+* The high pass of an integral is fed the rate times dt directly instead
+* of differencing a running integral, which is the same filter without the
+* float integral losing bits as it grows over a long run.
+*
+* comp_filter_batch() runs the same arithmetic over logged arrays for
+* offline reprocessing. Only depends on libm, no cape library needed.
+*******************************************************************************/
+
+#ifndef COMP_FILTER_H
+#define COMP_FILTER_H
+
+#include <math.h>
+
+#define COMP_FILTER_DEG_TO_RAD	0.0174532925199f
+
+typedef struct comp_filter_t{
+	float alpha;		// w*dt, low pass weight of a new sample
+	float beta;		// 1-alpha, pole of both halves
+	float gyro_scale;	// dt*DEG_TO_RAD, gyro deg/s to rad per sample
+	float last_a_raw;	// accelerometer angle of the last step
+	float theta_g_raw;	// integrated gyro, only kept for display
+	float theta_a;		// low passed accelerometer angle
+	float theta_g;		// high passed gyro angle
+}comp_filter_t;
+
+// w crossover in rad/s, dt sample period in s
+int comp_filter_init(comp_filter_t* f, float w, float dt);
+// back to zero angle, keeps the coefficients
+void comp_filter_reset(comp_filter_t* f);
+// n samples of accel y,z (any unit) and gyro x (deg/s) into theta (rad)
+int comp_filter_batch(comp_filter_t* f, const float* restrict accel_y,\
+		const float* restrict accel_z, const float* restrict gyro_x,\
+		float* restrict theta, int n);
+
+/*******************************************************************************
+* static inline float comp_filter_step_alpha(comp_filter_t* f, float accel_y,
+*				float accel_z, float gyro_x, float alpha)
+*
+* one sample with this tick's weight instead of the one from init, for a
+* crossover that moves. Returns theta_a+theta_g in rad.
+*******************************************************************************/
+static inline float comp_filter_step_alpha(comp_filter_t* f, float accel_y,\
+				float accel_z, float gyro_x, float alpha){
+	float d = f->gyro_scale*gyro_x;
+
+	f->theta_a = alpha*f->last_a_raw + (1.0f-alpha)*f->theta_a;
+	f->theta_g = (1.0f-alpha)*f->theta_g + d;
+	f->last_a_raw = atan2f(-accel_z, accel_y);
+	f->theta_g_raw += d;
+	return f->theta_a + f->theta_g;
+}
+
+/*******************************************************************************
+* static inline float comp_filter_step(comp_filter_t* f, float accel_y,
+*						float accel_z, float gyro_x)
+*
+* one sample, accel in any unit and gyro in deg/s. Returns theta in rad.
+*******************************************************************************/
+static inline float comp_filter_step(comp_filter_t* f, float accel_y,\
+						float accel_z, float gyro_x){
+	float d = f->gyro_scale*gyro_x;
+
+	f->theta_a = f->alpha*f->last_a_raw + f->beta*f->theta_a;
+	f->theta_g = f->beta*f->theta_g + d;
+	f->last_a_raw = atan2f(-accel_z, accel_y);
+	f->theta_g_raw += d;
+	return f->theta_a + f->theta_g;
+}
+
+#endif	//COMP_FILTER_H
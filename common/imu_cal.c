@@ -0,0 +1,171 @@
+/*******************************************************************************
+* imu_cal.c
+*
+* File format, checks and the still window behind imu_cal.h
+*******************************************************************************/
+
+#include <stdio.h>
+#include <stddef.h>
+#include <string.h>
+#include <errno.h>
+#include <math.h>
+#include <time.h>
+#include <unistd.h>
+#include <libgen.h>
+#include <sys/stat.h>
+#include "imu_cal.h"
+
+/*******************************************************************************
+* static uint32_t crc32(const void* p, size_t n)
+*
+* bitwise CRC-32 (IEEE), the file is read once per launch so no table
+*******************************************************************************/
+static uint32_t crc32(const void* p, size_t n){
+	const uint8_t* b = p;
+	uint32_t c = 0xffffffff;
+	int k;
+
+	while(n--){
+		c ^= *b++;
+		for(k=0;k<8;k++) c = (c>>1) ^ (0xedb88320 & -(c&1));
+	}
+	return ~c;
+}
+
+static int in_range(const float* v, int n, float max){
+	int i;
+	for(i=0;i<n;i++) if(!(fabsf(v[i])<=max)) return 0;	// NaN fails too
+	return 1;
+}
+
+void imu_cal_default(imu_cal_t* c, float mount_angle){
+	memset(c, 0, sizeof(imu_cal_t));
+	c->magic = IMU_CAL_MAGIC;
+	c->version = IMU_CAL_VERSION;
+	c->size = sizeof(imu_cal_t);
+	c->mount_angle = mount_angle;
+}
+
+/*******************************************************************************
+* int imu_cal_load(const char* path, imu_cal_t* c)
+*
+* A missing file is the normal first launch and isn't reported, anything
+* else that keeps the file from being used is.
+*******************************************************************************/
+int imu_cal_load(const char* path, imu_cal_t* c){
+	imu_cal_t f;
+	FILE* fd;
+	size_t n;
+
+	fd = fopen(path, "rb");
+	if(fd==NULL){
+		if(errno!=ENOENT) perror(path);
+		return -1;
+	}
+	n = fread(&f, 1, sizeof(f), fd);
+	fclose(fd);
+	if(n<sizeof(f) || f.magic!=IMU_CAL_MAGIC){
+		fprintf(stderr,"WARNING: %s is not an IMU calibration file\n", path);
+		return -1;
+	}
+	if(f.version!=IMU_CAL_VERSION || f.size!=sizeof(imu_cal_t)){
+		fprintf(stderr,"WARNING: %s is version %u, expected %d\n", path,\
+			f.version, IMU_CAL_VERSION);
+		return -1;
+	}
+	if(f.crc!=crc32(&f, offsetof(imu_cal_t, crc))){
+		fprintf(stderr,"WARNING: %s is corrupt\n", path);
+		return -1;
+	}
+	if(!in_range(f.gyro_bias, 3, IMU_CAL_MAX_GYRO) ||\
+	   !in_range(&f.mount_angle, 1, IMU_CAL_MAX_MOUNT)){
+		fprintf(stderr,"WARNING: %s holds implausible values, ignored\n", path);
+		return -1;
+	}
+	*c = f;
+	return 0;
+}
+
+/*******************************************************************************
+* int imu_cal_save(const char* path, imu_cal_t* c)
+*
+* Written next to the old file and renamed over it, so a crash or power cut
+* leaves either the old calibration or the new one, never half of each.
+*******************************************************************************/
+int imu_cal_save(const char* path, imu_cal_t* c){
+	char tmp[256], dir[256];
+	FILE* fd;
+	int ok;
+
+	snprintf(dir, sizeof(dir), "%s", path);
+	if(mkdir(dirname(dir), 0755) && errno!=EEXIST){
+		perror(dir);
+		return -1;
+	}
+	c->magic = IMU_CAL_MAGIC;
+	c->version = IMU_CAL_VERSION;
+	c->size = sizeof(imu_cal_t);
+	c->saved = time(NULL);
+	c->crc = crc32(c, offsetof(imu_cal_t, crc));
+
+	snprintf(tmp, sizeof(tmp), "%s.tmp", path);
+	fd = fopen(tmp, "wb");
+	if(fd==NULL){
+		perror(tmp);
+		return -1;
+	}
+	ok = fwrite(c, sizeof(imu_cal_t), 1, fd)==1;
+	ok = fflush(fd)==0 && ok;
+	ok = fsync(fileno(fd))==0 && ok;
+	ok = fclose(fd)==0 && ok;
+	if(!ok || rename(tmp, path)){
+		perror(path);
+		unlink(tmp);
+		return -1;
+	}
+	return 0;
+}
+
+int imu_cal_window_init(imu_cal_window_t* w, int len, float still_sd){
+	if(len<2 || still_sd<=0){
+		fprintf(stderr,"ERROR: IMU calibration window needs len > 1 and still_sd > 0\n");
+		return -1;
+	}
+	w->len = len;
+	w->still_sd = still_sd;
+	imu_cal_window_reset(w);
+	return 0;
+}
+
+void imu_cal_window_reset(imu_cal_window_t* w){
+	memset(w->sum, 0, sizeof(w->sum));
+	memset(w->sum2, 0, sizeof(w->sum2));
+	w->n = 0;
+}
+
+/*******************************************************************************
+* int imu_cal_window_add(imu_cal_window_t* w, const float gyro[3],
+*							float mean[3])
+*
+* The window is judged once it is full and starts over either way.
+*******************************************************************************/
+int imu_cal_window_add(imu_cal_window_t* w, const float gyro[3], float mean[3]){
+	double m, var, lim;
+	int i, still=1;
+
+	for(i=0;i<3;i++){
+		w->sum[i] += gyro[i];
+		w->sum2[i] += (double)gyro[i]*gyro[i];
+	}
+	if(++w->n<w->len) return 0;
+
+	lim = (double)w->still_sd*w->still_sd;
+	for(i=0;i<3;i++){
+		m = w->sum[i]/w->n;
+		var = w->sum2[i]/w->n - m*m;
+		if(var>lim) still = 0;
+		mean[i] = m;
+	}
+	imu_cal_window_reset(w);
+	return still;
+}
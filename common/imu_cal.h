@@ -0,0 +1,92 @@
+/*******************************************************************************
+* imu_cal.h
+*
+* IMU calibration kept between runs: residual gyro bias and the mount
+* angle, in a small versioned binary file. A program loads it before the
+* IMU starts and subtracts the bias from every sample with imu_cal_apply(),
+* so the values are right from the first tick instead of being measured
+* again on every launch.
+*
+* There are no accelerometer offsets. The robot only ever lies still at
+* whatever tilt it rests at, and one pose can't tell an offset from tilt.
+* What the offsets would do to the body angle the mount angle takes up.
+*
+* Loading only checks the header, the sizes, the checksum and that every
+* value is in a plausible range. Whether the gyro bias still holds is
+* checked later, on the first window of samples taken while the robot lies
+* still (imu_cal_window_add()), and the file is rewritten when it didn't.
+* balance also tracks the bias and mount angle while it balances and saves
+* them when they moved.
+*
+* The cape library's own calibration (rc_calibrate_gyro) is applied by the
+* library before any of this, the bias here is what's left after it.
+*******************************************************************************/
+
+#ifndef IMU_CAL_H
+#define IMU_CAL_H
+
+#include <stdint.h>
+
+#define IMU_CAL_FILE		"/var/lib/balance/imu_cal.bin"
+#define IMU_CAL_MAGIC		0x4c41434d	// "MCAL" little endian
+#define IMU_CAL_VERSION		2
+#define IMU_CAL_MAX_GYRO	10.0	// deg/s, a larger bias means a bad file
+#define IMU_CAL_MAX_MOUNT	1.0	// rad
+
+// flags, which values were measured rather than left at their default
+#define IMU_CAL_GYRO		0x1
+#define IMU_CAL_MOUNT		0x2
+
+/*******************************************************************************
+* imu_cal_t
+*
+* Also the file layout, written as is. 44 bytes and 4 of padding after crc
+* that nothing reads.
+*******************************************************************************/
+typedef struct imu_cal_t{
+	uint32_t magic;
+	uint32_t version;
+	uint32_t size;			// sizeof(imu_cal_t) when written
+	uint32_t flags;
+	int64_t saved;			// unix time of the last save
+	float gyro_bias[3];		// deg/s, subtracted from rc_imu_data_t.gyro
+	float mount_angle;		// rad, added to the estimated body angle
+	uint32_t crc;			// crc32 of everything above
+}imu_cal_t;
+
+/*******************************************************************************
+* imu_cal_window_t
+*
+* Running sums over a window of gyro samples. A window whose spread stays
+* under still_sd on every axis gives the gyro's mean while still.
+*******************************************************************************/
+typedef struct imu_cal_window_t{
+	double sum[3], sum2[3];
+	int n, len;
+	float still_sd;			// deg/s
+}imu_cal_window_t;
+
+// zero bias and the given mount angle, nothing measured
+void imu_cal_default(imu_cal_t* c, float mount_angle);
+// 0 and c filled from a valid file, -1 and c untouched otherwise
+int imu_cal_load(const char* path, imu_cal_t* c);
+// fills in the header and checksum, replaces the file in one rename
+int imu_cal_save(const char* path, imu_cal_t* c);
+
+// len samples per window, still_sd the largest spread that counts as still
+int imu_cal_window_init(imu_cal_window_t* w, int len, float still_sd);
+void imu_cal_window_reset(imu_cal_window_t* w);
+// 1 with the window's mean in mean[] after a still window, 0 otherwise
+int imu_cal_window_add(imu_cal_window_t* w, const float gyro[3], float mean[3]);
+
+/*******************************************************************************
+* static inline void imu_cal_apply(const imu_cal_t* c, float gyro[3])
+*
+* corrects one gyro sample in place, three subtractions
+*******************************************************************************/
+static inline void imu_cal_apply(const imu_cal_t* c, float gyro[3]){
+	int i;
+	for(i=0;i<3;i++) gyro[i] -= c->gyro_bias[i];
+}
+
+#endif	//IMU_CAL_H
@@ -0,0 +1,281 @@
+/*******************************************************************************
+* input_event.c
+*
+* Edge handling, the press state machine and the command queue behind
+* input_event.h. The state machine runs under one mutex, from the button
+* callbacks and from the timer thread, so the queue has a single producer
+* and needs nothing more than its two indices.
+*******************************************************************************/
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <sys/timerfd.h>
+#include <roboticscape.h>
+#include "input_event.h"
+
+#define INPUT_MASK	(INPUT_QUEUE-1)
+
+#if INPUT_QUEUE & INPUT_MASK
+#error "INPUT_QUEUE must be a power of two"
+#endif
+
+typedef struct button_t{
+	int raw;		// last edge reported
+	uint64_t raw_ns;
+	int level;		// debounced
+	uint64_t edge_ns;	// last debounced edge
+	uint64_t settle_ns;	// end of the debounce window with an edge in it, 0 none
+	uint64_t long_ns;	// long press deadline while held, 0 none
+}button_t;
+
+static button_t buttons[INPUT_BUTTONS];
+static input_cmd_type_t bindings[INPUT_BUTTONS][INPUT_PRESSES];
+static uint64_t debounce_ns, long_press_ns;
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_t timer_thread_id;
+static int timer_fd=-1;
+static int running=0;
+
+static input_cmd_t queue[INPUT_QUEUE];
+static _Atomic uint32_t q_head=0;	// written by the producer, under lock
+static _Atomic uint32_t q_tail=0;	// written by input_poll()
+static unsigned long dropped=0;
+
+static uint64_t now_ns(){
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec*1000000000ULL + ts.tv_nsec;
+}
+
+// under lock, the one producer
+static void emit(input_button_t b, input_press_t p, uint64_t t_ns){
+	uint32_t h = atomic_load_explicit(&q_head, memory_order_relaxed);
+	input_cmd_t* c;
+
+	if(bindings[b][p]==INPUT_CMD_NONE) return;
+	if(h-atomic_load_explicit(&q_tail, memory_order_acquire)>=INPUT_QUEUE){
+		dropped++;
+		return;
+	}
+	c = &queue[h & INPUT_MASK];
+	c->type = bindings[b][p];
+	c->button = b;
+	c->press = p;
+	c->t_ns = t_ns;
+	atomic_store_explicit(&q_head, h+1, memory_order_release);
+}
+
+// under lock, a debounced edge
+static void accept(input_button_t b, int level, uint64_t t_ns){
+	button_t* s = &buttons[b];
+
+	if(level==s->level) return;
+	s->level = level;
+	s->edge_ns = t_ns;
+	if(level){
+		s->long_ns = t_ns+long_press_ns;
+		return;
+	}
+	// released, short unless the long press already went out
+	if(s->long_ns) emit(b, INPUT_SHORT, t_ns);
+	s->long_ns = 0;
+}
+
+// under lock, the timer to the earliest deadline or off
+static void rearm(){
+	struct itimerspec spec;
+	uint64_t next=0;
+	int i;
+
+	for(i=0;i<INPUT_BUTTONS;i++){
+		if(buttons[i].settle_ns && (!next || buttons[i].settle_ns<next)) next = buttons[i].settle_ns;
+		if(buttons[i].long_ns && (!next || buttons[i].long_ns<next)) next = buttons[i].long_ns;
+	}
+	memset(&spec, 0, sizeof(spec));
+	spec.it_value.tv_sec = next/1000000000ULL;
+	spec.it_value.tv_nsec = next%1000000000ULL;
+	timerfd_settime(timer_fd, TFD_TIMER_ABSTIME, &spec, NULL);
+}
+
+/*******************************************************************************
+* static void* timer_thread(void* ptr)
+*
+* Sleeps in read() until the earliest deadline. Debounce windows that end
+* with the button in the other state take the edge they hid, long press
+* deadlines still held report the long press.
+*******************************************************************************/
+static void* timer_thread(void* ptr){
+	uint64_t expirations, now;
+	button_t* s;
+	int i;
+
+	while(1){
+		if(read(timer_fd, &expirations, sizeof(expirations))!=sizeof(expirations)) continue;
+		pthread_mutex_lock(&lock);
+		if(!running){
+			pthread_mutex_unlock(&lock);
+			return NULL;
+		}
+		now = now_ns();
+		for(i=0;i<INPUT_BUTTONS;i++){
+			s = &buttons[i];
+			if(s->settle_ns && now>=s->settle_ns){
+				s->settle_ns = 0;
+				accept(i, s->raw, s->raw_ns);
+			}
+			if(s->long_ns && now>=s->long_ns){
+				emit(i, INPUT_LONG, s->long_ns);
+				s->long_ns = 0;
+			}
+		}
+		rearm();
+		pthread_mutex_unlock(&lock);
+	}
+	return NULL;
+}
+
+/*******************************************************************************
+* int input_init(int debounce_ms, int long_ms)
+*******************************************************************************/
+int input_init(int debounce_ms, int long_ms){
+	if(running) return 0;
+	if(debounce_ms<0 || long_ms<=debounce_ms){
+		fprintf(stderr,"ERROR: input needs 0 <= debounce < long press\n");
+		return -1;
+	}
+	memset(buttons, 0, sizeof(buttons));
+	memset(bindings, 0, sizeof(bindings));
+	debounce_ns = debounce_ms*1000000ULL;
+	long_press_ns = long_ms*1000000ULL;
+	timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC);
+	if(timer_fd<0){
+		perror("timerfd_create");
+		return -1;
+	}
+	running = 1;
+	if(pthread_create(&timer_thread_id, NULL, timer_thread, NULL)){
+		perror("input timer thread");
+		running = 0;
+		close(timer_fd);
+		timer_fd = -1;
+		return -1;
+	}
+	return 0;
+}
+
+int input_bind(input_button_t b, input_press_t p, input_cmd_type_t cmd){
+	if(b<0 || b>=INPUT_BUTTONS || p<0 || p>=INPUT_PRESSES){
+		fprintf(stderr,"ERROR: no button %d press %d to bind\n", b, p);
+		return -1;
+	}
+	pthread_mutex_lock(&lock);
+	bindings[b][p] = cmd;
+	pthread_mutex_unlock(&lock);
+	return 0;
+}
+
+static void on_pause_pressed(){ input_edge(INPUT_PAUSE, 1); }
+static void on_pause_released(){ input_edge(INPUT_PAUSE, 0); }
+static void on_mode_pressed(){ input_edge(INPUT_MODE, 1); }
+static void on_mode_released(){ input_edge(INPUT_MODE, 0); }
+
+int input_attach(){
+	if(!running){
+		fprintf(stderr,"ERROR: input_attach() needs input_init()\n");
+		return -1;
+	}
+	if(rc_set_pause_pressed_func(&on_pause_pressed) ||
+	   rc_set_pause_released_func(&on_pause_released) ||
+	   rc_set_mode_pressed_func(&on_mode_pressed) ||
+	   rc_set_mode_released_func(&on_mode_released)){
+		fprintf(stderr,"ERROR: can't set the button callbacks\n");
+		return -1;
+	}
+	return 0;
+}
+
+/*******************************************************************************
+* void input_edge(input_button_t b, int pressed)
+*
+* The time is taken before the lock so a contended edge keeps its own.
+*******************************************************************************/
+void input_edge(input_button_t b, int pressed){
+	uint64_t t = now_ns();
+	button_t* s;
+
+	if(b<0 || b>=INPUT_BUTTONS) return;
+	pthread_mutex_lock(&lock);
+	if(!running){
+		pthread_mutex_unlock(&lock);
+		return;
+	}
+	s = &buttons[b];
+	s->raw = pressed!=0;
+	s->raw_ns = t;
+	if(s->edge_ns && t-s->edge_ns<debounce_ns){
+		s->settle_ns = s->edge_ns+debounce_ns;
+	}
+	else{
+		s->settle_ns = 0;
+		accept(b, s->raw, t);
+	}
+	rearm();
+	pthread_mutex_unlock(&lock);
+}
+
+int input_poll(input_cmd_t* out){
+	uint32_t t = atomic_load_explicit(&q_tail, memory_order_relaxed);
+
+	if(t==atomic_load_explicit(&q_head, memory_order_acquire)) return 0;
+	*out = queue[t & INPUT_MASK];
+	atomic_store_explicit(&q_tail, t+1, memory_order_release);
+	return 1;
+}
+
+int input_apply_state(const input_cmd_t* c){
+	switch(c->type){
+	case INPUT_CMD_PAUSE:
+		if(rc_get_state()==RUNNING) rc_set_state(PAUSED);
+		else if(rc_get_state()==PAUSED) rc_set_state(RUNNING);
+		return 0;
+	case INPUT_CMD_EXIT:
+		printf("exit command, shutting down\n");
+		rc_set_state(EXITING);
+		return 0;
+	default:
+		return -1;
+	}
+}
+
+unsigned long input_dropped(){
+	unsigned long n;
+
+	pthread_mutex_lock(&lock);
+	n = dropped;
+	pthread_mutex_unlock(&lock);
+	return n;
+}
+
+void input_cleanup(){
+	struct itimerspec spec;
+
+	pthread_mutex_lock(&lock);
+	if(!running){
+		pthread_mutex_unlock(&lock);
+		return;
+	}
+	running = 0;
+	// any time in the past wakes the thread at once
+	memset(&spec, 0, sizeof(spec));
+	spec.it_value.tv_nsec = 1;
+	timerfd_settime(timer_fd, TFD_TIMER_ABSTIME, &spec, NULL);
+	pthread_mutex_unlock(&lock);
+	pthread_join(timer_thread_id, NULL);
+	close(timer_fd);
+	timer_fd = -1;
+}
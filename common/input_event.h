@@ -0,0 +1,76 @@
+/*******************************************************************************
+* input_event.h
+*
+* Pause and mode buttons turned into commands. The cape library's button
+* callbacks only hand the edge over: it is timestamped on arrival, debounced
+* and fed to a per button state machine. A press released before long_ms is
+* a short press, one still held at long_ms is a long press, reported right
+* then without waiting for the release. Bounces and long press deadlines
+* share one timer thread that sleeps until the earliest of them, nothing
+* polls the buttons.
+*
+* Debouncing keeps the first edge and ignores the button for debounce_ms
+* after it. If the button ended up in the other state by then, that edge is
+* taken at the time it arrived, so a tap shorter than the window still
+* counts.
+*
+* Each press type is bound to a command. Commands go into a fixed size
+* single consumer queue, the program takes them with input_poll() at a tick
+* boundary of its own loop, so a mode change never lands in the middle of a
+* control step. input_poll() takes no lock and never blocks.
+*******************************************************************************/
+
+#ifndef INPUT_EVENT_H
+#define INPUT_EVENT_H
+
+#include <stdint.h>
+
+#define INPUT_QUEUE		16	// commands, power of two
+#define INPUT_DEBOUNCE_MS	20
+#define INPUT_LONG_MS		2000	// held this long is a long press
+
+typedef enum input_button_t{
+	INPUT_PAUSE,
+	INPUT_MODE,
+	INPUT_BUTTONS
+}input_button_t;
+
+typedef enum input_press_t{
+	INPUT_SHORT,
+	INPUT_LONG,
+	INPUT_PRESSES
+}input_press_t;
+
+typedef enum input_cmd_type_t{
+	INPUT_CMD_NONE,		// press not bound to anything
+	INPUT_CMD_PAUSE,	// toggle between RUNNING and PAUSED
+	INPUT_CMD_EXIT,
+	INPUT_CMD_GAIN_SET,	// next gain set
+	INPUT_CMD_LOG		// flight log on or off
+}input_cmd_type_t;
+
+typedef struct input_cmd_t{
+	input_cmd_type_t type;
+	input_button_t button;
+	input_press_t press;
+	uint64_t t_ns;		// CLOCK_MONOTONIC, the press edge or when it became long
+}input_cmd_t;
+
+// debounce and long press times in ms, starts the timer thread
+int input_init(int debounce_ms, int long_ms);
+// bind before input_attach(), every press starts out INPUT_CMD_NONE
+int input_bind(input_button_t b, input_press_t p, input_cmd_type_t cmd);
+// sets the cape's pause and mode button callbacks, after rc_initialize()
+int input_attach();
+// from a button callback or anything else that sees an edge
+void input_edge(input_button_t b, int pressed);
+// next command into out, 1 if there was one. From one thread only.
+int input_poll(input_cmd_t* out);
+// INPUT_CMD_PAUSE and _EXIT as rc_set_state(), -1 for anything else
+int input_apply_state(const input_cmd_t* c);
+// commands dropped because the queue was full
+unsigned long input_dropped();
+// stop the timer thread, after rc_cleanup() so no callback comes in late
+void input_cleanup();
+
+#endif	//INPUT_EVENT_H
@@ -0,0 +1,107 @@
+/*******************************************************************************
+* motor_output.c
+*
+* Table fill and the per tick update behind motor_output.h
+*******************************************************************************/
+
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <roboticscape.h>
+#include "motor_output.h"
+
+/*******************************************************************************
+* int motor_output_init(motor_output_t* m, float slew_rate, float hz)
+*******************************************************************************/
+int motor_output_init(motor_output_t* m, float slew_rate, float hz){
+	if(slew_rate<0 || hz<=0){
+		fprintf(stderr,"ERROR: motor output needs slew_rate >= 0 and hz > 0\n");
+		return -1;
+	}
+	memset(m, 0, sizeof(motor_output_t));
+	m->channel[MOTOR_OUTPUT_L] = -1;
+	m->channel[MOTOR_OUTPUT_R] = -1;
+	m->slew = slew_rate>0 ? (int)ceilf(slew_rate/hz*MOTOR_OUTPUT_STEPS) : 0;
+	motor_output_reset(m);
+	return 0;
+}
+
+/*******************************************************************************
+* int motor_output_add(motor_output_t* m, int side, int channel, int polarity,
+*							float deadband)
+*
+* Past MOTOR_COMP_BAND a command u becomes deadband+(1-deadband)*|u| with
+* the sign of u, so the useful range of the motor maps onto all of 0 to 1.
+* Below it the output ramps linearly from 0 instead of stepping to the
+* deadband, which would chatter the wheels around zero.
+*******************************************************************************/
+int motor_output_add(motor_output_t* m, int side, int channel, int polarity,\
+							float deadband){
+	float u, a, c;
+	long q;
+	int i;
+
+	if(side!=MOTOR_OUTPUT_L && side!=MOTOR_OUTPUT_R){
+		fprintf(stderr,"ERROR: motor output side must be MOTOR_OUTPUT_L or _R\n");
+		return -1;
+	}
+	if(channel<1 || (polarity!=1 && polarity!=-1) || deadband<0 || deadband>=1){
+		fprintf(stderr,"ERROR: bad motor channel %d polarity %d deadband %f\n",\
+			channel, polarity, deadband);
+		return -1;
+	}
+	for(i=0;i<MOTOR_TABLE_N;i++){
+		u = (i-MOTOR_TABLE_HALF)/(float)MOTOR_TABLE_HALF;
+		a = fabsf(u);
+		if(a<MOTOR_COMP_BAND) c = a*(deadband+(1-deadband)*MOTOR_COMP_BAND)/MOTOR_COMP_BAND;
+		else c = deadband + (1-deadband)*a;
+		q = lrintf((u<0 ? -c : c)*polarity*MOTOR_OUTPUT_STEPS);
+		if(q>MOTOR_OUTPUT_STEPS) q = MOTOR_OUTPUT_STEPS;
+		if(q<-MOTOR_OUTPUT_STEPS) q = -MOTOR_OUTPUT_STEPS;
+		m->table[side][i] = q;
+	}
+	m->channel[side] = channel;
+	return 0;
+}
+
+/*******************************************************************************
+* void motor_output_set(motor_output_t* m, float duty_l, float duty_r)
+*
+* Everything is worked out for both motors before either is written.
+*******************************************************************************/
+void motor_output_set(motor_output_t* m, float duty_l, float duty_r){
+	const float duty[2] = {duty_l, duty_r};
+	int32_t q, d;
+	float x;
+	int s;
+
+	for(s=0;s<2;s++){
+		x = duty[s]*MOTOR_TABLE_HALF;
+		if(!(x>-MOTOR_TABLE_HALF)) x = x==x ? -MOTOR_TABLE_HALF : 0;	// NaN stops
+		if(x>MOTOR_TABLE_HALF) x = MOTOR_TABLE_HALF;
+		q = m->table[s][lrintf(x)+MOTOR_TABLE_HALF];
+		if(m->slew){
+			d = q - m->cmd[s];
+			if(d>m->slew) q = m->cmd[s] + m->slew;
+			else if(d<-m->slew) q = m->cmd[s] - m->slew;
+		}
+		m->cmd[s] = q;
+	}
+	for(s=0;s<2;s++){
+		if(m->channel[s]<1 || m->cmd[s]==m->written[s]) continue;
+		rc_set_motor(m->channel[s], m->cmd[s]*(1.0f/MOTOR_OUTPUT_STEPS));
+		m->written[s] = m->cmd[s];
+		m->writes++;
+	}
+	m->updates++;
+}
+
+/*******************************************************************************
+* void motor_output_reset(motor_output_t* m)
+*******************************************************************************/
+void motor_output_reset(motor_output_t* m){
+	m->cmd[MOTOR_OUTPUT_L] = 0;
+	m->cmd[MOTOR_OUTPUT_R] = 0;
+	m->written[MOTOR_OUTPUT_L] = MOTOR_OUTPUT_UNKNOWN;
+	m->written[MOTOR_OUTPUT_R] = MOTOR_OUTPUT_UNKNOWN;
+}
@@ -0,0 +1,48 @@
+/*******************************************************************************
+* motor_output.h
+*
+* Output stage for a pair of motors. Both duties are handed over in one
+* call, go through a per motor table that folds in polarity, deadband
+* compensation and the PWM resolution, are slew limited in PWM counts and
+* only then written, back to back. A motor whose count didn't change isn't
+* written at all, so a steady command costs no driver calls and the two
+* writes that are left sit as close together as the cape library allows.
+*
+* The table is filled once by motor_output_add(), a tick is two table
+* reads, two clamps and zero to two rc_set_motor() calls.
+*******************************************************************************/
+
+#ifndef MOTOR_OUTPUT_H
+#define MOTOR_OUTPUT_H
+
+#include <stdint.h>
+
+#define MOTOR_OUTPUT_L		0
+#define MOTOR_OUTPUT_R		1
+#define MOTOR_OUTPUT_STEPS	4000	// PWM counts per period, 100MHz TBCLK at 25kHz
+#define MOTOR_TABLE_HALF	1024	// table entries per unit of duty
+#define MOTOR_TABLE_N		(2*MOTOR_TABLE_HALF+1)
+#define MOTOR_COMP_BAND		0.02	// duty over which the deadband step is ramped in
+#define MOTOR_OUTPUT_UNKNOWN	INT32_MIN	// hardware state not known, write next time
+
+typedef struct motor_output_t{
+	int channel[2];			// cape channel, <1 unused
+	int slew;			// max PWM counts per update, 0 no limit
+	int32_t cmd[2];			// last command after the slew limit
+	int32_t written[2];		// last count sent to the driver
+	unsigned long updates;		// motor_output_set() calls
+	unsigned long writes;		// rc_set_motor() calls they made
+	int16_t table[2][MOTOR_TABLE_N];	// duty to signed PWM counts
+}motor_output_t;
+
+// slew_rate in duty per second at hz updates, 0 for no limit
+int motor_output_init(motor_output_t* m, float slew_rate, float hz);
+// side is MOTOR_OUTPUT_L or _R, deadband the duty the wheel starts to turn at
+int motor_output_add(motor_output_t* m, int side, int channel, int polarity,\
+							float deadband);
+// new duties for both motors, -1 to 1 before compensation
+void motor_output_set(motor_output_t* m, float duty_l, float duty_r);
+// after anything else touched the motors, next set starts from 0 and writes
+void motor_output_reset(motor_output_t* m);
+
+#endif	//MOTOR_OUTPUT_H
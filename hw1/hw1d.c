@@ -1,22 +1,60 @@
 /*******************************************************************************
-* rc_project_template.c
+* hw1d.c
 *
-* This is meant to be a skeleton program for robotics cape projects. 
-* Change this description and file name 
+* Wheel synchronization. Both wheels are driven toward each other with a
+* proportional gain on their angle difference, so turning one by hand drags
+* the other along and the two end up at the same angle.
+*
+* The control loop runs on absolute CLOCK_MONOTONIC deadlines with
+* clock_nanosleep(), so the time spent reading encoders, writing motors or
+* being preempted never stretches the period. How late every wakeup was is
+* kept over the last second and printed from a separate thread.
+*
+*	hw1d K [hz]		gain in duty per rad, loop rate (default 100)
 *******************************************************************************/
 
 // usefulincludes is a collection of common system includes for the lazy
 // This is not necessary for roboticscape projects but here for convenience
-#include <rc_usefulincludes.h> 
+#include <rc_usefulincludes.h>
 // main roboticscape API header
 #include <roboticscape.h>
+#include <sys/mman.h>
+#include "../common/motor_output.h"
+#include "../common/input_event.h"
 
+#define DEFAULT_HZ		100
+#define COUNTS_PER_REV		(35.57*60)	// gearbox times encoder counts
+#define ENCODER_CHANNEL_L	2
+#define ENCODER_CHANNEL_R	3
+#define ENCODER_POLARITY_L	1
+#define ENCODER_POLARITY_R	-1
+#define MOTOR_CHANNEL_L		2
+#define MOTOR_CHANNEL_R		3
+#define MOTOR_POLARITY_L	1
+#define MOTOR_POLARITY_R	-1
+#define LOOP_PRIORITY		50	// SCHED_FIFO, above the cape's own threads
+#define PRINT_HZ		2
+#define STATS_WINDOW_S		1	// seconds of periods the statistics cover
+#define MAX_WINDOW		4000
+
+/*******************************************************************************
+* period_stats_t
+*
+* Wakeup lateness of the last n periods in a ring, with running sums so the
+* mean and standard deviation don't need a pass over the window.
+*******************************************************************************/
+typedef struct period_stats_t{
+	int64_t late_ns[MAX_WINDOW];
+	int size, head, n;
+	double sum, sum2;
+	uint64_t periods;
+	uint64_t missed;	// deadlines passed before the loop got to them
+	int64_t worst_ns;	// since start
+}period_stats_t;
 
 // function declarations
-void on_pause_pressed();
-void on_pause_released();
-struct Thetas get_encoder_pos();
-void P_control(struct Thetas theta, float K);
+void* print_data(void* ptr);
+
 // global variable declarations
 struct Thetas{
 		float thetaL;
@@ -25,8 +63,66 @@ struct Thetas{
 
 struct Thetas Mip;
 float K;
+float dutyL, dutyR;
+motor_output_t motors;
+period_stats_t stats;
+pthread_mutex_t stats_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static void timespec_add_ns(struct timespec* t, long ns){
+	t->tv_nsec += ns;
+	while(t->tv_nsec>=1000000000L){
+		t->tv_nsec -= 1000000000L;
+		t->tv_sec++;
+	}
+}
+
+static int64_t timespec_diff_ns(const struct timespec* a, const struct timespec* b){
+	return (int64_t)(a->tv_sec-b->tv_sec)*1000000000LL + (a->tv_nsec-b->tv_nsec);
+}
+
 /*******************************************************************************
-* int main() 
+* static void stats_add(period_stats_t* s, int64_t late)
+*******************************************************************************/
+static void stats_add(period_stats_t* s, int64_t late){
+	if(s->n==s->size){
+		s->sum -= s->late_ns[s->head];
+		s->sum2 -= (double)s->late_ns[s->head]*s->late_ns[s->head];
+	}
+	else s->n++;
+	s->late_ns[s->head] = late;
+	s->sum += late;
+	s->sum2 += (double)late*late;
+	s->head = (s->head+1)%s->size;
+	s->periods++;
+	if(late>s->worst_ns) s->worst_ns = late;
+}
+
+/*******************************************************************************
+* void get_encoder_pos(struct Thetas* theta)
+*
+* both encoders read back to back, then converted to wheel radians
+*******************************************************************************/
+void get_encoder_pos(struct Thetas* theta){
+	int pL = rc_get_encoder_pos(ENCODER_CHANNEL_L);
+	int pR = rc_get_encoder_pos(ENCODER_CHANNEL_R);
+	theta->thetaL = ENCODER_POLARITY_L*TWO_PI*pL/COUNTS_PER_REV;
+	theta->thetaR = ENCODER_POLARITY_R*TWO_PI*pR/COUNTS_PER_REV;
+}
+
+/*******************************************************************************
+* void P_control(struct Thetas theta, float K)
+*
+* each wheel is pushed toward the other one, both motors in one update
+*******************************************************************************/
+void P_control(struct Thetas theta, float K){
+	float e = theta.thetaR-theta.thetaL;
+	dutyL = K*e;
+	dutyR = -K*e;
+	motor_output_set(&motors,dutyL,dutyR);
+}
+
+/*******************************************************************************
+* int main()
 *
 * This template main function contains these critical components
 * - call to rc_initialize() at the beginning
@@ -34,118 +130,133 @@ float K;
 * - rc_cleanup() at the end
 *******************************************************************************/
 int main(int argc,char *argv[]){
-	
+	struct sched_param param;
+	struct timespec deadline, now;
+	pthread_t print_thread;
+	input_cmd_t cmd;
+	int64_t late;
+	long period_ns;
+	int hz=DEFAULT_HZ;
+
+	if(argc<2 || argc>3){
+		printf("\nUsage: hw1d K [hz]\n");
+		printf("K     gain in duty per rad of difference between the wheels\n");
+		printf("hz    control loop rate (default %d)\n\n", DEFAULT_HZ);
+		return -1;
+	}
+	K=atof(argv[1]);
+	if(argc==3) hz=atoi(argv[2]);
+	if(hz<1 || hz*STATS_WINDOW_S>MAX_WINDOW){
+		fprintf(stderr,"ERROR: loop rate must be between 1 and %d hz\n",\
+			MAX_WINDOW/STATS_WINDOW_S);
+		return -1;
+	}
+	period_ns = 1000000000L/hz;
+	stats.size = hz*STATS_WINDOW_S;
+
 	// always initialize cape library first
 	if(rc_initialize()){
 		fprintf(stderr,"ERROR: failed to initialize rc_initialize(), are you root?\n");
 		return -1;
 	}
-	
+
 	// do your own initialization here
 	printf("\nHello BeagleBone\n");
-	rc_set_pause_pressed_func(&on_pause_pressed);
-	rc_set_pause_released_func(&on_pause_released);
-	//including command line arguments to input K and other values
-	if(argc==2){ 			//argc should be 2 for proportion 	
-		K=atof(argv[1]);
-		printf("K is %s\n",argv[1]);
-		//set_point=atof(argv[2]);
-		//printf("Set point is %s\n",argv[2]);
-		rc_set_state(RUNNING); 
+	printf("K is %f, loop at %dhz\n",K,hz);
+	// pause toggles, held for two seconds stops, see common/input_event.h
+	if(input_init(INPUT_DEBOUNCE_MS,INPUT_LONG_MS) ||
+	   input_bind(INPUT_PAUSE,INPUT_SHORT,INPUT_CMD_PAUSE) ||
+	   input_bind(INPUT_PAUSE,INPUT_LONG,INPUT_CMD_EXIT) || input_attach())
+		fprintf(stderr,"WARNING: pause button won't work, stop with ctrl-c\n");
+	if(motor_output_init(&motors,0,hz) ||
+	   motor_output_add(&motors,MOTOR_OUTPUT_L,MOTOR_CHANNEL_L,MOTOR_POLARITY_L,0) ||
+	   motor_output_add(&motors,MOTOR_OUTPUT_R,MOTOR_CHANNEL_R,MOTOR_POLARITY_R,0)){
+		rc_cleanup();
+		return -1;
 	}
-	else if(argc>2){
-		printf("Too many arguments.\n");
-		rc_set_state(EXITING);
+
+	// started first so it stays at normal priority
+	if(pthread_create(&print_thread,NULL,print_data,NULL)){
+		fprintf(stderr,"ERROR: failed to start print thread\n");
+		rc_cleanup();
+		return -1;
 	}
-	else {
-		printf("Two arguments expected K &Setpoint \n");
-		rc_set_state(EXITING);
+	// no page faults and nothing but the kernel ahead of the control loop
+	if(mlockall(MCL_CURRENT|MCL_FUTURE)) perror("WARNING: mlockall");
+	param.sched_priority = LOOP_PRIORITY;
+	if(pthread_setschedparam(pthread_self(), SCHED_FIFO, &param)){
+		fprintf(stderr,"WARNING: can't run the loop SCHED_FIFO, timing will suffer\n");
 	}
-	usleep(1000000);
+
+	rc_enable_motors();
+	rc_set_state(RUNNING);
+	clock_gettime(CLOCK_MONOTONIC, &deadline);
 
 	// Keep looping until state changes to EXITING
 	while(rc_get_state()!=EXITING){
+		timespec_add_ns(&deadline, period_ns);
+		clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &deadline, NULL);
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		late = timespec_diff_ns(&now, &deadline);
+		// button commands between periods, the state below is the new one
+		while(input_poll(&cmd)) input_apply_state(&cmd);
+
 		// handle other states
 		if(rc_get_state()==RUNNING){
-			// do things
-			rc_set_led(GREEN, ON);
-			rc_set_led(RED, OFF);
-			Mip=get_encoder_pos(Mip);
-			printf("Left %f Right %f  \n",Mip.thetaL,Mip.thetaR);
+			get_encoder_pos(&Mip);
 			P_control(Mip,K);
-				}
+		}
 		else if(rc_get_state()==PAUSED){
-			// do other things
-			rc_set_led(GREEN, OFF);
-			rc_set_led(RED, ON);
+			motor_output_set(&motors,0,0);
 		}
-		// always sleep at some point
-		usleep(10000);
+
+		pthread_mutex_lock(&stats_lock);
+		stats_add(&stats, late);
+		// a whole period or more behind, skip to the next deadline ahead
+		while(late>=period_ns){
+			timespec_add_ns(&deadline, period_ns);
+			late -= period_ns;
+			stats.missed++;
+		}
+		pthread_mutex_unlock(&stats_lock);
 	}
-	
+
 	// exit cleanly
-	rc_cleanup(); 
+	rc_disable_motors();
+	pthread_join(print_thread,NULL);
+	printf("\n%llu periods, %llu missed, worst wakeup %.1fus late, "\
+		"%lu of %lu motor updates written\n", (unsigned long long)stats.periods,\
+		(unsigned long long)stats.missed, stats.worst_ns/1000.0,\
+		motors.writes, 2*motors.updates);
+	rc_cleanup();
+	input_cleanup();
 	return 0;
 }
 
-
-/*******************************************************************************
-* void on_pause_released() 
-*	
-* Make the Pause button toggle between paused and running states.
-*******************************************************************************/
-void on_pause_released(){
-	// toggle betewen paused and running modes
-	if(rc_get_state()==RUNNING)		rc_set_state(PAUSED);
-	else if(rc_get_state()==PAUSED)	rc_set_state(RUNNING);
-	return;
-}
-
 /*******************************************************************************
-* void on_pause_pressed() 
+* void* print_data(void* ptr)
 *
-* If the user holds the pause button for 2 seconds, set state to exiting which 
-* triggers the rest of the program to exit cleanly.
+* Wheel angles, duties and the wakeup lateness over the last STATS_WINDOW_S,
+* printed at PRINT_HZ so the control loop never waits on the terminal.
 *******************************************************************************/
-void on_pause_pressed(){
-	int i=0;
-	const int samples = 100;	// check for release 100 times in this period
-	const int us_wait = 2000000; // 2 seconds
-	
-	// now keep checking to see if the button is still held down
-	for(i=0;i<samples;i++){
-		rc_usleep(us_wait/samples);
-		if(rc_get_pause_button() == RELEASED) return;
-	}
-	printf("long press detected, shutting down\n");
-	rc_set_state(EXITING);
-	return;
-}
-
-/*
-*  Get encoder positions
-*  and convert to radians
-*/
-struct Thetas  get_encoder_pos(struct Thetas theta){
-	//declare variables
-	int p1;
-	int p2;
-	float one_rev=2*3.14159;
-	p1=rc_get_encoder_pos(2);
-	p2=rc_get_encoder_pos(3);
-	theta.thetaL=one_rev*p1/2134;
-	theta.thetaR=-one_rev*p2/2134;
-return theta;					
-}
+void* print_data(void* ptr){
+	double mean, sd;
+	int64_t max;
+	int i;
 
-void P_control(struct Thetas theta,float K){
-	float duty;
-	rc_enable_motors();
-	duty=K*(theta.thetaR-theta.thetaL);
-	printf("%f",duty);
-	rc_set_motor(2,duty);
+	printf("   Left  |  Right  |  dutyL |  dutyR | late mean   sd    max | missed\n");
+	while(rc_get_state()!=EXITING){
+		pthread_mutex_lock(&stats_lock);
+		mean = stats.n ? stats.sum/stats.n : 0;
+		sd = stats.n ? sqrt(fmax(stats.sum2/stats.n - mean*mean, 0)) : 0;
+		max = 0;
+		for(i=0;i<stats.n;i++) if(stats.late_ns[i]>max) max = stats.late_ns[i];
+		pthread_mutex_unlock(&stats_lock);
+		printf("\r %7.3f | %7.3f | %6.3f | %6.3f | %6.1fus %5.1f %6.1f | %6llu",\
+			Mip.thetaL, Mip.thetaR, dutyL, dutyR, mean/1000.0, sd/1000.0,\
+			max/1000.0, (unsigned long long)stats.missed);
+		fflush(stdout);
+		rc_usleep(1000000/PRINT_HZ);
+	}
+	return NULL;
 }
-
-
-
-
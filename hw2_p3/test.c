@@ -10,15 +10,14 @@
 #include <rc_usefulincludes.h> 
 // main roboticscape API header
 #include <roboticscape.h>
+#include "../common/comp_filter.h"
+#include "../common/imu_cal.h"
+#include "../common/input_event.h"
 #define SAMPLE_RATE 100
 #define TIME_CONSTANT 0.7
 #define FILENAME "plot.txt"
 
 
-// function declarations
-void on_pause_pressed();
-void on_pause_released();
-
 /*******************************************************************************
 * int main() 
 *
@@ -30,8 +29,11 @@ void on_pause_released();
 int main(){
 	//new data struct
 	rc_imu_data_t data;
-	//initializing euler integration
-	float theta_g_raw=0;
+	//complementary filter state
+	comp_filter_t comp;
+	//offsets balance measured and saved, zero without the file
+	imu_cal_t cal;
+	input_cmd_t cmd;
 	const float dt=1.0/SAMPLE_RATE;
 	const float w=1.0/TIME_CONSTANT;
 	//file to store plotting data
@@ -50,8 +52,11 @@ int main(){
 
 	// do your own initialization here
 	printf("\nHello BeagleBone\n");
-	rc_set_pause_pressed_func(&on_pause_pressed);
-	rc_set_pause_released_func(&on_pause_released);
+	// pause toggles, held for two seconds stops, see common/input_event.h
+	if(input_init(INPUT_DEBOUNCE_MS,INPUT_LONG_MS) ||
+	   input_bind(INPUT_PAUSE,INPUT_SHORT,INPUT_CMD_PAUSE) ||
+	   input_bind(INPUT_PAUSE,INPUT_LONG,INPUT_CMD_EXIT) || input_attach())
+		fprintf(stderr,"WARNING: pause button won't work, stop with ctrl-c\n");
 	printf("\nSample Rate: %dhz\n",SAMPLE_RATE);
 	printf("Time Constant: %5.2f\n",TIME_CONSTANT);
 
@@ -62,27 +67,12 @@ int main(){
 		fprintf(stderr,"rc_initialize_imu_failed\n");
 		return -1;
 	}
-	//setup ring buffers
-	rc_ringbuf_t accel_in_buf=rc_empty_ringbuf();
-	rc_ringbuf_t accel_out_buf=rc_empty_ringbuf();
-	rc_ringbuf_t gyro_in_buf=rc_empty_ringbuf();
-	rc_ringbuf_t gyro_out_buf=rc_empty_ringbuf();
-	if(rc_alloc_ringbuf(&accel_in_buf,5)<0){
-		printf("accel in ringbuf allocation failed\n");
-	}
-	if(rc_alloc_ringbuf(&accel_out_buf,5)<0){
-		printf("accel out ringbuf allocation failed\n");
-	}
-	if(rc_alloc_ringbuf(&gyro_in_buf,5)<0){
-		printf("gyro in ringbuf allocation failed\n");
-	}	
-	if(rc_alloc_ringbuf(&gyro_out_buf,5)<0){
-		printf("gyro out ringbuf allocation failed\n");
+	//setup filter
+	if(comp_filter_init(&comp,w,dt)){
+		return -1;
 	}
-	rc_reset_ringbuf(&accel_in_buf);
-	rc_reset_ringbuf(&accel_out_buf);
-	rc_reset_ringbuf(&gyro_in_buf);
-	rc_reset_ringbuf(&gyro_out_buf);
+	imu_cal_default(&cal,0);
+	if(imu_cal_load(IMU_CAL_FILE,&cal)==0) printf("gyro bias from %s\n",IMU_CAL_FILE);
 
 	//print headers
 	//printf(" Accel XYZ(m/s^2)   |");
@@ -99,6 +89,8 @@ int main(){
 
 	// Keep looping until state changes to EXITING
 	while(rc_get_state()!=EXITING){
+		// button commands between iterations
+		while(input_poll(&cmd)) input_apply_state(&cmd);
 		// handle other states
 		if(rc_get_state()==RUNNING){
 			// do things
@@ -121,34 +113,22 @@ int main(){
 			*				data.gyro[1]*DEG_TO_RAD,\
 			*				data.gyro[2]*DEG_TO_RAD);
 			*/
-			// calculate accel angle of Z over Y
-			float theta_a_raw=atan2(-data.accel[2],data.accel[1]);
-			// Euler integration of gyro data X 
-			theta_g_raw=theta_g_raw+data.gyro[0]*dt*DEG_TO_RAD;
-			printf("       %6.3f      |",theta_a_raw);
-			printf("    %6.3f    |",theta_g_raw);
-			rc_insert_new_ringbuf_value(&accel_in_buf,theta_a_raw);
-			rc_insert_new_ringbuf_value(&gyro_in_buf,theta_g_raw);
-			//float accel_in_old=rc_get_ringbuf_value(&accel_in_buf,1);
-			float accel_out_old=rc_get_ringbuf_value(&accel_out_buf,1);
-			float gyro_in_old=rc_get_ringbuf_value(&gyro_in_buf,1);
-			float gyro_out_old=rc_get_ringbuf_value(&gyro_out_buf,1);
-			
-			//LPF for accelerometer tf=(w*h)/(z+(w*h-1))
-			//float theta_a=w*dt*(accel_in_old-accel_out_old)+accel_out_old;
-			float theta_a=w*dt*(rc_get_ringbuf_value(&accel_in_buf,1)-accel_out_old)+accel_out_old;
-			//HPF for gyroscope tf= (z-1)/(z+(w*h-1))
-			float theta_g=theta_g_raw-gyro_in_old-(w*dt-1.0)*gyro_out_old;
-			//update buffer
-			rc_insert_new_ringbuf_value(&accel_out_buf,theta_a);
-			rc_insert_new_ringbuf_value(&gyro_out_buf,theta_g);
-			float theta_f=theta_a+theta_g;
+			imu_cal_apply(&cal,data.gyro);
+			//LPF for accelerometer, HPF for gyroscope
+			float theta_f=comp_filter_step(&comp,data.accel[1],data.accel[2],\
+							data.gyro[0]);
+			float theta_a=comp.theta_a;
+			float theta_g=comp.theta_g;
+			printf("       %6.3f      |",comp.last_a_raw);
+			printf("    %6.3f    |",comp.theta_g_raw);
 			//print filtered values
 			printf("  %6.3f  |",theta_a);
 			printf("  %6.3f  |",theta_g);
 			printf("  %6.3f  |",theta_f);
-			//log plotting data
-			fprintf(f,"%6.3f %6.3f %6.3f\n",theta_a,theta_g,theta_f);
+			//log plotting data, raw accel Y Z and gyro X after it
+			//so ../balance/reprocess can run the log through other filters
+			fprintf(f,"%6.3f %6.3f %6.3f %7.4f %7.4f %8.3f\n",theta_a,theta_g,\
+					theta_f,data.accel[1],data.accel[2],data.gyro[0]);
 
 
 		}
@@ -166,40 +146,7 @@ int main(){
 	fclose(f);
 	rc_power_off_imu();
 	rc_cleanup(); 
+	input_cleanup();
 	return 0;
 }
 
-
-/*******************************************************************************
-* void on_pause_released() 
-*	
-* Make the Pause button toggle between paused and running states.
-*******************************************************************************/
-void on_pause_released(){
-	// toggle betewen paused and running modes
-	if(rc_get_state()==RUNNING)		rc_set_state(PAUSED);
-	else if(rc_get_state()==PAUSED)	rc_set_state(RUNNING);
-	return;
-}
-
-/*******************************************************************************
-* void on_pause_pressed() 
-*
-* If the user holds the pause button for 2 seconds, set state to exiting which 
-* triggers the rest of the program to exit cleanly.
-*******************************************************************************/
-void on_pause_pressed(){
-	int i=0;
-	const int samples = 100;	// check for release 100 times in this period
-	const int us_wait = 2000000; // 2 seconds
-	
-	// now keep checking to see if the button is still held down
-	for(i=0;i<samples;i++){
-		rc_usleep(us_wait/samples);
-		if(rc_get_pause_button() == RELEASED) return;
-	}
-	printf("long press detected, shutting down\n");
-	rc_set_state(EXITING);
-	return;
-}
-